@@ -0,0 +1,32 @@
+QT += testlib sql
+QT -= gui
+TEMPLATE = app
+TARGET = sqlitecipher_bench
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG += c++11
+win32: {
+    CONFIG += build_all
+    QMAKE_SUBSTITUTES += qt_conf
+    qt_conf.input = qt.conf.in
+    build_pass: CONFIG(debug, debug|release) {
+        qt_conf.output = debug/qt.conf
+    }
+    else: build_pass {
+        qt_conf.output = release/qt.conf
+    }
+} else {
+    QMAKE_SUBSTITUTES += qt.conf.in
+}
+ios: {
+    CONFIG(debug, debug|release) {
+        LIBS += -lsqlitecipher_debug
+    } else {
+        LIBS += -lsqlitecipher
+    }
+}
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# Input
+SOURCES += main.cpp
@@ -0,0 +1,295 @@
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+
+#ifdef Q_OS_IOS
+#  include <QtPlugin>
+
+Q_IMPORT_PLUGIN(SqliteCipherDriverPlugin)
+#endif
+
+/*
+ * Benchmarks for the SQLITECIPHER driver.
+ *
+ * Every operation runs for each cipher and for an unencrypted baseline
+ * ("plain"), at page sizes from 1 KiB to 64 KiB. Data tags have the form
+ * "cipher/pagesize". QtTest writes machine-readable results, e.g.
+ *
+ *     sqlitecipher_bench -o results.xml,xml
+ *     sqlitecipher_bench -csv
+ *
+ * The page cache is limited to 256 KiB, so reads hit the codec and not only
+ * the cache. synchronous=OFF keeps the numbers about CPU cost rather than
+ * the storage device's fsync latency.
+ */
+
+static const int rowCount = 20000;
+static const int payloadSize = 100;
+static const int batchSize = 1000;
+static const int rangeSize = 1000;
+static const char *password = "bench";
+
+static const char *ciphers[] = { "plain", "aes128cbc", "aes256cbc", "chacha20", "sqlcipher" };
+static const int pageSizes[] = { 1024, 2048, 4096, 8192, 16384, 32768, 65536 };
+
+// Small deterministic generator, so every run touches the same rows
+static int nextId(quint32 &state)
+{
+    state = state * 1664525u + 1013904223u;
+    return int((state >> 8) % rowCount) + 1;
+}
+
+class BenchSqliteCipher: public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase() // will run once before the first test
+    {
+        // Check that the driver exists
+        QVERIFY2(QSqlDatabase::isDriverAvailable("SQLITECIPHER"), "SQLITECIPHER driver not found.");
+        payload = QByteArray(payloadSize, 'x');
+    }
+    void openWithKdf_data();
+    void openWithKdf();
+    void pointSelect_data() { addMatrix(); }
+    void pointSelect();
+    void rangeScan_data() { addMatrix(); }
+    void rangeScan();
+    void insertRow_data() { addMatrix(); }
+    void insertRow();
+    void insertBatch_data() { addMatrix(); }
+    void insertBatch();
+    void updateRow_data() { addMatrix(); }
+    void updateRow();
+    void deleteRow_data() { addMatrix(); }
+    void deleteRow();
+    void rekey_data() { addMatrix(); }
+    void rekey();
+    void cleanupTestCase()
+    {
+        const QStringList names = QSqlDatabase::connectionNames();
+        for(const QString& name : names)
+        {
+            QSqlDatabase::database(name, false).close();
+            QSqlDatabase::removeDatabase(name);
+        }
+    }
+private:
+    void addMatrix();
+    void configure(QSqlDatabase &db, const QString &cipher, int pageSize);
+    bool openDatabase(const QString &cipher, int pageSize, QSqlDatabase &db);
+    QTemporaryDir tmpDir;
+    QByteArray payload;
+};
+
+void BenchSqliteCipher::addMatrix()
+{
+    QTest::addColumn<QString>("cipher");
+    QTest::addColumn<int>("pageSize");
+    for(const char *cipher : ciphers)
+    {
+        for(int pageSize : pageSizes)
+        {
+            QTest::newRow(QString("%1/%2").arg(cipher).arg(pageSize).toLatin1().constData()) << QString(cipher) << pageSize;
+        }
+    }
+}
+
+void BenchSqliteCipher::configure(QSqlDatabase &db, const QString &cipher, int pageSize)
+{
+    db.setDatabaseName(QDir(tmpDir.path()).absoluteFilePath(QString("%1_%2.db").arg(cipher).arg(pageSize)));
+    if(cipher != QString("plain"))
+    {
+        db.setPassword(password);
+        db.setConnectOptions(QString("QSQLITE_USE_CIPHER=%1").arg(cipher));
+    }
+}
+
+// Open the database for the given cipher and page size, creating and
+// filling it on first use. The connection stays open for later tests.
+bool BenchSqliteCipher::openDatabase(const QString &cipher, int pageSize, QSqlDatabase &db)
+{
+    const QString name = QString("%1_%2").arg(cipher).arg(pageSize);
+    if(QSqlDatabase::contains(name))
+    {
+        db = QSqlDatabase::database(name);
+        return db.isOpen();
+    }
+    db = QSqlDatabase::addDatabase("SQLITECIPHER", name);
+    configure(db, cipher, pageSize);
+    if(!db.open())
+    {
+        qWarning() << db.lastError().text();
+        return false;
+    }
+    QSqlQuery q(db);
+    QStringList queries;
+    queries << QString("PRAGMA page_size=%1").arg(pageSize)
+            << "PRAGMA cache_size=-256"
+            << "PRAGMA synchronous=OFF"
+            << "CREATE TABLE IF NOT EXISTS bench(id INTEGER PRIMARY KEY, v BLOB)"
+            << QString("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x<%1) "
+                       "INSERT OR IGNORE INTO bench SELECT x, randomblob(%2) FROM c").arg(rowCount).arg(payloadSize);
+    for(const QString& qs : queries)
+    {
+        if(!q.exec(qs))
+        {
+            qWarning() << q.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+void BenchSqliteCipher::openWithKdf_data()
+{
+    QTest::addColumn<QString>("cipher");
+    for(const char *cipher : ciphers)
+    {
+        QTest::newRow(cipher) << QString(cipher);
+    }
+}
+
+void BenchSqliteCipher::openWithKdf()
+{
+    QFETCH(QString, cipher);
+    QSqlDatabase db;
+    QVERIFY(openDatabase(cipher, 4096, db));
+    {
+        QSqlDatabase other = QSqlDatabase::addDatabase("SQLITECIPHER", "kdf");
+        configure(other, cipher, 4096);
+        // The driver derives the key and reads the schema on open
+        QBENCHMARK {
+            QVERIFY2(other.open(), other.lastError().text().toLatin1().constData());
+            other.close();
+        }
+    }
+    QSqlDatabase::removeDatabase("kdf");
+}
+
+void BenchSqliteCipher::pointSelect()
+{
+    QFETCH(QString, cipher);
+    QFETCH(int, pageSize);
+    QSqlDatabase db;
+    QVERIFY(openDatabase(cipher, pageSize, db));
+    QSqlQuery q(db);
+    QVERIFY(q.prepare("SELECT v FROM bench WHERE id = ?"));
+    quint32 state = 1;
+    QBENCHMARK {
+        q.bindValue(0, nextId(state));
+        QVERIFY(q.exec());
+        QVERIFY(q.next());
+    }
+}
+
+void BenchSqliteCipher::rangeScan()
+{
+    QFETCH(QString, cipher);
+    QFETCH(int, pageSize);
+    QSqlDatabase db;
+    QVERIFY(openDatabase(cipher, pageSize, db));
+    QSqlQuery q(db);
+    QVERIFY(q.prepare("SELECT sum(length(v)) FROM bench WHERE id BETWEEN ? AND ?"));
+    quint32 state = 1;
+    QBENCHMARK {
+        const int first = nextId(state) % (rowCount - rangeSize) + 1;
+        q.bindValue(0, first);
+        q.bindValue(1, first + rangeSize - 1);
+        QVERIFY(q.exec());
+        QVERIFY(q.next());
+    }
+}
+
+void BenchSqliteCipher::insertRow()
+{
+    QFETCH(QString, cipher);
+    QFETCH(int, pageSize);
+    QSqlDatabase db;
+    QVERIFY(openDatabase(cipher, pageSize, db));
+    QSqlQuery q(db);
+    QVERIFY(q.prepare("INSERT INTO bench(v) VALUES (?)"));
+    q.bindValue(0, payload);
+    QBENCHMARK {
+        QVERIFY(q.exec());
+    }
+}
+
+void BenchSqliteCipher::insertBatch()
+{
+    QFETCH(QString, cipher);
+    QFETCH(int, pageSize);
+    QSqlDatabase db;
+    QVERIFY(openDatabase(cipher, pageSize, db));
+    QSqlQuery q(db);
+    QVERIFY(q.prepare("INSERT INTO bench(v) VALUES (?)"));
+    q.bindValue(0, payload);
+    QBENCHMARK {
+        QVERIFY(db.transaction());
+        for(int i = 0; i < batchSize; ++i)
+        {
+            QVERIFY(q.exec());
+        }
+        QVERIFY(db.commit());
+    }
+}
+
+void BenchSqliteCipher::updateRow()
+{
+    QFETCH(QString, cipher);
+    QFETCH(int, pageSize);
+    QSqlDatabase db;
+    QVERIFY(openDatabase(cipher, pageSize, db));
+    QSqlQuery q(db);
+    QVERIFY(q.prepare("UPDATE bench SET v = ? WHERE id = ?"));
+    q.bindValue(0, payload);
+    quint32 state = 1;
+    QBENCHMARK {
+        q.bindValue(1, nextId(state));
+        QVERIFY(q.exec());
+    }
+}
+
+void BenchSqliteCipher::deleteRow()
+{
+    QFETCH(QString, cipher);
+    QFETCH(int, pageSize);
+    QSqlDatabase db;
+    QVERIFY(openDatabase(cipher, pageSize, db));
+    QSqlQuery q(db);
+    QVERIFY(q.prepare("DELETE FROM bench WHERE id = ?"));
+    int id = 1;
+    QBENCHMARK {
+        q.bindValue(0, id);
+        QVERIFY(q.exec());
+        id = id % rowCount + 1;
+    }
+    // Put the deleted rows back for the following benchmarks
+    QVERIFY(q.exec(QString("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x<%1) "
+                           "INSERT OR IGNORE INTO bench SELECT x, randomblob(%2) FROM c").arg(rowCount).arg(payloadSize)));
+}
+
+void BenchSqliteCipher::rekey()
+{
+    QFETCH(QString, cipher);
+    QFETCH(int, pageSize);
+    if(cipher == QString("plain"))
+    {
+        QSKIP("Rekeying requires an encrypted database.");
+    }
+    QSqlDatabase db;
+    QVERIFY(openDatabase(cipher, pageSize, db));
+    QSqlQuery q(db);
+    int n = 0;
+    QBENCHMARK {
+        // The cipher setting is reset after each use, select it again so
+        // that the database keeps its cipher
+        QVERIFY(q.exec(QString("SELECT wxsqlite3_config('cipher', '%1')").arg(cipher)));
+        QVERIFY(q.exec(QString("PRAGMA rekey='%1%2'").arg(password).arg(++n % 2)));
+    }
+}
+
+QTEST_GUILESS_MAIN(BenchSqliteCipher)
+#include "main.moc"
@@ -0,0 +1,227 @@
+/*
+** Name:        cryptobench.c
+** Purpose:     Microbenchmark of the page ciphers and key derivation functions
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** Measures the cost of the page transforms (EncryptPage* and DecryptPage*)
+** of every cipher in codecDescriptorTable, for all page sizes, and of the
+** key derivation of each cipher with its default parameters. Results are
+** given in cycles per byte (time stamp counter, x86 only), nanoseconds per
+** byte and MB/s, and in milliseconds per key derivation.
+**
+** The benchmark is compiled together with the amalgamation, because the
+** cipher descriptors are internal to codec.c. The CPU features of the host
+** and the implementation selected for each primitive are printed first;
+** the same report is available at runtime as SELECT wxsqlite3_cpu_features().
+**
+** Usage: cryptobench [-t milliseconds] [cipher...]
+*/
+
+#include "sqlite3secure.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define BENCH_HAS_TSC 1
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define BENCH_HAS_TSC 1
+#endif
+
+static sqlite3_int64
+BenchCycles()
+{
+#ifdef BENCH_HAS_TSC
+  return (sqlite3_int64) __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+typedef struct _BenchResult
+{
+  sqlite3_int64 m_runs;
+  sqlite3_int64 m_nanos;
+  sqlite3_int64 m_cycles;
+} BenchResult;
+
+/*
+** Run one page transform repeatedly for at least minTime nanoseconds
+*/
+static int
+BenchPageTransform(const CodecDescriptor* descriptor, void* cipher, int encrypt,
+                   unsigned char* page, int pageSize, int reserved, sqlite3_int64 minTime, BenchResult* result)
+{
+  int rc = SQLITE_OK;
+  sqlite3_int64 startTime, startCycles;
+  result->m_runs = 0;
+  startCycles = BenchCycles();
+  startTime = CodecTimestamp();
+  do
+  {
+    int j;
+    /* Batches keep the timer overhead out of the measurement */
+    for (j = 0; j < 16 && rc == SQLITE_OK; ++j)
+    {
+      if (encrypt)
+      {
+        rc = descriptor->m_encryptPage(cipher, 2, page, pageSize, reserved);
+      }
+      else
+      {
+        /* Decryption verifies the MAC, so decrypt a freshly encrypted page */
+        memcpy(page, page + pageSize, pageSize);
+        rc = descriptor->m_decryptPage(cipher, 2, page, pageSize, reserved);
+      }
+    }
+    result->m_runs += j;
+    result->m_nanos = CodecTimestamp() - startTime;
+  }
+  while (rc == SQLITE_OK && result->m_nanos < minTime);
+  result->m_cycles = BenchCycles() - startCycles;
+  return rc;
+}
+
+static int
+BenchCipher(sqlite3* db, const CodecDescriptor* descriptor, sqlite3_int64 minTime)
+{
+  static const int pageSizes[] = { 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536 };
+  Btree* pBt = db->aDb[0].pBt;
+  int rc = SQLITE_OK;
+  int j, k;
+  sqlite3_int64 startTime, startCycles;
+  void* cipher;
+  unsigned char* page = (unsigned char*) sqlite3_malloc(2 * SQLITE_MAX_PAGE_SIZE);
+  if (page == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+
+  /* Key derivation with the default parameters of the cipher */
+  cipher = descriptor->m_allocateCipher(db);
+  if (cipher == NULL)
+  {
+    sqlite3_free(page);
+    return SQLITE_NOMEM;
+  }
+  startCycles = BenchCycles();
+  startTime = CodecTimestamp();
+  descriptor->m_generateKey(cipher, CodecGetFile(pBt), "cryptobench", 11, 0);
+  printf("%-10s %-8s %6s %10.2f ms", descriptor->m_name, "kdf", "-", (CodecTimestamp() - startTime) / 1e6);
+#ifdef BENCH_HAS_TSC
+  printf(" %14lld cycles", (long long) (BenchCycles() - startCycles));
+#endif
+  printf("\n");
+
+  for (j = 0; j < (int) (sizeof(pageSizes) / sizeof(pageSizes[0])) && rc == SQLITE_OK; ++j)
+  {
+    int pageSize = pageSizes[j];
+    int reserved = descriptor->m_getReserved(cipher);
+    for (k = 0; k < pageSize; ++k)
+    {
+      page[k] = (unsigned char) (k * 31 + 7);
+    }
+    /* Keep an encrypted copy behind the working page for the decryption runs */
+    rc = descriptor->m_encryptPage(cipher, 2, page, pageSize, reserved);
+    memcpy(page + pageSize, page, pageSize);
+    for (k = 1; k >= 0 && rc == SQLITE_OK; --k)
+    {
+      BenchResult result;
+      double bytes;
+      rc = BenchPageTransform(descriptor, cipher, k, page, pageSize, reserved, minTime, &result);
+      if (rc != SQLITE_OK)
+      {
+        fprintf(stderr, "%s: %s of a %d byte page failed (%d)\n", descriptor->m_name, (k) ? "encryption" : "decryption", pageSize, rc);
+        break;
+      }
+      bytes = (double) result.m_runs * pageSize;
+      printf("%-10s %-8s %6d", descriptor->m_name, (k) ? "encrypt" : "decrypt", pageSize);
+#ifdef BENCH_HAS_TSC
+      printf(" %10.2f c/B", result.m_cycles / bytes);
+#endif
+      printf(" %10.3f ns/B %10.1f MB/s\n", result.m_nanos / bytes, bytes * 1e3 / result.m_nanos);
+    }
+  }
+
+  descriptor->m_freeCipher(cipher);
+  sqlite3_free(page);
+  return rc;
+}
+
+int main(int argc, char** argv)
+{
+  sqlite3* db = NULL;
+  sqlite3_stmt* pStmt = NULL;
+  sqlite3_int64 minTime = 200 * 1000000;
+  int rc;
+  int j, k;
+  int nNames = 0;
+
+  for (j = 1; j < argc; ++j)
+  {
+    if (strcmp(argv[j], "-t") == 0 && j + 1 < argc)
+    {
+      minTime = (sqlite3_int64) atoi(argv[++j]) * 1000000;
+    }
+    else if (argv[j][0] == '-')
+    {
+      fprintf(stderr, "Usage: %s [-t milliseconds] [cipher...]\n", argv[0]);
+      return 1;
+    }
+    else
+    {
+      ++nNames;
+    }
+  }
+
+  /* The ciphers read their parameters from the connection */
+  rc = sqlite3_open(":memory:", &db);
+  if (rc != SQLITE_OK)
+  {
+    fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
+    sqlite3_close(db);
+    return 1;
+  }
+
+  if (sqlite3_prepare_v2(db, "SELECT wxsqlite3_cpu_features()", -1, &pStmt, NULL) == SQLITE_OK &&
+      sqlite3_step(pStmt) == SQLITE_ROW)
+  {
+    printf("CPU features: %s\n", sqlite3_column_text(pStmt, 0));
+  }
+  sqlite3_finalize(pStmt);
+#ifdef BENCH_HAS_TSC
+  printf("Cycles are time stamp counter ticks at the nominal clock rate.\n");
+#endif
+  printf("\n");
+
+  for (j = 0; strlen(codecDescriptorTable[j].m_name) > 0 && rc == SQLITE_OK; ++j)
+  {
+    int selected = (nNames == 0);
+    for (k = 1; k < argc && !selected; ++k)
+    {
+      if (strcmp(argv[k], "-t") == 0)
+      {
+        ++k;
+      }
+      else
+      {
+        selected = (sqlite3_stricmp(argv[k], codecDescriptorTable[j].m_name) == 0);
+      }
+    }
+    /* Ciphers compiled out by WXSQLITE3_SINGLE_CIPHER have no functions */
+    if (selected && codecDescriptorTable[j].m_allocateCipher != NULL)
+    {
+      rc = BenchCipher(db, &codecDescriptorTable[j], minTime);
+    }
+  }
+
+  sqlite3_close(db);
+  return (rc == SQLITE_OK) ? 0 : 1;
+}
@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET   = cryptobench
+CONFIG  += console
+CONFIG  -= app_bundle qt
+
+include($$PWD/../sqlitecipher/sqlite3/sqlite3.pri)
+
+# cryptobench.c includes the amalgamation to reach the cipher descriptors,
+# so it is the only source file.
+SOURCES = $$PWD/cryptobench.c
+
+unix: LIBS += -lpthread -ldl -lm
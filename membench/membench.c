@@ -0,0 +1,275 @@
+/*
+** Name:        membench.c
+** Purpose:     Benchmark of allocation rate and allocator contention
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** Runs two workloads on 1, 2, 4 and 8 threads, for the system allocator and
+** the allocator of threadmalloc.c, each with memory statistics on and off:
+**
+**   malloc  sqlite3_malloc/sqlite3_free of mixed sizes on a working set of
+**           256 blocks per thread
+**   sql     prepare, step and finalize of a small query on a connection of
+**           each thread to an in-memory database
+**
+** The rate is given in operations per second for all threads together; the
+** scaling column divides it by the single-thread rate times the number of
+** threads, so 1.00 means no contention at all. SQLite is shut down and
+** initialized again between the configurations.
+**
+** Usage: membench [-t milliseconds] [-l slotsize,count] [threads...]
+**   -l sets the lookaside of the connections of the sql workload
+*/
+
+#include "sqlite3secure.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if SQLITE_OS_UNIX
+#include <pthread.h>
+#endif
+
+#define BENCH_SLOTS 256
+
+typedef struct _BenchThread
+{
+  int           m_workload;       /* 0: malloc, 1: sql */
+  sqlite3_int64 m_minTime;
+  int           m_lookasideSize;  /* -1 for SQLite's default */
+  int           m_lookasideCount;
+  sqlite3_int64 m_ops;
+  int           m_rc;
+} BenchThread;
+
+static unsigned int
+BenchRandom(unsigned int* state)
+{
+  /* xorshift32 */
+  unsigned int x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static void
+BenchMalloc(BenchThread* bench)
+{
+  void* slots[BENCH_SLOTS];
+  unsigned int state = 2463534242u ^ (unsigned int) (uintptr_t) bench;
+  sqlite3_int64 startTime = CodecTimestamp();
+  int j;
+  memset(slots, 0, sizeof(slots));
+  do
+  {
+    for (j = 0; j < 1024; ++j)
+    {
+      unsigned int r = BenchRandom(&state);
+      int slot = r % BENCH_SLOTS;
+      /* Mostly small objects as parser and VDBE allocate, few page sized ones */
+      int size = ((r >> 8) & 15) == 0 ? 4096 + (int) ((r >> 12) & 255) : 16 + (int) ((r >> 12) & 511);
+      sqlite3_free(slots[slot]);
+      slots[slot] = sqlite3_malloc(size);
+      if (slots[slot] == NULL)
+      {
+        bench->m_rc = SQLITE_NOMEM;
+        break;
+      }
+      memset(slots[slot], 0, 16);
+    }
+    bench->m_ops += j;
+  }
+  while (bench->m_rc == SQLITE_OK && CodecTimestamp() - startTime < bench->m_minTime);
+  for (j = 0; j < BENCH_SLOTS; ++j)
+  {
+    sqlite3_free(slots[j]);
+  }
+}
+
+static void
+BenchSql(BenchThread* bench)
+{
+  static const char* zSql = "SELECT upper(?1) || lower(?1), length(?1), instr(?1, 'x') FROM (SELECT 1)";
+  sqlite3* db = NULL;
+  sqlite3_int64 startTime;
+  int j;
+
+  bench->m_rc = sqlite3_open(":memory:", &db);
+  if (bench->m_rc == SQLITE_OK && bench->m_lookasideSize >= 0)
+  {
+    bench->m_rc = sqlite3_db_config(db, SQLITE_DBCONFIG_LOOKASIDE, NULL, bench->m_lookasideSize, bench->m_lookasideCount);
+  }
+  startTime = CodecTimestamp();
+  while (bench->m_rc == SQLITE_OK && CodecTimestamp() - startTime < bench->m_minTime)
+  {
+    for (j = 0; j < 64 && bench->m_rc == SQLITE_OK; ++j)
+    {
+      sqlite3_stmt* pStmt = NULL;
+      bench->m_rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL);
+      if (bench->m_rc == SQLITE_OK)
+      {
+        sqlite3_bind_text(pStmt, 1, "The quick brown fox jumps over the lazy dog", -1, SQLITE_STATIC);
+        bench->m_rc = (sqlite3_step(pStmt) == SQLITE_ROW) ? SQLITE_OK : sqlite3_errcode(db);
+      }
+      sqlite3_finalize(pStmt);
+    }
+    bench->m_ops += j;
+  }
+  sqlite3_close(db);
+}
+
+#if SQLITE_OS_UNIX
+static void*
+BenchThreadMain(void* pArg)
+#else
+static DWORD WINAPI
+BenchThreadMain(void* pArg)
+#endif
+{
+  BenchThread* bench = (BenchThread*) pArg;
+  if (bench->m_workload == 0)
+  {
+    BenchMalloc(bench);
+  }
+  else
+  {
+    BenchSql(bench);
+  }
+  return 0;
+}
+
+/*
+** Run a workload on nThreads threads, returning operations per second
+*/
+static double
+BenchRun(int workload, int nThreads, sqlite3_int64 minTime, int lookasideSize, int lookasideCount, int* pRc)
+{
+  BenchThread bench[64];
+#if SQLITE_OS_UNIX
+  pthread_t threads[64];
+#else
+  HANDLE threads[64];
+#endif
+  sqlite3_int64 startTime, ops = 0;
+  int j;
+
+  memset(bench, 0, sizeof(bench));
+  startTime = CodecTimestamp();
+  for (j = 0; j < nThreads; ++j)
+  {
+    bench[j].m_workload = workload;
+    bench[j].m_minTime = minTime;
+    bench[j].m_lookasideSize = lookasideSize;
+    bench[j].m_lookasideCount = lookasideCount;
+#if SQLITE_OS_UNIX
+    pthread_create(&threads[j], NULL, BenchThreadMain, &bench[j]);
+#else
+    threads[j] = CreateThread(NULL, 0, BenchThreadMain, &bench[j], 0, NULL);
+#endif
+  }
+  for (j = 0; j < nThreads; ++j)
+  {
+#if SQLITE_OS_UNIX
+    pthread_join(threads[j], NULL);
+#else
+    WaitForSingleObject(threads[j], INFINITE);
+    CloseHandle(threads[j]);
+#endif
+    ops += bench[j].m_ops;
+    if (bench[j].m_rc != SQLITE_OK)
+    {
+      *pRc = bench[j].m_rc;
+    }
+  }
+  return ops * 1e9 / (double) (CodecTimestamp() - startTime);
+}
+
+int main(int argc, char** argv)
+{
+  static const char* workloadNames[] = { "malloc", "sql" };
+  sqlite3_mem_methods systemMethods;
+  sqlite3_int64 minTime = 500 * 1000000;
+  int lookasideSize = -1, lookasideCount = -1;
+  int threadCounts[16] = { 1, 2, 4, 8 };
+  int nThreadCounts = 4;
+  int customThreads = 0;
+  int rc = SQLITE_OK;
+  int allocator, memstatus, workload, j;
+
+  for (j = 1; j < argc; ++j)
+  {
+    if (strcmp(argv[j], "-t") == 0 && j + 1 < argc)
+    {
+      minTime = (sqlite3_int64) atoi(argv[++j]) * 1000000;
+    }
+    else if (strcmp(argv[j], "-l") == 0 && j + 1 < argc &&
+             sscanf(argv[++j], "%d,%d", &lookasideSize, &lookasideCount) == 2)
+    {
+    }
+    else if (argv[j][0] != '-' && atoi(argv[j]) > 0 && atoi(argv[j]) <= 64)
+    {
+      /* Thread counts given replace the default ones */
+      if (!customThreads)
+      {
+        nThreadCounts = 0;
+        customThreads = 1;
+      }
+      if (nThreadCounts < 16)
+      {
+        threadCounts[nThreadCounts++] = atoi(argv[j]);
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-t milliseconds] [-l slotsize,count] [threads...]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  sqlite3_config(SQLITE_CONFIG_GETMALLOC, &systemMethods);
+  printf("%-10s %-9s %-8s %7s %14s %8s\n", "allocator", "memstatus", "workload", "threads", "ops/s", "scaling");
+
+  for (allocator = 0; allocator < 2 && rc == SQLITE_OK; ++allocator)
+  {
+    for (memstatus = 1; memstatus >= 0 && rc == SQLITE_OK; --memstatus)
+    {
+      sqlite3_shutdown();
+      rc = (allocator == 0) ? sqlite3_config(SQLITE_CONFIG_MALLOC, &systemMethods) : wxsqlite3_install_malloc();
+      if (rc == SQLITE_OK)
+      {
+        rc = sqlite3_config(SQLITE_CONFIG_MEMSTATUS, memstatus);
+      }
+      if (rc == SQLITE_OK)
+      {
+        rc = sqlite3_initialize();
+      }
+      for (workload = 0; workload < 2 && rc == SQLITE_OK; ++workload)
+      {
+        double single = 0;
+        for (j = 0; j < nThreadCounts && rc == SQLITE_OK; ++j)
+        {
+          double rate = BenchRun(workload, threadCounts[j], minTime, lookasideSize, lookasideCount, &rc);
+          if (j == 0)
+          {
+            single = rate / threadCounts[0];
+          }
+          printf("%-10s %-9s %-8s %7d %14.0f %8.2f\n", (allocator == 0) ? "system" : "thread", (memstatus) ? "on" : "off",
+                 workloadNames[workload], threadCounts[j], rate, rate / (single * threadCounts[j]));
+        }
+      }
+    }
+  }
+
+  if (rc != SQLITE_OK)
+  {
+    fprintf(stderr, "Benchmark failed: %s\n", sqlite3_errstr(rc));
+  }
+  sqlite3_shutdown();
+  return (rc == SQLITE_OK) ? 0 : 1;
+}
@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET   = membench
+CONFIG  += console
+CONFIG  -= app_bundle qt
+
+include($$PWD/../sqlitecipher/sqlite3/sqlite3.pri)
+
+# membench.c includes the amalgamation, like cryptobench, so it is the only
+# source file.
+SOURCES = $$PWD/membench.c
+
+unix: LIBS += -lpthread -ldl -lm
@@ -0,0 +1,18 @@
+TEMPLATE = app
+TARGET   = sqlite3shell
+CONFIG  += console
+CONFIG  -= app_bundle qt
+
+include($$PWD/../sqlitecipher/sqlite3/sqlite3.pri)
+
+# sqlite3secure.c already includes the SQLite3 amalgamation and all
+# extensions listed in sqlite3.pri, so only the amalgamation is compiled.
+SOURCES = \
+    $$PWD/../sqlitecipher/sqlite3/sqlite3secure.c \
+    $$PWD/../sqlitecipher/sqlite3/shell.c
+
+unix: LIBS += -lpthread -ldl -lm
+win32: RC_FILE = $$PWD/../sqlitecipher/sqlite3/sqlite3shell.rc
+
+target.path = $$[QT_INSTALL_BINS]
+INSTALLS += target
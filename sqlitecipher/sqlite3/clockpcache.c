@@ -0,0 +1,523 @@
+/*
+** Name:        clockpcache.c
+** Purpose:     Page cache with per-connection partitions, slab allocation and CLOCK replacement
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** SQLite's default page cache (pcache1) keeps the recyclable pages of all
+** connections in a group with a common LRU list and mutex, and allocates
+** page buffers one at a time. With large caches that costs a list update
+** under the mutex for every page access, and many small allocations spread
+** over many TLB entries.
+**
+** This implementation of sqlite3_pcache_methods2 gives every cache, i.e.
+** every database of every connection, its own partition. A cache is only
+** called by its connection, so no mutex is taken at all. Page buffers are
+** carved from slabs: small ones at first, doubling up to CLOCK_SLAB_SIZE,
+** from which on slabs are mapped as huge pages if the system provides them
+** (MAP_HUGETLB, else transparent huge pages through MADV_HUGEPAGE). The
+** page buffers of a slab are stored contiguously in front of the page
+** headers, so they are aligned to the page size.
+**
+** Replacement uses the CLOCK algorithm: an access just sets the reference
+** bit of a page, and the hand sweeping all pages of the cache clears the
+** bits and recycles the first unpinned page whose bit was clear already.
+**
+** Since pages are not shared between caches, memory is not rebalanced
+** between connections, and sqlite3_release_memory() and the soft heap limit
+** do not shrink these caches; size them with cache_size. Install the cache
+** with wxsqlite3_install_pcache() before SQLite is initialized, or with the
+** driver option QSQLITE_PCACHE=clock on the first connection of a process.
+*/
+
+#if SQLITE_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+#define CLOCK_SLAB_SIZE       (2*1024*1024)  /* Huge page size on x86-64 and arm64 */
+#define CLOCK_FIRST_SLAB      16             /* Pages in the first slab of a cache */
+
+typedef struct _ClockPage
+{
+  sqlite3_pcache_page m_base;      /* Page buffer and extra, must be first */
+  struct _ClockPage*  m_hashNext;  /* Next page in the hash chain, or in the free list */
+  unsigned int        m_key;
+  unsigned char       m_inUse;     /* In the hash table */
+  unsigned char       m_pinned;
+  unsigned char       m_referenced;
+} ClockPage;
+
+typedef struct _ClockSlab
+{
+  struct _ClockSlab*  m_next;
+  void*               m_memory;
+  size_t              m_size;
+  int                 m_mapped;    /* m_memory was mapped, not allocated */
+} ClockSlab;
+
+typedef struct _ClockCache
+{
+  int                 m_pageSize;
+  int                 m_extraSize;
+  int                 m_purgeable;
+  unsigned int        m_max;       /* Cache size in pages */
+  unsigned int        m_count;     /* Pages in the hash table */
+  unsigned int        m_pinned;
+  unsigned int        m_maxKey;
+  ClockPage**         m_hash;
+  unsigned int        m_hashSize;  /* Power of 2 */
+  ClockPage**         m_clock;     /* All pages of all slabs, swept by the hand */
+  unsigned int        m_clockSize;
+  unsigned int        m_hand;
+  ClockPage*          m_free;
+  ClockSlab*          m_slabs;
+  unsigned int        m_nextSlab;  /* Pages in the next slab */
+} ClockCache;
+
+/* --- Slabs --- */
+
+/*
+** Memory for a slab, mapped as huge pages where possible
+*/
+static void*
+ClockSlabAllocate(size_t size, int* pMapped)
+{
+#if SQLITE_OS_UNIX && defined(MAP_ANONYMOUS)
+  if (size == CLOCK_SLAB_SIZE)
+  {
+    unsigned char* memory;
+    size_t head;
+#ifdef MAP_HUGETLB
+    memory = (unsigned char*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED)
+    {
+      *pMapped = 1;
+      return memory;
+    }
+#endif
+    /* Map twice the size and trim it to an aligned slab, which the kernel can back with a huge page */
+    memory = (unsigned char*) mmap(NULL, 2 * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory != MAP_FAILED)
+    {
+      head = (CLOCK_SLAB_SIZE - ((uintptr_t) memory & (CLOCK_SLAB_SIZE - 1))) & (CLOCK_SLAB_SIZE - 1);
+      if (head > 0)
+      {
+        munmap(memory, head);
+      }
+      munmap(memory + head + size, size - head);
+      memory += head;
+#ifdef MADV_HUGEPAGE
+      madvise(memory, size, MADV_HUGEPAGE);
+#endif
+      *pMapped = 1;
+      return memory;
+    }
+  }
+#endif
+  *pMapped = 0;
+  return sqlite3_malloc64(size);
+}
+
+static void
+ClockSlabFree(ClockSlab* slab)
+{
+#if SQLITE_OS_UNIX && defined(MAP_ANONYMOUS)
+  if (slab->m_mapped)
+  {
+    munmap(slab->m_memory, slab->m_size);
+  }
+  else
+#endif
+  {
+    sqlite3_free(slab->m_memory);
+  }
+  sqlite3_free(slab);
+}
+
+/*
+** Add a slab to the cache and its pages to the free list
+*/
+static int
+ClockAddSlab(ClockCache* cache)
+{
+  size_t headerSize = (sizeof(ClockPage) + cache->m_extraSize + 7) & ~(size_t) 7;
+  size_t pageSize = cache->m_pageSize + headerSize;
+  unsigned int count = cache->m_nextSlab;
+  size_t size = count * pageSize;
+  ClockSlab* slab;
+  ClockPage** clock;
+  unsigned char* headers;
+  unsigned int j;
+
+  if (size >= CLOCK_SLAB_SIZE)
+  {
+    size = CLOCK_SLAB_SIZE;
+    count = (unsigned int) (size / pageSize);
+  }
+  slab = (ClockSlab*) sqlite3_malloc(sizeof(ClockSlab));
+  clock = (ClockPage**) sqlite3_realloc64(cache->m_clock, (cache->m_clockSize + count) * sizeof(ClockPage*));
+  if (slab == NULL || clock == NULL)
+  {
+    sqlite3_free(slab);
+    if (clock != NULL) cache->m_clock = clock;
+    return SQLITE_NOMEM;
+  }
+  cache->m_clock = clock;
+  slab->m_size = size;
+  slab->m_memory = ClockSlabAllocate(size, &slab->m_mapped);
+  if (slab->m_memory == NULL)
+  {
+    sqlite3_free(slab);
+    return SQLITE_NOMEM;
+  }
+  slab->m_next = cache->m_slabs;
+  cache->m_slabs = slab;
+
+  headers = (unsigned char*) slab->m_memory + (size_t) count * cache->m_pageSize;
+  for (j = 0; j < count; ++j)
+  {
+    ClockPage* page = (ClockPage*) (headers + j * headerSize);
+    memset(page, 0, sizeof(ClockPage));
+    page->m_base.pBuf = (unsigned char*) slab->m_memory + (size_t) j * cache->m_pageSize;
+    page->m_base.pExtra = &page[1];
+    page->m_hashNext = cache->m_free;
+    cache->m_free = page;
+    cache->m_clock[cache->m_clockSize++] = page;
+  }
+  if (cache->m_nextSlab < CLOCK_SLAB_SIZE / pageSize + 1)
+  {
+    cache->m_nextSlab *= 2;
+  }
+  return SQLITE_OK;
+}
+
+/* --- Hash table --- */
+
+static void
+ClockHashRemove(ClockCache* cache, ClockPage* page)
+{
+  ClockPage** pp = &cache->m_hash[page->m_key & (cache->m_hashSize - 1)];
+  while (*pp != page)
+  {
+    pp = &(*pp)->m_hashNext;
+  }
+  *pp = page->m_hashNext;
+  if (page->m_pinned)
+  {
+    cache->m_pinned--;
+  }
+  page->m_inUse = 0;
+  page->m_pinned = 0;
+  page->m_referenced = 0;
+  page->m_hashNext = cache->m_free;
+  cache->m_free = page;
+  cache->m_count--;
+}
+
+static void
+ClockHashInsert(ClockCache* cache, ClockPage* page, unsigned int key)
+{
+  ClockPage** slot = &cache->m_hash[key & (cache->m_hashSize - 1)];
+  page->m_key = key;
+  page->m_hashNext = *slot;
+  *slot = page;
+  page->m_inUse = 1;
+  cache->m_count++;
+  if (key > cache->m_maxKey)
+  {
+    cache->m_maxKey = key;
+  }
+}
+
+static int
+ClockHashResize(ClockCache* cache)
+{
+  unsigned int newSize = (cache->m_hashSize > 0) ? 2 * cache->m_hashSize : 256;
+  ClockPage** newHash = (ClockPage**) sqlite3_malloc64(newSize * sizeof(ClockPage*));
+  unsigned int j;
+  if (newHash == NULL)
+  {
+    return (cache->m_hashSize > 0) ? SQLITE_OK : SQLITE_NOMEM;
+  }
+  memset(newHash, 0, newSize * sizeof(ClockPage*));
+  for (j = 0; j < cache->m_hashSize; ++j)
+  {
+    ClockPage* next;
+    ClockPage* page;
+    for (page = cache->m_hash[j]; page != NULL; page = next)
+    {
+      next = page->m_hashNext;
+      page->m_hashNext = newHash[page->m_key & (newSize - 1)];
+      newHash[page->m_key & (newSize - 1)] = page;
+    }
+  }
+  sqlite3_free(cache->m_hash);
+  cache->m_hash = newHash;
+  cache->m_hashSize = newSize;
+  return SQLITE_OK;
+}
+
+/*
+** Sweep the clock for an unpinned page that was not referenced since the
+** last sweep, and take it out of the hash table. Two rounds suffice: the
+** first one clears all reference bits.
+*/
+static ClockPage*
+ClockEvict(ClockCache* cache)
+{
+  unsigned int steps;
+  if (cache->m_clockSize == 0 || cache->m_pinned >= cache->m_count)
+  {
+    return NULL;
+  }
+  for (steps = 2 * cache->m_clockSize; steps > 0; --steps)
+  {
+    ClockPage* page = cache->m_clock[cache->m_hand];
+    cache->m_hand = (cache->m_hand + 1 < cache->m_clockSize) ? cache->m_hand + 1 : 0;
+    if (!page->m_inUse || page->m_pinned)
+    {
+      continue;
+    }
+    if (page->m_referenced)
+    {
+      page->m_referenced = 0;
+      continue;
+    }
+    ClockHashRemove(cache, page);
+    return page;
+  }
+  return NULL;
+}
+
+/* --- sqlite3_pcache_methods2 --- */
+
+static int
+ClockInit(void* pArg)
+{
+  return SQLITE_OK;
+}
+
+static void
+ClockShutdown(void* pArg)
+{
+}
+
+static sqlite3_pcache*
+ClockCreate(int szPage, int szExtra, int bPurgeable)
+{
+  ClockCache* cache = (ClockCache*) sqlite3_malloc(sizeof(ClockCache));
+  if (cache != NULL)
+  {
+    memset(cache, 0, sizeof(ClockCache));
+    cache->m_pageSize = szPage;
+    cache->m_extraSize = szExtra;
+    cache->m_purgeable = bPurgeable;
+    cache->m_max = bPurgeable ? 100 : 0;
+    cache->m_nextSlab = CLOCK_FIRST_SLAB;
+  }
+  return (sqlite3_pcache*) cache;
+}
+
+static void
+ClockCachesize(sqlite3_pcache* p, int nCachesize)
+{
+  ClockCache* cache = (ClockCache*) p;
+  if (cache->m_purgeable)
+  {
+    cache->m_max = (nCachesize > 0) ? (unsigned int) nCachesize : 0;
+    while (cache->m_count > cache->m_max && ClockEvict(cache) != NULL)
+    {
+    }
+  }
+}
+
+static int
+ClockPagecount(sqlite3_pcache* p)
+{
+  return (int) ((ClockCache*) p)->m_count;
+}
+
+static sqlite3_pcache_page*
+ClockFetch(sqlite3_pcache* p, unsigned int key, int createFlag)
+{
+  ClockCache* cache = (ClockCache*) p;
+  ClockPage* page = NULL;
+
+  if (cache->m_hashSize > 0)
+  {
+    page = cache->m_hash[key & (cache->m_hashSize - 1)];
+    while (page != NULL && page->m_key != key)
+    {
+      page = page->m_hashNext;
+    }
+  }
+  if (page != NULL)
+  {
+    if (!page->m_pinned)
+    {
+      page->m_pinned = 1;
+      cache->m_pinned++;
+    }
+    page->m_referenced = 1;
+    return &page->m_base;
+  }
+  if (createFlag == 0)
+  {
+    return NULL;
+  }
+
+  /* Like pcache1, make the pager spill dirty pages before the cache is filled with pinned ones */
+  if (createFlag == 1 && cache->m_purgeable && cache->m_pinned >= cache->m_max * 9 / 10)
+  {
+    return NULL;
+  }
+  if (cache->m_count >= cache->m_hashSize && ClockHashResize(cache) != SQLITE_OK)
+  {
+    return NULL;
+  }
+  if (cache->m_purgeable && cache->m_count + 1 >= cache->m_max)
+  {
+    page = ClockEvict(cache);
+  }
+  if (page == NULL)
+  {
+    if (cache->m_free == NULL && ClockAddSlab(cache) != SQLITE_OK)
+    {
+      return NULL;
+    }
+    page = cache->m_free;
+  }
+  cache->m_free = page->m_hashNext;
+  ClockHashInsert(cache, page, key);
+  page->m_pinned = 1;
+  page->m_referenced = 1;
+  cache->m_pinned++;
+  *(void**) page->m_base.pExtra = NULL;
+  return &page->m_base;
+}
+
+static void
+ClockUnpin(sqlite3_pcache* p, sqlite3_pcache_page* pPg, int reuseUnlikely)
+{
+  ClockCache* cache = (ClockCache*) p;
+  ClockPage* page = (ClockPage*) pPg;
+  if (reuseUnlikely || (cache->m_purgeable && cache->m_count > cache->m_max))
+  {
+    ClockHashRemove(cache, page);
+  }
+  else
+  {
+    page->m_pinned = 0;
+    cache->m_pinned--;
+  }
+}
+
+static void
+ClockRekey(sqlite3_pcache* p, sqlite3_pcache_page* pPg, unsigned int oldKey, unsigned int newKey)
+{
+  ClockCache* cache = (ClockCache*) p;
+  ClockPage* page = (ClockPage*) pPg;
+  ClockPage** pp = &cache->m_hash[oldKey & (cache->m_hashSize - 1)];
+  while (*pp != page)
+  {
+    pp = &(*pp)->m_hashNext;
+  }
+  *pp = page->m_hashNext;
+  cache->m_count--;
+  ClockHashInsert(cache, page, newKey);
+}
+
+static void
+ClockTruncate(sqlite3_pcache* p, unsigned int iLimit)
+{
+  ClockCache* cache = (ClockCache*) p;
+  unsigned int j;
+  if (iLimit > cache->m_maxKey)
+  {
+    return;
+  }
+  for (j = 0; j < cache->m_clockSize; ++j)
+  {
+    ClockPage* page = cache->m_clock[j];
+    if (page->m_inUse && page->m_key >= iLimit)
+    {
+      ClockHashRemove(cache, page);
+    }
+  }
+  cache->m_maxKey = (iLimit > 0) ? iLimit - 1 : 0;
+}
+
+static void
+ClockDestroy(sqlite3_pcache* p)
+{
+  ClockCache* cache = (ClockCache*) p;
+  while (cache->m_slabs != NULL)
+  {
+    ClockSlab* next = cache->m_slabs->m_next;
+    ClockSlabFree(cache->m_slabs);
+    cache->m_slabs = next;
+  }
+  sqlite3_free(cache->m_clock);
+  sqlite3_free(cache->m_hash);
+  sqlite3_free(cache);
+}
+
+static void
+ClockShrink(sqlite3_pcache* p)
+{
+  ClockCache* cache = (ClockCache*) p;
+  unsigned int j;
+  for (j = 0; j < cache->m_clockSize; ++j)
+  {
+    ClockPage* page = cache->m_clock[j];
+    if (page->m_inUse && !page->m_pinned)
+    {
+      ClockHashRemove(cache, page);
+    }
+  }
+  if (cache->m_count == 0)
+  {
+    /* Nothing is referenced any more, give the slabs back */
+    while (cache->m_slabs != NULL)
+    {
+      ClockSlab* next = cache->m_slabs->m_next;
+      ClockSlabFree(cache->m_slabs);
+      cache->m_slabs = next;
+    }
+    cache->m_free = NULL;
+    cache->m_clockSize = 0;
+    cache->m_hand = 0;
+    cache->m_nextSlab = CLOCK_FIRST_SLAB;
+  }
+}
+
+static const sqlite3_pcache_methods2 clockPcacheMethods =
+{
+  1,                              /* iVersion */
+  0,                              /* pArg */
+  ClockInit,                      /* xInit */
+  ClockShutdown,                  /* xShutdown */
+  ClockCreate,                    /* xCreate */
+  ClockCachesize,                 /* xCachesize */
+  ClockPagecount,                 /* xPagecount */
+  ClockFetch,                     /* xFetch */
+  ClockUnpin,                     /* xUnpin */
+  ClockRekey,                     /* xRekey */
+  ClockTruncate,                  /* xTruncate */
+  ClockDestroy,                   /* xDestroy */
+  ClockShrink                     /* xShrink */
+};
+
+/*
+** Use the cache for all connections. Like every sqlite3_config() call this
+** fails with SQLITE_MISUSE once SQLite is initialized.
+*/
+int
+wxsqlite3_install_pcache(void)
+{
+  return sqlite3_config(SQLITE_CONFIG_PCACHE2, &clockPcacheMethods);
+}
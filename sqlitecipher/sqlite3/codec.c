@@ -194,14 +194,7 @@ static unsigned char padding[] =
 #define CIPHER_PARAMS_SENTINEL  { "", 0, 0, 0, 0 }
 #define CIPHER_PAGE1_OFFSET 24
 
-typedef struct _CipherParams
-{
-  char* m_name;
-  int   m_value;
-  int   m_default;
-  int   m_minValue;
-  int   m_maxValue;
-} CipherParams;
+typedef WxSQLite3CipherParam CipherParams;
 
 /*
 ** Common configuration parameters
@@ -209,9 +202,17 @@ typedef struct _CipherParams
 ** - cipher : default cipher type
 */
 
+#ifdef WXSQLITE3_SINGLE_CIPHER
+#define CODEC_CIPHER_MIN WXSQLITE3_SINGLE_CIPHER
+#define CODEC_CIPHER_MAX WXSQLITE3_SINGLE_CIPHER
+#else
+#define CODEC_CIPHER_MIN 1
+#define CODEC_CIPHER_MAX CODEC_TYPE_MAX
+#endif
+
 CipherParams commonParams[] =
 {
-  { "cipher", CODEC_TYPE, CODEC_TYPE, 1, CODEC_TYPE_MAX },
+  { "cipher", CODEC_TYPE, CODEC_TYPE, CODEC_CIPHER_MIN, CODEC_CIPHER_MAX },
   CIPHER_PARAMS_SENTINEL
 };
 
@@ -220,6 +221,7 @@ CipherParams commonParams[] =
 **
 ** - legacy mode : compatibility with first version (page 1 encrypted)
 **                 possible values:  1 = yes, 0 = no (default)
+** - raw_hkdf : pass raw keys (x'...') through HKDF-SHA256
 */
 
 #ifdef WXSQLITE3_USE_OLD_ENCRYPTION_SCHEME
@@ -232,6 +234,7 @@ CipherParams aes128Params[] =
 {
   { "legacy",            AES128_LEGACY_DEFAULT, AES128_LEGACY_DEFAULT, 0, 1 },
   { "legacy_page_size",  0,                     0,                     0, SQLITE_MAX_PAGE_SIZE },
+  { "raw_hkdf",          0,                     0,                     0, 1 },
   CIPHER_PARAMS_SENTINEL
 };
 
@@ -241,6 +244,7 @@ CipherParams aes128Params[] =
 ** - legacy mode : compatibility with first version (page 1 encrypted)
 **                 possible values:  1 = yes, 0 = no (default)
 ** - kdf_iter : number of iterations for key derivation
+** - raw_hkdf : pass raw keys (x'...') through HKDF-SHA256
 */
 
 #ifdef WXSQLITE3_USE_OLD_ENCRYPTION_SCHEME
@@ -254,6 +258,7 @@ CipherParams aes256Params[] =
   { "legacy",            AES256_LEGACY_DEFAULT, AES256_LEGACY_DEFAULT, 0, 1 },
   { "legacy_page_size",  0,                     0,                     0, SQLITE_MAX_PAGE_SIZE },
   { "kdf_iter",          CODEC_SHA_ITER,        CODEC_SHA_ITER,        1, 0x7fffffff },
+  { "raw_hkdf",          0,                     0,                     0, 1 },
   CIPHER_PARAMS_SENTINEL
 };
 
@@ -264,6 +269,7 @@ CipherParams aes256Params[] =
 **                 (page 1 encrypted, kdf_iter = 12345)
 **                 possible values:  1 = yes, 0 = no
 ** - kdf_iter : number of iterations for key derivation
+** - raw_hkdf : pass raw keys (x'...') through HKDF-SHA256
 */
 
 #ifdef WXSQLITE3_USE_SQLEET_LEGACY
@@ -281,6 +287,7 @@ CipherParams chacha20Params[] =
   { "legacy",            CHACHA20_LEGACY_DEFAULT,   CHACHA20_LEGACY_DEFAULT,   0, 1 },
   { "legacy_page_size",  CHACHA20_LEGACY_PAGE_SIZE, CHACHA20_LEGACY_PAGE_SIZE, 0, SQLITE_MAX_PAGE_SIZE },
   { "kdf_iter",          CHACHA20_KDF_ITER_DEFAULT, CHACHA20_KDF_ITER_DEFAULT, 1, 0x7fffffff },
+  { "raw_hkdf",          0,                         0,                         0, 1 },
   CIPHER_PARAMS_SENTINEL
 };
 
@@ -332,17 +339,141 @@ GetCipherParameter(CipherParams* cipherParams, const char* paramName)
   if (strlen(cipherParams->m_name) > 0)
   {
     value = cipherParams->m_value;
-    cipherParams->m_value = cipherParams->m_default;
+    /* Values of the shared table always equal their defaults */
+    if (cipherParams->m_value != cipherParams->m_default)
+    {
+      cipherParams->m_value = cipherParams->m_default;
+    }
   }
   return value;
 }
 
+static int IsHexKey(const unsigned char* hex, int len)
+{
+  int j;
+  for (j = 0; j < len; ++j)
+  {
+    unsigned char c = hex[j];
+    if ((c < '0' || c > '9') && (c < 'A' || c > 'F') && (c < 'a' || c > 'f'))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int ConvertHex2Int(char c)
+{
+  return (c >= '0' && c <= '9') ? (c)-'0' :
+         (c >= 'A' && c <= 'F') ? (c)-'A' + 10 :
+         (c >= 'a' && c <= 'f') ? (c)-'a' + 10 : 0;
+}
+
+static void ConvertHex2Bin(const unsigned char* hex, int len, unsigned char* bin)
+{
+  int j;
+  for (j = 0; j < len; j += 2)
+  {
+    bin[j / 2] = (ConvertHex2Int(hex[j]) << 4) | ConvertHex2Int(hex[j + 1]);
+  }
+}
+
+/* --- Raw keys --- */
+
+/* SQLCipher has a raw key format of its own */
+#if CODEC_HAS_CIPHER(CODEC_TYPE_AES128) || CODEC_HAS_CIPHER(CODEC_TYPE_AES256) || CODEC_HAS_CIPHER(CODEC_TYPE_CHACHA20)
+
+/*
+** A password of the form x'<hex>' with twice as many hex digits as the key
+** length of the cipher is taken as the key itself, skipping the KDF.
+*/
+static int
+CodecIsRawKey(const char* userPassword, int passwordLength, int keyLength)
+{
+  return passwordLength == (keyLength * 2) + 3 &&
+         sqlite3_strnicmp(userPassword, "x'", 2) == 0 &&
+         userPassword[passwordLength - 1] == '\'' &&
+         IsHexKey((const unsigned char*) (userPassword + 2), keyLength * 2) != 0;
+}
+
+static void
+CodecHmacSha256(const unsigned char* key, int keyLength,
+                const unsigned char* data1, int len1, const unsigned char* data2, int len2,
+                unsigned char digest[SHA256_DIGEST_SIZE])
+{
+  unsigned char pad[SHA256_BLOCK_SIZE];
+  unsigned char inner[SHA256_DIGEST_SIZE];
+  sha256_ctx ctx;
+  int j;
+
+  /* Keys are never longer than one block here (salt or PRK) */
+  memset(pad, 0, SHA256_BLOCK_SIZE);
+  memcpy(pad, key, keyLength);
+  for (j = 0; j < SHA256_BLOCK_SIZE; ++j)
+  {
+    pad[j] ^= 0x36;
+  }
+  sha256_init(&ctx);
+  sha256_update(&ctx, pad, SHA256_BLOCK_SIZE);
+  sha256_update(&ctx, data1, len1);
+  sha256_update(&ctx, data2, len2);
+  sha256_final(&ctx, inner);
+
+  for (j = 0; j < SHA256_BLOCK_SIZE; ++j)
+  {
+    pad[j] ^= 0x36 ^ 0x5c;
+  }
+  sha256_init(&ctx);
+  sha256_update(&ctx, pad, SHA256_BLOCK_SIZE);
+  sha256_update(&ctx, inner, SHA256_DIGEST_SIZE);
+  sha256_final(&ctx, digest);
+
+  memset(pad, 0, SHA256_BLOCK_SIZE);
+  memset(inner, 0, SHA256_DIGEST_SIZE);
+}
+
+/*
+** Convert a raw key password to the cipher key. With useHkdf the key is
+** passed through HKDF-SHA256 (RFC 5869), using the database salt (if the
+** cipher has one) and the cipher name as info. This keeps the keys of
+** several databases or ciphers apart when they share one master key.
+*/
+static void
+CodecRawKey(const char* userPassword, int keyLength, int useHkdf,
+            const unsigned char* salt, int saltLength, const char* info, unsigned char* key)
+{
+  ConvertHex2Bin((const unsigned char*) (userPassword + 2), keyLength * 2, key);
+  if (useHkdf != 0)
+  {
+    static const unsigned char zeroSalt[SHA256_DIGEST_SIZE] = { 0 };
+    static const unsigned char counter = 1;
+    unsigned char prk[SHA256_DIGEST_SIZE];
+    unsigned char okm[SHA256_DIGEST_SIZE];
+    if (salt == NULL)
+    {
+      salt = zeroSalt;
+      saltLength = SHA256_DIGEST_SIZE;
+    }
+    /* Extract, then the first block of expand is enough for keys up to 32 bytes */
+    CodecHmacSha256(salt, saltLength, key, keyLength, NULL, 0, prk);
+    CodecHmacSha256(prk, SHA256_DIGEST_SIZE, (const unsigned char*) info, (int) strlen(info), &counter, 1, okm);
+    memcpy(key, okm, keyLength);
+    memset(prk, 0, SHA256_DIGEST_SIZE);
+    memset(okm, 0, SHA256_DIGEST_SIZE);
+  }
+}
+
+#endif
+
+#if CODEC_HAS_CIPHER(CODEC_TYPE_AES128)
+
 /* --- AES 128-bit cipher (wxSQLite3) --- */
 
 typedef struct _AES128Cipher
 {
   int           m_legacy;
   int           m_legacyPageSize;
+  int           m_rawHkdf;
   int           m_keyLength;
   unsigned char m_key[KEYLENGTH_AES128];
   Rijndael*     m_aes;
@@ -372,6 +503,7 @@ AllocateAES128Cipher(sqlite3* db)
     CipherParams* cipherParams = (CipherParams*) GetCipherParams(db, CODEC_TYPE_AES128);
     aesCipher->m_legacy = GetCipherParameter(cipherParams, "legacy");
     aesCipher->m_legacyPageSize = GetCipherParameter(cipherParams, "legacy_page_size");
+    aesCipher->m_rawHkdf = GetCipherParameter(cipherParams, "raw_hkdf");
   }
   return aesCipher;
 }
@@ -393,6 +525,7 @@ CloneAES128Cipher(void* cipherTo, void* cipherFrom)
   AES128Cipher* aesCipherFrom = (AES128Cipher*) cipherFrom;
   aesCipherTo->m_legacy = aesCipherFrom->m_legacy;
   aesCipherTo->m_legacyPageSize = aesCipherFrom->m_legacyPageSize;
+  aesCipherTo->m_rawHkdf = aesCipherFrom->m_rawHkdf;
   aesCipherTo->m_keyLength = aesCipherFrom->m_keyLength;
   memcpy(aesCipherTo->m_key, aesCipherFrom->m_key, KEYLENGTH_AES128);
   RijndaelInvalidate(aesCipherTo->m_aes);
@@ -406,6 +539,13 @@ GetLegacyAES128Cipher(void* cipher)
   return aesCipher->m_legacy;
 }
 
+void
+SetLegacyAES128Cipher(void* cipher, int legacy)
+{
+  AES128Cipher* aesCipher = (AES128Cipher*) cipher;
+  aesCipher->m_legacy = legacy;
+}
+
 int
 GetPageSizeAES128Cipher(void* cipher)
 {
@@ -429,7 +569,7 @@ GetReservedAES128Cipher(void* cipher)
 }
 
 void
-GenerateKeyAES128Cipher(void* cipher, Btree* pBt, char* userPassword, int passwordLength, int rekey)
+GenerateKeyAES128Cipher(void* cipher, sqlite3_file* fd, char* userPassword, int passwordLength, int rekey)
 {
   AES128Cipher* aesCipher = (AES128Cipher*) cipher;
   unsigned char userPad[32];
@@ -442,6 +582,12 @@ GenerateKeyAES128Cipher(void* cipher, Btree* pBt, char* userPassword, int passwo
   int i, j, k;
   MD5_CTX ctx;
 
+  if (CodecIsRawKey(userPassword, passwordLength, KEYLENGTH_AES128))
+  {
+    CodecRawKey(userPassword, KEYLENGTH_AES128, aesCipher->m_rawHkdf, NULL, 0, "aes128cbc", aesCipher->m_key);
+    return;
+  }
+
   /* Pad passwords */
   CodecPadPassword(userPassword, passwordLength, userPad);
   CodecPadPassword("", 0, ownerPad);
@@ -565,6 +711,10 @@ DecryptPageAES128Cipher(void* cipher, int page, unsigned char* data, int len, in
   return rc;
 }
 
+#endif
+
+#if CODEC_HAS_CIPHER(CODEC_TYPE_AES256)
+
 /* --- AES 256-bit cipher (wxSQLite3) --- */
 
 typedef struct _AES256Cipher
@@ -572,6 +722,7 @@ typedef struct _AES256Cipher
   int           m_legacy;
   int           m_legacyPageSize;
   int           m_kdfIter;
+  int           m_rawHkdf;
   int           m_keyLength;
   unsigned char m_key[KEYLENGTH_AES256];
   Rijndael*     m_aes;
@@ -602,6 +753,7 @@ AllocateAES256Cipher(sqlite3* db)
     aesCipher->m_legacy = GetCipherParameter(cipherParams, "legacy");
     aesCipher->m_legacyPageSize = GetCipherParameter(cipherParams, "legacy_page_size");
     aesCipher->m_kdfIter = GetCipherParameter(cipherParams, "kdf_iter");
+    aesCipher->m_rawHkdf = GetCipherParameter(cipherParams, "raw_hkdf");
   }
   return aesCipher;
 }
@@ -624,6 +776,7 @@ CloneAES256Cipher(void* cipherTo, void* cipherFrom)
   aesCipherTo->m_legacy = aesCipherFrom->m_legacy;
   aesCipherTo->m_legacyPageSize = aesCipherFrom->m_legacyPageSize;
   aesCipherTo->m_kdfIter = aesCipherFrom->m_kdfIter;
+  aesCipherTo->m_rawHkdf = aesCipherFrom->m_rawHkdf;
   aesCipherTo->m_keyLength = aesCipherFrom->m_keyLength;
   memcpy(aesCipherTo->m_key, aesCipherFrom->m_key, KEYLENGTH_AES256);
   RijndaelInvalidate(aesCipherTo->m_aes);
@@ -637,6 +790,13 @@ GetLegacyAES256Cipher(void* cipher)
   return aesCipher->m_legacy;
 }
 
+void
+SetLegacyAES256Cipher(void* cipher, int legacy)
+{
+  AES256Cipher* aesCipher = (AES256Cipher*) cipher;
+  aesCipher->m_legacy = legacy;
+}
+
 int
 GetPageSizeAES256Cipher(void* cipher)
 {
@@ -660,7 +820,7 @@ GetReservedAES256Cipher(void* cipher)
 }
 
 void
-GenerateKeyAES256Cipher(void* cipher, Btree* pBt, char* userPassword, int passwordLength, int rekey)
+GenerateKeyAES256Cipher(void* cipher, sqlite3_file* fd, char* userPassword, int passwordLength, int rekey)
 {
   AES256Cipher* aesCipher = (AES256Cipher*) cipher;
   unsigned char userPad[32];
@@ -668,6 +828,12 @@ GenerateKeyAES256Cipher(void* cipher, Btree* pBt, char* userPassword, int passwo
   int keyLength = KEYLENGTH_AES256;
   int k;
 
+  if (CodecIsRawKey(userPassword, passwordLength, KEYLENGTH_AES256))
+  {
+    CodecRawKey(userPassword, KEYLENGTH_AES256, aesCipher->m_rawHkdf, NULL, 0, "aes256cbc", aesCipher->m_key);
+    return;
+  }
+
   /* Pad password */
   CodecPadPassword(userPassword, passwordLength, userPad);
 
@@ -758,6 +924,10 @@ DecryptPageAES256Cipher(void* cipher, int page, unsigned char* data, int len, in
   return rc;
 }
 
+#endif
+
+#if CODEC_HAS_CIPHER(CODEC_TYPE_CHACHA20)
+
 /* --- ChaCha20-Poly1305 cipher (plus sqleet variant) --- */
 
 #define KEYLENGTH_CHACHA20       32
@@ -771,6 +941,7 @@ typedef struct _chacha20Cipher
   int           m_legacy;
   int           m_legacyPageSize;
   int           m_kdfIter;
+  int           m_rawHkdf;
   int           m_keyLength;
   unsigned char m_key[KEYLENGTH_CHACHA20];
   unsigned char m_salt[SALTLENGTH_CHACHA20];
@@ -792,10 +963,7 @@ AllocateChaCha20Cipher(sqlite3* db)
     chacha20Cipher->m_legacy = GetCipherParameter(cipherParams, "legacy");
     chacha20Cipher->m_legacyPageSize = GetCipherParameter(cipherParams, "legacy_page_size");
     chacha20Cipher->m_kdfIter = GetCipherParameter(cipherParams, "kdf_iter");
-    if (chacha20Cipher->m_legacy != 0)
-    {
-      chacha20Cipher->m_kdfIter = SQLEET_KDF_ITER;
-    }
+    chacha20Cipher->m_rawHkdf = GetCipherParameter(cipherParams, "raw_hkdf");
   }
   return chacha20Cipher;
 }
@@ -816,6 +984,7 @@ CloneChaCha20Cipher(void* cipherTo, void* cipherFrom)
   chacha20CipherTo->m_legacy = chacha20CipherFrom->m_legacy;
   chacha20CipherTo->m_legacyPageSize = chacha20CipherFrom->m_legacyPageSize;
   chacha20CipherTo->m_kdfIter = chacha20CipherFrom->m_kdfIter;
+  chacha20CipherTo->m_rawHkdf = chacha20CipherFrom->m_rawHkdf;
   chacha20CipherTo->m_keyLength = chacha20CipherFrom->m_keyLength;
   memcpy(chacha20CipherTo->m_key, chacha20CipherFrom->m_key, KEYLENGTH_CHACHA20);
   memcpy(chacha20CipherTo->m_salt, chacha20CipherFrom->m_salt, SALTLENGTH_CHACHA20);
@@ -828,6 +997,13 @@ GetLegacyChaCha20Cipher(void* cipher)
   return chacha20Cipher->m_legacy;
 }
 
+void
+SetLegacyChaCha20Cipher(void* cipher, int legacy)
+{
+  ChaCha20Cipher* chacha20Cipher = (ChaCha20Cipher*) cipher;
+  chacha20Cipher->m_legacy = legacy;
+}
+
 int
 GetPageSizeChaCha20Cipher(void* cipher)
 {
@@ -851,21 +1027,26 @@ GetReservedChaCha20Cipher(void* cipher)
 }
 
 void
-GenerateKeyChaCha20Cipher(void* cipher, Btree* pBt, char* userPassword, int passwordLength, int rekey)
+GenerateKeyChaCha20Cipher(void* cipher, sqlite3_file* fd, char* userPassword, int passwordLength, int rekey)
 {
   ChaCha20Cipher* chacha20Cipher = (ChaCha20Cipher*) cipher;
 
-  Pager *pPager = pBt->pBt->pPager;
-  sqlite3_file* fd = (isOpen(pPager->fd)) ? pPager->fd : NULL;
-
   if (rekey || fd == NULL || sqlite3OsRead(fd, chacha20Cipher->m_salt, SALTLENGTH_CHACHA20, 0) != SQLITE_OK)
   {
     chacha20_rng(chacha20Cipher->m_salt, SALTLENGTH_CHACHA20);
   }
-  fastpbkdf2_hmac_sha256((unsigned char*) userPassword, passwordLength, 
-                         chacha20Cipher->m_salt, SALTLENGTH_CHACHA20,
-                         chacha20Cipher->m_kdfIter, 
-                         chacha20Cipher->m_key, KEYLENGTH_CHACHA20);
+  if (CodecIsRawKey(userPassword, passwordLength, KEYLENGTH_CHACHA20))
+  {
+    CodecRawKey(userPassword, KEYLENGTH_CHACHA20, chacha20Cipher->m_rawHkdf,
+                chacha20Cipher->m_salt, SALTLENGTH_CHACHA20, "chacha20", chacha20Cipher->m_key);
+  }
+  else
+  {
+    fastpbkdf2_hmac_sha256((unsigned char*) userPassword, passwordLength, 
+                           chacha20Cipher->m_salt, SALTLENGTH_CHACHA20,
+                           (chacha20Cipher->m_legacy != 0) ? SQLEET_KDF_ITER : chacha20Cipher->m_kdfIter,
+                           chacha20Cipher->m_key, KEYLENGTH_CHACHA20);
+  }
 }
 
 int
@@ -992,6 +1173,10 @@ DecryptPageChaCha20Cipher(void* cipher, int page, unsigned char* data, int len,
   return rc;
 }
 
+#endif
+
+#if CODEC_HAS_CIPHER(CODEC_TYPE_SQLCIPHER)
+
 /* --- SQLCipher AES256CBC-HMAC cipher --- */
 
 #define KEYLENGTH_SQLCIPHER      32
@@ -1087,6 +1272,13 @@ GetLegacySQLCipherCipher(void* cipher)
   return sqlCipherCipher->m_legacy;
 }
 
+void
+SetLegacySQLCipherCipher(void* cipher, int legacy)
+{
+  SQLCipherCipher* sqlCipherCipher = (SQLCipherCipher*) cipher;
+  sqlCipherCipher->m_legacy = legacy;
+}
+
 int
 GetPageSizeSQLCipherCipher(void* cipher)
 {
@@ -1115,44 +1307,11 @@ GetReservedSQLCipherCipher(void* cipher)
   return reserved;
 }
 
-static int IsHexKey(const unsigned char* hex, int len)
-{
-  int j;
-  for (j = 0; j < len; ++j)
-  {
-    unsigned char c = hex[j];
-    if ((c < '0' || c > '9') && (c < 'A' || c > 'F') && (c < 'a' || c > 'f'))
-    {
-      return 0;
-    }
-  }
-  return 1;
-}
-
-static int ConvertHex2Int(char c)
-{
-  return (c >= '0' && c <= '9') ? (c)-'0' :
-         (c >= 'A' && c <= 'F') ? (c)-'A' + 10 :
-         (c >= 'a' && c <= 'f') ? (c)-'a' + 10 : 0;
-}
-
-static void ConvertHex2Bin(const unsigned char* hex, int len, unsigned char* bin)
-{
-  int j;
-  for (j = 0; j < len; j += 2)
-  {
-    bin[j / 2] = (ConvertHex2Int(hex[j]) << 4) | ConvertHex2Int(hex[j + 1]);
-  }
-}
-
 void
-GenerateKeySQLCipherCipher(void* cipher, Btree* pBt, char* userPassword, int passwordLength, int rekey)
+GenerateKeySQLCipherCipher(void* cipher, sqlite3_file* fd, char* userPassword, int passwordLength, int rekey)
 {
   SQLCipherCipher* sqlCipherCipher = (SQLCipherCipher*) cipher;
 
-  Pager *pPager = pBt->pBt->pPager;
-  sqlite3_file* fd = (isOpen(pPager->fd)) ? pPager->fd : NULL;
-
   if (rekey || fd == NULL || sqlite3OsRead(fd, sqlCipherCipher->m_salt, SALTLENGTH_SQLCIPHER, 0) != SQLITE_OK)
   {
     chacha20_rng(sqlCipherCipher->m_salt, SALTLENGTH_SQLCIPHER);
@@ -1333,13 +1492,16 @@ DecryptPageSQLCipherCipher(void* cipher, int page, unsigned char* data, int len,
 }
 
 
+#endif
+
 typedef struct _CodecParameter
 {
   char*         m_name;
   CipherParams* m_params;
 } CodecParameter;
 
-CodecParameter codecParameterTable[] =
+/* Room for the ciphers registered at runtime, plus the sentinel */
+CodecParameter codecParameterTable[CODEC_COUNT_MAX + 2] =
 {
   { "global",    commonParams },
   { "aes128cbc", aes128Params },
@@ -1409,13 +1571,64 @@ FreeCodecParameterTable(CodecParameter* codecParams)
   sqlite3_free(codecParams);
 }
 
+/*
+** The parameter table of a connection. All connections share the global
+** table, in which every value equals its default, until a connection
+** changes a parameter; then it gets a copy of its own.
+*/
+typedef struct _CodecParameterRef
+{
+  CodecParameter* m_params;   /* codecParameterTable or the copy of the connection */
+} CodecParameterRef;
+
+CodecParameterRef*
+NewCodecParameterRef()
+{
+  CodecParameterRef* ref = (CodecParameterRef*) sqlite3_malloc(sizeof(CodecParameterRef));
+  if (ref != NULL)
+  {
+    ref->m_params = codecParameterTable;
+  }
+  return ref;
+}
+
+void
+FreeCodecParameterRef(CodecParameterRef* ref)
+{
+  if (ref->m_params != codecParameterTable)
+  {
+    FreeCodecParameterTable(ref->m_params);
+  }
+  sqlite3_free(ref);
+}
+
+/*
+** Parameter k of table j, made writable by copying the shared table first;
+** NULL if there is not enough memory for the copy
+*/
+static CipherParams*
+GetCodecParamForWrite(CodecParameterRef* ref, int j, int k)
+{
+  if (ref->m_params == codecParameterTable)
+  {
+    CodecParameter* clone = CloneCodecParameterTable();
+    if (clone == NULL)
+    {
+      return NULL;
+    }
+    ref->m_params = clone;
+  }
+  return &ref->m_params[j].m_params[k];
+}
+
 typedef void* (*AllocateCipher_t)(sqlite3* db);
 typedef void  (*FreeCipher_t)(void* cipher);
 typedef void  (*CloneCipher_t)(void* cipherTo, void* cipherFrom);
 typedef int   (*GetLegacy_t)(void* cipher);
+typedef void  (*SetLegacy_t)(void* cipher, int legacy);
 typedef int   (*GetPageSize_t)(void* cipher);
 typedef int   (*GetReserved_t)(void* cipher);
-typedef void  (*GenerateKey_t)(void* cipher, Btree* pBt, char* userPassword, int passwordLength, int rekey);
+typedef void  (*GenerateKey_t)(void* cipher, sqlite3_file* fd, char* userPassword, int passwordLength, int rekey);
 typedef int   (*EncryptPage_t)(void* cipher, int page, unsigned char* data, int len, int reserved);
 typedef int   (*DecryptPage_t)(void* cipher, int page, unsigned char* data, int len, int reserved);
 
@@ -1426,6 +1639,7 @@ typedef struct _CodecDescriptor
   FreeCipher_t     m_freeCipher;
   CloneCipher_t    m_cloneCipher;
   GetLegacy_t      m_getLegacy;
+  SetLegacy_t      m_setLegacy;
   GetPageSize_t    m_getPageSize;
   GetReserved_t    m_getReserved;
   GenerateKey_t    m_generateKey;
@@ -1433,59 +1647,271 @@ typedef struct _CodecDescriptor
   DecryptPage_t    m_decryptPage;
 } CodecDescriptor;
 
-CodecDescriptor codecDescriptorTable[] =
+/* Number of available ciphers, the built-in ones come first */
+static int codecCount = CODEC_TYPE_MAX;
+
+CodecDescriptor codecDescriptorTable[CODEC_COUNT_MAX + 1] =
 {
+#if CODEC_HAS_CIPHER(CODEC_TYPE_AES128)
   /* wxSQLite3 AES 128 bit CBC */
   { "aes128cbc", AllocateAES128Cipher,
                  FreeAES128Cipher,
                  CloneAES128Cipher,
                  GetLegacyAES128Cipher,
+                 SetLegacyAES128Cipher,
                  GetPageSizeAES128Cipher,
                  GetReservedAES128Cipher,
                  GenerateKeyAES128Cipher,
                  EncryptPageAES128Cipher,
                  DecryptPageAES128Cipher },
+#else
+  { "aes128cbc", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
+#endif
+#if CODEC_HAS_CIPHER(CODEC_TYPE_AES256)
   /* wxSQLite3 AES 128 bit CBC */
   { "aes256cbc", AllocateAES256Cipher,
                  FreeAES256Cipher,
                  CloneAES256Cipher,
                  GetLegacyAES256Cipher,
+                 SetLegacyAES256Cipher,
                  GetPageSizeAES256Cipher,
                  GetReservedAES256Cipher,
                  GenerateKeyAES256Cipher,
                  EncryptPageAES256Cipher,
                  DecryptPageAES256Cipher },
+#else
+  { "aes256cbc", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
+#endif
+#if CODEC_HAS_CIPHER(CODEC_TYPE_CHACHA20)
   /* ChaCha20 - Poly1305 (including sqleet legacy */
   { "chacha20",  AllocateChaCha20Cipher,
                  FreeChaCha20Cipher,
                  CloneChaCha20Cipher,
                  GetLegacyChaCha20Cipher,
+                 SetLegacyChaCha20Cipher,
                  GetPageSizeChaCha20Cipher,
                  GetReservedChaCha20Cipher,
                  GenerateKeyChaCha20Cipher,
                  EncryptPageChaCha20Cipher,
                  DecryptPageChaCha20Cipher },
+#else
+  { "chacha20",  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
+#endif
+#if CODEC_HAS_CIPHER(CODEC_TYPE_SQLCIPHER)
   /* ChaCha20 - Poly1305 (including sqleet legacy */
   { "sqlcipher", AllocateSQLCipherCipher,
                  FreeSQLCipherCipher,
                  CloneSQLCipherCipher,
                  GetLegacySQLCipherCipher,
+                 SetLegacySQLCipherCipher,
                  GetPageSizeSQLCipherCipher,
                  GetReservedSQLCipherCipher,
                  GenerateKeySQLCipherCipher,
                  EncryptPageSQLCipherCipher,
                  DecryptPageSQLCipherCipher },
-  { "", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL }
+#else
+  { "sqlcipher", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
+#endif
+  { "", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
+/*
+** With a single cipher the page functions are called directly, so the
+** compiler can inline them into the codec. The page size and the reserved
+** bytes stay runtime values, they differ between databases (legacy files,
+** databases being encrypted by a rekey).
+*/
+#ifdef WXSQLITE3_SINGLE_CIPHER
+#if WXSQLITE3_SINGLE_CIPHER == CODEC_TYPE_AES128
+#define CODEC_SINGLE_ENCRYPT EncryptPageAES128Cipher
+#define CODEC_SINGLE_DECRYPT DecryptPageAES128Cipher
+#elif WXSQLITE3_SINGLE_CIPHER == CODEC_TYPE_AES256
+#define CODEC_SINGLE_ENCRYPT EncryptPageAES256Cipher
+#define CODEC_SINGLE_DECRYPT DecryptPageAES256Cipher
+#elif WXSQLITE3_SINGLE_CIPHER == CODEC_TYPE_CHACHA20
+#define CODEC_SINGLE_ENCRYPT EncryptPageChaCha20Cipher
+#define CODEC_SINGLE_DECRYPT DecryptPageChaCha20Cipher
+#elif WXSQLITE3_SINGLE_CIPHER == CODEC_TYPE_SQLCIPHER
+#define CODEC_SINGLE_ENCRYPT EncryptPageSQLCipherCipher
+#define CODEC_SINGLE_DECRYPT DecryptPageSQLCipherCipher
+#else
+#error "Invalid single cipher selected"
+#endif
+#endif
+
+/* --- Cipher registration --- */
+
+int
+wxsqlite3_cipher_index(const char* cipherName)
+{
+  int j;
+  if (cipherName == NULL)
+  {
+    return 0;
+  }
+  for (j = 0; strlen(codecDescriptorTable[j].m_name) > 0; ++j)
+  {
+    if (sqlite3_stricmp(cipherName, codecDescriptorTable[j].m_name) == 0)
+    {
+      /* Ciphers compiled out by WXSQLITE3_SINGLE_CIPHER are unknown */
+      return (codecDescriptorTable[j].m_allocateCipher != NULL) ? j + 1 : 0;
+    }
+  }
+  return 0;
+}
+
+const char*
+wxsqlite3_cipher_name(int cipherType)
+{
+  int j;
+  for (j = 0; strlen(codecDescriptorTable[j].m_name) > 0; ++j)
+  {
+    if (j + 1 == cipherType)
+    {
+      return (codecDescriptorTable[j].m_allocateCipher != NULL) ? codecDescriptorTable[j].m_name : NULL;
+    }
+  }
+  return NULL;
+}
+
+int
+wxsqlite3_cipher_param(sqlite3* db, const char* cipherName, const char* paramName)
+{
+  int value = -1;
+  int cipherType = wxsqlite3_cipher_index(cipherName);
+  if (cipherType > 0 && paramName != NULL)
+  {
+    CipherParams* cipherParams = (CipherParams*) GetCipherParams(db, cipherType);
+    if (cipherParams != NULL)
+    {
+      value = GetCipherParameter(cipherParams, paramName);
+    }
+  }
+  return value;
+}
+
+int
+wxsqlite3_register_cipher(const WxSQLite3CipherDescriptor* descriptor, const WxSQLite3CipherParam* params)
+{
+  int rc = SQLITE_OK;
+  int nParams = 0;
+  int lenNames = 0;
+  CipherParams* cipherParams;
+  char* names;
+  sqlite3_mutex* mutex;
+  int j;
+
+  if (descriptor == NULL || descriptor->m_name == NULL ||
+      strlen(descriptor->m_name) == 0 || strlen(descriptor->m_name) >= sizeof(codecDescriptorTable[0].m_name) ||
+      sqlite3_stricmp(descriptor->m_name, "global") == 0 ||
+      descriptor->m_allocateCipher == NULL || descriptor->m_freeCipher == NULL ||
+      descriptor->m_cloneCipher == NULL || descriptor->m_getLegacy == NULL ||
+      descriptor->m_getPageSize == NULL || descriptor->m_getReserved == NULL ||
+      descriptor->m_generateKey == NULL || descriptor->m_encryptPage == NULL ||
+      descriptor->m_decryptPage == NULL)
+  {
+    return SQLITE_MISUSE;
+  }
+  for (j = 0; params != NULL && params[j].m_name != NULL && strlen(params[j].m_name) > 0; ++j)
+  {
+    if (params[j].m_minValue > params[j].m_maxValue ||
+        params[j].m_default < params[j].m_minValue || params[j].m_default > params[j].m_maxValue)
+    {
+      return SQLITE_MISUSE;
+    }
+    lenNames += (int) strlen(params[j].m_name) + 1;
+  }
+  nParams = j;
+
+  rc = sqlite3_initialize();
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+#ifdef WXSQLITE3_SINGLE_CIPHER
+  /* The codec calls the single cipher directly */
+  return SQLITE_MISUSE;
+#endif
+
+  /* One block for the parameters, their sentinel and their names */
+  cipherParams = (CipherParams*) sqlite3_malloc((nParams + 1) * sizeof(CipherParams) + lenNames);
+  if (cipherParams == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  names = (char*) &cipherParams[nParams + 1];
+  for (j = 0; j < nParams; ++j)
+  {
+    strcpy(names, params[j].m_name);
+    cipherParams[j].m_name     = names;
+    cipherParams[j].m_value    = params[j].m_default;
+    cipherParams[j].m_default  = params[j].m_default;
+    cipherParams[j].m_minValue = params[j].m_minValue;
+    cipherParams[j].m_maxValue = params[j].m_maxValue;
+    names += strlen(names) + 1;
+  }
+  memset(&cipherParams[nParams], 0, sizeof(CipherParams));
+  cipherParams[nParams].m_name = "";
+
+  mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(mutex);
+  if (wxsqlite3_cipher_index(descriptor->m_name) > 0)
+  {
+    rc = SQLITE_ERROR;
+  }
+  else if (codecCount >= CODEC_COUNT_MAX)
+  {
+    rc = SQLITE_FULL;
+  }
+  else
+  {
+    CodecDescriptor* entry = &codecDescriptorTable[codecCount];
+    entry->m_allocateCipher = descriptor->m_allocateCipher;
+    entry->m_freeCipher = descriptor->m_freeCipher;
+    entry->m_cloneCipher = descriptor->m_cloneCipher;
+    entry->m_getLegacy = descriptor->m_getLegacy;
+    entry->m_setLegacy = NULL;
+    entry->m_getPageSize = descriptor->m_getPageSize;
+    entry->m_getReserved = descriptor->m_getReserved;
+    entry->m_generateKey = descriptor->m_generateKey;
+    entry->m_encryptPage = descriptor->m_encryptPage;
+    entry->m_decryptPage = descriptor->m_decryptPage;
+    strcpy(entry->m_name, descriptor->m_name);
+
+    /* The parameter table has "global" in front of the ciphers */
+    codecParameterTable[codecCount + 2].m_name = "";
+    codecParameterTable[codecCount + 2].m_params = NULL;
+    codecParameterTable[codecCount + 1].m_params = cipherParams;
+    codecParameterTable[codecCount + 1].m_name = entry->m_name;
+    ++codecCount;
+
+    /* Connections sharing the global table accept the new cipher type */
+    commonParams[0].m_maxValue = codecCount;
+  }
+  sqlite3_mutex_leave(mutex);
+
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_free(cipherParams);
+  }
+  return rc;
+}
+
 /* --- Codec --- */
 
+static sqlite3_file*
+CodecGetFile(Btree* bt)
+{
+  Pager* pPager = bt->pBt->pPager;
+  return (isOpen(pPager->fd)) ? pPager->fd : NULL;
+}
+
 void
 wxsqlite3_config_table(sqlite3_context* context, int argc, sqlite3_value** argv)
 {
-  CodecParameter* codecParams = (CodecParameter*) sqlite3_user_data(context);
+  CodecParameterRef* ref = (CodecParameterRef*) sqlite3_user_data(context);
   assert(argc == 0);
-  sqlite3_result_pointer(context, codecParams, "wxsqlite3_codec_params", 0);
+  sqlite3_result_pointer(context, ref, "wxsqlite3_codec_params", 0);
 }
 
 /*
@@ -1494,6 +1920,7 @@ wxsqlite3_config_table(sqlite3_context* context, int argc, sqlite3_value** argv)
 void
 wxsqlite3_config_params(sqlite3_context* context, int argc, sqlite3_value** argv)
 {
+  CodecParameterRef* ref;
   CodecParameter* codecParams;
   const char* nameParam1;
   int hasDefaultPrefix = 0;
@@ -1503,6 +1930,7 @@ wxsqlite3_config_params(sqlite3_context* context, int argc, sqlite3_value** argv
   CipherParams* cipherParamTable = NULL;
   int isCommonParam1;
   int isCipherParam1 = 0;
+  int cipherIndex = 0;
 
   assert(argc == 1 || argc == 2 || argc == 3);
   /* NULL values are not allowed for the first 2 arguments */
@@ -1512,7 +1940,8 @@ wxsqlite3_config_params(sqlite3_context* context, int argc, sqlite3_value** argv
     return;
   }
 
-  codecParams = (CodecParameter*) sqlite3_user_data(context);
+  ref = (CodecParameterRef*) sqlite3_user_data(context);
+  codecParams = ref->m_params;
 
   /* Check first argument whether it is a common parameter */
   /* If the first argument is a common parameter, param1 will point to its parameter table entry */
@@ -1555,6 +1984,7 @@ wxsqlite3_config_params(sqlite3_context* context, int argc, sqlite3_value** argv
       isCipherParam1 = strlen(codecParams[j].m_name) > 0;
       if (isCipherParam1)
       {
+        cipherIndex = j;
         cipherParamTable = codecParams[j].m_params;
       }
     }
@@ -1636,8 +2066,15 @@ wxsqlite3_config_params(sqlite3_context* context, int argc, sqlite3_value** argv
           {
             if (sqlite3_stricmp(nameCipher, codecDescriptorTable[j].m_name) == 0) break;
           }
-          if (strlen(codecDescriptorTable[j].m_name) > 0)
+          /* Ciphers registered after the table of the connection was copied, or compiled out, are out of range */
+          if (strlen(codecDescriptorTable[j].m_name) > 0 && j + 1 >= param1->m_minValue && j + 1 <= param1->m_maxValue)
           {
+            param1 = GetCodecParamForWrite(ref, 0, (int) (param1 - codecParams[0].m_params));
+            if (param1 == NULL)
+            {
+              sqlite3_result_error_nomem(context);
+              return;
+            }
             if (hasDefaultPrefix)
             {
               param1->m_default = j + 1;
@@ -1663,6 +2100,12 @@ wxsqlite3_config_params(sqlite3_context* context, int argc, sqlite3_value** argv
         int value = sqlite3_value_int(argv[1]);
         if (value >= param1->m_minValue && value <= param1->m_maxValue)
         {
+          param1 = GetCodecParamForWrite(ref, 0, (int) (param1 - codecParams[0].m_params));
+          if (param1 == NULL)
+          {
+            sqlite3_result_error_nomem(context);
+            return;
+          }
           if (hasDefaultPrefix)
           {
             param1->m_default = value;
@@ -1721,6 +2164,12 @@ wxsqlite3_config_params(sqlite3_context* context, int argc, sqlite3_value** argv
           int value = sqlite3_value_int(argv[2]);
           if (value >= param2->m_minValue && value <= param2->m_maxValue)
           {
+            param2 = GetCodecParamForWrite(ref, cipherIndex, (int) (param2 - cipherParamTable));
+            if (param2 == NULL)
+            {
+              sqlite3_result_error_nomem(context);
+              return;
+            }
             if (hasDefaultPrefix)
             {
               param2->m_default = value;
@@ -1754,13 +2203,127 @@ wxsqlite3_config_params(sqlite3_context* context, int argc, sqlite3_value** argv
   }
 }
 
-CodecParameter*
-GetCodecParams(sqlite3* db)
+/*
+** Report the CPU features of the host and the implementation used by each
+** crypto primitive, as JSON. All primitives are portable C, so the report
+** shows which hardware acceleration is available but unused.
+*/
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CODEC_CPU_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) && defined(__linux__)
+#define CODEC_CPU_ARM64_LINUX 1
+#include <sys/auxv.h>
+#endif
+
+static const char*
+CodecCpuArchitecture()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+  return "x86_64";
+#elif defined(__i386__) || defined(_M_IX86)
+  return "x86";
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  return "arm64";
+#elif defined(__arm__) || defined(_M_ARM)
+  return "arm";
+#else
+  return "unknown";
+#endif
+}
+
+static char*
+CodecCpuFlags()
+{
+#if defined(CODEC_CPU_X86)
+  unsigned int regs1[4] = { 0, 0, 0, 0 };
+  unsigned int regs7[4] = { 0, 0, 0, 0 };
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] >= 1)
+  {
+    __cpuid(info, 1);
+    memcpy(regs1, info, sizeof(regs1));
+  }
+  if (info[0] >= 7)
+  {
+    __cpuidex(info, 7, 0);
+    memcpy(regs7, info, sizeof(regs7));
+  }
+#else
+  unsigned int maxLeaf = __get_cpuid_max(0, NULL);
+  if (maxLeaf >= 1)
+  {
+    __cpuid(1, regs1[0], regs1[1], regs1[2], regs1[3]);
+  }
+  if (maxLeaf >= 7)
+  {
+    __cpuid_count(7, 0, regs7[0], regs7[1], regs7[2], regs7[3]);
+  }
+#endif
+  /* Leaf 1: ECX bits 1 (PCLMULQDQ), 9 (SSSE3), 19 (SSE4.1), 25 (AES-NI), 28 (AVX)
+  ** Leaf 7: EBX bits 5 (AVX2), 29 (SHA) */
+  return sqlite3_mprintf("{\"sse2\":%d,\"ssse3\":%d,\"sse41\":%d,\"avx\":%d,\"avx2\":%d,\"aesni\":%d,\"pclmul\":%d,\"sha\":%d}",
+                         (regs1[3] >> 26) & 1, (regs1[2] >> 9) & 1, (regs1[2] >> 19) & 1, (regs1[2] >> 28) & 1,
+                         (regs7[1] >> 5) & 1, (regs1[2] >> 25) & 1, (regs1[2] >> 1) & 1, (regs7[1] >> 29) & 1);
+#elif defined(CODEC_CPU_ARM64_LINUX)
+  /* HWCAP bits of the arm64 Linux kernel ABI */
+  unsigned long hwcap = getauxval(AT_HWCAP);
+  return sqlite3_mprintf("{\"neon\":%d,\"aes\":%d,\"pmull\":%d,\"sha1\":%d,\"sha2\":%d,\"sha512\":%d}",
+                         (int) ((hwcap >> 1) & 1), (int) ((hwcap >> 3) & 1), (int) ((hwcap >> 4) & 1),
+                         (int) ((hwcap >> 5) & 1), (int) ((hwcap >> 6) & 1), (int) ((hwcap >> 21) & 1));
+#else
+  return sqlite3_mprintf("{}");
+#endif
+}
+
+void
+wxsqlite3_cpu_features(sqlite3_context* context, int argc, sqlite3_value** argv)
+{
+  char* flags = CodecCpuFlags();
+  char* features;
+#if defined(__GNUC__) && __GNUC__ >= 4 && __BYTE_ORDER == __LITTLE_ENDIAN
+  const char* pbkdf2 = "portable, bswap builtins";
+#else
+  const char* pbkdf2 = "portable, byte-wise";
+#endif
+#ifdef WITH_OPENMP
+  const int openmp = 1;
+#else
+  const int openmp = 0;
+#endif
+  if (flags == NULL)
+  {
+    sqlite3_result_error_nomem(context);
+    return;
+  }
+  features = sqlite3_mprintf("{\"arch\":\"%s\",\"cpu\":%s,\"aes\":\"%s\",\"chacha20\":\"%s\",\"poly1305\":\"%s\","
+                             "\"sha1\":\"%s\",\"sha2\":\"%s\",\"md5\":\"%s\",\"pbkdf2\":\"%s\",\"openmp\":%d}",
+                             CodecCpuArchitecture(), flags,
+                             "portable, T-tables", "portable", "portable, 26-bit limbs",
+                             "portable", "portable", "portable", pbkdf2, openmp);
+  sqlite3_free(flags);
+  if (features == NULL)
+  {
+    sqlite3_result_error_nomem(context);
+    return;
+  }
+  sqlite3_result_text(context, features, -1, sqlite3_free);
+}
+
+static CodecParameterRef*
+GetCodecParamsRef(sqlite3* db)
 {
 #if 0
   sqlite3_mutex_enter(db->mutex);
 #endif
-  CodecParameter* codecParams = NULL;
+  CodecParameterRef* ref = NULL;
   sqlite3_stmt* pStmt = 0; 
   int rc = sqlite3_prepare_v2(db, "SELECT wxsqlite3_config_table();", -1, &pStmt, 0); 
   if (rc == SQLITE_OK)
@@ -1768,20 +2331,28 @@ GetCodecParams(sqlite3* db)
     if (SQLITE_ROW == sqlite3_step(pStmt))
     {
       sqlite3_value* ptrValue = sqlite3_column_value(pStmt, 0);
-      codecParams = (CodecParameter*) sqlite3_value_pointer(ptrValue, "wxsqlite3_codec_params");
+      ref = (CodecParameterRef*) sqlite3_value_pointer(ptrValue, "wxsqlite3_codec_params");
     }
     sqlite3_finalize(pStmt); 
   }
 #if 0
   sqlite3_mutex_leave(db->mutex);
 #endif
-  return codecParams;
+  return ref;
+}
+
+CodecParameter*
+GetCodecParams(sqlite3* db)
+{
+  CodecParameterRef* ref = GetCodecParamsRef(db);
+  return (ref != NULL) ? ref->m_params : NULL;
 }
 
 int
 wxsqlite3_config(sqlite3* db, const char* paramName, int newValue)
 {
   int value = -1;
+  CodecParameterRef* ref = (db != NULL) ? GetCodecParamsRef(db) : NULL;
   CodecParameter* codecParams;
   int hasDefaultPrefix = 0;
   int hasMinPrefix = 0;
@@ -1793,7 +2364,7 @@ wxsqlite3_config(sqlite3* db, const char* paramName, int newValue)
     return value;
   }
 
-  codecParams = (db != NULL) ? GetCodecParams(db) : codecParameterTable;
+  codecParams = (db != NULL) ? ((ref != NULL) ? ref->m_params : NULL) : codecParameterTable;
   if (codecParams == NULL)
   {
     return value;
@@ -1833,12 +2404,21 @@ wxsqlite3_config(sqlite3* db, const char* paramName, int newValue)
     value = (hasDefaultPrefix) ? param->m_default : (hasMinPrefix) ? param->m_minValue : (hasMaxPrefix) ? param->m_maxValue : param->m_value;
     if (!hasMinPrefix && !hasMaxPrefix && newValue >= 0 && newValue >= param->m_minValue && newValue <= param->m_maxValue)
     {
-      if (hasDefaultPrefix)
+      /* Only a connection changes values, db is not NULL here */
+      param = GetCodecParamForWrite(ref, 0, (int) (param - codecParams[0].m_params));
+      if (param != NULL)
+      {
+        if (hasDefaultPrefix)
+        {
+          param->m_default = newValue;
+        }
+        param->m_value = newValue;
+        value = newValue;
+      }
+      else
       {
-        param->m_default = newValue;
+        value = -1;
       }
-      param->m_value = newValue;
-      value = newValue;
     }
     if (db != NULL)
     {
@@ -1856,6 +2436,7 @@ int
 wxsqlite3_config_cipher(sqlite3* db, const char* cipherName, const char* paramName, int newValue)
 {
   int value = -1;
+  CodecParameterRef* ref = (db != NULL) ? GetCodecParamsRef(db) : NULL;
   CodecParameter* codecParams;
   CipherParams* cipherParamTable = NULL;
   int j = 0;
@@ -1865,7 +2446,7 @@ wxsqlite3_config_cipher(sqlite3* db, const char* cipherName, const char* paramNa
     return value;
   }
 
-  codecParams = (db != NULL) ? GetCodecParams(db) : codecParameterTable;
+  codecParams = (db != NULL) ? ((ref != NULL) ? ref->m_params : NULL) : codecParameterTable;
   if (codecParams == NULL)
   {
     return value;
@@ -1920,12 +2501,20 @@ wxsqlite3_config_cipher(sqlite3* db, const char* cipherName, const char* paramNa
       value = (hasDefaultPrefix) ? param->m_default : (hasMinPrefix) ? param->m_minValue : (hasMaxPrefix) ? param->m_maxValue : param->m_value;
       if (!hasMinPrefix && !hasMaxPrefix && newValue >= 0 && newValue >= param->m_minValue && newValue <= param->m_maxValue)
       {
-        if (hasDefaultPrefix)
+        param = GetCodecParamForWrite(ref, j, (int) (param - cipherParamTable));
+        if (param != NULL)
         {
-          param->m_default = newValue;
+          if (hasDefaultPrefix)
+          {
+            param->m_default = newValue;
+          }
+          param->m_value = newValue;
+          value = newValue;
+        }
+        else
+        {
+          value = -1;
         }
-        param->m_value = newValue;
-        value = newValue;
       }
       if (db != NULL)
       {
@@ -1971,7 +2560,11 @@ GetCipherType(sqlite3* db)
   if (strlen(cipher->m_name) > 0)
   {
     cipherType = cipher->m_value;
-    cipher->m_value = cipher->m_default;
+    /* Values of the shared table always equal their defaults */
+    if (cipher->m_value != cipher->m_default)
+    {
+      cipher->m_value = cipher->m_default;
+    }
   }
   return cipherType;
 }
@@ -1980,8 +2573,14 @@ void*
 GetCipherParams(sqlite3* db, int cypherType)
 {
   CodecParameter* codecParams = (db != NULL) ? GetCodecParams(db) : codecParameterTable;
-  CipherParams* cipherParamTable = (codecParams != NULL) ? codecParams[cypherType].m_params : codecParameterTable[cypherType].m_params;
-  return cipherParamTable;
+  int j;
+  if (codecParams == NULL)
+  {
+    codecParams = codecParameterTable;
+  }
+  /* Copies of the table taken before a cipher was registered do not know it */
+  for (j = 0; j < cypherType && strlen(codecParams[j].m_name) > 0; ++j);
+  return (strlen(codecParams[j].m_name) > 0) ? codecParams[j].m_params : NULL;
 }
 
 int
@@ -2002,6 +2601,14 @@ CodecInit(Codec* codec)
     memset(codec->m_page, 0, sizeof(codec->m_page));
     codec->m_pageSize = 0;
     codec->m_reserved = 0;
+    codec->m_rekeying = 0;
+    codec->m_pagesDecrypted = 0;
+    codec->m_pagesEncrypted = 0;
+    codec->m_cryptoTime = 0;
+    codec->m_pagesJournaled = 0;
+    codec->m_pagesShared = 0;
+    codec->m_shareState = 0;
+    codec->m_warmupPages = NULL;
   }
   else
   {
@@ -2023,9 +2630,24 @@ CodecTerm(Codec* codec)
     codecDescriptorTable[codec->m_writeCipherType-1].m_freeCipher(codec->m_writeCipher);
     codec->m_writeCipher = NULL;
   }
+  CodecResetShare(codec);
   memset(codec, 0, sizeof(Codec));
 }
 
+/*
+** The scope of the codec in the shared page store is determined again on the
+** next read
+*/
+void
+CodecResetShare(Codec* codec)
+{
+  if (codec->m_shareState > 0)
+  {
+    SharedPagesScopeRelease(codec->m_shareScope);
+  }
+  codec->m_shareState = 0;
+}
+
 int
 CodecSetup(Codec* codec, int cipherType, char* userPassword, int passwordLength)
 {
@@ -2070,6 +2692,298 @@ CodecSetupWriteCipher(Codec* codec, int cipherType, char* userPassword, int pass
   return rc;
 }
 
+/*
+** Detection of the cipher of an existing database
+**
+** Each candidate cipher derives its key and trial decrypts a private copy
+** of page 1. The key derivation dominates, so the candidates run in
+** parallel on SQLite worker threads. A candidate matches if page 1
+** decrypts to a valid database header and b-tree page.
+*/
+
+typedef struct _CodecDetectTask
+{
+  CodecDescriptor* m_descriptor;
+  void*            m_cipher;
+  int              m_cipherType;
+  sqlite3_file*    m_fd;
+  char*            m_userPassword;
+  int              m_passwordLength;
+  unsigned char*   m_page;
+  int              m_pageSize;
+  int              m_reserved;
+  int              m_match;
+} CodecDetectTask;
+
+/*
+** Read-only file over the copy of page 1, from which the candidates read
+** their salt. The workers must not share the database file: VFS methods of
+** a file may not run on several threads at the same time.
+*/
+typedef struct _CodecPageFile
+{
+  sqlite3_file         m_base;
+  const unsigned char* m_page;
+  int                  m_size;
+} CodecPageFile;
+
+static int
+CodecPageFileClose(sqlite3_file* pFile)
+{
+  return SQLITE_OK;
+}
+
+static int
+CodecPageFileRead(sqlite3_file* pFile, void* zBuf, int iAmt, sqlite3_int64 iOfst)
+{
+  CodecPageFile* file = (CodecPageFile*) pFile;
+  int n = (iOfst < file->m_size) ? (int) (file->m_size - iOfst) : 0;
+  if (n >= iAmt)
+  {
+    memcpy(zBuf, file->m_page + iOfst, iAmt);
+    return SQLITE_OK;
+  }
+  if (n > 0)
+  {
+    memcpy(zBuf, file->m_page + iOfst, n);
+  }
+  memset((unsigned char*) zBuf + n, 0, iAmt - n);
+  return SQLITE_IOERR_SHORT_READ;
+}
+
+static int
+CodecPageFileWrite(sqlite3_file* pFile, const void* zBuf, int iAmt, sqlite3_int64 iOfst)
+{
+  return SQLITE_READONLY;
+}
+
+static int
+CodecPageFileTruncate(sqlite3_file* pFile, sqlite3_int64 size)
+{
+  return SQLITE_READONLY;
+}
+
+static int
+CodecPageFileSync(sqlite3_file* pFile, int flags)
+{
+  return SQLITE_OK;
+}
+
+static int
+CodecPageFileSize(sqlite3_file* pFile, sqlite3_int64* pSize)
+{
+  *pSize = ((CodecPageFile*) pFile)->m_size;
+  return SQLITE_OK;
+}
+
+static int
+CodecPageFileLock(sqlite3_file* pFile, int eLock)
+{
+  return SQLITE_OK;
+}
+
+static int
+CodecPageFileCheckReservedLock(sqlite3_file* pFile, int* pResOut)
+{
+  *pResOut = 0;
+  return SQLITE_OK;
+}
+
+static int
+CodecPageFileControl(sqlite3_file* pFile, int op, void* pArg)
+{
+  return SQLITE_NOTFOUND;
+}
+
+static int
+CodecPageFileSectorSize(sqlite3_file* pFile)
+{
+  return 512;
+}
+
+static int
+CodecPageFileDeviceCharacteristics(sqlite3_file* pFile)
+{
+  return SQLITE_IOCAP_IMMUTABLE;
+}
+
+static const sqlite3_io_methods codecPageFileMethods =
+{
+  1,
+  CodecPageFileClose,
+  CodecPageFileRead,
+  CodecPageFileWrite,
+  CodecPageFileTruncate,
+  CodecPageFileSync,
+  CodecPageFileSize,
+  CodecPageFileLock,
+  CodecPageFileLock,
+  CodecPageFileCheckReservedLock,
+  CodecPageFileControl,
+  CodecPageFileSectorSize,
+  CodecPageFileDeviceCharacteristics
+};
+
+static int
+CodecIsValidHeader(const unsigned char* dbHeader)
+{
+  /* Bytes 16..23 of the database header: page size, file format versions,
+  ** reserved bytes and the fixed payload fractions */
+  int dbPageSize = (dbHeader[0] << 8) | (dbHeader[1] << 16);
+  return (dbPageSize >= 512) && (dbPageSize <= SQLITE_MAX_PAGE_SIZE) && (((dbPageSize - 1) & dbPageSize) == 0) &&
+         (dbHeader[5] == 0x40) && (dbHeader[6] == 0x20) && (dbHeader[7] == 0x20);
+}
+
+static void*
+CodecDetectWorker(void* pArg)
+{
+  CodecDetectTask* task = (CodecDetectTask*) pArg;
+  unsigned char* page = task->m_page;
+  task->m_descriptor->m_generateKey(task->m_cipher, task->m_fd, task->m_userPassword, task->m_passwordLength, 0);
+  if (task->m_descriptor->m_decryptPage(task->m_cipher, 1, page, task->m_pageSize, task->m_reserved) == SQLITE_OK)
+  {
+    /* Without a MAC a wrong key still yields a page, so check its content */
+    int dbPageSize = (page[16] << 8) | (page[17] << 16);
+    task->m_match = (memcmp(page, SQLITE_FILE_HEADER, 16) == 0) && CodecIsValidHeader(page + 16) &&
+                    (dbPageSize == task->m_pageSize) && (page[100] == 0x0d || page[100] == 0x05);
+  }
+  return NULL;
+}
+
+int
+CodecSetupDetect(Codec* codec, const unsigned char* page1, int nPage1, char* userPassword, int passwordLength)
+{
+  int rc = SQLITE_OK;
+  CodecDetectTask tasks[CODEC_COUNT_MAX];
+  CodecPageFile pageFile;
+#if SQLITE_MAX_WORKER_THREADS > 0
+  SQLiteThread* threads[CODEC_COUNT_MAX];
+#endif
+  /* Only the legacy schemes encrypt the header bytes 16..23 */
+  int legacy = !CodecIsValidHeader(page1 + 16);
+  int nTasks = 0;
+  int match = -1;
+  int j;
+
+  memset(tasks, 0, sizeof(tasks));
+  pageFile.m_base.pMethods = &codecPageFileMethods;
+  pageFile.m_page = page1;
+  pageFile.m_size = nPage1;
+  for (j = 0; j < codecCount && GetCipherParams(codec->m_db, j + 1) != NULL && rc == SQLITE_OK; ++j)
+  {
+    CodecDetectTask* task;
+    if (codecDescriptorTable[j].m_allocateCipher == NULL)
+    {
+      /* Compiled out by WXSQLITE3_SINGLE_CIPHER */
+      continue;
+    }
+    task = &tasks[nTasks++];
+    task->m_cipherType = j + 1;
+    task->m_descriptor = &codecDescriptorTable[j];
+    task->m_cipher = task->m_descriptor->m_allocateCipher(codec->m_db);
+    task->m_page = (unsigned char*) sqlite3_malloc(SQLITE_MAX_PAGE_SIZE);
+    if (task->m_cipher == NULL || task->m_page == NULL)
+    {
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    /* Only the candidate is switched, the connection's settings stay */
+    if (task->m_descriptor->m_setLegacy != NULL)
+    {
+      task->m_descriptor->m_setLegacy(task->m_cipher, legacy);
+    }
+    task->m_fd = &pageFile.m_base;
+    task->m_userPassword = userPassword;
+    task->m_passwordLength = passwordLength;
+    if (legacy)
+    {
+      task->m_pageSize = task->m_descriptor->m_getPageSize(task->m_cipher);
+      if (task->m_pageSize <= 0)
+      {
+        task->m_pageSize = SQLITE_DEFAULT_PAGE_SIZE;
+      }
+      task->m_reserved = task->m_descriptor->m_getReserved(task->m_cipher);
+    }
+    else
+    {
+      task->m_pageSize = (page1[16] << 8) | (page1[17] << 16);
+      task->m_reserved = page1[20];
+    }
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    for (j = 0; j < nTasks; ++j)
+    {
+      CodecDetectTask* task = &tasks[j];
+      if (task->m_pageSize > nPage1)
+      {
+        /* The file is too short for this cipher's page size */
+        continue;
+      }
+      memcpy(task->m_page, page1, task->m_pageSize);
+#if SQLITE_MAX_WORKER_THREADS > 0
+      if (sqlite3GlobalConfig.bCoreMutex && j < nTasks - 1)
+      {
+        /* The last candidate runs on the calling thread */
+        if (sqlite3ThreadCreate(&threads[j], CodecDetectWorker, task) != SQLITE_OK)
+        {
+          threads[j] = NULL;
+          CodecDetectWorker(task);
+        }
+        continue;
+      }
+      threads[j] = NULL;
+#endif
+      CodecDetectWorker(task);
+    }
+#if SQLITE_MAX_WORKER_THREADS > 0
+    for (j = 0; j < nTasks; ++j)
+    {
+      void* pOut;
+      if (tasks[j].m_pageSize <= nPage1 && threads[j] != NULL)
+      {
+        sqlite3ThreadJoin(threads[j], &pOut);
+      }
+    }
+#endif
+    /* The first candidate in table order wins */
+    for (j = 0; j < nTasks && match < 0; ++j)
+    {
+      if (tasks[j].m_match)
+      {
+        match = j;
+      }
+    }
+    rc = (match >= 0) ? SQLITE_OK : SQLITE_NOTADB;
+  }
+
+  if (match >= 0)
+  {
+    codec->m_isEncrypted = 1;
+    codec->m_hasReadCipher = 1;
+    codec->m_hasWriteCipher = 1;
+    codec->m_readCipherType = tasks[match].m_cipherType;
+    codec->m_readCipher = tasks[match].m_cipher;
+    tasks[match].m_cipher = NULL;
+    rc = CodecCopyCipher(codec, 1);
+  }
+
+  for (j = 0; j < CODEC_COUNT_MAX; ++j)
+  {
+    if (tasks[j].m_cipher != NULL)
+    {
+      tasks[j].m_descriptor->m_freeCipher(tasks[j].m_cipher);
+    }
+    if (tasks[j].m_page != NULL)
+    {
+      memset(tasks[j].m_page, 0, SQLITE_MAX_PAGE_SIZE);
+      sqlite3_free(tasks[j].m_page);
+    }
+  }
+  return rc;
+}
+
 void
 CodecSetIsEncrypted(Codec* codec, int isEncrypted)
 {
@@ -2201,6 +3115,7 @@ CodecCopy(Codec* codec, Codec* other)
   codec->m_writeCipherType = other->m_writeCipherType;
   codec->m_readCipher = NULL;
   codec->m_writeCipher = NULL;
+  codec->m_warmupPages = NULL;
 
   if (codec->m_hasReadCipher)
   {
@@ -2236,6 +3151,7 @@ int
 CodecCopyCipher(Codec* codec, int read2write)
 {
   int rc = SQLITE_OK;
+  CodecResetShare(codec);
   if (read2write)
   {
     if (codec->m_writeCipher != NULL && codec->m_writeCipherType != codec->m_readCipherType)
@@ -2302,27 +3218,85 @@ CodecPadPassword(char* password, int pswdlen, unsigned char pswd[32])
 void
 CodecGenerateReadKey(Codec* codec, char* userPassword, int passwordLength)
 {
-  codecDescriptorTable[codec->m_readCipherType-1].m_generateKey(codec->m_readCipher, codec->m_bt, userPassword, passwordLength, 0);
+  codecDescriptorTable[codec->m_readCipherType-1].m_generateKey(codec->m_readCipher, CodecGetFile(codec->m_bt), userPassword, passwordLength, 0);
 }
 
 void
 CodecGenerateWriteKey(Codec* codec, char* userPassword, int passwordLength)
 {
-  codecDescriptorTable[codec->m_writeCipherType-1].m_generateKey(codec->m_writeCipher, codec->m_bt, userPassword, passwordLength, 1);
+  codecDescriptorTable[codec->m_writeCipherType-1].m_generateKey(codec->m_writeCipher, CodecGetFile(codec->m_bt), userPassword, passwordLength, 1);
 }
 
 int
 CodecEncrypt(Codec* codec, int page, unsigned char* data, int len, int useWriteKey)
 {
-  int cipherType = (useWriteKey) ? codec->m_writeCipherType : codec->m_readCipherType;
   void* cipher = (useWriteKey) ? codec->m_writeCipher : codec->m_readCipher;
+#ifdef WXSQLITE3_SINGLE_CIPHER
+  return CODEC_SINGLE_ENCRYPT(cipher, page, data, len, codec->m_reserved);
+#else
+  int cipherType = (useWriteKey) ? codec->m_writeCipherType : codec->m_readCipherType;
   return codecDescriptorTable[cipherType-1].m_encryptPage(cipher, page, data, len, codec->m_reserved);
+#endif
 }
 
 int
 CodecDecrypt(Codec* codec, int page, unsigned char* data, int len)
 {
-  int cipherType = codec->m_readCipherType;
   void* cipher = codec->m_readCipher;
+#ifdef WXSQLITE3_SINGLE_CIPHER
+  return CODEC_SINGLE_DECRYPT(cipher, page, data, len, codec->m_reserved);
+#else
+  int cipherType = codec->m_readCipherType;
   return codecDescriptorTable[cipherType-1].m_decryptPage(cipher, page, data, len, codec->m_reserved);
+#endif
+}
+
+/*
+** Feed everything that determines the plaintext of a decrypted page into
+** ctx: cipher, key and the options changing the page layout. Returns 0 for
+** registered ciphers, whose key is opaque to the codec.
+*/
+int
+CodecHashReadKey(Codec* codec, sha256_ctx* ctx)
+{
+  void* cipher = codec->m_readCipher;
+  unsigned char header[8];
+  header[0] = (unsigned char) codec->m_readCipherType;
+  header[1] = (unsigned char) codec->m_reserved;
+  header[2] = (unsigned char) CodecGetLegacyReadCipher(codec);
+  memset(&header[3], 0, sizeof(header) - 3);
+  switch (codec->m_readCipherType)
+  {
+#if CODEC_HAS_CIPHER(CODEC_TYPE_AES128)
+    case CODEC_TYPE_AES128:
+      sha256_update(ctx, header, sizeof(header));
+      sha256_update(ctx, ((AES128Cipher*) cipher)->m_key, ((AES128Cipher*) cipher)->m_keyLength);
+      return 1;
+#endif
+#if CODEC_HAS_CIPHER(CODEC_TYPE_AES256)
+    case CODEC_TYPE_AES256:
+      sha256_update(ctx, header, sizeof(header));
+      sha256_update(ctx, ((AES256Cipher*) cipher)->m_key, ((AES256Cipher*) cipher)->m_keyLength);
+      return 1;
+#endif
+#if CODEC_HAS_CIPHER(CODEC_TYPE_CHACHA20)
+    case CODEC_TYPE_CHACHA20:
+      sha256_update(ctx, header, sizeof(header));
+      sha256_update(ctx, ((ChaCha20Cipher*) cipher)->m_key, ((ChaCha20Cipher*) cipher)->m_keyLength);
+      return 1;
+#endif
+#if CODEC_HAS_CIPHER(CODEC_TYPE_SQLCIPHER)
+    case CODEC_TYPE_SQLCIPHER:
+      /* The HMAC settings decide which pages are verified */
+      header[3] = (unsigned char) ((SQLCipherCipher*) cipher)->m_hmacUse;
+      header[4] = (unsigned char) ((SQLCipherCipher*) cipher)->m_hmacPgno;
+      header[5] = (unsigned char) ((SQLCipherCipher*) cipher)->m_hmacSaltMask;
+      sha256_update(ctx, header, sizeof(header));
+      sha256_update(ctx, ((SQLCipherCipher*) cipher)->m_key, ((SQLCipherCipher*) cipher)->m_keyLength);
+      sha256_update(ctx, ((SQLCipherCipher*) cipher)->m_hmacKey, ((SQLCipherCipher*) cipher)->m_keyLength);
+      return 1;
+#endif
+    default:
+      return 0;
+  }
 }
@@ -33,6 +33,8 @@ extern "C" {
 #endif
 
 #include "rijndael.h"
+#include "sha2.h"
+#include "sqlite3secure.h"
 
 #define CODEC_TYPE_UNKNOWN   0
 #define CODEC_TYPE_AES128    1
@@ -41,8 +43,23 @@ extern "C" {
 #define CODEC_TYPE_SQLCIPHER 4
 #define CODEC_TYPE_MAX       4
 
+/* Built-in plus registered ciphers, see wxsqlite3_register_cipher */
+#define CODEC_COUNT_MAX      WXSQLITE3_CIPHER_COUNT_MAX
+
 #define CODEC_TYPE_DEFAULT CODEC_TYPE_CHACHA20
 
+/*
+** Build for a single cipher: WXSQLITE3_SINGLE_CIPHER=CODEC_TYPE_xxx compiles
+** the other ciphers out and lets the codec call the cipher directly
+*/
+#ifdef WXSQLITE3_SINGLE_CIPHER
+#undef CODEC_TYPE
+#define CODEC_TYPE WXSQLITE3_SINGLE_CIPHER
+#define CODEC_HAS_CIPHER(type) (WXSQLITE3_SINGLE_CIPHER == (type))
+#else
+#define CODEC_HAS_CIPHER(type) 1
+#endif
+
 #ifndef CODEC_TYPE
 #define CODEC_TYPE CODEC_TYPE_DEFAULT
 #endif
@@ -74,10 +91,25 @@ typedef struct _Codec
   unsigned char m_page[SQLITE_MAX_PAGE_SIZE+24];
   int           m_pageSize;
   int           m_reserved;
+  int           m_rekeying; /* Pages on disk may not use the read cipher */
+  /* Statistics */
+  sqlite3_int64 m_pagesDecrypted;
+  sqlite3_int64 m_pagesEncrypted;
+  sqlite3_int64 m_cryptoTime; /* Time spent in the ciphers, in nanoseconds */
+  sqlite3_int64 m_pagesJournaled;
+  sqlite3_int64 m_pagesShared;   /* Pages taken from the shared page store */
+  /* Shared page store, see sharedpages.c */
+  int           m_shareState;    /* 0: scope not computed yet, 1: shareable, -1: not shareable */
+  unsigned char m_shareScope[16];
+  /* Pages decrypted ahead by wxsqlite3_warmup, see warmup.c */
+  struct _WarmupPages* m_warmupPages;
 } Codec;
 
 void wxsqlite3_config_table(sqlite3_context* context, int argc, sqlite3_value** argv);
 void wxsqlite3_config_params(sqlite3_context* context, int argc, sqlite3_value** argv);
+void wxsqlite3_cpu_features(sqlite3_context* context, int argc, sqlite3_value** argv);
+void wxsqlite3_kdf_calibrate_func(sqlite3_context* context, int argc, sqlite3_value** argv);
+void wxsqlite3_cipher_check_func(sqlite3_context* context, int argc, sqlite3_value** argv);
 
 int wxsqlite3_config(sqlite3* db, const char* paramName, int newValue);
 int wxsqlite3_config_cipher(sqlite3* db, const char* cipherName, const char* paramName, int newValue);
@@ -97,10 +129,17 @@ int CodecEncrypt(Codec* codec, int page, unsigned char* data, int len, int useWr
 
 int CodecDecrypt(Codec* codec, int page, unsigned char* data, int len);
 
+int CodecHashReadKey(Codec* codec, sha256_ctx* ctx);
+
 int CodecCopyCipher(Codec* codec, int read2write);
+void CodecResetShare(Codec* codec);
+
+/* Shared page store, see sharedpages.c */
+void SharedPagesScopeRelease(const unsigned char* scope);
 
 int CodecSetup(Codec* codec, int cipherType, char* userPassword, int passwordLength);
 int CodecSetupWriteCipher(Codec* codec, int cipherType, char* userPassword, int passwordLength);
+int CodecSetupDetect(Codec* codec, const unsigned char* page1, int nPage1, char* userPassword, int passwordLength);
 
 void CodecSetIsEncrypted(Codec* codec, int isEncrypted);
 void CodecSetReadCipherType(Codec* codec, int cipherType);
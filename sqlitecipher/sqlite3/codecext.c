@@ -16,6 +16,11 @@
 #include "rekeyvacuum.c"
 
 #include "codec.h"
+#include "sqlite3secure.h"
+
+#if !SQLITE_OS_WIN
+#include <time.h>
+#endif
 
 void sqlite3_activate_see(const char *info)
 {
@@ -40,6 +45,7 @@ void sqlite3CodecSizeChange(void *pArg, int pageSize, int reservedSize)
   Codec* pCodec = (Codec*) pArg;
   pCodec->m_pageSize = pageSize;
   pCodec->m_reserved = reservedSize;
+  CodecResetShare(pCodec);
 }
 
 static void reportCodecError(Btree* pBt, int error)
@@ -49,6 +55,73 @@ static void reportCodecError(Btree* pBt, int error)
   pBt->pBt->db->errCode = error;
 }
 
+/*
+// Monotonic timestamp in nanoseconds, used for the codec statistics
+*/
+static sqlite3_int64 CodecTimestamp()
+{
+#if SQLITE_OS_WIN
+  static sqlite3_int64 frequency = 0;
+  LARGE_INTEGER counter;
+  if (frequency == 0)
+  {
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    frequency = f.QuadPart;
+  }
+  QueryPerformanceCounter(&counter);
+  return (sqlite3_int64) ((counter.QuadPart / frequency) * 1000000000 +
+                          (counter.QuadPart % frequency) * 1000000000 / frequency);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (sqlite3_int64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Whether sqlite3Codec measures the time spent in the ciphers */
+static int codecTiming = 0;
+
+/*
+// Turn the measurement of WXSQLITE3_CODECSTATUS_CRYPTO_TIME on (1) or off (0),
+// or only query it (-1). Returns the previous setting.
+*/
+int wxsqlite3_codec_timing(int onoff)
+{
+  int previous = codecTiming;
+  if (onoff >= 0)
+  {
+    codecTiming = (onoff != 0);
+  }
+  return previous;
+}
+
+/*
+// Read the ciphertext of a page that is about to be journaled.
+// Outside of a rekey every page that is not yet in the journal is stored in
+// the database file encrypted with the read cipher, which is exactly what
+// "case 7" would produce (or an equivalent encryption for ciphers with a
+// random nonce). Returns NULL if the page can't be read, the pager then
+// falls back to encrypting it.
+*/
+static void* CodecReadJournalPage(Codec* codec, Pgno nPageNum, int pageSize)
+{
+  unsigned char* pageBuffer;
+  sqlite3_file* fd;
+  if (!CodecHasReadCipher(codec) || codec->m_rekeying)
+  {
+    return NULL;
+  }
+  fd = CodecGetFile(CodecGetBtree(codec));
+  pageBuffer = CodecGetPageBuffer(codec);
+  if (fd == NULL || sqlite3OsRead(fd, pageBuffer, pageSize, (i64) (nPageNum - 1) * pageSize) != SQLITE_OK)
+  {
+    return NULL;
+  }
+  codec->m_pagesJournaled++;
+  return pageBuffer;
+}
+
 /*
 // Encrypt/Decrypt functionality, called by pager.c
 */
@@ -57,6 +130,8 @@ void* sqlite3Codec(void* pCodecArg, void* data, Pgno nPageNum, int nMode)
   int rc = SQLITE_OK;
   Codec* codec = NULL;
   int pageSize;
+  int timing = codecTiming;
+  sqlite3_int64 startTime = 0;
   if (pCodecArg == NULL)
   {
     return data;
@@ -68,6 +143,14 @@ void* sqlite3Codec(void* pCodecArg, void* data, Pgno nPageNum, int nMode)
   }
   
   pageSize = sqlite3BtreeGetPageSize(CodecGetBtree(codec));
+  if (nMode == 8) /* Get the journal image of an unmodified page, see case 7 */
+  {
+    return CodecReadJournalPage(codec, nPageNum, pageSize);
+  }
+  if (timing)
+  {
+    startTime = CodecTimestamp();
+  }
 
   switch(nMode)
   {
@@ -78,6 +161,7 @@ void* sqlite3Codec(void* pCodecArg, void* data, Pgno nPageNum, int nMode)
       {
         rc = CodecDecrypt(codec, nPageNum, (unsigned char*) data, pageSize);
         if (rc != SQLITE_OK) reportCodecError(CodecGetBtree(codec), rc);
+        codec->m_pagesDecrypted++;
       }
       break;
 
@@ -89,6 +173,7 @@ void* sqlite3Codec(void* pCodecArg, void* data, Pgno nPageNum, int nMode)
         data = pageBuffer;
         rc = CodecEncrypt(codec, nPageNum, (unsigned char*) data, pageSize, 1);
         if (rc != SQLITE_OK) reportCodecError(CodecGetBtree(codec), rc);
+        codec->m_pagesEncrypted++;
       }
       break;
 
@@ -108,9 +193,14 @@ void* sqlite3Codec(void* pCodecArg, void* data, Pgno nPageNum, int nMode)
         data = pageBuffer;
         rc = CodecEncrypt(codec, nPageNum, (unsigned char*) data, pageSize, 0);
         if (rc != SQLITE_OK) reportCodecError(CodecGetBtree(codec), rc);
+        codec->m_pagesEncrypted++;
       }
       break;
   }
+  if (timing)
+  {
+    codec->m_cryptoTime += CodecTimestamp() - startTime;
+  }
   return data;
 }
 
@@ -149,6 +239,25 @@ static int mySqlite3AdjustBtree(Btree* pBt, int nPageSize, int nReserved, int is
   return rc;
 }
 
+/*
+// Adjust the b-tree to the read cipher and install the codec in the pager
+*/
+static void mySqlite3InstallCodec(sqlite3* db, int nDb, Codec* codec)
+{
+  mySqlite3AdjustBtree(db->aDb[nDb].pBt, CodecGetPageSizeReadCipher(codec), CodecGetReservedReadCipher(codec), CodecGetLegacyReadCipher(codec));
+#if (SQLITE_VERSION_NUMBER >= 3006016)
+  mySqlite3PagerSetCodec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, sqlite3CodecSizeChange, sqlite3CodecFree, codec);
+#else
+#if (SQLITE_VERSION_NUMBER >= 3003014)
+  sqlite3PagerSetCodec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, codec);
+#else
+  sqlite3pager_set_codec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, codec);
+#endif
+  db->aDb[nDb].pAux = codec;
+  db->aDb[nDb].xFreeAux = sqlite3CodecFree;
+#endif
+}
+
 int sqlite3CodecAttach(sqlite3* db, int nDb, const void* zKey, int nKey)
 {
   /* Attach a key to a database. */
@@ -178,18 +287,7 @@ int sqlite3CodecAttach(sqlite3* db, int nDb, const void* zKey, int nKey)
         if (rc == SQLITE_OK)
         {
           CodecSetBtree(codec, db->aDb[nDb].pBt);
-          mySqlite3AdjustBtree(db->aDb[nDb].pBt, CodecGetPageSizeReadCipher(codec), CodecGetReservedReadCipher(codec), CodecGetLegacyReadCipher(codec));
-#if (SQLITE_VERSION_NUMBER >= 3006016)
-          mySqlite3PagerSetCodec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, sqlite3CodecSizeChange, sqlite3CodecFree, codec);
-#else
-#if (SQLITE_VERSION_NUMBER >= 3003014)
-          sqlite3PagerSetCodec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, codec);
-#else
-          sqlite3pager_set_codec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, codec);
-#endif
-          db->aDb[nDb].pAux = codec;
-          db->aDb[nDb].xFreeAux = sqlite3CodecFree;
-#endif
+          mySqlite3InstallCodec(db, nDb, codec);
         }
         else
         {
@@ -216,18 +314,7 @@ int sqlite3CodecAttach(sqlite3* db, int nDb, const void* zKey, int nKey)
     rc = CodecSetup(codec, GetCipherType(db), (char*) zKey, nKey);
     if (rc == SQLITE_OK)
     {
-      mySqlite3AdjustBtree(db->aDb[nDb].pBt, CodecGetPageSizeReadCipher(codec), CodecGetReservedReadCipher(codec), CodecGetLegacyReadCipher(codec));
-#if (SQLITE_VERSION_NUMBER >= 3006016)
-      mySqlite3PagerSetCodec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, sqlite3CodecSizeChange, sqlite3CodecFree, codec);
-#else
-#if (SQLITE_VERSION_NUMBER >= 3003014)
-      sqlite3PagerSetCodec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, codec);
-#else
-      sqlite3pager_set_codec(sqlite3BtreePager(db->aDb[nDb].pBt), sqlite3Codec, codec);
-#endif
-      db->aDb[nDb].pAux = codec;
-      db->aDb[nDb].xFreeAux = sqlite3CodecFree;
-#endif
+      mySqlite3InstallCodec(db, nDb, codec);
     }
     else
     {
@@ -299,6 +386,126 @@ int sqlite3_key_v2(sqlite3 *db, const char *zDbName, const void *zKey, int nKey)
   return rc;
 }
 
+/*
+// Like sqlite3_key_v2, but the cipher of an existing database is detected
+// from its first page instead of taken from the "cipher" setting. A new or
+// empty database gets the configured cipher. On success *pCipherType holds
+// the cipher in use.
+*/
+int wxsqlite3_key_auto(sqlite3* db, const char* zDbName, const void* zKey, int nKey, int* pCipherType)
+{
+  int rc = SQLITE_ERROR;
+  if (pCipherType != NULL)
+  {
+    *pCipherType = 0;
+  }
+  if ((db != NULL) && (zKey != NULL) && (nKey > 0))
+  {
+    int dbIndex = dbFindIndex(db, zDbName);
+    Pager* pPager = sqlite3BtreePager(db->aDb[dbIndex].pBt);
+    sqlite3_file* fd = sqlite3PagerFile(pPager);
+    sqlite3_int64 fileSize = 0;
+    Codec* codec;
+
+    if (!isOpen(fd) || sqlite3OsFileSize(fd, &fileSize) != SQLITE_OK || fileSize < 512)
+    {
+      /* Nothing to detect */
+      rc = sqlite3CodecAttach(db, dbIndex, zKey, nKey);
+    }
+    else
+    {
+      int nPage1 = (fileSize < SQLITE_MAX_PAGE_SIZE) ? (int) fileSize : SQLITE_MAX_PAGE_SIZE;
+      unsigned char* page1 = (unsigned char*) sqlite3_malloc(nPage1);
+      codec = (Codec*) sqlite3_malloc(sizeof(Codec));
+      rc = (codec != NULL) ? CodecInit(codec) : SQLITE_NOMEM;
+      if (rc == SQLITE_OK && page1 == NULL)
+      {
+        rc = SQLITE_NOMEM;
+      }
+      if (rc == SQLITE_OK)
+      {
+        rc = sqlite3OsRead(fd, page1, nPage1, 0);
+      }
+      if (rc == SQLITE_OK)
+      {
+        sqlite3_mutex_enter(db->mutex);
+        CodecSetDb(codec, db);
+        CodecSetBtree(codec, db->aDb[dbIndex].pBt);
+        rc = CodecSetupDetect(codec, page1, nPage1, (char*) zKey, nKey);
+        if (rc == SQLITE_OK)
+        {
+          mySqlite3InstallCodec(db, dbIndex, codec);
+          codec = NULL;
+        }
+        sqlite3_mutex_leave(db->mutex);
+      }
+      if (codec != NULL)
+      {
+        sqlite3CodecFree(codec);
+      }
+      sqlite3_free(page1);
+    }
+
+    codec = (Codec*) mySqlite3PagerGetCodec(pPager);
+    if (rc == SQLITE_OK && pCipherType != NULL && codec != NULL && CodecIsEncrypted(codec))
+    {
+      *pCipherType = codec->m_readCipherType;
+    }
+  }
+  return rc;
+}
+
+/*
+// Give a database the key of a database of another connection, as ATTACH
+// does for a database without key. The cipher is cloned, so the key
+// derivation does not run again. Nothing happens if the source database
+// is not encrypted.
+*/
+int wxsqlite3_key_copy(sqlite3* db, const char* zDbName, sqlite3* dbSource, const char* zSourceName)
+{
+  int rc = SQLITE_ERROR;
+  if ((db != NULL) && (dbSource != NULL))
+  {
+    int dbIndex = dbFindIndex(db, zDbName);
+    int sourceIndex = dbFindIndex(dbSource, zSourceName);
+    Codec* sourceCodec;
+    Codec* codec = NULL;
+
+    sqlite3_mutex_enter(dbSource->mutex);
+    sourceCodec = (Codec*) mySqlite3PagerGetCodec(sqlite3BtreePager(dbSource->aDb[sourceIndex].pBt));
+    if (sourceCodec == NULL || !CodecIsEncrypted(sourceCodec))
+    {
+      rc = SQLITE_OK;
+    }
+    else
+    {
+      codec = (Codec*) sqlite3_malloc(sizeof(Codec));
+      rc = (codec != NULL) ? CodecInit(codec) : SQLITE_NOMEM;
+      if (rc == SQLITE_OK)
+      {
+        sqlite3_mutex_enter(db->mutex);
+        CodecSetDb(codec, db);
+        rc = CodecCopy(codec, sourceCodec);
+        if (rc == SQLITE_OK)
+        {
+          /* CodecCopy takes over the connection of the source */
+          CodecSetDb(codec, db);
+          CodecSetBtree(codec, db->aDb[dbIndex].pBt);
+          mySqlite3InstallCodec(db, dbIndex, codec);
+          codec = NULL;
+        }
+        sqlite3_mutex_leave(db->mutex);
+      }
+      if (codec != NULL)
+      {
+        sqlite3CodecFree(codec);
+      }
+    }
+    sqlite3_mutex_leave(dbSource->mutex);
+  }
+  return rc;
+}
+
 int sqlite3_rekey_v2(sqlite3 *db, const char *zDbName, const void *zKey, int nKey)
 {
   /* Changes the encryption key for an existing database. */
@@ -373,6 +580,7 @@ int sqlite3_rekey_v2(sqlite3 *db, const char *zDbName, const void *zKey, int nKe
   {
     /* Database encrypted, but key not specified, therefore decrypt database */
     /* Keep read key, drop write key */
+    codec->m_rekeying = 1;
     CodecSetHasWriteCipher(codec, 0);
     if (nReserved > 0)
     {
@@ -386,6 +594,7 @@ int sqlite3_rekey_v2(sqlite3 *db, const char *zDbName, const void *zKey, int nKe
   {
     /* Database encrypted and key specified, therefore re-encrypt database with new key */
     /* Keep read key, change write key to new key */
+    codec->m_rekeying = 1;
     rc = CodecSetupWriteCipher(codec, GetCipherType(db), (char*) zKey, nKey);
     if (rc == SQLITE_OK)
     {
@@ -478,6 +687,7 @@ leave_rekey:
   sqlite3_mutex_leave(db->mutex);
 
 /*leave_final:*/
+  codec->m_rekeying = 0;
   if (rc == SQLITE_OK)
   {
     /* Set read key equal to write key if necessary */
@@ -528,6 +738,390 @@ int sqlite3_rekey(sqlite3 *db, const void *zKey, int nKey)
   return sqlite3_rekey_v2(db, "main", zKey, nKey);
 }
 
+/*
+// Retrieve (and optionally reset) the codec statistics of a database.
+// Unencrypted databases report zero for all counters.
+*/
+int wxsqlite3_codec_status(sqlite3* db, const char* zDbName, int op, sqlite3_int64* pCurrent, int resetFlag)
+{
+  int rc = SQLITE_OK;
+  Codec* codec;
+  if (db == NULL || pCurrent == NULL)
+  {
+    return SQLITE_MISUSE;
+  }
+  sqlite3_mutex_enter(db->mutex);
+  codec = (Codec*) mySqlite3PagerGetCodec(sqlite3BtreePager(db->aDb[dbFindIndex(db, zDbName)].pBt));
+  switch (op)
+  {
+    case WXSQLITE3_CODECSTATUS_PAGES_DECRYPTED:
+      *pCurrent = (codec != NULL) ? codec->m_pagesDecrypted : 0;
+      if (codec != NULL && resetFlag) codec->m_pagesDecrypted = 0;
+      break;
+    case WXSQLITE3_CODECSTATUS_PAGES_ENCRYPTED:
+      *pCurrent = (codec != NULL) ? codec->m_pagesEncrypted : 0;
+      if (codec != NULL && resetFlag) codec->m_pagesEncrypted = 0;
+      break;
+    case WXSQLITE3_CODECSTATUS_CRYPTO_TIME:
+      *pCurrent = (codec != NULL) ? codec->m_cryptoTime : 0;
+      if (codec != NULL && resetFlag) codec->m_cryptoTime = 0;
+      break;
+    case WXSQLITE3_CODECSTATUS_PAGES_JOURNALED:
+      *pCurrent = (codec != NULL) ? codec->m_pagesJournaled : 0;
+      if (codec != NULL && resetFlag) codec->m_pagesJournaled = 0;
+      break;
+    case WXSQLITE3_CODECSTATUS_PAGES_SHARED:
+      *pCurrent = (codec != NULL) ? codec->m_pagesShared : 0;
+      if (codec != NULL && resetFlag) codec->m_pagesShared = 0;
+      break;
+    default:
+      rc = SQLITE_ERROR;
+      break;
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+/*
+// Run the key derivation function of a cipher with the given iteration count
+*/
+static void CodecRunKdf(int cipherType, int iterations)
+{
+  static const unsigned char password[] = "wxsqlite3_kdf_calibrate";
+  unsigned char salt[16];
+  unsigned char digest[32];
+  memset(salt, 0x5a, sizeof(salt));
+  switch (cipherType)
+  {
+    case CODEC_TYPE_CHACHA20:
+      fastpbkdf2_hmac_sha256(password, sizeof(password) - 1, salt, sizeof(salt), iterations, digest, sizeof(digest));
+      break;
+    case CODEC_TYPE_SQLCIPHER:
+      fastpbkdf2_hmac_sha1(password, sizeof(password) - 1, salt, sizeof(salt), iterations, digest, sizeof(digest));
+      break;
+  }
+}
+
+/*
+// Measure the key derivation of a cipher on this machine and return the
+// kdf_iter value for which deriving a key takes about targetMs milliseconds.
+// Returns -1 for ciphers whose key derivation has a fixed iteration count
+// (aes128cbc, and aes256cbc whose files always use 4001 iterations) or an
+// invalid target.
+*/
+int wxsqlite3_kdf_calibrate(const char* cipherName, int targetMs)
+{
+  int cipherType = CODEC_TYPE_UNKNOWN;
+  int iterations = 1000;
+  sqlite3_int64 elapsed = 0;
+  sqlite3_int64 target = (sqlite3_int64) targetMs * 1000000;
+  double estimate;
+
+  if (cipherName == NULL || targetMs <= 0)
+  {
+    return -1;
+  }
+  if (sqlite3_stricmp(cipherName, "chacha20") == 0)
+  {
+    cipherType = CODEC_TYPE_CHACHA20;
+  }
+  else if (sqlite3_stricmp(cipherName, "sqlcipher") == 0)
+  {
+    cipherType = CODEC_TYPE_SQLCIPHER;
+  }
+  else
+  {
+    return -1;
+  }
+
+  /* Double the iterations until a run is long enough for a stable estimate */
+  for (;;)
+  {
+    sqlite3_int64 start = CodecTimestamp();
+    CodecRunKdf(cipherType, iterations);
+    elapsed = CodecTimestamp() - start;
+    if (elapsed >= 50000000 || elapsed * 4 >= target || iterations >= 0x20000000)
+    {
+      break;
+    }
+    iterations *= 2;
+  }
+
+  estimate = (double) iterations * (double) target / (double) ((elapsed > 0) ? elapsed : 1);
+  if (estimate < 1.0)
+  {
+    estimate = 1.0;
+  }
+  if (estimate > (double) 0x7fffffff)
+  {
+    estimate = (double) 0x7fffffff;
+  }
+  return (int) estimate;
+}
+
+/*
+// SQL function wxsqlite3_kdf_calibrate(cipher, target_ms)
+*/
+void wxsqlite3_kdf_calibrate_func(sqlite3_context* context, int argc, sqlite3_value** argv)
+{
+  int iterations;
+  assert(argc == 2);
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL)
+  {
+    sqlite3_result_null(context);
+    return;
+  }
+  iterations = wxsqlite3_kdf_calibrate((const char*) sqlite3_value_text(argv[0]), sqlite3_value_int(argv[1]));
+  if (iterations > 0)
+  {
+    sqlite3_result_int(context, iterations);
+  }
+  else
+  {
+    sqlite3_result_null(context);
+  }
+}
+
+/*
+// Conformance checks for cipher backends, see wxsqlite3_register_cipher
+*/
+static void CodecCheckFillPage(unsigned char* data, int pageSize, int page, int reserved)
+{
+  int k;
+  for (k = 0; k < pageSize; ++k)
+  {
+    data[k] = (unsigned char) (k * 31 + page);
+  }
+  if (page == 1)
+  {
+    /* Ciphers may keep parts of a valid database header in plain text */
+    memcpy(data, SQLITE_FILE_HEADER, 16);
+    data[16] = (unsigned char) ((pageSize >> 8) & 0xff);
+    data[17] = (unsigned char) ((pageSize >> 16) & 0xff);
+    data[18] = 1;
+    data[19] = 1;
+    data[20] = (unsigned char) reserved;
+    data[21] = 0x40;
+    data[22] = 0x20;
+    data[23] = 0x20;
+  }
+}
+
+/*
+// Encrypted pages must decrypt with a clone of the cipher, and must not
+// decrypt with another key or as another page
+*/
+static char* CodecCheckPages(sqlite3* db, const CodecDescriptor* descriptor)
+{
+  static const int pageSizes[] = { 512, 1024, 4096, 65536 };
+  static const int pages[] = { 1, 2, 1000 };
+  char* zErr = NULL;
+  void* cipher = descriptor->m_allocateCipher(db);
+  void* clone = descriptor->m_allocateCipher(db);
+  void* other = descriptor->m_allocateCipher(db);
+  unsigned char* plain = (unsigned char*) sqlite3_malloc(3 * SQLITE_MAX_PAGE_SIZE);
+  unsigned char* encrypted = plain + SQLITE_MAX_PAGE_SIZE;
+  unsigned char* data = encrypted + SQLITE_MAX_PAGE_SIZE;
+  int reserved = 0;
+  int pageSize = 0;
+  int j, k;
+
+  if (cipher == NULL || clone == NULL || other == NULL || plain == NULL)
+  {
+    zErr = sqlite3_mprintf("out of memory");
+  }
+  else
+  {
+    descriptor->m_generateKey(cipher, NULL, "conformance", 11, 1);
+    descriptor->m_cloneCipher(clone, cipher);
+    descriptor->m_generateKey(other, NULL, "different", 9, 1);
+    reserved = descriptor->m_getReserved(cipher);
+    pageSize = descriptor->m_getPageSize(cipher);
+    if (reserved < 0 || reserved > 255)
+    {
+      zErr = sqlite3_mprintf("%d reserved bytes per page, at most 255 are possible", reserved);
+    }
+    else if (pageSize != 0 && (pageSize < 512 || pageSize > SQLITE_MAX_PAGE_SIZE || ((pageSize - 1) & pageSize) != 0))
+    {
+      zErr = sqlite3_mprintf("invalid legacy page size %d", pageSize);
+    }
+  }
+
+  for (j = 0; zErr == NULL && j < (int) (sizeof(pageSizes) / sizeof(pageSizes[0])); ++j)
+  {
+    int len = pageSizes[j];
+    for (k = 0; zErr == NULL && k < (int) (sizeof(pages) / sizeof(pages[0])); ++k)
+    {
+      int page = pages[k];
+      CodecCheckFillPage(plain, len, page, reserved);
+      memcpy(encrypted, plain, len);
+      if (descriptor->m_encryptPage(cipher, page, encrypted, len, reserved) != SQLITE_OK)
+      {
+        zErr = sqlite3_mprintf("encrypting page %d of size %d failed", page, len);
+        break;
+      }
+      if (memcmp(encrypted + 24, plain + 24, len - reserved - 24) == 0)
+      {
+        zErr = sqlite3_mprintf("page %d of size %d is stored in plain text", page, len);
+        break;
+      }
+      memcpy(data, encrypted, len);
+      if (descriptor->m_decryptPage(clone, page, data, len, reserved) != SQLITE_OK ||
+          memcmp(data, plain, len - reserved) != 0)
+      {
+        zErr = sqlite3_mprintf("page %d of size %d does not decrypt to its plain text", page, len);
+        break;
+      }
+      memcpy(data, encrypted, len);
+      if (descriptor->m_decryptPage(other, page, data, len, reserved) == SQLITE_OK &&
+          memcmp(data, plain, len - reserved) == 0)
+      {
+        zErr = sqlite3_mprintf("page %d of size %d decrypts with a different key", page, len);
+        break;
+      }
+      memcpy(data, encrypted, len);
+      if (descriptor->m_decryptPage(clone, page + 1, data, len, reserved) == SQLITE_OK &&
+          memcmp(data, plain, len - reserved) == 0)
+      {
+        zErr = sqlite3_mprintf("page %d of size %d decrypts as page %d", page, len, page + 1);
+        break;
+      }
+    }
+  }
+
+  if (cipher != NULL) descriptor->m_freeCipher(cipher);
+  if (clone != NULL) descriptor->m_freeCipher(clone);
+  if (other != NULL) descriptor->m_freeCipher(other);
+  sqlite3_free(plain);
+  return zErr;
+}
+
+/*
+// The cipher must work as the codec of a database: pages are written and
+// read back through the pager with a tiny cache, then the database is rekeyed
+*/
+static char* CodecCheckDatabase(int cipherType)
+{
+  static const char* workload =
+    "PRAGMA cache_size=4;"
+    "CREATE TABLE t(x INTEGER PRIMARY KEY, y BLOB);"
+    "WITH RECURSIVE c(n) AS (SELECT 1 UNION ALL SELECT n+1 FROM c WHERE n<2000) "
+    "INSERT INTO t SELECT n, randomblob(200) FROM c;"
+    "UPDATE t SET y=randomblob(100) WHERE x%3=0;"
+    "DELETE FROM t WHERE x%7=0;";
+  char* zErr = NULL;
+  sqlite3* db = NULL;
+  sqlite3_stmt* stmt = NULL;
+  int pass;
+  /* A temporary database on disk, deleted on close */
+  int rc = sqlite3_open("", &db);
+  if (rc == SQLITE_OK)
+  {
+    wxsqlite3_config(db, "cipher", cipherType);
+    rc = sqlite3_key(db, "conformance", 11);
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_exec(db, workload, NULL, NULL, NULL);
+  }
+  for (pass = 0; rc == SQLITE_OK && pass < 2; ++pass)
+  {
+    if (pass == 1)
+    {
+      wxsqlite3_config(db, "cipher", cipherType);
+      rc = sqlite3_rekey(db, "rekeyed", 7);
+      if (rc != SQLITE_OK)
+      {
+        break;
+      }
+    }
+    rc = sqlite3_prepare_v2(db, "SELECT (SELECT count(*) FROM t), (SELECT group_concat(integrity_check) FROM pragma_integrity_check)", -1, &stmt, NULL);
+    if (rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      const char* integrity = (const char*) sqlite3_column_text(stmt, 1);
+      if (sqlite3_column_int(stmt, 0) != 1715 || integrity == NULL || strcmp(integrity, "ok") != 0)
+      {
+        zErr = sqlite3_mprintf("database is corrupt%s: %s", (pass == 1) ? " after rekey" : "", integrity ? integrity : "");
+        rc = SQLITE_CORRUPT;
+      }
+    }
+    else if (rc == SQLITE_OK)
+    {
+      rc = sqlite3_errcode(db);
+    }
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+  }
+  if (rc != SQLITE_OK && zErr == NULL)
+  {
+    zErr = sqlite3_mprintf("database test failed: %s", (db != NULL) ? sqlite3_errmsg(db) : sqlite3_errstr(rc));
+  }
+  sqlite3_close(db);
+  return zErr;
+}
+
+int wxsqlite3_cipher_check(const char* cipherName, char** pzErrMsg)
+{
+  char* zErr = NULL;
+  int cipherType = wxsqlite3_cipher_index(cipherName);
+  if (pzErrMsg != NULL)
+  {
+    *pzErrMsg = NULL;
+  }
+  if (cipherType == CODEC_TYPE_UNKNOWN)
+  {
+    zErr = sqlite3_mprintf("unknown cipher '%s'", (cipherName != NULL) ? cipherName : "");
+  }
+  else
+  {
+    /* The cipher objects read their parameters from a connection */
+    sqlite3* db = NULL;
+    if (sqlite3_open(":memory:", &db) == SQLITE_OK)
+    {
+      zErr = CodecCheckPages(db, &codecDescriptorTable[cipherType - 1]);
+    }
+    else
+    {
+      zErr = sqlite3_mprintf("out of memory");
+    }
+    sqlite3_close(db);
+    if (zErr == NULL)
+    {
+      zErr = CodecCheckDatabase(cipherType);
+    }
+  }
+  if (zErr == NULL)
+  {
+    return SQLITE_OK;
+  }
+  if (pzErrMsg != NULL)
+  {
+    *pzErrMsg = zErr;
+  }
+  else
+  {
+    sqlite3_free(zErr);
+  }
+  return SQLITE_ERROR;
+}
+
+/*
+// SQL function wxsqlite3_cipher_check(cipher), 'ok' or the first failure
+*/
+void wxsqlite3_cipher_check_func(sqlite3_context* context, int argc, sqlite3_value** argv)
+{
+  char* zErr = NULL;
+  assert(argc == 1);
+  if (wxsqlite3_cipher_check((const char*) sqlite3_value_text(argv[0]), &zErr) == SQLITE_OK)
+  {
+    sqlite3_result_text(context, "ok", -1, SQLITE_STATIC);
+  }
+  else
+  {
+    sqlite3_result_text(context, zErr, -1, sqlite3_free);
+  }
+}
+
 #endif /* SQLITE_HAS_CODEC */
 
 #endif /* SQLITE_OMIT_DISKIO */
@@ -0,0 +1,608 @@
+/*
+** Name:        directvfs.c
+** Purpose:     VFS shim reading and writing the database file without the OS page cache
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** For an encrypted database the OS page cache holds ciphertext that only
+** this process can use, while the SQLite page cache holds the same pages as
+** plaintext. Every cached page costs memory twice.
+**
+** This file implements the VFS "direct", a shim on top of the default VFS
+** that is selected per connection (vfs=direct in a URI filename, or the
+** driver option QSQLITE_DIRECT_IO). The main database file is switched to
+** O_DIRECT after the underlying VFS has opened it, so that its pages are
+** cached only once, decrypted, in the SQLite page cache; the memory saved
+** is better spent on a larger cache_size.
+**
+** O_DIRECT requires file offsets, transfer sizes and buffer addresses to be
+** aligned to the logical block size of the device. DIRECT_IO_ALIGNMENT is
+** the largest block size in common use, so it satisfies all of them. Page
+** reads and writes of a page size of at least DIRECT_IO_ALIGNMENT only need
+** an aligned buffer; they go through a per-file bounce buffer unless the
+** caller's buffer happens to be aligned. Smaller transfers (the file header,
+** the change counter, pages of a smaller page size) read the surrounding
+** blocks and, for writes, write them back. xSectorSize reports at least
+** DIRECT_IO_ALIGNMENT and xDeviceCharacteristics drops the powersafe
+** overwrite property, so that the pager journals all pages sharing a block
+** before it is rewritten.
+**
+** Journal and WAL files are passed to the underlying VFS unchanged: they are
+** written sequentially and read back only on recovery or, for the WAL, on
+** access to recently committed pages, which the OS page cache serves best.
+** WAL checkpoints write to the database file through this shim. Memory
+** mapped I/O is disabled for the database file, as the mapping would bring
+** the OS page cache back.
+**
+** If the file system rejects O_DIRECT (tmpfs on older kernels, some network
+** file systems) the file is accessed through the underlying VFS as usual. On
+** Apple platforms, which have no O_DIRECT, F_NOCACHE is set instead; it has
+** no alignment requirements.
+*/
+
+#define DIRECT_VFS_NAME       "direct"
+#define DIRECT_IO_ALIGNMENT   4096
+
+typedef struct _DirectFile
+{
+  sqlite3_file    m_base;       /* Base class - must be first */
+  sqlite3_file*   m_file;       /* Underlying file */
+  int             m_fd;         /* Descriptor opened with O_DIRECT, -1 to pass through */
+  unsigned char*  m_bounce;     /* Aligned bounce buffer, inside m_bounceAlloc */
+  int             m_bounceSize;
+  void*           m_bounceAlloc;
+} DirectFile;
+
+#define ORIGVFS(p)  ((sqlite3_vfs*) ((p)->pAppData))
+
+#define DIRECT_ALIGNED(x)     ((((uintptr_t) (x)) & (DIRECT_IO_ALIGNMENT - 1)) == 0)
+#define DIRECT_ALIGN_DOWN(x)  ((x) & ~((sqlite3_int64) (DIRECT_IO_ALIGNMENT - 1)))
+#define DIRECT_ALIGN_UP(x)    DIRECT_ALIGN_DOWN((x) + DIRECT_IO_ALIGNMENT - 1)
+
+/* --- Aligned I/O --- */
+
+/*
+** Make the bounce buffer hold at least size bytes
+*/
+static int
+DirectBounce(DirectFile* p, int size)
+{
+  void* alloc;
+  if (size <= p->m_bounceSize)
+  {
+    return SQLITE_OK;
+  }
+  alloc = sqlite3_malloc(size + DIRECT_IO_ALIGNMENT);
+  if (alloc == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  sqlite3_free(p->m_bounceAlloc);
+  p->m_bounceAlloc = alloc;
+  p->m_bounce = (unsigned char*) alloc + ((DIRECT_IO_ALIGNMENT - ((uintptr_t) alloc & (DIRECT_IO_ALIGNMENT - 1))) & (DIRECT_IO_ALIGNMENT - 1));
+  p->m_bounceSize = size;
+  return SQLITE_OK;
+}
+
+/*
+** Read aligned blocks. A regular file only returns less than requested at
+** its end, and a second pread() would start at an unaligned offset, so the
+** first short read is final. Returns the number of bytes read, or -1.
+*/
+static int
+DirectPread(DirectFile* p, unsigned char* buf, int size, sqlite3_int64 offset)
+{
+  ssize_t got;
+  do
+  {
+    got = pread(p->m_fd, buf, (size_t) size, (off_t) offset);
+  }
+  while (got < 0 && errno == EINTR);
+  if (got < 0)
+  {
+    storeLastErrno((unixFile*) p->m_file, errno);
+    return -1;
+  }
+  return (int) got;
+}
+
+static int
+DirectPwrite(DirectFile* p, const unsigned char* buf, int size, sqlite3_int64 offset)
+{
+  ssize_t wrote;
+  do
+  {
+    wrote = pwrite(p->m_fd, buf, (size_t) size, (off_t) offset);
+  }
+  while (wrote < 0 && errno == EINTR);
+  if (wrote < 0 && errno != ENOSPC)
+  {
+    storeLastErrno((unixFile*) p->m_file, errno);
+    return SQLITE_IOERR_WRITE;
+  }
+  return (wrote == size) ? SQLITE_OK : SQLITE_FULL;
+}
+
+static int
+DirectReadAligned(DirectFile* p, void* zBuf, int iAmt, sqlite3_int64 iOfst)
+{
+  sqlite3_int64 start = DIRECT_ALIGN_DOWN(iOfst);
+  int size = (int) (DIRECT_ALIGN_UP(iOfst + iAmt) - start);
+  int skip = (int) (iOfst - start);
+  unsigned char* buf;
+  int got;
+
+  if (skip == 0 && size == iAmt && DIRECT_ALIGNED(zBuf))
+  {
+    buf = (unsigned char*) zBuf;
+  }
+  else
+  {
+    int rc = DirectBounce(p, size);
+    if (rc != SQLITE_OK)
+    {
+      return rc;
+    }
+    buf = p->m_bounce;
+  }
+
+  got = DirectPread(p, buf, size, start);
+  if (got < 0)
+  {
+    return SQLITE_IOERR_READ;
+  }
+  got = (got > skip) ? got - skip : 0;
+  if (got > iAmt)
+  {
+    got = iAmt;
+  }
+  if (buf != zBuf)
+  {
+    memcpy(zBuf, buf + skip, got);
+  }
+  if (got < iAmt)
+  {
+    /* Unread parts of the buffer must be zero-filled, as in unixRead() */
+    memset(((unsigned char*) zBuf) + got, 0, iAmt - got);
+    return SQLITE_IOERR_SHORT_READ;
+  }
+  return SQLITE_OK;
+}
+
+static int
+DirectWriteAligned(DirectFile* p, const void* zBuf, int iAmt, sqlite3_int64 iOfst)
+{
+  sqlite3_int64 start = DIRECT_ALIGN_DOWN(iOfst);
+  sqlite3_int64 end = DIRECT_ALIGN_UP(iOfst + iAmt);
+  int size = (int) (end - start);
+  int skip = (int) (iOfst - start);
+  sqlite3_int64 fileSize = -1;
+  int rc;
+
+  if (skip == 0 && size == iAmt)
+  {
+    if (DIRECT_ALIGNED(zBuf))
+    {
+      return DirectPwrite(p, (const unsigned char*) zBuf, iAmt, iOfst);
+    }
+    rc = DirectBounce(p, size);
+    if (rc != SQLITE_OK)
+    {
+      return rc;
+    }
+    memcpy(p->m_bounce, zBuf, iAmt);
+    return DirectPwrite(p, p->m_bounce, iAmt, iOfst);
+  }
+
+  /* Partial blocks: read, modify and write back the surrounding blocks */
+  rc = DirectBounce(p, size);
+  if (rc == SQLITE_OK)
+  {
+    struct stat buf;
+    int got = DirectPread(p, p->m_bounce, size, start);
+    if (got < 0)
+    {
+      return SQLITE_IOERR_WRITE;
+    }
+    if (got < size)
+    {
+      memset(p->m_bounce + got, 0, size - got);
+      if (fstat(p->m_fd, &buf) != 0)
+      {
+        storeLastErrno((unixFile*) p->m_file, errno);
+        return SQLITE_IOERR_FSTAT;
+      }
+      fileSize = buf.st_size;
+    }
+    memcpy(p->m_bounce + skip, zBuf, iAmt);
+    rc = DirectPwrite(p, p->m_bounce, size, start);
+  }
+
+  /* Don't leave the zero padding of the last block behind the end of the file */
+  if (rc == SQLITE_OK && fileSize >= 0 && fileSize < end)
+  {
+    sqlite3_int64 newSize = (iOfst + iAmt > fileSize) ? iOfst + iAmt : fileSize;
+    if (newSize < end && robust_ftruncate(p->m_fd, newSize) != 0)
+    {
+      storeLastErrno((unixFile*) p->m_file, errno);
+      rc = SQLITE_IOERR_TRUNCATE;
+    }
+  }
+  return rc;
+}
+
+/* --- I/O methods --- */
+
+static int
+DirectClose(sqlite3_file* pFile)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  int rc = p->m_file->pMethods->xClose(p->m_file);
+  sqlite3_free(p->m_bounceAlloc);
+  p->m_bounceAlloc = NULL;
+  p->m_bounce = NULL;
+  p->m_bounceSize = 0;
+  return rc;
+}
+
+static int
+DirectRead(sqlite3_file* pFile, void* zBuf, int iAmt, sqlite3_int64 iOfst)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  if (p->m_fd < 0)
+  {
+    return p->m_file->pMethods->xRead(p->m_file, zBuf, iAmt, iOfst);
+  }
+  return DirectReadAligned(p, zBuf, iAmt, iOfst);
+}
+
+static int
+DirectWrite(sqlite3_file* pFile, const void* zBuf, int iAmt, sqlite3_int64 iOfst)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  if (p->m_fd < 0)
+  {
+    return p->m_file->pMethods->xWrite(p->m_file, zBuf, iAmt, iOfst);
+  }
+  return DirectWriteAligned(p, zBuf, iAmt, iOfst);
+}
+
+static int
+DirectTruncate(sqlite3_file* pFile, sqlite3_int64 size)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  return p->m_file->pMethods->xTruncate(p->m_file, size);
+}
+
+static int
+DirectSync(sqlite3_file* pFile, int flags)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  return p->m_file->pMethods->xSync(p->m_file, flags);
+}
+
+static int
+DirectFileSize(sqlite3_file* pFile, sqlite3_int64* pSize)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  return p->m_file->pMethods->xFileSize(p->m_file, pSize);
+}
+
+static int
+DirectLock(sqlite3_file* pFile, int eLock)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  return p->m_file->pMethods->xLock(p->m_file, eLock);
+}
+
+static int
+DirectUnlock(sqlite3_file* pFile, int eLock)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  return p->m_file->pMethods->xUnlock(p->m_file, eLock);
+}
+
+static int
+DirectCheckReservedLock(sqlite3_file* pFile, int* pResOut)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  return p->m_file->pMethods->xCheckReservedLock(p->m_file, pResOut);
+}
+
+static int
+DirectFileControl(sqlite3_file* pFile, int op, void* pArg)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  int rc = p->m_file->pMethods->xFileControl(p->m_file, op, pArg);
+  if (rc == SQLITE_OK && op == SQLITE_FCNTL_VFSNAME)
+  {
+    *(char**) pArg = sqlite3_mprintf(DIRECT_VFS_NAME "/%z", *(char**) pArg);
+  }
+  return rc;
+}
+
+static int
+DirectSectorSize(sqlite3_file* pFile)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  int sectorSize = p->m_file->pMethods->xSectorSize(p->m_file);
+  return (p->m_fd >= 0 && sectorSize < DIRECT_IO_ALIGNMENT) ? DIRECT_IO_ALIGNMENT : sectorSize;
+}
+
+static int
+DirectDeviceCharacteristics(sqlite3_file* pFile)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  int iocap = p->m_file->pMethods->xDeviceCharacteristics(p->m_file);
+  /* A partial block write rewrites its neighbours, see DirectSectorSize() */
+  return (p->m_fd >= 0) ? (iocap & ~SQLITE_IOCAP_POWERSAFE_OVERWRITE) : iocap;
+}
+
+static int
+DirectShmMap(sqlite3_file* pFile, int iPg, int pgsz, int bExtend, void volatile** pp)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  return p->m_file->pMethods->xShmMap(p->m_file, iPg, pgsz, bExtend, pp);
+}
+
+static int
+DirectShmLock(sqlite3_file* pFile, int offset, int n, int flags)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  return p->m_file->pMethods->xShmLock(p->m_file, offset, n, flags);
+}
+
+static void
+DirectShmBarrier(sqlite3_file* pFile)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  p->m_file->pMethods->xShmBarrier(p->m_file);
+}
+
+static int
+DirectShmUnmap(sqlite3_file* pFile, int deleteFlag)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  return p->m_file->pMethods->xShmUnmap(p->m_file, deleteFlag);
+}
+
+static int
+DirectFetch(sqlite3_file* pFile, sqlite3_int64 iOfst, int iAmt, void** pp)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  *pp = NULL;
+  if (p->m_fd >= 0)
+  {
+    /* A mapping would be served from the OS page cache */
+    return SQLITE_OK;
+  }
+  return p->m_file->pMethods->xFetch(p->m_file, iOfst, iAmt, pp);
+}
+
+static int
+DirectUnfetch(sqlite3_file* pFile, sqlite3_int64 iOfst, void* pPage)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  return p->m_file->pMethods->xUnfetch(p->m_file, iOfst, pPage);
+}
+
+static const sqlite3_io_methods directIoMethods =
+{
+  3,                              /* iVersion */
+  DirectClose,                    /* xClose */
+  DirectRead,                     /* xRead */
+  DirectWrite,                    /* xWrite */
+  DirectTruncate,                 /* xTruncate */
+  DirectSync,                     /* xSync */
+  DirectFileSize,                 /* xFileSize */
+  DirectLock,                     /* xLock */
+  DirectUnlock,                   /* xUnlock */
+  DirectCheckReservedLock,        /* xCheckReservedLock */
+  DirectFileControl,              /* xFileControl */
+  DirectSectorSize,               /* xSectorSize */
+  DirectDeviceCharacteristics,    /* xDeviceCharacteristics */
+  DirectShmMap,                   /* xShmMap */
+  DirectShmLock,                  /* xShmLock */
+  DirectShmBarrier,               /* xShmBarrier */
+  DirectShmUnmap,                 /* xShmUnmap */
+  DirectFetch,                    /* xFetch */
+  DirectUnfetch                   /* xUnfetch */
+};
+
+/* --- VFS methods --- */
+
+/*
+** Bypass the OS page cache for an open unix file. Returns the descriptor if
+** the shim has to align the I/O itself, -1 otherwise.
+*/
+static int
+DirectEnable(int fd)
+{
+#if defined(O_DIRECT)
+  int flags = fcntl(fd, F_GETFL);
+  if (flags >= 0 && ((flags & O_DIRECT) != 0 || fcntl(fd, F_SETFL, flags | O_DIRECT) == 0))
+  {
+    return fd;
+  }
+#elif defined(F_NOCACHE)
+  fcntl(fd, F_NOCACHE, 1);
+#endif
+  return -1;
+}
+
+static int
+DirectOpen(sqlite3_vfs* pVfs, const char* zName, sqlite3_file* pFile, int flags, int* pOutFlags)
+{
+  DirectFile* p = (DirectFile*) pFile;
+  sqlite3_vfs* origVfs = ORIGVFS(pVfs);
+  const sqlite3_io_methods* methods;
+  int rc;
+
+  if ((flags & SQLITE_OPEN_MAIN_DB) == 0)
+  {
+    /* Journals, WAL and temporary files go to the underlying VFS directly */
+    return origVfs->xOpen(origVfs, zName, pFile, flags, pOutFlags);
+  }
+
+  memset(p, 0, sizeof(DirectFile));
+  p->m_fd = -1;
+  p->m_file = (sqlite3_file*) &p[1];
+  rc = origVfs->xOpen(origVfs, zName, p->m_file, flags, pOutFlags);
+  if (rc != SQLITE_OK)
+  {
+    p->m_base.pMethods = NULL;
+    return rc;
+  }
+
+  /* Only files of the unix VFS expose a descriptor, all others pass through */
+  methods = p->m_file->pMethods;
+  if (methods != NULL && methods->xWrite == unixWrite && methods->iVersion >= 3)
+  {
+    p->m_fd = DirectEnable(((unixFile*) p->m_file)->h);
+  }
+  p->m_base.pMethods = &directIoMethods;
+  return SQLITE_OK;
+}
+
+static int
+DirectDelete(sqlite3_vfs* pVfs, const char* zName, int syncDir)
+{
+  return ORIGVFS(pVfs)->xDelete(ORIGVFS(pVfs), zName, syncDir);
+}
+
+static int
+DirectAccess(sqlite3_vfs* pVfs, const char* zName, int flags, int* pResOut)
+{
+  return ORIGVFS(pVfs)->xAccess(ORIGVFS(pVfs), zName, flags, pResOut);
+}
+
+static int
+DirectFullPathname(sqlite3_vfs* pVfs, const char* zName, int nOut, char* zOut)
+{
+  return ORIGVFS(pVfs)->xFullPathname(ORIGVFS(pVfs), zName, nOut, zOut);
+}
+
+static void*
+DirectDlOpen(sqlite3_vfs* pVfs, const char* zFilename)
+{
+  return ORIGVFS(pVfs)->xDlOpen(ORIGVFS(pVfs), zFilename);
+}
+
+static void
+DirectDlError(sqlite3_vfs* pVfs, int nByte, char* zErrMsg)
+{
+  ORIGVFS(pVfs)->xDlError(ORIGVFS(pVfs), nByte, zErrMsg);
+}
+
+static void
+(*DirectDlSym(sqlite3_vfs* pVfs, void* p, const char* zSym))(void)
+{
+  return ORIGVFS(pVfs)->xDlSym(ORIGVFS(pVfs), p, zSym);
+}
+
+static void
+DirectDlClose(sqlite3_vfs* pVfs, void* pHandle)
+{
+  ORIGVFS(pVfs)->xDlClose(ORIGVFS(pVfs), pHandle);
+}
+
+static int
+DirectRandomness(sqlite3_vfs* pVfs, int nByte, char* zOut)
+{
+  return ORIGVFS(pVfs)->xRandomness(ORIGVFS(pVfs), nByte, zOut);
+}
+
+static int
+DirectSleep(sqlite3_vfs* pVfs, int nMicro)
+{
+  return ORIGVFS(pVfs)->xSleep(ORIGVFS(pVfs), nMicro);
+}
+
+static int
+DirectCurrentTime(sqlite3_vfs* pVfs, double* pTimeOut)
+{
+  return ORIGVFS(pVfs)->xCurrentTime(ORIGVFS(pVfs), pTimeOut);
+}
+
+static int
+DirectGetLastError(sqlite3_vfs* pVfs, int nErr, char* zErr)
+{
+  return ORIGVFS(pVfs)->xGetLastError(ORIGVFS(pVfs), nErr, zErr);
+}
+
+static int
+DirectCurrentTimeInt64(sqlite3_vfs* pVfs, sqlite3_int64* pTimeOut)
+{
+  return ORIGVFS(pVfs)->xCurrentTimeInt64(ORIGVFS(pVfs), pTimeOut);
+}
+
+static int
+DirectSetSystemCall(sqlite3_vfs* pVfs, const char* zName, sqlite3_syscall_ptr pNewFunc)
+{
+  return ORIGVFS(pVfs)->xSetSystemCall(ORIGVFS(pVfs), zName, pNewFunc);
+}
+
+static sqlite3_syscall_ptr
+DirectGetSystemCall(sqlite3_vfs* pVfs, const char* zName)
+{
+  return ORIGVFS(pVfs)->xGetSystemCall(ORIGVFS(pVfs), zName);
+}
+
+static const char*
+DirectNextSystemCall(sqlite3_vfs* pVfs, const char* zName)
+{
+  return ORIGVFS(pVfs)->xNextSystemCall(ORIGVFS(pVfs), zName);
+}
+
+static sqlite3_vfs directVfs =
+{
+  3,                              /* iVersion */
+  0,                              /* szOsFile (set on registration) */
+  0,                              /* mxPathname (set on registration) */
+  0,                              /* pNext */
+  DIRECT_VFS_NAME,                /* zName */
+  0,                              /* pAppData (set to the underlying VFS) */
+  DirectOpen,                     /* xOpen */
+  DirectDelete,                   /* xDelete */
+  DirectAccess,                   /* xAccess */
+  DirectFullPathname,             /* xFullPathname */
+  DirectDlOpen,                   /* xDlOpen */
+  DirectDlError,                  /* xDlError */
+  DirectDlSym,                    /* xDlSym */
+  DirectDlClose,                  /* xDlClose */
+  DirectRandomness,               /* xRandomness */
+  DirectSleep,                    /* xSleep */
+  DirectCurrentTime,              /* xCurrentTime */
+  DirectGetLastError,             /* xGetLastError */
+  DirectCurrentTimeInt64,         /* xCurrentTimeInt64 */
+  DirectSetSystemCall,            /* xSetSystemCall */
+  DirectGetSystemCall,            /* xGetSystemCall */
+  DirectNextSystemCall            /* xNextSystemCall */
+};
+
+/*
+** Register the shim on top of the current default VFS, without making it
+** the default. Called once from sqlite3_initialize().
+*/
+int
+sqlite3_directvfs_init(void)
+{
+  sqlite3_vfs* origVfs = sqlite3_vfs_find(NULL);
+  if (origVfs == NULL)
+  {
+    return SQLITE_ERROR;
+  }
+  if (sqlite3_vfs_find(DIRECT_VFS_NAME) != NULL)
+  {
+    return SQLITE_OK;
+  }
+  directVfs.iVersion = (origVfs->iVersion < 3) ? origVfs->iVersion : 3;
+  directVfs.szOsFile = sizeof(DirectFile) + origVfs->szOsFile;
+  directVfs.mxPathname = origVfs->mxPathname;
+  directVfs.pAppData = origVfs;
+  return sqlite3_vfs_register(&directVfs, 0);
+}
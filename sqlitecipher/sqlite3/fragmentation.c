@@ -0,0 +1,232 @@
+/*
+** Name:        fragmentation.c
+** Purpose:     Fragmentation report of a database, based on the dbstat virtual table
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** wxsqlite3_fragmentation() reports, as JSON, how much of a database file is
+** wasted and how scattered its b-trees are:
+**
+**   {"schema":"main","page_size":4096,"pages":1200,"free_pages":310,
+**    "auto_vacuum":"incremental",
+**    "btrees":[{"name":"t1","pages":800,"leaf_pages":790,"overflow_pages":0,
+**               "fill":0.712,"out_of_order":95}, ...]}
+**
+** free_pages are the pages on the freelist, which only VACUUM or, with
+** auto_vacuum=INCREMENTAL, PRAGMA incremental_vacuum give back. fill is the
+** used share of the pages of a table or index. out_of_order counts the leaf
+** pages which do not directly follow the previous leaf in the file, so a
+** scan of the b-tree has to seek there.
+**
+** The pages are read through the pager, so an encrypted database is
+** decrypted page by page; the report of a large database takes as long as
+** a full scan. The SQL function wxsqlite3_fragmentation([schema]) returns
+** the same report.
+*/
+
+static void
+FragmentationAppendString(sqlite3_str* report, const char* text)
+{
+  sqlite3_str_appendchar(report, 1, '"');
+  for (; *text != 0; ++text)
+  {
+    unsigned char c = (unsigned char) *text;
+    if (c == '"' || c == '\\')
+    {
+      sqlite3_str_appendchar(report, 1, '\\');
+      sqlite3_str_appendchar(report, 1, (char) c);
+    }
+    else if (c < 0x20)
+    {
+      sqlite3_str_appendf(report, "\\u%04x", c);
+    }
+    else
+    {
+      sqlite3_str_appendchar(report, 1, (char) c);
+    }
+  }
+  sqlite3_str_appendchar(report, 1, '"');
+}
+
+static int
+FragmentationPragma(sqlite3* db, const char* zDbName, const char* pragma, sqlite3_int64* pValue)
+{
+  sqlite3_stmt* pStmt = NULL;
+  char* zSql = sqlite3_mprintf("PRAGMA \"%w\".%s", zDbName, pragma);
+  int rc = (zSql != NULL) ? sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL) : SQLITE_NOMEM;
+  sqlite3_free(zSql);
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_step(pStmt);
+    if (rc == SQLITE_ROW)
+    {
+      *pValue = sqlite3_column_int64(pStmt, 0);
+      rc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
+}
+
+typedef struct _FragmentationBtree
+{
+  char*         m_name;
+  sqlite3_int64 m_pages;
+  sqlite3_int64 m_leafPages;
+  sqlite3_int64 m_overflowPages;
+  sqlite3_int64 m_bytes;
+  sqlite3_int64 m_unused;
+  sqlite3_int64 m_outOfOrder;
+  sqlite3_int64 m_lastLeaf;
+} FragmentationBtree;
+
+static void
+FragmentationAppendBtree(sqlite3_str* report, FragmentationBtree* btree, int first)
+{
+  double fill = (btree->m_bytes > 0) ? (double) (btree->m_bytes - btree->m_unused) / btree->m_bytes : 0.0;
+  sqlite3_str_appendall(report, first ? "{\"name\":" : ",{\"name\":");
+  FragmentationAppendString(report, btree->m_name);
+  sqlite3_str_appendf(report, ",\"pages\":%lld,\"leaf_pages\":%lld,\"overflow_pages\":%lld,\"fill\":%.3f,\"out_of_order\":%lld}",
+                      btree->m_pages, btree->m_leafPages, btree->m_overflowPages, fill, btree->m_outOfOrder);
+}
+
+int
+wxsqlite3_fragmentation(sqlite3* db, const char* zDbName, char** pzReport)
+{
+  static const char* autoVacuumModes[] = { "none", "full", "incremental" };
+  sqlite3_str* report;
+  sqlite3_stmt* pStmt = NULL;
+  sqlite3_int64 pageSize = 0, pages = 0, freePages = 0, autoVacuum = 0;
+  FragmentationBtree btree;
+  int nBtrees = 0;
+  int rc;
+
+  if (db == NULL || pzReport == NULL)
+  {
+    return SQLITE_MISUSE;
+  }
+  *pzReport = NULL;
+  if (zDbName == NULL)
+  {
+    zDbName = "main";
+  }
+
+  rc = FragmentationPragma(db, zDbName, "page_size", &pageSize);
+  if (rc == SQLITE_OK)
+  {
+    rc = FragmentationPragma(db, zDbName, "page_count", &pages);
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = FragmentationPragma(db, zDbName, "freelist_count", &freePages);
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = FragmentationPragma(db, zDbName, "auto_vacuum", &autoVacuum);
+  }
+  if (rc == SQLITE_OK)
+  {
+    /* dbstat returns the b-trees one after the other, each in key order */
+    rc = sqlite3_prepare_v2(db, "SELECT name, pageno, pagetype, unused, pgsize FROM dbstat WHERE schema=?1", -1, &pStmt, NULL);
+  }
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_finalize(pStmt);
+    return rc;
+  }
+  sqlite3_bind_text(pStmt, 1, zDbName, -1, SQLITE_STATIC);
+
+  report = sqlite3_str_new(db);
+  sqlite3_str_appendall(report, "{\"schema\":");
+  FragmentationAppendString(report, zDbName);
+  sqlite3_str_appendf(report, ",\"page_size\":%lld,\"pages\":%lld,\"free_pages\":%lld,\"auto_vacuum\":\"%s\",\"btrees\":[",
+                      pageSize, pages, freePages, autoVacuumModes[(autoVacuum >= 0 && autoVacuum <= 2) ? autoVacuum : 0]);
+
+  memset(&btree, 0, sizeof(btree));
+  while ((rc = sqlite3_step(pStmt)) == SQLITE_ROW)
+  {
+    const char* name = (const char*) sqlite3_column_text(pStmt, 0);
+    const char* pageType = (const char*) sqlite3_column_text(pStmt, 2);
+    sqlite3_int64 pageNo = sqlite3_column_int64(pStmt, 1);
+    if (name == NULL || pageType == NULL)
+    {
+      continue;
+    }
+    if (btree.m_name == NULL || strcmp(btree.m_name, name) != 0)
+    {
+      if (btree.m_name != NULL)
+      {
+        FragmentationAppendBtree(report, &btree, nBtrees++ == 0);
+        sqlite3_free(btree.m_name);
+      }
+      memset(&btree, 0, sizeof(btree));
+      btree.m_name = sqlite3_mprintf("%s", name);
+      if (btree.m_name == NULL)
+      {
+        rc = SQLITE_NOMEM;
+        break;
+      }
+    }
+    btree.m_pages++;
+    btree.m_bytes += sqlite3_column_int64(pStmt, 4);
+    btree.m_unused += sqlite3_column_int64(pStmt, 3);
+    if (strcmp(pageType, "leaf") == 0)
+    {
+      if (btree.m_leafPages > 0 && pageNo != btree.m_lastLeaf + 1)
+      {
+        btree.m_outOfOrder++;
+      }
+      btree.m_leafPages++;
+      btree.m_lastLeaf = pageNo;
+    }
+    else if (strcmp(pageType, "overflow") == 0)
+    {
+      btree.m_overflowPages++;
+    }
+  }
+  if (rc == SQLITE_DONE)
+  {
+    rc = SQLITE_OK;
+    if (btree.m_name != NULL)
+    {
+      FragmentationAppendBtree(report, &btree, nBtrees == 0);
+    }
+  }
+  sqlite3_free(btree.m_name);
+  sqlite3_finalize(pStmt);
+
+  sqlite3_str_appendall(report, "]}");
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_str_errcode(report);
+  }
+  *pzReport = sqlite3_str_finish(report);
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_free(*pzReport);
+    *pzReport = NULL;
+  }
+  return rc;
+}
+
+static void
+wxsqlite3_fragmentation_func(sqlite3_context* context, int argc, sqlite3_value** argv)
+{
+  const char* zDbName = (argc > 0) ? (const char*) sqlite3_value_text(argv[0]) : NULL;
+  sqlite3* db = sqlite3_context_db_handle(context);
+  char* zReport = NULL;
+  int rc = wxsqlite3_fragmentation(db, zDbName, &zReport);
+  if (rc == SQLITE_OK)
+  {
+    sqlite3_result_text(context, zReport, -1, sqlite3_free);
+  }
+  else
+  {
+    sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+    sqlite3_result_error_code(context, rc);
+  }
+}
@@ -0,0 +1,497 @@
+/*
+** Name:        indexadvisor.c
+** Purpose:     Table-valued function recommending indexes for a workload
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** This extension adds the table-valued function
+**
+**   index_advisor(WORKLOAD [, SAMPLE [, TOP]])
+**
+** WORKLOAD is a SELECT statement returning the SQL statements to analyze,
+** either as rows (sql) or as rows (sql, cost), for example the contents of
+** a statement statistics log. Identical statements are merged, their costs
+** summed up (without a cost column every occurrence counts as 1).
+**
+** The statements are fed into the index recommender of the SQLite shell
+** (see sqlite3expert.c). For each statement one row is returned, ordered
+** by descending cost:
+**
+**   sql          The statement
+**   cost         The accumulated cost of the statement in the workload
+**   indexes      The recommended CREATE INDEX statements, NULL if none
+**   plan_before  The query plan using the existing indexes
+**   plan_after   The query plan using the recommended indexes
+**
+** SAMPLE is the percentage of rows sampled for the statistics of the
+** candidate indexes (default 100, 0 disables sampling). If TOP is given,
+** only the TOP most expensive statements are analyzed. Statements which
+** cannot be analyzed (for example because they refer to temporary
+** tables) are skipped.
+*/
+
+#if defined(SQLITE_ENABLE_EXPERT) && !defined(SQLITE_OMIT_VIRTUALTABLE)
+
+/* Column numbers */
+#define INDEXADVISOR_COLUMN_SQL         0
+#define INDEXADVISOR_COLUMN_COST        1
+#define INDEXADVISOR_COLUMN_INDEXES     2
+#define INDEXADVISOR_COLUMN_PLANBEFORE  3
+#define INDEXADVISOR_COLUMN_PLANAFTER   4
+#define INDEXADVISOR_COLUMN_WORKLOAD    5
+#define INDEXADVISOR_COLUMN_SAMPLE      6
+#define INDEXADVISOR_COLUMN_TOP         7
+
+typedef struct _IndexAdvisorRow
+{
+  char*  m_zSql;
+  double m_cost;
+  char*  m_zIndexes;
+  char*  m_zPlanBefore;
+  char*  m_zPlanAfter;
+} IndexAdvisorRow;
+
+typedef struct _IndexAdvisorCursor
+{
+  sqlite3_vtab_cursor m_base;     /* Base class - must be first */
+  sqlite3*            m_db;       /* Database connection */
+  IndexAdvisorRow*    m_rows;     /* Result rows */
+  int                 m_nRows;    /* Number of result rows */
+  int                 m_iRow;     /* Current row */
+} IndexAdvisorCursor;
+
+typedef struct _IndexAdvisorVtab
+{
+  sqlite3_vtab m_base;            /* Base class - must be first */
+  sqlite3*     m_db;              /* Database connection */
+} IndexAdvisorVtab;
+
+static int
+IndexAdvisorConnect(sqlite3* db, void* pAux, int argc, const char* const* argv,
+                    sqlite3_vtab** ppVtab, char** pzErr)
+{
+  IndexAdvisorVtab* vtab;
+  int rc;
+
+  UNUSED_PARAM(pAux);
+  UNUSED_PARAM(argc);
+  UNUSED_PARAM(argv);
+  UNUSED_PARAM(pzErr);
+  rc = sqlite3_declare_vtab(db,
+         "CREATE TABLE x(sql,cost,indexes,plan_before,plan_after,"
+                        "workload HIDDEN,sample HIDDEN,top HIDDEN)");
+  if (rc == SQLITE_OK)
+  {
+    vtab = (IndexAdvisorVtab*) sqlite3_malloc(sizeof(IndexAdvisorVtab));
+    *ppVtab = (sqlite3_vtab*) vtab;
+    if (vtab == NULL)
+    {
+      return SQLITE_NOMEM;
+    }
+    memset(vtab, 0, sizeof(IndexAdvisorVtab));
+    vtab->m_db = db;
+  }
+  return rc;
+}
+
+static int
+IndexAdvisorDisconnect(sqlite3_vtab* pVtab)
+{
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+
+static int
+IndexAdvisorOpen(sqlite3_vtab* pVtab, sqlite3_vtab_cursor** ppCursor)
+{
+  IndexAdvisorCursor* cursor = (IndexAdvisorCursor*) sqlite3_malloc(sizeof(IndexAdvisorCursor));
+  if (cursor == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  memset(cursor, 0, sizeof(IndexAdvisorCursor));
+  cursor->m_db = ((IndexAdvisorVtab*) pVtab)->m_db;
+  *ppCursor = &cursor->m_base;
+  return SQLITE_OK;
+}
+
+static void
+IndexAdvisorCursorReset(IndexAdvisorCursor* cursor)
+{
+  int j;
+  for (j = 0; j < cursor->m_nRows; ++j)
+  {
+    sqlite3_free(cursor->m_rows[j].m_zSql);
+    sqlite3_free(cursor->m_rows[j].m_zIndexes);
+    sqlite3_free(cursor->m_rows[j].m_zPlanBefore);
+    sqlite3_free(cursor->m_rows[j].m_zPlanAfter);
+  }
+  sqlite3_free(cursor->m_rows);
+  cursor->m_rows = NULL;
+  cursor->m_nRows = 0;
+  cursor->m_iRow = 0;
+}
+
+static int
+IndexAdvisorClose(sqlite3_vtab_cursor* cur)
+{
+  IndexAdvisorCursor* cursor = (IndexAdvisorCursor*) cur;
+  IndexAdvisorCursorReset(cursor);
+  sqlite3_free(cursor);
+  return SQLITE_OK;
+}
+
+static int
+IndexAdvisorNext(sqlite3_vtab_cursor* cur)
+{
+  ((IndexAdvisorCursor*) cur)->m_iRow++;
+  return SQLITE_OK;
+}
+
+static int
+IndexAdvisorEof(sqlite3_vtab_cursor* cur)
+{
+  IndexAdvisorCursor* cursor = (IndexAdvisorCursor*) cur;
+  return cursor->m_iRow >= cursor->m_nRows;
+}
+
+static int
+IndexAdvisorColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int column)
+{
+  IndexAdvisorCursor* cursor = (IndexAdvisorCursor*) cur;
+  IndexAdvisorRow* row = &cursor->m_rows[cursor->m_iRow];
+  switch (column)
+  {
+    case INDEXADVISOR_COLUMN_SQL:
+      sqlite3_result_text(ctx, row->m_zSql, -1, SQLITE_TRANSIENT);
+      break;
+    case INDEXADVISOR_COLUMN_COST:
+      sqlite3_result_double(ctx, row->m_cost);
+      break;
+    case INDEXADVISOR_COLUMN_INDEXES:
+      sqlite3_result_text(ctx, row->m_zIndexes, -1, SQLITE_TRANSIENT);
+      break;
+    case INDEXADVISOR_COLUMN_PLANBEFORE:
+      sqlite3_result_text(ctx, row->m_zPlanBefore, -1, SQLITE_TRANSIENT);
+      break;
+    case INDEXADVISOR_COLUMN_PLANAFTER:
+      sqlite3_result_text(ctx, row->m_zPlanAfter, -1, SQLITE_TRANSIENT);
+      break;
+    default:
+      break;
+  }
+  return SQLITE_OK;
+}
+
+static int
+IndexAdvisorRowid(sqlite3_vtab_cursor* cur, sqlite_int64* pRowid)
+{
+  *pRowid = ((IndexAdvisorCursor*) cur)->m_iRow + 1;
+  return SQLITE_OK;
+}
+
+/*
+** An equality constraint on the workload column is required. Bit 0 of
+** idxNum flags its presence, bit 1 the sample and bit 2 the top argument.
+*/
+static int
+IndexAdvisorBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo)
+{
+  int constraintIndex[3];
+  const struct sqlite3_index_constraint* constraint = pIdxInfo->aConstraint;
+  int idxNum = 0;
+  int argvIndex = 0;
+  int j;
+
+  UNUSED_PARAM(tab);
+  for (j = 0; j < pIdxInfo->nConstraint; ++j, ++constraint)
+  {
+    int slot = constraint->iColumn - INDEXADVISOR_COLUMN_WORKLOAD;
+    if (constraint->usable == 0 || constraint->op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+    if (slot < 0 || slot > 2) continue;
+    constraintIndex[slot] = j;
+    idxNum |= (1 << slot);
+  }
+  if ((idxNum & 1) == 0)
+  {
+    pIdxInfo->idxNum = 0;
+    pIdxInfo->estimatedCost = 1e99;
+    return SQLITE_OK;
+  }
+  for (j = 0; j < 3; ++j)
+  {
+    if (idxNum & (1 << j))
+    {
+      pIdxInfo->aConstraintUsage[constraintIndex[j]].argvIndex = ++argvIndex;
+      pIdxInfo->aConstraintUsage[constraintIndex[j]].omit = 1;
+    }
+  }
+  pIdxInfo->idxNum = idxNum;
+  pIdxInfo->estimatedCost = 1e6;
+  return SQLITE_OK;
+}
+
+/*
+** Return the query plan of a statement in the format used by sqlite3expert
+*/
+static char*
+IndexAdvisorQueryPlan(sqlite3* db, const char* zSql)
+{
+  sqlite3_stmt* stmt = NULL;
+  char* zPlan = NULL;
+  char* zExplain = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", zSql);
+  if (zExplain == NULL)
+  {
+    return NULL;
+  }
+  if (sqlite3_prepare_v2(db, zExplain, -1, &stmt, NULL) == SQLITE_OK)
+  {
+    sqlite3_str* plan = sqlite3_str_new(db);
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      const char* zDetail = (const char*) sqlite3_column_text(stmt, 3);
+      if (zDetail != NULL && zDetail[0] != '-')
+      {
+        sqlite3_str_appendf(plan, "%s\n", zDetail);
+      }
+    }
+    zPlan = sqlite3_str_finish(plan);
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_free(zExplain);
+  return zPlan;
+}
+
+/*
+** Read the workload, merging identical statements and ordering them by cost
+*/
+static int
+IndexAdvisorReadWorkload(IndexAdvisorCursor* cursor, const char* zWorkload, int top, char** pzErr)
+{
+  sqlite3* db = cursor->m_db;
+  sqlite3_stmt* stmt = NULL;
+  char* zSql;
+  int nCol;
+  int nAlloc = 0;
+  int rc;
+
+  rc = sqlite3_prepare_v2(db, zWorkload, -1, &stmt, NULL);
+  if (rc != SQLITE_OK)
+  {
+    *pzErr = sqlite3_mprintf("index_advisor: %s", sqlite3_errmsg(db));
+    return rc;
+  }
+  nCol = sqlite3_column_count(stmt);
+  sqlite3_finalize(stmt);
+  if (nCol != 1 && nCol != 2)
+  {
+    *pzErr = sqlite3_mprintf("index_advisor: workload must return (sql) or (sql, cost)");
+    return SQLITE_ERROR;
+  }
+
+  zSql = sqlite3_mprintf("WITH w(sql,cost) AS (SELECT *%s FROM (%s)) "
+                         "SELECT sql, total(cost) FROM w WHERE sql IS NOT NULL "
+                         "GROUP BY sql ORDER BY 2 DESC LIMIT %d",
+                         (nCol == 1) ? ",1" : "", zWorkload, top);
+  if (zSql == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  rc = sqlite3_prepare_v2(db, zSql, -1, &stmt, NULL);
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK)
+  {
+    *pzErr = sqlite3_mprintf("index_advisor: %s", sqlite3_errmsg(db));
+    return rc;
+  }
+  while (rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    IndexAdvisorRow* row;
+    if (cursor->m_nRows >= nAlloc)
+    {
+      int nNew = (nAlloc > 0) ? 2 * nAlloc : 16;
+      IndexAdvisorRow* rows = (IndexAdvisorRow*) sqlite3_realloc(cursor->m_rows, nNew * sizeof(IndexAdvisorRow));
+      if (rows == NULL)
+      {
+        rc = SQLITE_NOMEM;
+        break;
+      }
+      cursor->m_rows = rows;
+      nAlloc = nNew;
+    }
+    row = &cursor->m_rows[cursor->m_nRows];
+    memset(row, 0, sizeof(IndexAdvisorRow));
+    row->m_zSql = sqlite3_mprintf("%s", sqlite3_column_text(stmt, 0));
+    row->m_cost = sqlite3_column_double(stmt, 1);
+    if (row->m_zSql == NULL)
+    {
+      rc = SQLITE_NOMEM;
+      break;
+    }
+    cursor->m_nRows++;
+  }
+  if (sqlite3_finalize(stmt) != SQLITE_OK && rc == SQLITE_OK)
+  {
+    *pzErr = sqlite3_mprintf("index_advisor: %s", sqlite3_errmsg(db));
+    rc = SQLITE_ERROR;
+  }
+  return rc;
+}
+
+/*
+** Analyze the workload rows of the cursor and fill in the recommendations
+*/
+static int
+IndexAdvisorAnalyze(IndexAdvisorCursor* cursor, int sample, char** pzErr)
+{
+  sqlite3expert* expert;
+  int* stmtIds;
+  int nRows = 0;
+  int rc = SQLITE_OK;
+  int j;
+
+  stmtIds = (int*) sqlite3_malloc((cursor->m_nRows + 1) * sizeof(int));
+  if (stmtIds == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  expert = sqlite3_expert_new(cursor->m_db, pzErr);
+  if (expert == NULL)
+  {
+    sqlite3_free(stmtIds);
+    return SQLITE_ERROR;
+  }
+  sqlite3_expert_config(expert, EXPERT_CONFIG_SAMPLE, sample);
+
+  /* Add the statements one by one, dropping those which cannot be analyzed */
+  for (j = 0; j < cursor->m_nRows; ++j)
+  {
+    IndexAdvisorRow* row = &cursor->m_rows[j];
+    int stmtId = sqlite3_expert_count(expert);
+    char* zErr = NULL;
+    if (sqlite3_expert_sql(expert, row->m_zSql, &zErr) == SQLITE_OK &&
+        sqlite3_expert_count(expert) > stmtId)
+    {
+      stmtIds[nRows] = stmtId;
+      cursor->m_rows[nRows++] = *row;
+    }
+    else
+    {
+      sqlite3_free(row->m_zSql);
+    }
+    sqlite3_free(zErr);
+  }
+  cursor->m_nRows = nRows;
+
+  if (nRows > 0)
+  {
+    rc = sqlite3_expert_analyze(expert, pzErr);
+  }
+  for (j = 0; rc == SQLITE_OK && j < nRows; ++j)
+  {
+    IndexAdvisorRow* row = &cursor->m_rows[j];
+    const char* zIndexes = sqlite3_expert_report(expert, stmtIds[j], EXPERT_REPORT_INDEXES);
+    const char* zPlan = sqlite3_expert_report(expert, stmtIds[j], EXPERT_REPORT_PLAN);
+    if (zIndexes != NULL && zIndexes[0] != 0)
+    {
+      row->m_zIndexes = sqlite3_mprintf("%s", zIndexes);
+    }
+    if (zPlan != NULL)
+    {
+      row->m_zPlanAfter = sqlite3_mprintf("%s", zPlan);
+    }
+    row->m_zPlanBefore = IndexAdvisorQueryPlan(cursor->m_db, row->m_zSql);
+  }
+  sqlite3_expert_destroy(expert);
+  sqlite3_free(stmtIds);
+  return rc;
+}
+
+static int
+IndexAdvisorFilter(sqlite3_vtab_cursor* cur, int idxNum, const char* idxStr,
+                   int argc, sqlite3_value** argv)
+{
+  IndexAdvisorCursor* cursor = (IndexAdvisorCursor*) cur;
+  const char* zWorkload;
+  int sample = 100;
+  int top = -1;
+  int iArg = 1;
+  char* zErr = NULL;
+  int rc;
+
+  UNUSED_PARAM(idxStr);
+  UNUSED_PARAM(argc);
+  IndexAdvisorCursorReset(cursor);
+  if ((idxNum & 1) == 0)
+  {
+    return SQLITE_OK;
+  }
+  zWorkload = (const char*) sqlite3_value_text(argv[0]);
+  if (zWorkload == NULL)
+  {
+    return SQLITE_OK;
+  }
+  if (idxNum & 2)
+  {
+    sample = sqlite3_value_int(argv[iArg++]);
+  }
+  if ((idxNum & 4) && sqlite3_value_type(argv[iArg]) != SQLITE_NULL)
+  {
+    top = sqlite3_value_int(argv[iArg]);
+  }
+
+  rc = IndexAdvisorReadWorkload(cursor, zWorkload, top, &zErr);
+  if (rc == SQLITE_OK)
+  {
+    rc = IndexAdvisorAnalyze(cursor, sample, &zErr);
+  }
+  if (rc != SQLITE_OK)
+  {
+    IndexAdvisorCursorReset(cursor);
+    if (zErr != NULL)
+    {
+      sqlite3_free(cur->pVtab->zErrMsg);
+      cur->pVtab->zErrMsg = zErr;
+    }
+  }
+  return rc;
+}
+
+static sqlite3_module indexAdvisorModule =
+{
+  0,                         /* iVersion */
+  0,                         /* xCreate */
+  IndexAdvisorConnect,       /* xConnect */
+  IndexAdvisorBestIndex,     /* xBestIndex */
+  IndexAdvisorDisconnect,    /* xDisconnect */
+  0,                         /* xDestroy */
+  IndexAdvisorOpen,          /* xOpen - open a cursor */
+  IndexAdvisorClose,         /* xClose - close a cursor */
+  IndexAdvisorFilter,        /* xFilter - configure scan constraints */
+  IndexAdvisorNext,          /* xNext - advance a cursor */
+  IndexAdvisorEof,           /* xEof - check for end of scan */
+  IndexAdvisorColumn,        /* xColumn - read data */
+  IndexAdvisorRowid,         /* xRowid - read data */
+  0,                         /* xUpdate */
+  0,                         /* xBegin */
+  0,                         /* xSync */
+  0,                         /* xCommit */
+  0,                         /* xRollback */
+  0,                         /* xFindMethod */
+  0,                         /* xRename */
+  0,                         /* xSavepoint */
+  0,                         /* xRelease */
+  0                          /* xRollbackTo */
+};
+
+int
+sqlite3_indexadvisor_init(sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi)
+{
+  return sqlite3_create_module(db, "index_advisor", &indexAdvisorModule, NULL);
+}
+
+#endif
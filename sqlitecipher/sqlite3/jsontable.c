@@ -0,0 +1,402 @@
+/*
+** Name:        jsontable.c
+** Purpose:     Table-valued function extracting several JSON paths at once
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** This extension adds the table-valued function
+**
+**   json_table(JSON, PATH1, PATH2, ...)
+**
+** which yields a single row with the columns c1, c2, ... holding the
+** values found at the given paths (or NULL, if a path does not exist).
+** Up to JSONTABLE_MAX_PATHS paths are supported. Typical usage:
+**
+**   INSERT INTO items(a, c)
+**     SELECT j.c1, j.c2 FROM staging, json_table(staging.doc, '$.a', '$.b.c') AS j;
+**
+** The values are returned like json_extract() returns them. In contrast
+** to calling json_extract() once per column, the document is parsed only
+** once per row, and all paths are looked up in the same parse tree.
+*/
+
+#if defined(SQLITE_ENABLE_JSON1) && !defined(SQLITE_OMIT_VIRTUALTABLE)
+
+#define JSONTABLE_MAX_PATHS  16
+
+/* Column numbers */
+#define JSONTABLE_COLUMN_VALUE  0
+#define JSONTABLE_COLUMN_JSON   (JSONTABLE_COLUMN_VALUE + JSONTABLE_MAX_PATHS)
+#define JSONTABLE_COLUMN_PATH   (JSONTABLE_COLUMN_JSON + 1)
+
+typedef struct _JsonTableCursor
+{
+  sqlite3_vtab_cursor m_base;     /* Base class - must be first */
+  int                 m_eof;      /* True if there is no (more) row */
+  char*               m_zJson;    /* Copy of the input document */
+  sqlite3_int64       m_nJsonAlloc; /* Allocated size of m_zJson */
+  JsonParse           m_parse;    /* Parse tree of the input document */
+  char*               m_zPath[JSONTABLE_MAX_PATHS];
+  JsonNode*           m_node[JSONTABLE_MAX_PATHS];
+} JsonTableCursor;
+
+static int
+JsonTableConnect(sqlite3* db, void* pAux, int argc, const char* const* argv,
+                 sqlite3_vtab** ppVtab, char** pzErr)
+{
+  sqlite3_str* schema;
+  char* zSchema;
+  sqlite3_vtab* vtab;
+  int rc;
+  int j;
+
+  UNUSED_PARAM(pAux);
+  UNUSED_PARAM(argc);
+  UNUSED_PARAM(argv);
+  UNUSED_PARAM(pzErr);
+
+  schema = sqlite3_str_new(db);
+  sqlite3_str_appendall(schema, "CREATE TABLE x(");
+  for (j = 0; j < JSONTABLE_MAX_PATHS; ++j)
+  {
+    sqlite3_str_appendf(schema, "c%d,", j + 1);
+  }
+  sqlite3_str_appendall(schema, "json HIDDEN");
+  for (j = 0; j < JSONTABLE_MAX_PATHS; ++j)
+  {
+    sqlite3_str_appendf(schema, ",path%d HIDDEN", j + 1);
+  }
+  sqlite3_str_appendall(schema, ")");
+  zSchema = sqlite3_str_finish(schema);
+  if (zSchema == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+
+  rc = sqlite3_declare_vtab(db, zSchema);
+  sqlite3_free(zSchema);
+  if (rc == SQLITE_OK)
+  {
+    vtab = *ppVtab = (sqlite3_vtab*) sqlite3_malloc(sizeof(sqlite3_vtab));
+    if (vtab == NULL)
+    {
+      return SQLITE_NOMEM;
+    }
+    memset(vtab, 0, sizeof(sqlite3_vtab));
+  }
+  return rc;
+}
+
+static int
+JsonTableDisconnect(sqlite3_vtab* pVtab)
+{
+  sqlite3_free(pVtab);
+  return SQLITE_OK;
+}
+
+static int
+JsonTableOpen(sqlite3_vtab* pVtab, sqlite3_vtab_cursor** ppCursor)
+{
+  JsonTableCursor* cursor = (JsonTableCursor*) sqlite3_malloc(sizeof(JsonTableCursor));
+  UNUSED_PARAM(pVtab);
+  if (cursor == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  memset(cursor, 0, sizeof(JsonTableCursor));
+  cursor->m_eof = 1;
+  *ppCursor = &cursor->m_base;
+  return SQLITE_OK;
+}
+
+static void
+JsonTableCursorReset(JsonTableCursor* cursor)
+{
+  int j;
+  for (j = 0; j < JSONTABLE_MAX_PATHS; ++j)
+  {
+    cursor->m_node[j] = NULL;
+  }
+  cursor->m_parse.nNode = 0;
+  cursor->m_eof = 1;
+}
+
+static int
+JsonTableClose(sqlite3_vtab_cursor* cur)
+{
+  JsonTableCursor* cursor = (JsonTableCursor*) cur;
+  int j;
+  jsonParseReset(&cursor->m_parse);
+  sqlite3_free(cursor->m_zJson);
+  for (j = 0; j < JSONTABLE_MAX_PATHS; ++j)
+  {
+    sqlite3_free(cursor->m_zPath[j]);
+  }
+  sqlite3_free(cursor);
+  return SQLITE_OK;
+}
+
+/*
+** Parse the document in m_zJson. Unlike jsonParse() the node array of the
+** previous document is reused, avoiding a reallocation for every row.
+*/
+static int
+JsonTableParse(JsonTableCursor* cursor)
+{
+  JsonParse* parse = &cursor->m_parse;
+  const char* zJson = cursor->m_zJson;
+  int i;
+
+  parse->nNode = 0;
+  parse->zJson = zJson;
+  parse->oom = 0;
+  parse->nErr = 0;
+  parse->iDepth = 0;
+  i = jsonParseValue(parse, 0);
+  if (parse->oom)
+  {
+    return SQLITE_NOMEM;
+  }
+  if (i > 0)
+  {
+    while (safe_isspace(zJson[i])) i++;
+    if (zJson[i]) i = -1;
+  }
+  return (i > 0) ? SQLITE_OK : SQLITE_ERROR;
+}
+
+/*
+** Keep a copy of the path, reusing the previous copy if the path did not change
+*/
+static const char*
+JsonTableSetPath(JsonTableCursor* cursor, int j, sqlite3_value* value)
+{
+  const char* zPath = (const char*) sqlite3_value_text(value);
+  if (zPath == NULL)
+  {
+    return NULL;
+  }
+  if (cursor->m_zPath[j] == NULL || strcmp(cursor->m_zPath[j], zPath) != 0)
+  {
+    sqlite3_free(cursor->m_zPath[j]);
+    cursor->m_zPath[j] = sqlite3_mprintf("%s", zPath);
+  }
+  return cursor->m_zPath[j];
+}
+
+static int
+JsonTableNext(sqlite3_vtab_cursor* cur)
+{
+  ((JsonTableCursor*) cur)->m_eof = 1;
+  return SQLITE_OK;
+}
+
+static int
+JsonTableEof(sqlite3_vtab_cursor* cur)
+{
+  return ((JsonTableCursor*) cur)->m_eof;
+}
+
+static int
+JsonTableColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int column)
+{
+  JsonTableCursor* cursor = (JsonTableCursor*) cur;
+  if (column < JSONTABLE_COLUMN_JSON)
+  {
+    JsonNode* node = cursor->m_node[column - JSONTABLE_COLUMN_VALUE];
+    if (node != NULL)
+    {
+      jsonReturn(node, ctx, 0);
+    }
+  }
+  else if (column == JSONTABLE_COLUMN_JSON)
+  {
+    sqlite3_result_text(ctx, cursor->m_zJson, -1, SQLITE_STATIC);
+  }
+  else
+  {
+    sqlite3_result_text(ctx, cursor->m_zPath[column - JSONTABLE_COLUMN_PATH], -1, SQLITE_STATIC);
+  }
+  return SQLITE_OK;
+}
+
+static int
+JsonTableRowid(sqlite3_vtab_cursor* cur, sqlite_int64* pRowid)
+{
+  UNUSED_PARAM(cur);
+  *pRowid = 1;
+  return SQLITE_OK;
+}
+
+/*
+** An equality constraint on the json column is required. Bit 0 of idxNum
+** flags its presence, bit j+1 the presence of the constraint on path j+1.
+** The arguments are passed to xFilter in column order.
+*/
+static int
+JsonTableBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo)
+{
+  int constraintIndex[JSONTABLE_MAX_PATHS + 1];
+  const struct sqlite3_index_constraint* constraint = pIdxInfo->aConstraint;
+  int idxNum = 0;
+  int argvIndex = 0;
+  int j;
+
+  UNUSED_PARAM(tab);
+  for (j = 0; j < pIdxInfo->nConstraint; ++j, ++constraint)
+  {
+    int slot = constraint->iColumn - JSONTABLE_COLUMN_JSON;
+    if (constraint->usable == 0 || constraint->op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+    if (slot < 0 || slot > JSONTABLE_MAX_PATHS) continue;
+    constraintIndex[slot] = j;
+    idxNum |= (1 << slot);
+  }
+  if ((idxNum & 1) == 0)
+  {
+    pIdxInfo->idxNum = 0;
+    pIdxInfo->estimatedCost = 1e99;
+    return SQLITE_OK;
+  }
+  for (j = 0; j <= JSONTABLE_MAX_PATHS; ++j)
+  {
+    if (idxNum & (1 << j))
+    {
+      pIdxInfo->aConstraintUsage[constraintIndex[j]].argvIndex = ++argvIndex;
+      pIdxInfo->aConstraintUsage[constraintIndex[j]].omit = 1;
+    }
+  }
+  pIdxInfo->idxNum = idxNum;
+  pIdxInfo->estimatedCost = 1.0;
+  pIdxInfo->estimatedRows = 1;
+  return SQLITE_OK;
+}
+
+static int
+JsonTableSetError(sqlite3_vtab_cursor* cur, char* zErrMsg)
+{
+  sqlite3_free(cur->pVtab->zErrMsg);
+  cur->pVtab->zErrMsg = zErrMsg;
+  return (zErrMsg != NULL) ? SQLITE_ERROR : SQLITE_NOMEM;
+}
+
+static int
+JsonTableFilter(sqlite3_vtab_cursor* cur, int idxNum, const char* idxStr,
+                int argc, sqlite3_value** argv)
+{
+  JsonTableCursor* cursor = (JsonTableCursor*) cur;
+  const char* zJson;
+  sqlite3_int64 nJson;
+  int iArg = 1;
+  int rc;
+  int j;
+
+  UNUSED_PARAM(idxStr);
+  UNUSED_PARAM(argc);
+  JsonTableCursorReset(cursor);
+  if ((idxNum & 1) == 0)
+  {
+    return SQLITE_OK;
+  }
+  zJson = (const char*) sqlite3_value_text(argv[0]);
+  if (zJson == NULL)
+  {
+    return SQLITE_OK;
+  }
+
+  /* The parse tree points into the document, therefore keep a copy */
+  nJson = sqlite3_value_bytes(argv[0]) + 1;
+  if (nJson > cursor->m_nJsonAlloc)
+  {
+    char* zNew = (char*) sqlite3_realloc64(cursor->m_zJson, nJson);
+    if (zNew == NULL)
+    {
+      return SQLITE_NOMEM;
+    }
+    cursor->m_zJson = zNew;
+    cursor->m_nJsonAlloc = nJson;
+  }
+  memcpy(cursor->m_zJson, zJson, (size_t) nJson);
+
+  rc = JsonTableParse(cursor);
+  if (rc != SQLITE_OK)
+  {
+    JsonTableCursorReset(cursor);
+    return (rc == SQLITE_NOMEM) ? rc : JsonTableSetError(cur, sqlite3_mprintf("malformed JSON"));
+  }
+
+  /* Look up all requested paths in the single parse tree */
+  for (j = 0; j < JSONTABLE_MAX_PATHS; ++j)
+  {
+    const char* zPath;
+    const char* zErr = NULL;
+    if ((idxNum & (2 << j)) == 0) continue;
+    if (sqlite3_value_type(argv[iArg]) == SQLITE_NULL)
+    {
+      sqlite3_free(cursor->m_zPath[j]);
+      cursor->m_zPath[j] = NULL;
+      ++iArg;
+      continue;
+    }
+    zPath = JsonTableSetPath(cursor, j, argv[iArg++]);
+    if (zPath == NULL)
+    {
+      JsonTableCursorReset(cursor);
+      return SQLITE_NOMEM;
+    }
+    if (zPath[0] != '$')
+    {
+      zErr = zPath;
+    }
+    else
+    {
+      cursor->m_node[j] = jsonLookupStep(&cursor->m_parse, 0, zPath + 1, 0, &zErr);
+    }
+    if (zErr != NULL)
+    {
+      rc = JsonTableSetError(cur, jsonPathSyntaxError(zErr));
+      JsonTableCursorReset(cursor);
+      return rc;
+    }
+  }
+  cursor->m_eof = 0;
+  return SQLITE_OK;
+}
+
+static sqlite3_module jsonTableModule =
+{
+  0,                     /* iVersion */
+  0,                     /* xCreate */
+  JsonTableConnect,      /* xConnect */
+  JsonTableBestIndex,    /* xBestIndex */
+  JsonTableDisconnect,   /* xDisconnect */
+  0,                     /* xDestroy */
+  JsonTableOpen,         /* xOpen - open a cursor */
+  JsonTableClose,        /* xClose - close a cursor */
+  JsonTableFilter,       /* xFilter - configure scan constraints */
+  JsonTableNext,         /* xNext - advance a cursor */
+  JsonTableEof,          /* xEof - check for end of scan */
+  JsonTableColumn,       /* xColumn - read data */
+  JsonTableRowid,        /* xRowid - read data */
+  0,                     /* xUpdate */
+  0,                     /* xBegin */
+  0,                     /* xSync */
+  0,                     /* xCommit */
+  0,                     /* xRollback */
+  0,                     /* xFindMethod */
+  0,                     /* xRename */
+  0,                     /* xSavepoint */
+  0,                     /* xRelease */
+  0                      /* xRollbackTo */
+};
+
+int
+sqlite3_jsontable_init(sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi)
+{
+  return sqlite3_create_module(db, "json_table", &jsonTableModule, NULL);
+}
+
+#endif
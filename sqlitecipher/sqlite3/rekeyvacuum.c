@@ -26,7 +26,7 @@
 /*
 ** This routine implements the OP_Vacuum opcode of the VDBE.
 */
-/* CHANGE 1 of 3: Add function parameter nRes */
+/* CHANGE 1 of 4: Add function parameter nRes */
 SQLITE_PRIVATE int sqlite3RunVacuumForRekey(char **pzErrMsg, sqlite3 *db, int iDb, int nRes){
   int rc = SQLITE_OK;     /* Return code from service routines */
   Btree *pMain;           /* The database being vacuumed */
@@ -38,7 +38,7 @@ SQLITE_PRIVATE int sqlite3RunVacuumForRekey(char **pzErrMsg, sqlite3 *db, int iD
   u8 saved_mTrace;        /* Saved trace settings */
   Db *pDb = 0;            /* Database to detach at end of vacuum */
   int isMemDb;            /* True if vacuuming a :memory: database */
-  /* CHANGE 2 of 3: Do not define local variable nRes */
+  /* CHANGE 2 of 4: Do not define local variable nRes */
   /*int nRes;*/               /* Bytes of reserved space at the end of each page */
   int nDb;                /* Number of attached databases */
   const char *zDbMain;    /* Schema name of database to vacuum */
@@ -84,7 +84,11 @@ SQLITE_PRIVATE int sqlite3RunVacuumForRekey(char **pzErrMsg, sqlite3 *db, int iD
   ** to write the journal header file.
   */
   nDb = db->nDb;
-  rc = execSql(db, pzErrMsg, "ATTACH''AS vacuum_db");
+  /* CHANGE 3 of 4: Attach an in-memory database. The attached database gets
+  ** a copy of the codec, which cannot follow the change of nRes, while the
+  ** pager of an in-memory database does not use the codec. A temporary file
+  ** is no longer in memory since SQLITE_TEMP_STORE=1 */
+  rc = execSql(db, pzErrMsg, "ATTACH':memory:'AS vacuum_db");
   if (rc != SQLITE_OK) goto end_of_vacuum;
   assert((db->nDb - 1) == nDb);
   pDb = &db->aDb[nDb];
@@ -97,7 +101,7 @@ SQLITE_PRIVATE int sqlite3RunVacuumForRekey(char **pzErrMsg, sqlite3 *db, int iD
   ** cause problems for the call to BtreeSetPageSize() below.  */
   sqlite3BtreeCommit(pTemp);
 
-  /* CHANGE 3 of 3: Do not call sqlite3BtreeGetOptimalReserve */
+  /* CHANGE 4 of 4: Do not call sqlite3BtreeGetOptimalReserve */
   /* nRes = sqlite3BtreeGetOptimalReserve(pMain); */
 
   /* A VACUUM cannot change the pagesize of an encrypted database. */
@@ -0,0 +1,569 @@
+/*
+** Name:        rtreebulk.c
+** Purpose:     Bulk loading of R-Tree tables using Sort-Tile-Recursive packing
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** This extension adds the SQL function
+**
+**   rtree_bulkload(RTREE, SOURCE)
+**   rtree_bulkload(SCHEMA, RTREE, SOURCE)
+**
+** RTREE is the name of an empty 2-dimensional R-Tree virtual table.
+** SOURCE is a SELECT statement returning rows of the form
+** (id, minX, maxX, minY, maxY).
+**
+** Instead of inserting the entries one by one through the virtual table
+** (which causes many node splits and leaves the tree poorly packed) the
+** entries are sorted according to the Sort-Tile-Recursive (STR) algorithm
+** and written as completely filled nodes directly into the shadow tables
+** of the R-Tree. The function returns the number of loaded entries.
+**
+** The load is performed within a savepoint, that is, either all entries
+** are loaded or the R-Tree is left unchanged.
+*/
+
+#if defined(SQLITE_ENABLE_RTREE) && !defined(SQLITE_OMIT_VIRTUALTABLE)
+
+#include <math.h>
+
+#define RTREEBULK_DIMENSIONS  2
+#define RTREEBULK_CELL_SIZE   (8 + RTREEBULK_DIMENSIONS * 2 * 4)
+
+typedef struct _RtreeBulkEntry
+{
+  sqlite3_int64 m_id;             /* Rowid (leaf level) or node number */
+  RtreeCoord    m_coord[RTREEBULK_DIMENSIONS * 2];
+  double        m_center[RTREEBULK_DIMENSIONS];
+} RtreeBulkEntry;
+
+typedef struct _RtreeBulkLoader
+{
+  sqlite3*       m_db;
+  const char*    m_zDb;
+  const char*    m_zName;
+  int            m_isInt;         /* 1 for rtree_i32, 0 for rtree */
+  int            m_nodeSize;      /* Size of a node blob in bytes */
+  int            m_maxCells;      /* Maximum number of cells per node */
+  sqlite3_int64  m_nextNode;      /* Next free node number */
+  sqlite3_stmt*  m_writeNode;
+  sqlite3_stmt*  m_writeRowid;
+  sqlite3_stmt*  m_writeParent;
+  unsigned char* m_nodeBuffer;
+} RtreeBulkLoader;
+
+static int
+RtreeBulkCompareX(const void* a, const void* b)
+{
+  double ca = ((const RtreeBulkEntry*) a)->m_center[0];
+  double cb = ((const RtreeBulkEntry*) b)->m_center[0];
+  return (ca < cb) ? -1 : (ca > cb) ? 1 : 0;
+}
+
+static int
+RtreeBulkCompareY(const void* a, const void* b)
+{
+  double ca = ((const RtreeBulkEntry*) a)->m_center[1];
+  double cb = ((const RtreeBulkEntry*) b)->m_center[1];
+  return (ca < cb) ? -1 : (ca > cb) ? 1 : 0;
+}
+
+/*
+** Return the coordinate as double value
+*/
+static double
+RtreeBulkCoordValue(RtreeBulkLoader* loader, RtreeCoord* coord)
+{
+#ifndef SQLITE_RTREE_INT_ONLY
+  if (!loader->m_isInt)
+  {
+    return (double) coord->f;
+  }
+#endif
+  return (double) coord->i;
+}
+
+/*
+** Convert a source value into an R-Tree coordinate.
+** Minimum values are rounded down, maximum values are rounded up,
+** exactly as the R-Tree module does it on insert.
+*/
+static void
+RtreeBulkSetCoord(RtreeBulkLoader* loader, sqlite3_value* value, int roundUp, RtreeCoord* coord)
+{
+#ifndef SQLITE_RTREE_INT_ONLY
+  if (!loader->m_isInt)
+  {
+    double d = sqlite3_value_double(value);
+    float f = (float) d;
+    if (roundUp)
+    {
+      if (f < d) f = (float)(d * (d < 0 ? RNDTOWARDS : RNDAWAY));
+    }
+    else
+    {
+      if (f > d) f = (float)(d * (d < 0 ? RNDAWAY : RNDTOWARDS));
+    }
+    coord->f = f;
+    return;
+  }
+#endif
+  coord->i = sqlite3_value_int(value);
+}
+
+/*
+** Write a node consisting of the given entries to the node shadow table
+*/
+static int
+RtreeBulkWriteNode(RtreeBulkLoader* loader, sqlite3_int64 nodeNo, int depth,
+                   RtreeBulkEntry* entries, int nEntries)
+{
+  int rc;
+  int j, k;
+  unsigned char* p = loader->m_nodeBuffer;
+
+  memset(p, 0, loader->m_nodeSize);
+  writeInt16(p, (nodeNo == 1) ? depth : 0);
+  writeInt16(p + 2, nEntries);
+  p += 4;
+  for (j = 0; j < nEntries; ++j)
+  {
+    p += writeInt64(p, entries[j].m_id);
+    for (k = 0; k < RTREEBULK_DIMENSIONS * 2; ++k)
+    {
+      p += writeCoord(p, &entries[j].m_coord[k]);
+    }
+  }
+
+  sqlite3_bind_int64(loader->m_writeNode, 1, nodeNo);
+  sqlite3_bind_blob(loader->m_writeNode, 2, loader->m_nodeBuffer, loader->m_nodeSize, SQLITE_STATIC);
+  sqlite3_step(loader->m_writeNode);
+  rc = sqlite3_reset(loader->m_writeNode);
+  return rc;
+}
+
+static int
+RtreeBulkWriteMapping(sqlite3_stmt* stmt, sqlite3_int64 key, sqlite3_int64 value)
+{
+  sqlite3_bind_int64(stmt, 1, key);
+  sqlite3_bind_int64(stmt, 2, value);
+  sqlite3_step(stmt);
+  return sqlite3_reset(stmt);
+}
+
+/*
+** Compute the bounding box of a group of entries
+*/
+static void
+RtreeBulkBoundingBox(RtreeBulkLoader* loader, RtreeBulkEntry* entries, int nEntries, RtreeBulkEntry* box)
+{
+  int j, k;
+  *box = entries[0];
+  for (j = 1; j < nEntries; ++j)
+  {
+    for (k = 0; k < RTREEBULK_DIMENSIONS; ++k)
+    {
+      RtreeCoord* lo = &entries[j].m_coord[2 * k];
+      RtreeCoord* hi = &entries[j].m_coord[2 * k + 1];
+      if (RtreeBulkCoordValue(loader, lo) < RtreeBulkCoordValue(loader, &box->m_coord[2 * k]))
+      {
+        box->m_coord[2 * k] = *lo;
+      }
+      if (RtreeBulkCoordValue(loader, hi) > RtreeBulkCoordValue(loader, &box->m_coord[2 * k + 1]))
+      {
+        box->m_coord[2 * k + 1] = *hi;
+      }
+    }
+  }
+  for (k = 0; k < RTREEBULK_DIMENSIONS; ++k)
+  {
+    box->m_center[k] = (RtreeBulkCoordValue(loader, &box->m_coord[2 * k]) +
+                        RtreeBulkCoordValue(loader, &box->m_coord[2 * k + 1])) / 2.0;
+  }
+}
+
+/*
+** Order the entries of one tree level according to the STR algorithm:
+** sort by x center, cut into vertical slices of S*M entries,
+** and sort each slice by y center.
+*/
+static void
+RtreeBulkSortLevel(RtreeBulkLoader* loader, RtreeBulkEntry* entries, int nEntries)
+{
+  int M = loader->m_maxCells;
+  int nNodes = (nEntries + M - 1) / M;
+  int nSlices = (int) ceil(sqrt((double) nNodes));
+  int sliceSize = nSlices * M;
+  int j;
+
+  qsort(entries, nEntries, sizeof(RtreeBulkEntry), RtreeBulkCompareX);
+  for (j = 0; j < nEntries; j += sliceSize)
+  {
+    int n = (nEntries - j < sliceSize) ? nEntries - j : sliceSize;
+    qsort(entries + j, n, sizeof(RtreeBulkEntry), RtreeBulkCompareY);
+  }
+}
+
+/*
+** Pack one level of the tree. The entries are grouped into nodes which
+** are written to the database, the array is replaced in place by the
+** bounding boxes of the written nodes. Returns the number of nodes.
+*/
+static int
+RtreeBulkPackLevel(RtreeBulkLoader* loader, RtreeBulkEntry* entries, int nEntries,
+                   int isLeaf, int* pnNodes)
+{
+  int rc = SQLITE_OK;
+  int M = loader->m_maxCells;
+  int nNodes = 0;
+  int j, k;
+
+  RtreeBulkSortLevel(loader, entries, nEntries);
+  for (j = 0; rc == SQLITE_OK && j < nEntries; j += M)
+  {
+    int n = (nEntries - j < M) ? nEntries - j : M;
+    sqlite3_int64 nodeNo = loader->m_nextNode++;
+    RtreeBulkEntry box;
+
+    rc = RtreeBulkWriteNode(loader, nodeNo, 0, entries + j, n);
+    for (k = 0; rc == SQLITE_OK && k < n; ++k)
+    {
+      rc = (isLeaf) ? RtreeBulkWriteMapping(loader->m_writeRowid, entries[j + k].m_id, nodeNo)
+                    : RtreeBulkWriteMapping(loader->m_writeParent, entries[j + k].m_id, nodeNo);
+    }
+    RtreeBulkBoundingBox(loader, entries + j, n, &box);
+    box.m_id = nodeNo;
+    /* Node bounding boxes never overtake unprocessed entries, since nNodes <= j */
+    entries[nNodes++] = box;
+  }
+  *pnNodes = nNodes;
+  return rc;
+}
+
+/*
+** Determine node size and coordinate type of the target R-Tree
+** and check that the tree is empty.
+*/
+static int
+RtreeBulkInspect(RtreeBulkLoader* loader, char** pzErr)
+{
+  int rc;
+  sqlite3_stmt* stmt = NULL;
+  char* zSql;
+  int nCol = 0;
+  int isEmpty = 0;
+
+  zSql = sqlite3_mprintf("SELECT sql LIKE '%%rtree_i32%%' FROM \"%w\".sqlite_master WHERE type='table' AND name=%Q AND sql LIKE 'CREATE VIRTUAL TABLE%%'",
+                         loader->m_zDb, loader->m_zName);
+  rc = (zSql != NULL) ? sqlite3_prepare_v2(loader->m_db, zSql, -1, &stmt, NULL) : SQLITE_NOMEM;
+  sqlite3_free(zSql);
+  if (rc == SQLITE_OK)
+  {
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      loader->m_isInt = sqlite3_column_int(stmt, 0);
+    }
+    else
+    {
+      *pzErr = sqlite3_mprintf("no such R-Tree table: %s", loader->m_zName);
+      rc = SQLITE_ERROR;
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    zSql = sqlite3_mprintf("SELECT * FROM \"%w\".\"%w\" LIMIT 0", loader->m_zDb, loader->m_zName);
+    rc = (zSql != NULL) ? sqlite3_prepare_v2(loader->m_db, zSql, -1, &stmt, NULL) : SQLITE_NOMEM;
+    sqlite3_free(zSql);
+    if (rc == SQLITE_OK)
+    {
+      nCol = sqlite3_column_count(stmt);
+      sqlite3_finalize(stmt);
+    }
+    if (rc == SQLITE_OK && nCol != 1 + RTREEBULK_DIMENSIONS * 2)
+    {
+      *pzErr = sqlite3_mprintf("rtree_bulkload supports 2-dimensional R-Trees without auxiliary columns only");
+      rc = SQLITE_ERROR;
+    }
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    zSql = sqlite3_mprintf("SELECT length(data), (SELECT count(*) FROM \"%w\".\"%w_node\") = 1 AND NOT EXISTS (SELECT 1 FROM \"%w\".\"%w_rowid\") "
+                           "FROM \"%w\".\"%w_node\" WHERE nodeno=1",
+                           loader->m_zDb, loader->m_zName, loader->m_zDb, loader->m_zName, loader->m_zDb, loader->m_zName);
+    rc = (zSql != NULL) ? sqlite3_prepare_v2(loader->m_db, zSql, -1, &stmt, NULL) : SQLITE_NOMEM;
+    sqlite3_free(zSql);
+    if (rc == SQLITE_OK)
+    {
+      if (sqlite3_step(stmt) == SQLITE_ROW)
+      {
+        loader->m_nodeSize = sqlite3_column_int(stmt, 0);
+        isEmpty = sqlite3_column_int(stmt, 1);
+      }
+      rc = sqlite3_finalize(stmt);
+    }
+    if (rc == SQLITE_OK && (loader->m_nodeSize < 4 + RTREEBULK_CELL_SIZE * 2))
+    {
+      *pzErr = sqlite3_mprintf("invalid root node of R-Tree %s", loader->m_zName);
+      rc = SQLITE_CORRUPT_VTAB;
+    }
+    if (rc == SQLITE_OK && !isEmpty)
+    {
+      *pzErr = sqlite3_mprintf("rtree_bulkload requires an empty R-Tree");
+      rc = SQLITE_ERROR;
+    }
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    loader->m_maxCells = (loader->m_nodeSize - 4) / RTREEBULK_CELL_SIZE;
+  }
+  return rc;
+}
+
+/*
+** Read all entries of the source query into memory
+*/
+static int
+RtreeBulkReadSource(RtreeBulkLoader* loader, const char* zSource,
+                    RtreeBulkEntry** pEntries, int* pnEntries, char** pzErr)
+{
+  int rc;
+  sqlite3_stmt* stmt = NULL;
+  RtreeBulkEntry* entries = NULL;
+  int nEntries = 0;
+  int nAlloc = 0;
+
+  rc = sqlite3_prepare_v2(loader->m_db, zSource, -1, &stmt, NULL);
+  if (rc != SQLITE_OK)
+  {
+    *pzErr = sqlite3_mprintf("%s", sqlite3_errmsg(loader->m_db));
+    return rc;
+  }
+  if (sqlite3_column_count(stmt) != 1 + RTREEBULK_DIMENSIONS * 2)
+  {
+    *pzErr = sqlite3_mprintf("source query must return (id, minX, maxX, minY, maxY)");
+    sqlite3_finalize(stmt);
+    return SQLITE_ERROR;
+  }
+
+  while (rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    RtreeBulkEntry* entry;
+    int k;
+    if (nEntries == nAlloc)
+    {
+      int nNew = (nAlloc > 0) ? nAlloc * 2 : 1024;
+      RtreeBulkEntry* newEntries = (RtreeBulkEntry*) sqlite3_realloc64(entries, (sqlite3_uint64) nNew * sizeof(RtreeBulkEntry));
+      if (newEntries == NULL)
+      {
+        rc = SQLITE_NOMEM;
+        break;
+      }
+      entries = newEntries;
+      nAlloc = nNew;
+    }
+    entry = &entries[nEntries++];
+    entry->m_id = sqlite3_column_int64(stmt, 0);
+    for (k = 0; k < RTREEBULK_DIMENSIONS; ++k)
+    {
+      RtreeBulkSetCoord(loader, sqlite3_column_value(stmt, 1 + 2 * k), 0, &entry->m_coord[2 * k]);
+      RtreeBulkSetCoord(loader, sqlite3_column_value(stmt, 2 + 2 * k), 1, &entry->m_coord[2 * k + 1]);
+      if (RtreeBulkCoordValue(loader, &entry->m_coord[2 * k]) > RtreeBulkCoordValue(loader, &entry->m_coord[2 * k + 1]))
+      {
+        *pzErr = sqlite3_mprintf("invalid bounding box for id %lld", entry->m_id);
+        rc = SQLITE_CONSTRAINT;
+        break;
+      }
+      entry->m_center[k] = (RtreeBulkCoordValue(loader, &entry->m_coord[2 * k]) +
+                            RtreeBulkCoordValue(loader, &entry->m_coord[2 * k + 1])) / 2.0;
+    }
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_finalize(stmt);
+    if (rc != SQLITE_OK)
+    {
+      *pzErr = sqlite3_mprintf("%s", sqlite3_errmsg(loader->m_db));
+    }
+  }
+  else
+  {
+    sqlite3_finalize(stmt);
+  }
+
+  if (rc == SQLITE_OK)
+  {
+    *pEntries = entries;
+    *pnEntries = nEntries;
+  }
+  else
+  {
+    sqlite3_free(entries);
+  }
+  return rc;
+}
+
+static int
+RtreeBulkPrepare(RtreeBulkLoader* loader, sqlite3_stmt** stmt, const char* zFormat)
+{
+  int rc;
+  char* zSql = sqlite3_mprintf(zFormat, loader->m_zDb, loader->m_zName);
+  rc = (zSql != NULL) ? sqlite3_prepare_v2(loader->m_db, zSql, -1, stmt, NULL) : SQLITE_NOMEM;
+  sqlite3_free(zSql);
+  return rc;
+}
+
+/*
+** Build the packed tree. Levels are packed bottom up, the last level
+** consisting of at most M entries becomes the root node (node 1).
+*/
+static int
+RtreeBulkBuild(RtreeBulkLoader* loader, RtreeBulkEntry* entries, int nEntries)
+{
+  int rc = SQLITE_OK;
+  int depth = 0;
+  int isLeaf = 1;
+  int j;
+
+  loader->m_nextNode = 2;
+  while (rc == SQLITE_OK && nEntries > loader->m_maxCells)
+  {
+    rc = RtreeBulkPackLevel(loader, entries, nEntries, isLeaf, &nEntries);
+    isLeaf = 0;
+    ++depth;
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = RtreeBulkWriteNode(loader, 1, depth, entries, nEntries);
+  }
+  for (j = 0; rc == SQLITE_OK && j < nEntries; ++j)
+  {
+    rc = (isLeaf) ? RtreeBulkWriteMapping(loader->m_writeRowid, entries[j].m_id, 1)
+                  : RtreeBulkWriteMapping(loader->m_writeParent, entries[j].m_id, 1);
+  }
+  return rc;
+}
+
+static int
+RtreeBulkLoad(sqlite3* db, const char* zDb, const char* zName, const char* zSource,
+              sqlite3_int64* pnLoaded, char** pzErr)
+{
+  int rc;
+  RtreeBulkLoader loader;
+  RtreeBulkEntry* entries = NULL;
+  int nEntries = 0;
+
+  memset(&loader, 0, sizeof(loader));
+  loader.m_db = db;
+  loader.m_zDb = zDb;
+  loader.m_zName = zName;
+
+  rc = RtreeBulkInspect(&loader, pzErr);
+  if (rc == SQLITE_OK)
+  {
+    rc = RtreeBulkReadSource(&loader, zSource, &entries, &nEntries, pzErr);
+  }
+  if (rc == SQLITE_OK)
+  {
+    loader.m_nodeBuffer = (unsigned char*) sqlite3_malloc(loader.m_nodeSize);
+    rc = (loader.m_nodeBuffer != NULL) ? SQLITE_OK : SQLITE_NOMEM;
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = RtreeBulkPrepare(&loader, &loader.m_writeNode, "INSERT OR REPLACE INTO \"%w\".\"%w_node\"(nodeno, data) VALUES(?1, ?2)");
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = RtreeBulkPrepare(&loader, &loader.m_writeRowid, "INSERT INTO \"%w\".\"%w_rowid\"(rowid, nodeno) VALUES(?1, ?2)");
+  }
+  if (rc == SQLITE_OK)
+  {
+    rc = RtreeBulkPrepare(&loader, &loader.m_writeParent, "INSERT INTO \"%w\".\"%w_parent\"(nodeno, parentnode) VALUES(?1, ?2)");
+  }
+
+  if (rc == SQLITE_OK && nEntries > 0)
+  {
+    rc = sqlite3_exec(db, "SAVEPOINT rtree_bulkload", NULL, NULL, NULL);
+    if (rc == SQLITE_OK)
+    {
+      rc = RtreeBulkBuild(&loader, entries, nEntries);
+      if (rc == SQLITE_OK)
+      {
+        rc = sqlite3_exec(db, "RELEASE rtree_bulkload", NULL, NULL, NULL);
+      }
+      else
+      {
+        if (*pzErr == NULL)
+        {
+          *pzErr = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+        }
+        sqlite3_exec(db, "ROLLBACK TO rtree_bulkload; RELEASE rtree_bulkload", NULL, NULL, NULL);
+      }
+    }
+  }
+
+  sqlite3_finalize(loader.m_writeNode);
+  sqlite3_finalize(loader.m_writeRowid);
+  sqlite3_finalize(loader.m_writeParent);
+  sqlite3_free(loader.m_nodeBuffer);
+  sqlite3_free(entries);
+
+  if (rc == SQLITE_OK)
+  {
+    *pnLoaded = nEntries;
+  }
+  else if (*pzErr == NULL)
+  {
+    *pzErr = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+  }
+  return rc;
+}
+
+static void
+RtreeBulkLoadFunc(sqlite3_context* context, int argc, sqlite3_value** argv)
+{
+  sqlite3* db = sqlite3_context_db_handle(context);
+  const char* zDb = (argc == 3) ? (const char*) sqlite3_value_text(argv[0]) : "main";
+  const char* zName = (const char*) sqlite3_value_text(argv[argc - 2]);
+  const char* zSource = (const char*) sqlite3_value_text(argv[argc - 1]);
+  sqlite3_int64 nLoaded = 0;
+  char* zErr = NULL;
+  int rc;
+
+  if (zDb == NULL || zName == NULL || zSource == NULL)
+  {
+    sqlite3_result_error(context, "rtree_bulkload: arguments must not be NULL", -1);
+    return;
+  }
+  rc = RtreeBulkLoad(db, zDb, zName, zSource, &nLoaded, &zErr);
+  if (rc == SQLITE_OK)
+  {
+    sqlite3_result_int64(context, nLoaded);
+  }
+  else
+  {
+    sqlite3_result_error(context, (zErr != NULL) ? zErr : sqlite3_errstr(rc), -1);
+    sqlite3_result_error_code(context, rc);
+  }
+  sqlite3_free(zErr);
+}
+
+int
+sqlite3_rtreebulk_init(sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi)
+{
+  int rc = sqlite3_create_function(db, "rtree_bulkload", 2, SQLITE_UTF8, NULL, RtreeBulkLoadFunc, NULL, NULL);
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_create_function(db, "rtree_bulkload", 3, SQLITE_UTF8, NULL, RtreeBulkLoadFunc, NULL, NULL);
+  }
+  return rc;
+}
+
+#endif
@@ -0,0 +1,508 @@
+/*
+** Name:        sharedpages.c
+** Purpose:     Process-wide store of decrypted pages shared between connections
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** Every connection has a private page cache, so N pooled connections to the
+** same encrypted file read and decrypt the same hot pages N times. SQLite's
+** shared-cache mode avoids that, but serializes the connections through
+** table-level locks.
+**
+** The store below keeps decrypted pages once per process. The pager of a
+** connection in a read transaction looks a page up before it reads it from
+** the database file, and offers every page it decrypted. Connections can
+** then run with a small cache_size while the store holds the hot pages.
+** Sharing pcache buffers directly (sqlite3_pcache_methods2) is not possible:
+** the pager modifies cached pages in place and keeps its own state in them.
+**
+** A page is identified by a scope (file name, the identity of the file on
+** unix, and everything determining its plaintext, see CodecHashReadKey),
+** its number and the version of the file:
+**
+** - With a rollback journal, bytes 24..39 of page 1 as stored in the file.
+**   Every commit increments the change counter in this range, and since it
+**   is encrypted the stored bytes change with it.
+** - With a WAL, the salts of the WAL (changed by every restart) and the
+**   number of frames backfilled into the database file, which grows with
+**   every checkpoint that changes the file. The pager only reads a page from
+**   the database file if the WAL has no frame for it in the snapshot, and a
+**   checkpoint never backfills beyond the snapshot of an active reader.
+**
+** Only connections holding nothing but a shared lock take part. A writer may
+** read back pages it spilled to the file before committing, those must not
+** be shared. Page 1 is not shared: the pager reads the file version from it.
+** Pages of registered ciphers are not shared either, as their key is opaque.
+**
+** The store is off until wxsqlite3_shared_pages_limit() sets its size. It is
+** split into stripes with their own mutex and LRU list, so that concurrent
+** readers rarely wait for each other. The pages of a scope are dropped when
+** the last connection using it is closed or rekeyed: a file created again
+** under the same name and key may otherwise match the old version bytes,
+** since the AES ciphers encrypt page 1 with a deterministic IV.
+*/
+
+#define SHARED_PAGES_STRIPES    16
+#define SHARED_PAGES_MIN_HASH   256
+
+typedef struct _SharedPage
+{
+  struct _SharedPage* m_hashNext;
+  struct _SharedPage* m_lruPrev;     /* More recently used */
+  struct _SharedPage* m_lruNext;     /* Less recently used */
+  unsigned int        m_hash;
+  Pgno                m_pgno;
+  int                 m_pageSize;
+  unsigned char       m_scope[16];
+  unsigned char       m_version[16];
+  /* Page data follows */
+} SharedPage;
+
+typedef struct _SharedPagesStripe
+{
+  sqlite3_mutex*  m_mutex;
+  SharedPage**    m_hashTable;
+  unsigned int    m_hashSize;        /* Power of 2 */
+  unsigned int    m_pageCount;
+  SharedPage*     m_lruFirst;
+  SharedPage*     m_lruLast;
+  sqlite3_int64   m_bytes;
+} SharedPagesStripe;
+
+typedef struct _SharedPagesScope
+{
+  unsigned char m_scope[16];
+  int           m_refs;              /* Codecs using the scope */
+} SharedPagesScope;
+
+static sqlite3_int64 sharedPagesLimit = 0;
+static SharedPagesStripe sharedPagesStripes[SHARED_PAGES_STRIPES];
+/* Scopes in use, guarded by the master mutex */
+static SharedPagesScope* sharedPagesScopes = NULL;
+static int sharedPagesScopeCount = 0;
+static int sharedPagesScopeSize = 0;
+
+/* --- Stripes, called with the stripe mutex held --- */
+
+static void
+SharedPagesLruUnlink(SharedPagesStripe* stripe, SharedPage* page)
+{
+  if (page->m_lruPrev != NULL) page->m_lruPrev->m_lruNext = page->m_lruNext;
+  else stripe->m_lruFirst = page->m_lruNext;
+  if (page->m_lruNext != NULL) page->m_lruNext->m_lruPrev = page->m_lruPrev;
+  else stripe->m_lruLast = page->m_lruPrev;
+  page->m_lruPrev = page->m_lruNext = NULL;
+}
+
+static void
+SharedPagesLruPush(SharedPagesStripe* stripe, SharedPage* page)
+{
+  page->m_lruPrev = NULL;
+  page->m_lruNext = stripe->m_lruFirst;
+  if (stripe->m_lruFirst != NULL) stripe->m_lruFirst->m_lruPrev = page;
+  else stripe->m_lruLast = page;
+  stripe->m_lruFirst = page;
+}
+
+static SharedPage*
+SharedPagesFind(SharedPagesStripe* stripe, unsigned int hash, const unsigned char* scope, Pgno pgno)
+{
+  SharedPage* page;
+  if (stripe->m_hashTable == NULL)
+  {
+    return NULL;
+  }
+  page = stripe->m_hashTable[(hash / SHARED_PAGES_STRIPES) & (stripe->m_hashSize - 1)];
+  while (page != NULL && (page->m_pgno != pgno || memcmp(page->m_scope, scope, 16) != 0))
+  {
+    page = page->m_hashNext;
+  }
+  return page;
+}
+
+static void
+SharedPagesRemove(SharedPagesStripe* stripe, SharedPage* page)
+{
+  SharedPage** pp = &stripe->m_hashTable[(page->m_hash / SHARED_PAGES_STRIPES) & (stripe->m_hashSize - 1)];
+  while (*pp != page)
+  {
+    pp = &(*pp)->m_hashNext;
+  }
+  *pp = page->m_hashNext;
+  SharedPagesLruUnlink(stripe, page);
+  stripe->m_pageCount--;
+  stripe->m_bytes -= sizeof(SharedPage) + page->m_pageSize;
+  sqlite3_free(page);
+}
+
+static void
+SharedPagesInsert(SharedPagesStripe* stripe, SharedPage* page)
+{
+  unsigned int slot;
+  if (stripe->m_pageCount >= stripe->m_hashSize)
+  {
+    /* Grow the hash table; if that fails, the chains just get longer */
+    unsigned int newSize = (stripe->m_hashSize > 0) ? 2 * stripe->m_hashSize : SHARED_PAGES_MIN_HASH;
+    SharedPage** newTable = (SharedPage**) sqlite3_malloc64(newSize * sizeof(SharedPage*));
+    if (newTable != NULL)
+    {
+      unsigned int j;
+      memset(newTable, 0, newSize * sizeof(SharedPage*));
+      for (j = 0; j < stripe->m_hashSize; ++j)
+      {
+        SharedPage* next;
+        SharedPage* p;
+        for (p = stripe->m_hashTable[j]; p != NULL; p = next)
+        {
+          next = p->m_hashNext;
+          slot = (p->m_hash / SHARED_PAGES_STRIPES) & (newSize - 1);
+          p->m_hashNext = newTable[slot];
+          newTable[slot] = p;
+        }
+      }
+      sqlite3_free(stripe->m_hashTable);
+      stripe->m_hashTable = newTable;
+      stripe->m_hashSize = newSize;
+    }
+  }
+  slot = (page->m_hash / SHARED_PAGES_STRIPES) & (stripe->m_hashSize - 1);
+  page->m_hashNext = stripe->m_hashTable[slot];
+  stripe->m_hashTable[slot] = page;
+  SharedPagesLruPush(stripe, page);
+  stripe->m_pageCount++;
+  stripe->m_bytes += sizeof(SharedPage) + page->m_pageSize;
+}
+
+static void
+SharedPagesShrink(SharedPagesStripe* stripe, sqlite3_int64 limit, SharedPage* keep)
+{
+  while (stripe->m_bytes > limit && stripe->m_lruLast != NULL && stripe->m_lruLast != keep)
+  {
+    SharedPagesRemove(stripe, stripe->m_lruLast);
+  }
+  if (stripe->m_pageCount == 0)
+  {
+    sqlite3_free(stripe->m_hashTable);
+    stripe->m_hashTable = NULL;
+    stripe->m_hashSize = 0;
+  }
+}
+
+/* --- Scopes --- */
+
+/*
+** Count a codec using the scope. Returns 0 if the scope cannot be recorded,
+** the codec then does not share its pages.
+*/
+static int
+SharedPagesScopeAcquire(const unsigned char* scope)
+{
+  sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  int ok = 1;
+  int j;
+  sqlite3_mutex_enter(mutex);
+  for (j = 0; j < sharedPagesScopeCount && memcmp(sharedPagesScopes[j].m_scope, scope, 16) != 0; ++j);
+  if (j == sharedPagesScopeCount && sharedPagesScopeCount == sharedPagesScopeSize)
+  {
+    int newSize = (sharedPagesScopeSize > 0) ? 2 * sharedPagesScopeSize : 8;
+    SharedPagesScope* scopes = (SharedPagesScope*) sqlite3_realloc(sharedPagesScopes, newSize * sizeof(SharedPagesScope));
+    if (scopes != NULL)
+    {
+      sharedPagesScopes = scopes;
+      sharedPagesScopeSize = newSize;
+    }
+    else
+    {
+      ok = 0;
+    }
+  }
+  if (ok)
+  {
+    if (j == sharedPagesScopeCount)
+    {
+      memcpy(sharedPagesScopes[j].m_scope, scope, 16);
+      sharedPagesScopes[j].m_refs = 0;
+      sharedPagesScopeCount++;
+    }
+    sharedPagesScopes[j].m_refs++;
+  }
+  sqlite3_mutex_leave(mutex);
+  return ok;
+}
+
+/*
+** A codec no longer uses the scope. The pages of the scope are dropped with
+** its last codec.
+*/
+void
+SharedPagesScopeRelease(const unsigned char* scope)
+{
+  sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  int j;
+  sqlite3_mutex_enter(mutex);
+  for (j = 0; j < sharedPagesScopeCount && memcmp(sharedPagesScopes[j].m_scope, scope, 16) != 0; ++j);
+  if (j < sharedPagesScopeCount && --sharedPagesScopes[j].m_refs == 0)
+  {
+    int k;
+    sharedPagesScopes[j] = sharedPagesScopes[--sharedPagesScopeCount];
+    for (k = 0; k < SHARED_PAGES_STRIPES; ++k)
+    {
+      SharedPagesStripe* stripe = &sharedPagesStripes[k];
+      SharedPage* page;
+      SharedPage* next;
+      if (stripe->m_mutex == NULL)
+      {
+        continue;
+      }
+      sqlite3_mutex_enter(stripe->m_mutex);
+      for (page = stripe->m_lruFirst; page != NULL; page = next)
+      {
+        next = page->m_lruNext;
+        if (memcmp(page->m_scope, scope, 16) == 0)
+        {
+          SharedPagesRemove(stripe, page);
+        }
+      }
+      SharedPagesShrink(stripe, sharedPagesLimit / SHARED_PAGES_STRIPES, NULL);
+      sqlite3_mutex_leave(stripe->m_mutex);
+    }
+  }
+  if (sharedPagesScopeCount == 0)
+  {
+    sqlite3_free(sharedPagesScopes);
+    sharedPagesScopes = NULL;
+    sharedPagesScopeSize = 0;
+  }
+  sqlite3_mutex_leave(mutex);
+}
+
+/* --- Pager interface --- */
+
+/*
+** Check whether the page may be shared, and determine its scope and the
+** version of the file it belongs to
+*/
+static Codec*
+SharedPagesEligible(Pager* pPager, Pgno pgno, unsigned char version[16])
+{
+  Codec* codec = (Codec*) pPager->pCodec;
+  if (pgno == 1 || pPager->xCodec == NULL || codec == NULL ||
+      pPager->eState != PAGER_READER || pPager->exclusiveMode || pPager->tempFile || MEMDB ||
+      codec->m_rekeying)
+  {
+    return NULL;
+  }
+  if (codec->m_shareState == 0)
+  {
+    sha256_ctx ctx;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    codec->m_shareState = -1;
+    if (CodecIsEncrypted(codec) && CodecHasReadCipher(codec) && codec->m_readCipher != NULL)
+    {
+      int shareable;
+#if SQLITE_OS_UNIX
+      /* The file at the name is the open file, as long as it has not moved */
+      struct stat st;
+      int moved = 1;
+      shareable = osStat(pPager->zFilename, &st) == 0 &&
+                  sqlite3OsFileControl(pPager->fd, SQLITE_FCNTL_HAS_MOVED, &moved) == SQLITE_OK && !moved;
+#else
+      shareable = 1;
+#endif
+      sha256_init(&ctx);
+      if (shareable && CodecHashReadKey(codec, &ctx))
+      {
+        sha256_update(&ctx, (const unsigned char*) pPager->zFilename, (unsigned int) strlen(pPager->zFilename));
+#if SQLITE_OS_UNIX
+        sha256_update(&ctx, (const unsigned char*) &st.st_dev, (unsigned int) sizeof(st.st_dev));
+        sha256_update(&ctx, (const unsigned char*) &st.st_ino, (unsigned int) sizeof(st.st_ino));
+#endif
+        sha256_final(&ctx, digest);
+        memcpy(codec->m_shareScope, digest, sizeof(codec->m_shareScope));
+        if (SharedPagesScopeAcquire(codec->m_shareScope))
+        {
+          codec->m_shareState = 1;
+        }
+      }
+    }
+  }
+  if (codec->m_shareState < 0)
+  {
+    return NULL;
+  }
+#ifndef SQLITE_OMIT_WAL
+  if (pagerUseWal(pPager))
+  {
+    Wal* pWal = pPager->pWal;
+    u32 walVersion[4];
+    if (pWal->bShmUnreliable || pWal->readLock < 0)
+    {
+      return NULL;
+    }
+    walVersion[0] = pWal->hdr.aSalt[0];
+    walVersion[1] = pWal->hdr.aSalt[1];
+    walVersion[2] = walCkptInfo(pWal)->nBackfill;
+    walVersion[3] = 0xffffffff;
+    memcpy(version, walVersion, 16);
+    return codec;
+  }
+#endif
+  memcpy(version, pPager->dbFileVers, 16);
+  return codec;
+}
+
+static unsigned int
+SharedPagesHash(const unsigned char* scope, Pgno pgno)
+{
+  unsigned int hash;
+  memcpy(&hash, scope, sizeof(hash));
+  return hash ^ (pgno * 0x9e3779b1u);
+}
+
+/*
+** Copy a page decrypted by another connection, or ahead by wxsqlite3_warmup(),
+** into pData. Returns 1 if the page was found, 0 if it has to be read from
+** the file.
+*/
+SQLITE_PRIVATE int
+sqlite3CodecSharedGet(Pager* pPager, Pgno pgno, void* pData)
+{
+  unsigned char version[16];
+  Codec* codec;
+  SharedPagesStripe* stripe;
+  SharedPage* page;
+  unsigned int hash;
+  int found = 0;
+
+  codec = (Codec*) pPager->pCodec;
+  if (codec != NULL && codec->m_warmupPages != NULL && WarmupPagesGet(codec->m_warmupPages, pgno, pData))
+  {
+    return 1;
+  }
+  if (sharedPagesLimit <= 0 || (codec = SharedPagesEligible(pPager, pgno, version)) == NULL)
+  {
+    return 0;
+  }
+  hash = SharedPagesHash(codec->m_shareScope, pgno);
+  stripe = &sharedPagesStripes[hash % SHARED_PAGES_STRIPES];
+  sqlite3_mutex_enter(stripe->m_mutex);
+  page = SharedPagesFind(stripe, hash, codec->m_shareScope, pgno);
+  if (page != NULL && page->m_pageSize == pPager->pageSize && memcmp(page->m_version, version, 16) == 0)
+  {
+    memcpy(pData, &page[1], page->m_pageSize);
+    SharedPagesLruUnlink(stripe, page);
+    SharedPagesLruPush(stripe, page);
+    found = 1;
+  }
+  sqlite3_mutex_leave(stripe->m_mutex);
+  if (found)
+  {
+    codec->m_pagesShared++;
+  }
+  return found;
+}
+
+/*
+** Offer a page that was just read from the file and decrypted
+*/
+SQLITE_PRIVATE void
+sqlite3CodecSharedPut(Pager* pPager, Pgno pgno, const void* pData)
+{
+  unsigned char version[16];
+  Codec* codec;
+  SharedPagesStripe* stripe;
+  SharedPage* page;
+  sqlite3_int64 stripeLimit = sharedPagesLimit / SHARED_PAGES_STRIPES;
+  unsigned int hash;
+  int pageSize = pPager->pageSize;
+
+  if (stripeLimit < (sqlite3_int64) (sizeof(SharedPage) + pageSize) ||
+      (codec = SharedPagesEligible(pPager, pgno, version)) == NULL)
+  {
+    return;
+  }
+  hash = SharedPagesHash(codec->m_shareScope, pgno);
+  stripe = &sharedPagesStripes[hash % SHARED_PAGES_STRIPES];
+  sqlite3_mutex_enter(stripe->m_mutex);
+  page = SharedPagesFind(stripe, hash, codec->m_shareScope, pgno);
+  if (page != NULL && page->m_pageSize != pageSize)
+  {
+    SharedPagesRemove(stripe, page);
+    page = NULL;
+  }
+  if (page == NULL)
+  {
+    page = (SharedPage*) sqlite3_malloc(sizeof(SharedPage) + pageSize);
+    if (page != NULL)
+    {
+      memset(page, 0, sizeof(SharedPage));
+      page->m_hash = hash;
+      page->m_pgno = pgno;
+      page->m_pageSize = pageSize;
+      memcpy(page->m_scope, codec->m_shareScope, 16);
+      SharedPagesInsert(stripe, page);
+    }
+  }
+  else
+  {
+    /* Only one version per page is kept, the most recent reader wins */
+    SharedPagesLruUnlink(stripe, page);
+    SharedPagesLruPush(stripe, page);
+  }
+  if (page != NULL)
+  {
+    memcpy(page->m_version, version, 16);
+    memcpy(&page[1], pData, pageSize);
+    SharedPagesShrink(stripe, stripeLimit, page);
+  }
+  sqlite3_mutex_leave(stripe->m_mutex);
+}
+
+/* --- Public API --- */
+
+sqlite3_int64
+wxsqlite3_shared_pages_limit(sqlite3_int64 limit)
+{
+  sqlite3_mutex* mutex;
+  sqlite3_int64 previous;
+  int j;
+
+  if (sqlite3_initialize() != SQLITE_OK)
+  {
+    return -1;
+  }
+  mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+  sqlite3_mutex_enter(mutex);
+  previous = sharedPagesLimit;
+  if (limit >= 0)
+  {
+    for (j = 0; j < SHARED_PAGES_STRIPES && limit > 0; ++j)
+    {
+      if (sharedPagesStripes[j].m_mutex == NULL)
+      {
+        sharedPagesStripes[j].m_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+      }
+      if (sharedPagesStripes[j].m_mutex == NULL)
+      {
+        limit = previous;
+      }
+    }
+    sharedPagesLimit = limit;
+    for (j = 0; j < SHARED_PAGES_STRIPES; ++j)
+    {
+      SharedPagesStripe* stripe = &sharedPagesStripes[j];
+      if (stripe->m_mutex != NULL)
+      {
+        sqlite3_mutex_enter(stripe->m_mutex);
+        SharedPagesShrink(stripe, limit / SHARED_PAGES_STRIPES, NULL);
+        sqlite3_mutex_leave(stripe->m_mutex);
+      }
+    }
+  }
+  sqlite3_mutex_leave(mutex);
+  return previous;
+}
@@ -90,6 +90,9 @@ typedef unsigned char u8;
 #if SQLITE_USER_AUTHENTICATION
 # include "sqlite3userauth.h"
 #endif
+#ifdef SQLITE_HAS_CODEC
+# include "sqlite3secure.h"
+#endif
 #include <ctype.h>
 #include <stdarg.h>
 
@@ -111,6 +114,7 @@ typedef unsigned char u8;
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #if HAVE_READLINE
 # include <readline/readline.h>
@@ -954,6 +958,12 @@ static void shellAddSchemaName(
 #define SQLITE_EXTENSION_INIT1
 #define SQLITE_EXTENSION_INIT2(X) (void)(X)
 
+/*
+** When the shell is linked against sqlite3secure.c the SHA3, FILEIO and
+** expert extensions are already part of the library. Only declare their
+** entry points in that case to avoid duplicate symbols.
+*/
+#ifndef SQLITE_ENABLE_FILEIO
 #if defined(_WIN32) && defined(_MSC_VER)
 /************************* Begin test_windirent.h ******************/
 /*
@@ -1312,6 +1322,8 @@ INT closedir(
 /************************* End test_windirent.c ********************/
 #define dirent DIRENT
 #endif
+#endif /* SQLITE_ENABLE_FILEIO */
+#ifndef SQLITE_ENABLE_SHA3
 /************************* Begin ../ext/misc/shathree.c ******************/
 /*
 ** 2017-03-08
@@ -2028,6 +2040,10 @@ int sqlite3_shathree_init(
 }
 
 /************************* End ../ext/misc/shathree.c ********************/
+#else
+int sqlite3_shathree_init(sqlite3*, char**, const sqlite3_api_routines*);
+#endif /* SQLITE_ENABLE_SHA3 */
+#ifndef SQLITE_ENABLE_FILEIO
 /************************* Begin ../ext/misc/fileio.c ******************/
 /*
 ** 2014-06-13
@@ -2956,6 +2972,9 @@ int sqlite3_fileio_init(
 }
 
 /************************* End ../ext/misc/fileio.c ********************/
+#else
+int sqlite3_fileio_init(sqlite3*, char**, const sqlite3_api_routines*);
+#endif /* SQLITE_ENABLE_FILEIO */
 /************************* Begin ../ext/misc/completion.c ******************/
 /*
 ** 2017-07-10
@@ -6329,6 +6348,7 @@ int sqlite3_sqlar_init(
 
 /************************* End ../ext/misc/sqlar.c ********************/
 #endif
+#ifndef SQLITE_ENABLE_EXPERT
 /************************* Begin ../ext/expert/sqlite3expert.h ******************/
 /*
 ** 2017 April 07
@@ -8453,6 +8473,9 @@ void sqlite3_expert_destroy(sqlite3expert *p){
 #endif /* ifndef SQLITE_OMIT_VIRTUAL_TABLE */
 
 /************************* End ../ext/expert/sqlite3expert.c ********************/
+#else
+#include "sqlite3expert.h"
+#endif /* SQLITE_ENABLE_EXPERT */
 
 #if defined(SQLITE_ENABLE_SESSION)
 /*
@@ -8557,6 +8580,9 @@ struct ShellState {
   OpenSession aSession[4];  /* Array of sessions.  [0] is in focus. */
 #endif
   ExpertInfo expert;        /* Valid if previous command was ".expert OPT..." */
+#ifdef SQLITE_HAS_CODEC
+  sqlite3_int64 aCodecStat[3]; /* Codec counters at the last stats report */
+#endif
 };
 
 
@@ -9859,6 +9885,53 @@ static void displayStatLine(
 /*
 ** Display memory stats.
 */
+#ifdef SQLITE_HAS_CODEC
+/*
+** Number of codec counters reported by wxsqlite3_codec_status()
+*/
+#define CODEC_NSTAT 3
+
+/*
+** Store the change of the codec counters of the main database since aBase[]
+** in aDelta[] and make the current values the new base.  The counters start
+** over whenever a key is attached or changed, in which case the old base is
+** ignored.  All counters are zero if the database is not encrypted.
+*/
+static void codec_counters(
+  sqlite3 *db,                /* Database to query */
+  sqlite3_int64 *aBase,       /* Counters at the previous call */
+  sqlite3_int64 *aDelta       /* OUT: Change since the previous call */
+){
+  int i;
+  for(i=0; i<CODEC_NSTAT; i++){
+    sqlite3_int64 iCur = 0;
+    if( db ) wxsqlite3_codec_status(db, "main", i, &iCur, 0);
+    if( iCur<aBase[i] ) aBase[i] = 0;
+    if( aDelta ) aDelta[i] = iCur - aBase[i];
+    aBase[i] = iCur;
+  }
+}
+#endif
+
+/*
+** Return a monotonic timestamp in nanoseconds.  Used by ".bench", which
+** needs a finer resolution than timeOfDay().
+*/
+static sqlite3_int64 hiresTime(void){
+#if defined(_WIN32) || defined(WIN32)
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER cnt;
+  if( freq.QuadPart==0 ) QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&cnt);
+  return (sqlite3_int64)((cnt.QuadPart/freq.QuadPart)*1000000000
+                         + (cnt.QuadPart%freq.QuadPart)*1000000000/freq.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (sqlite3_int64)ts.tv_sec*1000000000 + ts.tv_nsec;
+#endif
+}
+
 static int display_stats(
   sqlite3 *db,                /* Database to query */
   ShellState *pArg,           /* Pointer to ShellState */
@@ -9950,6 +10023,18 @@ static int display_stats(
     iHiwtr = iCur = -1;
     sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_SPILL, &iCur, &iHiwtr, 1);
     raw_printf(pArg->out, "Page cache spills:                   %d\n", iCur);
+#ifdef SQLITE_HAS_CODEC
+    {
+      sqlite3_int64 aDelta[CODEC_NSTAT];
+      codec_counters(db, pArg->aCodecStat, aDelta);
+      raw_printf(pArg->out, "Pages decrypted:                     %lld\n",
+              aDelta[0]);
+      raw_printf(pArg->out, "Pages encrypted:                     %lld\n",
+              aDelta[1]);
+      raw_printf(pArg->out, "Codec time:                          %.3f ms\n",
+              aDelta[2]*0.000001);
+    }
+#endif
     iHiwtr = iCur = -1;
     sqlite3_db_status(db, SQLITE_DBSTATUS_SCHEMA_USED, &iCur, &iHiwtr, bReset);
     raw_printf(pArg->out, "Schema Heap Usage:                   %d bytes\n",
@@ -10832,10 +10917,16 @@ static char zHelp[] =
   ".backup ?DB? FILE      Backup DB (default \"main\") to FILE\n"
   "                         Add \"--append\" to open using appendvfs.\n"
   ".bail on|off           Stop after hitting an error.  Default OFF\n"
+  ".bench N SQL           Run SQL N times and report the run time and the\n"
+  "                         pages processed by the codec\n"
   ".binary on|off         Turn binary output on or off.  Default OFF\n"
   ".cd DIRECTORY          Change the working directory to DIRECTORY\n"
   ".changes on|off        Show number of rows changed by SQL\n"
   ".check GLOB            Fail if output since .testcase does not match\n"
+#ifdef SQLITE_HAS_CODEC
+  ".cipher ?NAME? ...     Show or set the cipher used by .key and .rekey\n"
+  "                         Add PARAM VALUE pairs to set cipher parameters\n"
+#endif
   ".clone NEWDB           Clone data into NEWDB from the existing database\n"
   ".databases             List names and files of attached databases\n"
   ".dbconfig ?op? ?val?   List or change sqlite3_db_config() options\n"
@@ -10863,6 +10954,9 @@ static char zHelp[] =
   "                         matching LIKE pattern TABLE.\n"
 #ifdef SQLITE_ENABLE_IOTRACE
   ".iotrace FILE          Enable I/O diagnostic logging to FILE\n"
+#endif
+#ifdef SQLITE_HAS_CODEC
+  ".key KEY ?DB?          Set the encryption key of DB (default \"main\")\n"
 #endif
   ".limit ?LIMIT? ?VAL?   Display or change the value of an SQLITE_LIMIT\n"
   ".lint OPTIONS          Report potential schema issues. Options:\n"
@@ -10894,6 +10988,9 @@ static char zHelp[] =
   ".prompt MAIN CONTINUE  Replace the standard prompts\n"
   ".quit                  Exit this program\n"
   ".read FILENAME         Execute SQL in FILENAME\n"
+#ifdef SQLITE_HAS_CODEC
+  ".rekey KEY ?DB?        Change the encryption key of DB, \"\" to decrypt\n"
+#endif
   ".restore ?DB? FILE     Restore content of DB (default \"main\") from FILE\n"
   ".save FILE             Write in-memory database into FILE\n"
   ".scanstats on|off      Turn sqlite3_stmt_scanstatus() metrics on or off\n"
@@ -13081,6 +13178,123 @@ end_ar_command:
 **********************************************************************************/
 #endif /* !defined(SQLITE_OMIT_VIRTUALTABLE) && defined(SQLITE_HAVE_ZLIB) */
 
+#ifdef SQLITE_HAS_CODEC
+/*
+** Run zSql, a "SELECT wxsqlite3_config(...)" statement, and return its
+** result as text obtained from sqlite3_mprintf().  NULL is returned if the
+** cipher, parameter or value was rejected.  zSql is freed.
+*/
+static char *codec_config(sqlite3 *db, char *zSql){
+  sqlite3_stmt *pStmt = 0;
+  char *zRes = 0;
+  if( zSql==0 ) return 0;
+  if( sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0)==SQLITE_OK
+   && sqlite3_step(pStmt)==SQLITE_ROW
+   && sqlite3_column_type(pStmt, 0)!=SQLITE_NULL
+  ){
+    zRes = sqlite3_mprintf("%s", sqlite3_column_text(pStmt, 0));
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zSql);
+  return zRes;
+}
+
+/*
+** Print the cipher used by ".key" and ".rekey" together with the values of
+** its parameters.
+*/
+static void codec_show_cipher(ShellState *p){
+  char *zCipher;
+  char *zParams;
+  char *z;
+  zCipher = codec_config(p->db,
+                 sqlite3_mprintf("SELECT wxsqlite3_config('default:cipher')"));
+  if( zCipher==0 ) return;
+  utf8_printf(p->out, "%s", zCipher);
+  zParams = codec_config(p->db,
+                 sqlite3_mprintf("SELECT wxsqlite3_config(%Q)", zCipher));
+  for(z=zParams; z && *z; ){
+    char *zEnd = strchr(z, ',');
+    char *zValue;
+    if( zEnd ) *zEnd = 0;
+    zValue = codec_config(p->db,
+        sqlite3_mprintf("SELECT wxsqlite3_config(%Q, 'default:%q')",
+                        zCipher, z));
+    utf8_printf(p->out, " %s=%s", z, zValue ? zValue : "?");
+    sqlite3_free(zValue);
+    z = zEnd ? zEnd+1 : 0;
+  }
+  raw_printf(p->out, "\n");
+  sqlite3_free(zParams);
+  sqlite3_free(zCipher);
+}
+
+/*
+** Check that the schema of database zDb can be read after a key has been
+** applied.  Return non-zero and print an error message if not.
+*/
+static int codec_check_key(ShellState *p, const char *zDb){
+  char *zSql = sqlite3_mprintf("SELECT count(*) FROM \"%w\".sqlite_master", zDb);
+  int rc = sqlite3_exec(p->db, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  if( rc!=SQLITE_OK ){
+    utf8_printf(stderr, "Error: %s\n", sqlite3_errmsg(p->db));
+    return 1;
+  }
+  return 0;
+}
+#endif
+
+/*
+** Implementation of the ".bench N SQL" command.  Run zSql nRun times with
+** its output discarded and report the minimum, average and maximum run time
+** together with the work done by the codec.
+*/
+static int shell_bench(ShellState *p, int nRun, const char *zSql){
+  sqlite3_int64 iMin = 0;
+  sqlite3_int64 iMax = 0;
+  sqlite3_int64 iTotal = 0;
+  int i;
+#ifdef SQLITE_HAS_CODEC
+  sqlite3_int64 aCodec[CODEC_NSTAT] = {0};
+  sqlite3_int64 aDelta[CODEC_NSTAT];
+#endif
+
+  open_db(p, 0);
+#ifdef SQLITE_HAS_CODEC
+  codec_counters(p->db, aCodec, 0);
+#endif
+  for(i=0; i<nRun && !seenInterrupt; i++){
+    char *zErrMsg = 0;
+    sqlite3_int64 iStart = hiresTime();
+    int rc = sqlite3_exec(p->db, zSql, 0, 0, &zErrMsg);
+    sqlite3_int64 iElapsed = hiresTime() - iStart;
+    if( rc!=SQLITE_OK ){
+      utf8_printf(stderr, "Error: %s\n",
+                  zErrMsg ? zErrMsg : sqlite3_errmsg(p->db));
+      sqlite3_free(zErrMsg);
+      return 1;
+    }
+    if( i==0 || iElapsed<iMin ) iMin = iElapsed;
+    if( iElapsed>iMax ) iMax = iElapsed;
+    iTotal += iElapsed;
+  }
+  if( i==0 ) return 1;
+  raw_printf(p->out, "Runs:                %d\n", i);
+  raw_printf(p->out, "Run time:            min %.3f avg %.3f max %.3f ms\n",
+             iMin*0.000001, iTotal*0.000001/i, iMax*0.000001);
+#ifdef SQLITE_HAS_CODEC
+  codec_counters(p->db, aCodec, aDelta);
+  raw_printf(p->out, "Pages decrypted:     %lld (%.1f per run)\n",
+             aDelta[0], (double)aDelta[0]/i);
+  raw_printf(p->out, "Pages encrypted:     %lld (%.1f per run)\n",
+             aDelta[1], (double)aDelta[1]/i);
+  raw_printf(p->out, "Codec time:          %.3f ms (%.1f%% of run time)\n",
+             aDelta[2]*0.000001, iTotal>0 ? aDelta[2]*100.0/iTotal : 0.0);
+#endif
+  return 0;
+}
+
 
 /*
 ** If an input line begins with "." then invoke this routine to
@@ -13224,6 +13438,15 @@ static int do_meta_command(char *zLine, ShellState *p){
     }
   }else
 
+  if( c=='b' && n>=3 && strncmp(azArg[0], "bench", n)==0 ){
+    if( nArg==3 && integerValue(azArg[1])>0 ){
+      rc = shell_bench(p, (int)integerValue(azArg[1]), azArg[2]);
+    }else{
+      raw_printf(stderr, "Usage: .bench N SQL\n");
+      rc = 1;
+    }
+  }else
+
   if( c=='b' && n>=3 && strncmp(azArg[0], "binary", n)==0 ){
     if( nArg==2 ){
       if( booleanValue(azArg[1]) ){
@@ -13297,6 +13520,40 @@ static int do_meta_command(char *zLine, ShellState *p){
     sqlite3_free(zRes);
   }else
 
+#ifdef SQLITE_HAS_CODEC
+  if( c=='c' && n>=3 && strncmp(azArg[0], "cipher", n)==0 ){
+    open_db(p, 0);
+    if( nArg==1 ){
+      codec_show_cipher(p);
+    }else if( (nArg%2)==0 ){
+      char *zRes;
+      int i;
+      zRes = codec_config(p->db,
+          sqlite3_mprintf("SELECT wxsqlite3_config('default:cipher', %Q)",
+                          azArg[1]));
+      if( zRes==0 ){
+        utf8_printf(stderr, "Error: unknown cipher \"%s\"\n", azArg[1]);
+        rc = 1;
+      }
+      sqlite3_free(zRes);
+      for(i=2; rc==0 && i<nArg; i+=2){
+        zRes = codec_config(p->db,
+            sqlite3_mprintf("SELECT wxsqlite3_config(%Q, 'default:%q', %lld)",
+                            azArg[1], azArg[i], integerValue(azArg[i+1])));
+        if( zRes==0 ){
+          utf8_printf(stderr, "Error: invalid parameter %s=%s\n",
+                      azArg[i], azArg[i+1]);
+          rc = 1;
+        }
+        sqlite3_free(zRes);
+      }
+    }else{
+      raw_printf(stderr, "Usage: .cipher ?NAME? ?PARAM VALUE ...?\n");
+      rc = 1;
+    }
+  }else
+#endif
+
   if( c=='c' && strncmp(azArg[0], "clone", n)==0 ){
     if( nArg==2 ){
       tryToClone(p, azArg[1]);
@@ -13870,6 +14127,24 @@ static int do_meta_command(char *zLine, ShellState *p){
   }else
 #endif
 
+#ifdef SQLITE_HAS_CODEC
+  if( c=='k' && strncmp(azArg[0], "key", n)==0 ){
+    if( nArg==2 || nArg==3 ){
+      const char *zDb = nArg==3 ? azArg[2] : "main";
+      open_db(p, 0);
+      if( sqlite3_key_v2(p->db, zDb, azArg[1], (int)strlen(azArg[1])) ){
+        utf8_printf(stderr, "Error: %s\n", sqlite3_errmsg(p->db));
+        rc = 1;
+      }else{
+        rc = codec_check_key(p, zDb);
+      }
+    }else{
+      raw_printf(stderr, "Usage: .key KEY ?DB?\n");
+      rc = 1;
+    }
+  }else
+#endif
+
   if( c=='l' && n>=5 && strncmp(azArg[0], "limits", n)==0 ){
     static const struct {
        const char *zLimitName;   /* Name of a limit */
@@ -14187,6 +14462,22 @@ static int do_meta_command(char *zLine, ShellState *p){
     }
   }else
 
+#ifdef SQLITE_HAS_CODEC
+  if( c=='r' && n>=3 && strncmp(azArg[0], "rekey", n)==0 ){
+    if( nArg==2 || nArg==3 ){
+      const char *zDb = nArg==3 ? azArg[2] : "main";
+      open_db(p, 0);
+      if( sqlite3_rekey_v2(p->db, zDb, azArg[1], (int)strlen(azArg[1])) ){
+        utf8_printf(stderr, "Error: %s\n", sqlite3_errmsg(p->db));
+        rc = 1;
+      }
+    }else{
+      raw_printf(stderr, "Usage: .rekey KEY ?DB?\n");
+      rc = 1;
+    }
+  }else
+#endif
+
   if( c=='r' && n>=3 && strncmp(azArg[0], "restore", n)==0 ){
     const char *zSrcFile;
     const char *zDb;
@@ -15452,12 +15743,28 @@ static int line_is_complete(char *zSql, int nSql){
 static int runOneSqlLine(ShellState *p, char *zSql, FILE *in, int startline){
   int rc;
   char *zErrMsg = 0;
+#ifdef SQLITE_HAS_CODEC
+  sqlite3_int64 aCodec[CODEC_NSTAT] = {0};
+#endif
 
   open_db(p, 0);
   if( ShellHasFlag(p,SHFLG_Backslash) ) resolve_backslashes(zSql);
+#ifdef SQLITE_HAS_CODEC
+  if( enableTimer ) codec_counters(p->db, aCodec, 0);
+#endif
   BEGIN_TIMER;
   rc = shell_exec(p, zSql, &zErrMsg);
   END_TIMER;
+#ifdef SQLITE_HAS_CODEC
+  if( enableTimer ){
+    sqlite3_int64 aDelta[CODEC_NSTAT];
+    codec_counters(p->db, aCodec, aDelta);
+    if( aDelta[0] || aDelta[1] ){
+      printf("Codec: decrypted %lld encrypted %lld pages in %.3f ms\n",
+         aDelta[0], aDelta[1], aDelta[2]*0.000001);
+    }
+  }
+#endif
   if( rc || zErrMsg ){
     char zPrefix[100];
     if( in!=0 || !stdin_is_interactive ){
@@ -16025,6 +16332,10 @@ int SQLITE_CDECL wmain(int argc, wchar_t **wargv){
   ** to call sqlite3_initialize() and process any command line -vfs option. */
   sqlite3_initialize();
 #endif
+#ifdef SQLITE_HAS_CODEC
+  /* .stats, .timer and .bench report the time spent in the ciphers */
+  wxsqlite3_codec_timing(1);
+#endif
 
   if( zVfs ){
     sqlite3_vfs *pVfs = sqlite3_vfs_find(zVfs);
@@ -2099,6 +2099,12 @@ struct sqlite3_io_methods {
 ** a file lock using the xLock or xShmLock methods of the VFS to wait
 ** for up to M milliseconds before failing, where M is the single 
 ** unsigned integer parameter.
+**
+** <li>[[SQLITE_FCNTL_CKPT_DONE]]
+** The [SQLITE_FCNTL_CKPT_DONE] opcode is invoked from within a checkpoint
+** in wal mode after the client has finished copying pages from the wal
+** file to the database file, but before the *-shm file is updated to
+** record the fact that the pages have been checkpointed.
 ** </ul>
 */
 #define SQLITE_FCNTL_LOCKSTATE               1
@@ -2134,6 +2140,7 @@ struct sqlite3_io_methods {
 #define SQLITE_FCNTL_COMMIT_ATOMIC_WRITE    32
 #define SQLITE_FCNTL_ROLLBACK_ATOMIC_WRITE  33
 #define SQLITE_FCNTL_LOCK_TIMEOUT           34
+#define SQLITE_FCNTL_CKPT_DONE              37
 
 /* deprecated names */
 #define SQLITE_GET_LOCKPROXYFILE      SQLITE_FCNTL_GET_LOCKPROXYFILE
@@ -52561,9 +52568,21 @@ end_playback:
 ** If an IO error occurs, then the IO error is returned to the caller.
 ** Otherwise, SQLITE_OK is returned.
 */
+#ifdef SQLITE_HAS_CODEC
+/* Decrypted pages shared between connections, see sharedpages.c */
+SQLITE_PRIVATE int sqlite3CodecSharedGet(Pager*, Pgno, void*);
+SQLITE_PRIVATE void sqlite3CodecSharedPut(Pager*, Pgno, const void*);
+#endif
+
 static int readDbPage(PgHdr *pPg){
   Pager *pPager = pPg->pPager; /* Pager object associated with page pPg */
   int rc = SQLITE_OK;          /* Return code */
+#ifdef SQLITE_HAS_CODEC
+  int bShare = 0;              /* Offer the decrypted page to other connections */
+#endif
+#if SQLITE_MAX_MMAP_SIZE>0 && defined(SQLITE_HAS_CODEC)
+  void *pMap = 0;              /* Ciphertext of the page in the mapping */
+#endif
 
 #ifndef SQLITE_OMIT_WAL
   u32 iFrame = 0;              /* Frame of WAL containing pgno */
@@ -52581,9 +52600,35 @@ static int readDbPage(PgHdr *pPg){
 #endif
   {
     i64 iOffset = (pPg->pgno-1)*(i64)pPager->pageSize;
-    rc = sqlite3OsRead(pPager->fd, pPg->pData, pPager->pageSize, iOffset);
-    if( rc==SQLITE_IOERR_SHORT_READ ){
-      rc = SQLITE_OK;
+#ifdef SQLITE_HAS_CODEC
+    if( pPager->xCodec ){
+      if( sqlite3CodecSharedGet(pPager, pPg->pgno, pPg->pData) ){
+        /* Already read and decrypted by another connection */
+        return SQLITE_OK;
+      }
+      bShare = 1;
+    }
+#endif
+#if SQLITE_MAX_MMAP_SIZE>0 && defined(SQLITE_HAS_CODEC)
+    /* Encrypted pages cannot be handed out straight from the mapping, since
+    ** they have to be decrypted first. But when memory-mapped I/O is enabled
+    ** the ciphertext can still be copied from the mapping into the page
+    ** buffer, which saves the read() system call. CODEC1() below then
+    ** decrypts the buffer in place. Pages outside of the mapping fall back
+    ** to sqlite3OsRead(). */
+    if( USEFETCH(pPager) && pPager->xCodec ){
+      rc = sqlite3OsFetch(pPager->fd, iOffset, pPager->pageSize, &pMap);
+    }
+    if( pMap ){
+      memcpy(pPg->pData, pMap, pPager->pageSize);
+      sqlite3OsUnfetch(pPager->fd, iOffset, pMap);
+    }else if( rc==SQLITE_OK )
+#endif
+    {
+      rc = sqlite3OsRead(pPager->fd, pPg->pData, pPager->pageSize, iOffset);
+      if( rc==SQLITE_IOERR_SHORT_READ ){
+        rc = SQLITE_OK;
+      }
     }
   }
 
@@ -52608,6 +52653,11 @@ static int readDbPage(PgHdr *pPg){
     }
   }
   CODEC1(pPager, pPg->pData, pPg->pgno, 3, rc = SQLITE_NOMEM_BKPT);
+#ifdef SQLITE_HAS_CODEC
+  if( bShare && rc==SQLITE_OK ){
+    sqlite3CodecSharedPut(pPager, pPg->pgno, pPg->pData);
+  }
+#endif
 
   PAGER_INCR(sqlite3_pager_readdb_count);
   PAGER_INCR(pPager->nRead);
@@ -55438,7 +55488,22 @@ static SQLITE_NOINLINE int pagerAddPageToRollbackJournal(PgHdr *pPg){
   assert( pPg->pgno!=PAGER_MJ_PGNO(pPager) );
 
   assert( pPager->journalHdr<=pPager->journalOff );
+#ifdef SQLITE_HAS_CODEC
+  /* The page has not been modified in this transaction yet, so the database
+  ** file already holds its encrypted image. Mode 8 asks the codec for that
+  ** image, which saves encrypting the page again for the journal. A NULL
+  ** return means it is not available (e.g. during a rekey). Temporary
+  ** databases are skipped, as their pages need not have reached the file. */
+  pData2 = 0;
+  if( pPager->xCodec && !pPager->tempFile ){
+    pData2 = (char*)pPager->xCodec(pPager->pCodec, pPg->pData, pPg->pgno, 8);
+  }
+  if( pData2==0 ){
+    CODEC2(pPager, pPg->pData, pPg->pgno, 7, return SQLITE_NOMEM_BKPT, pData2);
+  }
+#else
   CODEC2(pPager, pPg->pData, pPg->pgno, 7, return SQLITE_NOMEM_BKPT, pData2);
+#endif
   cksum = pager_cksum(pPager, (u8*)pData2);
 
   /* Even if an IO or diskfull error occurs while journalling the
@@ -59100,6 +59165,10 @@ static int walCheckpoint(
             rc = sqlite3OsSync(pWal->pDbFd, CKPT_SYNC_FLAGS(sync_flags));
           }
         }
+        if( rc==SQLITE_OK ){
+          rc = sqlite3OsFileControl(pWal->pDbFd, SQLITE_FCNTL_CKPT_DONE, 0);
+          if( rc==SQLITE_NOTFOUND ) rc = SQLITE_OK;
+        }
         if( rc==SQLITE_OK ){
           pInfo->nBackfill = mxSafeFrame;
         }
@@ -1,6 +1,17 @@
 CONFIG(release, debug|release):DEFINES *= NDEBUG
 
-DEFINES += _CRT_SECURE_NO_WARNINGS _CRT_SECURE_NO_DEPRECATE _CRT_NONSTDC_NO_DEPRECATE THREADSAFE=1 SQLITE_MAX_ATTACHED=10 SQLITE_SOUNDEX SQLITE_ENABLE_EXPLAIN_COMMENTS SQLITE_ENABLE_COLUMN_METADATA SQLITE_HAS_CODEC=1 CODEC_TYPE=CODEC_TYPE_CHACHA20 SQLITE_SECURE_DELETE SQLITE_ENABLE_FTS3 SQLITE_ENABLE_FTS3_PARENTHESIS SQLITE_ENABLE_FTS4 SQLITE_ENABLE_FTS5 SQLITE_ENABLE_JSON1 SQLITE_ENABLE_RTREE SQLITE_CORE SQLITE_ENABLE_EXTFUNC SQLITE_ENABLE_CSV SQLITE_ENABLE_SHA3 SQLITE_ENABLE_CARRAY SQLITE_ENABLE_FILEIO SQLITE_ENABLE_SERIES SQLITE_TEMP_STORE=2 SQLITE_USE_URI SQLITE_USER_AUTHENTICATION
+DEFINES += _CRT_SECURE_NO_WARNINGS _CRT_SECURE_NO_DEPRECATE _CRT_NONSTDC_NO_DEPRECATE THREADSAFE=1 SQLITE_MAX_ATTACHED=10 SQLITE_SOUNDEX SQLITE_ENABLE_EXPLAIN_COMMENTS SQLITE_ENABLE_COLUMN_METADATA SQLITE_HAS_CODEC=1 CODEC_TYPE=CODEC_TYPE_CHACHA20 SQLITE_SECURE_DELETE SQLITE_ENABLE_FTS3 SQLITE_ENABLE_FTS3_PARENTHESIS SQLITE_ENABLE_FTS4 SQLITE_ENABLE_FTS5 SQLITE_ENABLE_JSON1 SQLITE_ENABLE_RTREE SQLITE_CORE SQLITE_ENABLE_EXTFUNC SQLITE_ENABLE_CSV SQLITE_ENABLE_SHA3 SQLITE_ENABLE_CARRAY SQLITE_ENABLE_FILEIO SQLITE_ENABLE_SERIES SQLITE_ENABLE_EXPERT SQLITE_TEMP_STORE=1 SQLITE_ENABLE_TEMPCRYPT SQLITE_MAX_WORKER_THREADS=8 SQLITE_USE_URI SQLITE_USER_AUTHENTICATION SQLITE_DEFAULT_MEMSTATUS=0 SQLITE_ENABLE_DBSTAT_VTAB
+
+# qmake SINGLE_CIPHER=<aes128cbc|aes256cbc|chacha20|sqlcipher> builds the codec
+# with only that cipher; the page hot path then calls it directly
+!isEmpty(SINGLE_CIPHER) {
+    DEFINES -= CODEC_TYPE=CODEC_TYPE_CHACHA20
+    equals(SINGLE_CIPHER, aes128cbc): DEFINES += WXSQLITE3_SINGLE_CIPHER=CODEC_TYPE_AES128
+    else:equals(SINGLE_CIPHER, aes256cbc): DEFINES += WXSQLITE3_SINGLE_CIPHER=CODEC_TYPE_AES256
+    else:equals(SINGLE_CIPHER, chacha20): DEFINES += WXSQLITE3_SINGLE_CIPHER=CODEC_TYPE_CHACHA20
+    else:equals(SINGLE_CIPHER, sqlcipher): DEFINES += WXSQLITE3_SINGLE_CIPHER=CODEC_TYPE_SQLCIPHER
+    else: error("Unknown SINGLE_CIPHER $$SINGLE_CIPHER")
+}
 
 win32-msvc* {
     # Nothing for now.
@@ -11,6 +22,16 @@ android-g++ {
 win32-g++ {
     DEFINES += restrict=__restrict
 }
+linux:!android {
+    # VFS "uring", batching database writes through io_uring
+    DEFINES += SQLITE_ENABLE_URINGVFS
+}
+unix {
+    # VFS "direct", database file I/O bypassing the OS page cache
+    DEFINES += SQLITE_ENABLE_DIRECTVFS
+    # Millisecond sleeps for busy handlers, otherwise SQLite sleeps whole seconds
+    DEFINES += HAVE_USLEEP=1
+}
 
 INCLUDEPATH += $$PWD
 DEPENDPATH  += $$PWD
@@ -22,6 +43,7 @@ HEADERS += \
     $$PWD/sha1.h \
     $$PWD/sha2.h \
     $$PWD/sqlite3.h \
+    $$PWD/sqlite3expert.h \
     $$PWD/sqlite3ext.h \
     $$PWD/sqlite3secure.h \
     $$PWD/sqlite3userauth.h \
@@ -30,24 +52,36 @@ HEADERS += \
 SOURCES += \
     $$PWD/carray.c \
     $$PWD/chacha20poly1305.c \
+    $$PWD/clockpcache.c \
     $$PWD/codec.c \
     $$PWD/codecext.c \
     $$PWD/csv.c \
+    $$PWD/directvfs.c \
     $$PWD/extensionfunctions.c \
     $$PWD/fastpbkdf2.c \
     $$PWD/fileio.c \
+    $$PWD/fragmentation.c \
+    $$PWD/indexadvisor.c \
+    $$PWD/jsontable.c \
     $$PWD/md5.c \
     $$PWD/regexp.c \
     $$PWD/rekeyvacuum.c \
     $$PWD/rijndael.c \
+    $$PWD/rtreebulk.c \
     $$PWD/series.c \
     $$PWD/sha1.c \
     $$PWD/sha2.c \
+    $$PWD/sharedpages.c \
     $$PWD/shathree.c \
     $$PWD/sqlite3.c \
+    $$PWD/sqlite3expert.c \
     $$PWD/sqlite3secure.c \
+    $$PWD/tempcrypt.c \
     $$PWD/test_windirent.c \
-    $$PWD/userauth.c
+    $$PWD/threadmalloc.c \
+    $$PWD/uringvfs.c \
+    $$PWD/userauth.c \
+    $$PWD/warmup.c
 
 OTHER_FILES += \
     $$PWD/sqlite3.def \
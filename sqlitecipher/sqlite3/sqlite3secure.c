@@ -23,11 +23,17 @@
 ** To enable the CARRAY support define SQLITE_ENABLE_CARRAY on compiling this module
 ** To enable the FILEIO support define SQLITE_ENABLE_FILEIO on compiling this module
 ** To enable the SERIES support define SQLITE_ENABLE_SERIES on compiling this module
+** To enable the R-Tree bulk loader define SQLITE_ENABLE_RTREE on compiling this module
+** To enable the JSON table function define SQLITE_ENABLE_JSON1 on compiling this module
+** To enable the index advisor define SQLITE_ENABLE_EXPERT on compiling this module
 */
-#if defined(SQLITE_ENABLE_EXTFUNC) || defined(SQLITE_ENABLE_CSV) || defined(SQLITE_ENABLE_SHA3) || defined(SQLITE_ENABLE_CARRAY) || defined(SQLITE_ENABLE_FILEIO) || defined(SQLITE_ENABLE_SERIES)
-#define sqlite3_open    sqlite3_open_internal
-#define sqlite3_open16  sqlite3_open16_internal
-#define sqlite3_open_v2 sqlite3_open_v2_internal
+
+/*
+** The extensions are registered through sqlite3_auto_extension, and
+** encryption of temporary files and the VFSs are installed, on initialization
+*/
+#ifndef SQLITE_EXTRA_INIT
+#define SQLITE_EXTRA_INIT sqlite3secure_extra_init
 #endif
 
 /*
@@ -52,12 +58,6 @@
 #include "userauth.c"
 #endif
 
-#if defined(SQLITE_ENABLE_EXTFUNC) || defined(SQLITE_ENABLE_CSV) || defined(SQLITE_ENABLE_SHA3) || defined(SQLITE_ENABLE_CARRAY) || defined(SQLITE_ENABLE_FILEIO) || defined(SQLITE_ENABLE_SERIES)
-#undef sqlite3_open
-#undef sqlite3_open16
-#undef sqlite3_open_v2
-#endif
-
 #ifndef SQLITE_OMIT_DISKIO
 
 #ifdef SQLITE_HAS_CODEC
@@ -93,9 +93,42 @@ void mySqlite3PagerSetCodec(
 #include "rijndael.c"
 #include "codec.c"
 #include "codecext.c"
+#include "warmup.c"
+#include "sharedpages.c"
+
+/*
+** Encryption of temporary files
+*/
+#ifdef SQLITE_ENABLE_TEMPCRYPT
+#include "tempcrypt.c"
+#endif
+
+#endif
+
+/*
+** Batched database writes on Linux
+*/
+#if defined(SQLITE_ENABLE_URINGVFS) && SQLITE_OS_UNIX && defined(__linux__)
+#include "uringvfs.c"
+#endif
 
+/*
+** Database file I/O bypassing the OS page cache
+*/
+#if defined(SQLITE_ENABLE_DIRECTVFS) && SQLITE_OS_UNIX
+#include "directvfs.c"
 #endif
 
+/*
+** Partitioned page cache with CLOCK replacement
+*/
+#include "clockpcache.c"
+
+/*
+** Memory allocator with per-thread caches
+*/
+#include "threadmalloc.c"
+
 #endif
 
 /*
@@ -154,114 +187,423 @@ void mySqlite3PagerSetCodec(
 #include "series.c"
 #endif
 
-#if defined(SQLITE_ENABLE_EXTFUNC) || defined(SQLITE_ENABLE_CSV) || defined(SQLITE_ENABLE_SHA3) || defined(SQLITE_ENABLE_CARRAY) || defined(SQLITE_ENABLE_FILEIO) || defined(SQLITE_ENABLE_SERIES)
+/*
+** R-Tree bulk loading
+*/
+#ifdef SQLITE_ENABLE_RTREE
+#include "rtreebulk.c"
+#endif
+
+/*
+** JSON table
+*/
+#ifdef SQLITE_ENABLE_JSON1
+#include "jsontable.c"
+#endif
+
+/*
+** Index advisor
+*/
+#ifdef SQLITE_ENABLE_EXPERT
+#include "sqlite3expert.c"
+#include "indexadvisor.c"
+#endif
 
-static
-int registerAllExtensions(sqlite3 *db, char **pzErrMsg, const sqlite3_api_routines *pApi)
+/*
+** Fragmentation report
+*/
+#ifdef SQLITE_ENABLE_DBSTAT_VTAB
+#include "fragmentation.c"
+#endif
+
+/*
+** Extension groups, registered on every connection unless deselected with
+** wxsqlite3_default_extensions(). A group compiled out keeps its name, so
+** that the same selection works with every build.
+*/
+#ifdef SQLITE_ENABLE_CSV
+static int
+ExtensionInitCsv(sqlite3* db)
+{
+  return sqlite3_csv_init(db, NULL, NULL);
+}
+#endif
+
+#ifdef SQLITE_ENABLE_SHA3
+static int
+ExtensionInitSha3(sqlite3* db)
+{
+  return sqlite3_shathree_init(db, NULL, NULL);
+}
+#endif
+
+#ifdef SQLITE_ENABLE_CARRAY
+static int
+ExtensionInitCarray(sqlite3* db)
+{
+  return sqlite3_carray_init(db, NULL, NULL);
+}
+#endif
+
+#ifdef SQLITE_ENABLE_FILEIO
+static int
+ExtensionInitFileio(sqlite3* db)
+{
+  return sqlite3_fileio_init(db, NULL, NULL);
+}
+#endif
+
+#ifdef SQLITE_ENABLE_SERIES
+static int
+ExtensionInitSeries(sqlite3* db)
+{
+  return sqlite3_series_init(db, NULL, NULL);
+}
+#endif
+
+#if defined(SQLITE_ENABLE_RTREE) && !defined(SQLITE_OMIT_VIRTUALTABLE)
+static int
+ExtensionInitRtreeBulk(sqlite3* db)
+{
+  return sqlite3_rtreebulk_init(db, NULL, NULL);
+}
+#endif
+
+#if defined(SQLITE_ENABLE_JSON1) && !defined(SQLITE_OMIT_VIRTUALTABLE)
+static int
+ExtensionInitJsonTable(sqlite3* db)
+{
+  return sqlite3_jsontable_init(db, NULL, NULL);
+}
+#endif
+
+#if defined(SQLITE_ENABLE_EXPERT) && !defined(SQLITE_OMIT_VIRTUALTABLE)
+static int
+ExtensionInitIndexAdvisor(sqlite3* db)
+{
+  return sqlite3_indexadvisor_init(db, NULL, NULL);
+}
+#endif
+
+#ifdef SQLITE_ENABLE_DBSTAT_VTAB
+static int
+ExtensionInitFragmentation(sqlite3* db)
+{
+  int rc = sqlite3_create_function(db, "wxsqlite3_fragmentation", 0, SQLITE_UTF8, 0, wxsqlite3_fragmentation_func, 0, 0);
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_create_function(db, "wxsqlite3_fragmentation", 1, SQLITE_UTF8, 0, wxsqlite3_fragmentation_func, 0, 0);
+  }
+  return rc;
+}
+#endif
+
+typedef struct _ExtensionGroup
+{
+  const char* m_name;
+  int (*m_init)(sqlite3* db);     /* NULL if compiled out */
+} ExtensionGroup;
+
+static const ExtensionGroup extensionGroups[] =
+{
+#ifdef SQLITE_ENABLE_EXTFUNC
+  { "extfunc",       RegisterExtensionFunctions },
+#else
+  { "extfunc",       NULL },
+#endif
+#ifdef SQLITE_ENABLE_CSV
+  { "csv",           ExtensionInitCsv },
+#else
+  { "csv",           NULL },
+#endif
+#ifdef SQLITE_ENABLE_SHA3
+  { "sha3",          ExtensionInitSha3 },
+#else
+  { "sha3",          NULL },
+#endif
+#ifdef SQLITE_ENABLE_CARRAY
+  { "carray",        ExtensionInitCarray },
+#else
+  { "carray",        NULL },
+#endif
+#ifdef SQLITE_ENABLE_FILEIO
+  { "fileio",        ExtensionInitFileio },
+#else
+  { "fileio",        NULL },
+#endif
+#ifdef SQLITE_ENABLE_SERIES
+  { "series",        ExtensionInitSeries },
+#else
+  { "series",        NULL },
+#endif
+#if defined(SQLITE_ENABLE_RTREE) && !defined(SQLITE_OMIT_VIRTUALTABLE)
+  { "rtreebulk",     ExtensionInitRtreeBulk },
+#else
+  { "rtreebulk",     NULL },
+#endif
+#if defined(SQLITE_ENABLE_JSON1) && !defined(SQLITE_OMIT_VIRTUALTABLE)
+  { "jsontable",     ExtensionInitJsonTable },
+#else
+  { "jsontable",     NULL },
+#endif
+#if defined(SQLITE_ENABLE_EXPERT) && !defined(SQLITE_OMIT_VIRTUALTABLE)
+  { "indexadvisor",  ExtensionInitIndexAdvisor },
+#else
+  { "indexadvisor",  NULL },
+#endif
+#ifdef SQLITE_ENABLE_DBSTAT_VTAB
+  { "fragmentation", ExtensionInitFragmentation },
+#else
+  { "fragmentation", NULL },
+#endif
+};
+
+#define EXTENSION_GROUP_COUNT (int) (sizeof(extensionGroups) / sizeof(extensionGroups[0]))
+#define EXTENSION_GROUPS_ALL  ((1u << EXTENSION_GROUP_COUNT) - 1)
+
+/* Groups registered on connections opened from now on, guarded by the master mutex */
+static unsigned int extensionGroupsDefault = EXTENSION_GROUPS_ALL;
+
+#if defined(_MSC_VER)
+#define EXTENSION_THREAD_LOCAL __declspec(thread)
+#else
+#define EXTENSION_THREAD_LOCAL __thread
+#endif
+
+/* Groups of the connection wxsqlite3_open_extensions() is opening on this thread, -1 otherwise */
+static EXTENSION_THREAD_LOCAL int extensionGroupsOpen = -1;
+
+/*
+** Parse a comma separated list of group names, "all" or "none"
+*/
+static int
+ExtensionGroupsParse(const char* zGroups, unsigned int* pGroups)
+{
+  unsigned int groups = 0;
+  const char* p = zGroups;
+  if (zGroups == NULL)
+  {
+    return SQLITE_MISUSE;
+  }
+  while (*p != 0)
+  {
+    const char* end;
+    int n, j;
+    while (*p == ' ' || *p == ',')
+    {
+      ++p;
+    }
+    for (end = p; *end != 0 && *end != ','; ++end);
+    for (n = (int) (end - p); n > 0 && p[n - 1] == ' '; --n);
+    if (n == 3 && sqlite3_strnicmp(p, "all", 3) == 0)
+    {
+      groups = EXTENSION_GROUPS_ALL;
+    }
+    else if (n > 0 && !(n == 4 && sqlite3_strnicmp(p, "none", 4) == 0))
+    {
+      for (j = 0; j < EXTENSION_GROUP_COUNT; ++j)
+      {
+        if ((int) strlen(extensionGroups[j].m_name) == n && sqlite3_strnicmp(p, extensionGroups[j].m_name, n) == 0) break;
+      }
+      if (j == EXTENSION_GROUP_COUNT)
+      {
+        return SQLITE_ERROR;
+      }
+      groups |= 1u << j;
+    }
+    p = end;
+  }
+  *pGroups = groups;
+  return SQLITE_OK;
+}
+
+static int
+RegisterExtensionGroups(sqlite3* db, unsigned int groups)
 {
   int rc = SQLITE_OK;
+  int j;
+  for (j = 0; rc == SQLITE_OK && j < EXTENSION_GROUP_COUNT; ++j)
+  {
+    if ((groups & (1u << j)) != 0 && extensionGroups[j].m_init != NULL)
+    {
+      rc = extensionGroups[j].m_init(db);
+    }
+  }
+  return rc;
+}
+
 #ifdef SQLITE_HAS_CODEC
-  CodecParameter* codecParameterTable = CloneCodecParameterTable();
-  rc = (codecParameterTable != NULL) ? SQLITE_OK : SQLITE_NOMEM;
+static int
+RegisterCodecFunctions(sqlite3* db)
+{
+  /* The connection shares the global parameter table until it changes a parameter */
+  CodecParameterRef* codecParameterRef = NewCodecParameterRef();
+  int rc = (codecParameterRef != NULL) ? SQLITE_OK : SQLITE_NOMEM;
   if (rc == SQLITE_OK)
   {
     rc = sqlite3_create_function_v2(db, "wxsqlite3_config_table", 0, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
-                                    codecParameterTable, wxsqlite3_config_table, 0, 0, (void(*)(void*)) FreeCodecParameterTable);
+                                    codecParameterRef, wxsqlite3_config_table, 0, 0, (void(*)(void*)) FreeCodecParameterRef);
   }
   if (rc == SQLITE_OK)
   {
     rc = sqlite3_create_function(db, "wxsqlite3_config", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
-                                 codecParameterTable, wxsqlite3_config_params, 0, 0);
+                                 codecParameterRef, wxsqlite3_config_params, 0, 0);
   }
   if (rc == SQLITE_OK)
   {
     rc = sqlite3_create_function(db, "wxsqlite3_config", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
-                                 codecParameterTable, wxsqlite3_config_params, 0, 0);
+                                 codecParameterRef, wxsqlite3_config_params, 0, 0);
   }
   if (rc == SQLITE_OK)
   {
     rc = sqlite3_create_function(db, "wxsqlite3_config", 3, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
-                                 codecParameterTable, wxsqlite3_config_params, 0, 0);
+                                 codecParameterRef, wxsqlite3_config_params, 0, 0);
   }
-#endif
-#ifdef SQLITE_ENABLE_EXTFUNC
   if (rc == SQLITE_OK)
   {
-    rc = RegisterExtensionFunctions(db);
+    rc = sqlite3_create_function(db, "wxsqlite3_cpu_features", 0, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                 0, wxsqlite3_cpu_features, 0, 0);
   }
-#endif
-#ifdef SQLITE_ENABLE_CSV
   if (rc == SQLITE_OK)
   {
-    rc = sqlite3_csv_init(db, NULL, NULL);
+    rc = sqlite3_create_function(db, "wxsqlite3_kdf_calibrate", 2, SQLITE_UTF8,
+                                 0, wxsqlite3_kdf_calibrate_func, 0, 0);
   }
-#endif
-#ifdef SQLITE_ENABLE_SHA3
   if (rc == SQLITE_OK)
   {
-    rc = sqlite3_shathree_init(db, NULL, NULL);
+    rc = sqlite3_create_function(db, "wxsqlite3_cipher_check", 1, SQLITE_UTF8,
+                                 0, wxsqlite3_cipher_check_func, 0, 0);
   }
+  return rc;
+}
 #endif
-#ifdef SQLITE_ENABLE_CARRAY
-  if (rc == SQLITE_OK)
+
+/*
+** Automatic extension, called by SQLite on every open. The lookaside of the
+** connection is not set up yet at this point, so the definitions do not
+** take lookaside slots.
+*/
+static
+int registerAllExtensions(sqlite3 *db, char **pzErrMsg, const sqlite3_api_routines *pApi)
+{
+  int rc = SQLITE_OK;
+  unsigned int groups;
+  if (extensionGroupsOpen >= 0)
+  {
+    groups = (unsigned int) extensionGroupsOpen;
+  }
+  else
   {
-    rc = sqlite3_carray_init(db, NULL, NULL);
+    sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+    sqlite3_mutex_enter(mutex);
+    groups = extensionGroupsDefault;
+    sqlite3_mutex_leave(mutex);
   }
+#ifdef SQLITE_HAS_CODEC
+  rc = RegisterCodecFunctions(db);
 #endif
-#ifdef SQLITE_ENABLE_FILEIO
   if (rc == SQLITE_OK)
   {
-    rc = sqlite3_fileio_init(db, NULL, NULL);
+    rc = RegisterExtensionGroups(db, groups);
   }
-#endif
-#ifdef SQLITE_ENABLE_SERIES
+  return rc;
+}
+
+/*
+** Select the extension groups registered on connections opened from now on
+*/
+int
+wxsqlite3_default_extensions(const char* zGroups)
+{
+  unsigned int groups;
+  int rc = ExtensionGroupsParse(zGroups, &groups);
   if (rc == SQLITE_OK)
   {
-    rc = sqlite3_series_init(db, NULL, NULL);
+    sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+    sqlite3_mutex_enter(mutex);
+    extensionGroupsDefault = groups;
+    sqlite3_mutex_leave(mutex);
   }
-#endif
   return rc;
 }
 
-SQLITE_API int sqlite3_open(
-  const char *filename,   /* Database filename (UTF-8) */
-  sqlite3 **ppDb          /* OUT: SQLite db handle */
-)
+/*
+** Register extension groups on an open connection
+*/
+int
+wxsqlite3_register_extensions(sqlite3* db, const char* zGroups)
 {
-  int ret = sqlite3_open_internal(filename, ppDb);
-  if (ret == 0)
+  unsigned int groups;
+  int rc;
+  if (db == NULL)
+  {
+    return SQLITE_MISUSE;
+  }
+  rc = ExtensionGroupsParse(zGroups, &groups);
+  if (rc == SQLITE_OK)
   {
-    ret = registerAllExtensions(*ppDb, NULL, NULL);
+    sqlite3_mutex_enter(db->mutex);
+    /* The definitions live as long as the connection, keep them out of the
+    ** lookaside slots, so that SQLITE_DBCONFIG_LOOKASIDE still works */
+    db->lookaside.bDisable++;
+    rc = RegisterExtensionGroups(db, groups);
+    db->lookaside.bDisable--;
+    sqlite3_mutex_leave(db->mutex);
   }
-  return ret;
+  return rc;
 }
 
-SQLITE_API int sqlite3_open16(
-  const void *filename,   /* Database filename (UTF-16) */
-  sqlite3 **ppDb          /* OUT: SQLite db handle */
-)
+/*
+** Open a connection like sqlite3_open_v2, with its own selection of extension groups
+*/
+int
+wxsqlite3_open_extensions(const char* zFilename, sqlite3** ppDb, int flags, const char* zVfs, const char* zGroups)
 {
-  int ret = sqlite3_open16_internal(filename, ppDb);
-  if (ret == 0)
+  unsigned int groups;
+  int rc = ExtensionGroupsParse(zGroups, &groups);
+  if (rc != SQLITE_OK)
   {
-    ret = registerAllExtensions(*ppDb, NULL, NULL);
+    if (ppDb != NULL)
+    {
+      *ppDb = NULL;
+    }
+    return rc;
   }
-  return ret;
+  /* The automatic extension runs on this thread, within the open */
+  extensionGroupsOpen = (int) groups;
+  rc = sqlite3_open_v2(zFilename, ppDb, flags, zVfs);
+  extensionGroupsOpen = -1;
+  return rc;
 }
 
-SQLITE_API int sqlite3_open_v2(
-  const char *filename,   /* Database filename (UTF-8) */
-  sqlite3 **ppDb,         /* OUT: SQLite db handle */
-  int flags,              /* Flags */
-  const char *zVfs        /* Name of VFS module to use */
-)
+#ifdef SQLITE_EXTRA_INIT
+
+/*
+** Initialization hook called once by sqlite3_initialize()
+*/
+int sqlite3secure_extra_init(const char* dummy)
 {
-  int ret = sqlite3_open_v2_internal(filename, ppDb, flags, zVfs);
-  if (ret == 0)
+  /* SQLite forgets the automatic extensions on shutdown */
+  int rc = sqlite3_auto_extension((void(*)(void)) registerAllExtensions);
+#if defined(SQLITE_HAS_CODEC) && defined(SQLITE_ENABLE_TEMPCRYPT) && !defined(SQLITE_OMIT_DISKIO)
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_tempcrypt_init();
+  }
+#endif
+#if defined(SQLITE_ENABLE_URINGVFS) && SQLITE_OS_UNIX && defined(__linux__) && !defined(SQLITE_OMIT_DISKIO)
+  if (rc == SQLITE_OK)
   {
-    ret = registerAllExtensions(*ppDb, NULL, NULL);
+    rc = sqlite3_uringvfs_init();
   }
-  return ret;
+#endif
+#if defined(SQLITE_ENABLE_DIRECTVFS) && SQLITE_OS_UNIX && !defined(SQLITE_OMIT_DISKIO)
+  if (rc == SQLITE_OK)
+  {
+    rc = sqlite3_directvfs_init();
+  }
+#endif
+  return rc;
 }
 
 #endif
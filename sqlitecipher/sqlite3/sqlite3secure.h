@@ -33,6 +33,110 @@ extern "C" {
 #endif
 SQLITE_API int wxsqlite3_config(sqlite3* db, const char* paramName, int newValue);
 SQLITE_API int wxsqlite3_config_cipher(sqlite3* db, const char* cipherName, const char* paramName, int newValue);
+
+// Codec statistics, modelled after sqlite3_db_status
+#define WXSQLITE3_CODECSTATUS_PAGES_DECRYPTED 0
+#define WXSQLITE3_CODECSTATUS_PAGES_ENCRYPTED 1
+#define WXSQLITE3_CODECSTATUS_CRYPTO_TIME     2 /* Nanoseconds spent in the ciphers, see wxsqlite3_codec_timing */
+#define WXSQLITE3_CODECSTATUS_PAGES_JOURNALED 3 /* Journaled as read from disk, without encryption */
+#define WXSQLITE3_CODECSTATUS_PAGES_SHARED    4 /* Taken decrypted from the shared page store */
+SQLITE_API int wxsqlite3_codec_status(sqlite3* db, const char* zDbName, int op, sqlite3_int64* pCurrent, int resetFlag);
+// Process-wide switch for the CRYPTO_TIME counter, off by default since it
+// takes two clock readings per page: 1 on, 0 off, -1 query. Returns the
+// previous setting.
+SQLITE_API int wxsqlite3_codec_timing(int onoff);
+
+// Process-wide store of decrypted pages shared by the connections to the same
+// file, with the same key. Returns the previous limit in bytes; 0 disables the
+// store and frees its pages, a negative value only queries the limit.
+SQLITE_API sqlite3_int64 wxsqlite3_shared_pages_limit(sqlite3_int64 limit);
+
+// Replace SQLite's page cache by one with a partition per connection, huge-page
+// backed page slabs and CLOCK replacement. Must be called before SQLite is
+// initialized, otherwise SQLITE_MISUSE is returned.
+SQLITE_API int wxsqlite3_install_pcache(void);
+
+// Replace SQLite's memory allocator by one caching freed blocks per thread and
+// size class. Must be called before SQLite is initialized, otherwise
+// SQLITE_MISUSE is returned.
+SQLITE_API int wxsqlite3_install_malloc(void);
+
+// Fragmentation report of a database as JSON: free pages, and the fill factor
+// and the leaf pages out of order of every table and index. Needs
+// SQLITE_ENABLE_DBSTAT_VTAB. The report is freed with sqlite3_free.
+SQLITE_API int wxsqlite3_fragmentation(sqlite3* db, const char* zDbName, char** pzReport);
+
+// Load pages into the page cache of a connection ahead of use: the pages of
+// aHotPages first, then the b-trees of the schema level by level, up to nPages
+// pages or the cache size. Encrypted pages are decrypted on nThreads threads.
+SQLITE_API int wxsqlite3_warmup(sqlite3* db, const char* zDbName, const unsigned int* aHotPages, int nHotPages, int nPages, int nThreads);
+// Numbers of the pages in the page cache of a connection, e.g. to warm up the
+// cache with them at the next start. The array is freed with sqlite3_free.
+SQLITE_API int wxsqlite3_cached_pages(sqlite3* db, const char* zDbName, unsigned int** paPages, int* pnPages);
+
+// Select the extension groups registered on connections opened from now on,
+// as a comma separated list of extfunc, csv, sha3, carray, fileio, series,
+// rtreebulk, jsontable, indexadvisor, fragmentation, or "all" (the default)
+// or "none". The configuration functions of the codec are always registered.
+// Returns SQLITE_ERROR for an unknown name.
+SQLITE_API int wxsqlite3_default_extensions(const char* zGroups);
+// Register extension groups on an open connection, same names as above.
+SQLITE_API int wxsqlite3_register_extensions(sqlite3* db, const char* zGroups);
+// Open a connection like sqlite3_open_v2, registering the given extension
+// groups instead of the default selection. Returns SQLITE_ERROR without
+// opening for an unknown name, *ppDb is NULL then.
+SQLITE_API int wxsqlite3_open_extensions(const char* zFilename, sqlite3** ppDb, int flags, const char* zVfs, const char* zGroups);
+
+// Set the key of an existing database, detecting its cipher from page 1
+SQLITE_API int wxsqlite3_key_auto(sqlite3* db, const char* zDbName, const void* zKey, int nKey, int* pCipherType);
+
+// Set the key of a database to the key of a database of another connection,
+// without running the key derivation again
+SQLITE_API int wxsqlite3_key_copy(sqlite3* db, const char* zDbName, sqlite3* dbSource, const char* zSourceName);
+
+// Iteration count for which the cipher's key derivation takes targetMs on this machine
+// -1 for aes128cbc and aes256cbc, whose key derivations have a fixed count
+SQLITE_API int wxsqlite3_kdf_calibrate(const char* cipherName, int targetMs);
+
+// Cipher backends registered at runtime, in addition to the built-in ciphers.
+// The parameter table ends with an entry whose name is empty or NULL.
+typedef struct _WxSQLite3CipherParam
+{
+  char* m_name;
+  int   m_value;
+  int   m_default;
+  int   m_minValue;
+  int   m_maxValue;
+} WxSQLite3CipherParam;
+
+// fd is the database file, NULL if it is not open yet. rekey is set when a
+// new key is derived for writing, e.g. to choose a new salt.
+typedef struct _WxSQLite3CipherDescriptor
+{
+  const char* m_name;
+  void* (*m_allocateCipher)(sqlite3* db);
+  void  (*m_freeCipher)(void* cipher);
+  void  (*m_cloneCipher)(void* cipherTo, void* cipherFrom);
+  int   (*m_getLegacy)(void* cipher);
+  int   (*m_getPageSize)(void* cipher);
+  int   (*m_getReserved)(void* cipher);
+  void  (*m_generateKey)(void* cipher, sqlite3_file* fd, char* userPassword, int passwordLength, int rekey);
+  int   (*m_encryptPage)(void* cipher, int page, unsigned char* data, int len, int reserved);
+  int   (*m_decryptPage)(void* cipher, int page, unsigned char* data, int len, int reserved);
+} WxSQLite3CipherDescriptor;
+
+#define WXSQLITE3_CIPHER_COUNT_MAX 16
+
+// Register before opening the connections that use the cipher
+SQLITE_API int wxsqlite3_register_cipher(const WxSQLite3CipherDescriptor* descriptor, const WxSQLite3CipherParam* params);
+// Cipher type for QSQLITE_USE_CIPHER and wxsqlite3_config(db, "cipher", ...), 0 if unknown
+SQLITE_API int wxsqlite3_cipher_index(const char* cipherName);
+// Name of a cipher type, NULL if unknown
+SQLITE_API const char* wxsqlite3_cipher_name(int cipherType);
+// For allocateCipher: value of a parameter, which is then reset to its default
+SQLITE_API int wxsqlite3_cipher_param(sqlite3* db, const char* cipherName, const char* paramName);
+// Conformance checks for a cipher, SQLITE_OK if it passes, else *pzErrMsg tells why
+SQLITE_API int wxsqlite3_cipher_check(const char* cipherName, char** pzErrMsg);
 #ifdef __cplusplus
 }
 
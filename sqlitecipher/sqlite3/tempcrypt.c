@@ -0,0 +1,404 @@
+/*
+** Name:        tempcrypt.c
+** Purpose:     Encryption of temporary files
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** The codec encrypts the database file, its journals and statement
+** journals, but not the files SQLite creates for temporary data: the
+** spill files of the external sorter (large ORDER BY, GROUP BY and
+** CREATE INDEX), the temporary database and transient tables. Keeping
+** these in memory (SQLITE_TEMP_STORE=2) prevents plaintext on disk, but
+** also disables multi-threaded sorting and forces all sorter data into RAM.
+**
+** This file implements a VFS shim which is installed as the default VFS on
+** initialization. Temporary files are encrypted with ChaCha20 using a random
+** key and nonce per file. The key stream is addressed by file offset, so
+** that arbitrary reads and writes are possible. Temporary files are deleted
+** on close and never read by another connection, therefore the key is kept
+** in memory only and no integrity protection is needed. All other files are
+** opened by the underlying VFS directly.
+**
+** The shim files implement version 1 of the I/O methods, that is, the
+** sorter does not memory-map encrypted spill files.
+*/
+
+#define TEMPCRYPT_VFS_NAME  "tempcrypt"
+#define TEMPCRYPT_FILES     (SQLITE_OPEN_TEMP_JOURNAL | SQLITE_OPEN_TEMP_DB | SQLITE_OPEN_TRANSIENT_DB)
+
+typedef struct _TempCryptFile
+{
+  sqlite3_file   m_base;          /* Base class - must be first */
+  sqlite3_file*  m_file;          /* Underlying file */
+  unsigned char  m_key[32];       /* Random key of this file */
+  unsigned char  m_nonce[12];     /* Random nonce of this file */
+  unsigned char* m_buffer;        /* Buffer for encrypting written data */
+  int            m_bufferSize;    /* Size of m_buffer */
+} TempCryptFile;
+
+#define ORIGVFS(p)  ((sqlite3_vfs*) ((p)->pAppData))
+
+/*
+** Apply the key stream at the given file offset. The 64-bit block number
+** is split into the 32-bit block counter and the first word of the nonce.
+*/
+static void
+TempCryptXor(TempCryptFile* p, unsigned char* data, int n, sqlite3_int64 offset)
+{
+  unsigned char nonce[12];
+  unsigned char block[64];
+  while (n > 0)
+  {
+    sqlite3_uint64 blockNo = (sqlite3_uint64) offset >> 6;
+    int skip = (int) (offset & 63);
+    uint32_t counter = (uint32_t) blockNo;
+    uint32_t high = (uint32_t) (blockNo >> 32);
+    sqlite3_uint64 nMax = ((sqlite3_uint64) 0x100000000 - counter) * 64 - skip;
+    int len = (n < nMax) ? n : (int) nMax;
+    int i;
+
+    memcpy(nonce, p->m_nonce, sizeof(nonce));
+    nonce[0] ^= (unsigned char) (high);
+    nonce[1] ^= (unsigned char) (high >> 8);
+    nonce[2] ^= (unsigned char) (high >> 16);
+    nonce[3] ^= (unsigned char) (high >> 24);
+    if (skip > 0)
+    {
+      int k = (64 - skip < len) ? 64 - skip : len;
+      memset(block, 0, sizeof(block));
+      chacha20_xor(block, sizeof(block), p->m_key, nonce, counter);
+      for (i = 0; i < k; ++i)
+      {
+        data[i] ^= block[skip + i];
+      }
+      data += k;
+      n -= k;
+      len -= k;
+      offset += k;
+      ++counter;
+    }
+    if (len > 0)
+    {
+      chacha20_xor(data, len, p->m_key, nonce, counter);
+      data += len;
+      n -= len;
+      offset += len;
+    }
+  }
+}
+
+static int
+TempCryptClose(sqlite3_file* pFile)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  int rc = p->m_file->pMethods->xClose(p->m_file);
+  sqlite3_free(p->m_buffer);
+  memset(p->m_key, 0, sizeof(p->m_key));
+  p->m_buffer = NULL;
+  p->m_bufferSize = 0;
+  return rc;
+}
+
+static int
+TempCryptRead(sqlite3_file* pFile, void* zBuf, int iAmt, sqlite3_int64 iOfst)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  int rc = p->m_file->pMethods->xRead(p->m_file, zBuf, iAmt, iOfst);
+  if (rc == SQLITE_OK)
+  {
+    TempCryptXor(p, (unsigned char*) zBuf, iAmt, iOfst);
+  }
+  else if (rc == SQLITE_IOERR_SHORT_READ)
+  {
+    /* Decrypt the part actually read, the rest is zero-filled already */
+    sqlite3_int64 size;
+    if (p->m_file->pMethods->xFileSize(p->m_file, &size) == SQLITE_OK && size > iOfst)
+    {
+      int nRead = (size - iOfst < iAmt) ? (int) (size - iOfst) : iAmt;
+      TempCryptXor(p, (unsigned char*) zBuf, nRead, iOfst);
+    }
+  }
+  return rc;
+}
+
+static int
+TempCryptWrite(sqlite3_file* pFile, const void* zBuf, int iAmt, sqlite3_int64 iOfst)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  if (iAmt > p->m_bufferSize)
+  {
+    unsigned char* buffer = (unsigned char*) sqlite3_realloc(p->m_buffer, iAmt);
+    if (buffer == NULL)
+    {
+      return SQLITE_IOERR_NOMEM;
+    }
+    p->m_buffer = buffer;
+    p->m_bufferSize = iAmt;
+  }
+  memcpy(p->m_buffer, zBuf, iAmt);
+  TempCryptXor(p, p->m_buffer, iAmt, iOfst);
+  return p->m_file->pMethods->xWrite(p->m_file, p->m_buffer, iAmt, iOfst);
+}
+
+static int
+TempCryptTruncate(sqlite3_file* pFile, sqlite3_int64 size)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  return p->m_file->pMethods->xTruncate(p->m_file, size);
+}
+
+static int
+TempCryptSync(sqlite3_file* pFile, int flags)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  return p->m_file->pMethods->xSync(p->m_file, flags);
+}
+
+static int
+TempCryptFileSize(sqlite3_file* pFile, sqlite3_int64* pSize)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  return p->m_file->pMethods->xFileSize(p->m_file, pSize);
+}
+
+static int
+TempCryptLock(sqlite3_file* pFile, int eLock)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  return p->m_file->pMethods->xLock(p->m_file, eLock);
+}
+
+static int
+TempCryptUnlock(sqlite3_file* pFile, int eLock)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  return p->m_file->pMethods->xUnlock(p->m_file, eLock);
+}
+
+static int
+TempCryptCheckReservedLock(sqlite3_file* pFile, int* pResOut)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  return p->m_file->pMethods->xCheckReservedLock(p->m_file, pResOut);
+}
+
+static int
+TempCryptFileControl(sqlite3_file* pFile, int op, void* pArg)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  int rc = p->m_file->pMethods->xFileControl(p->m_file, op, pArg);
+  if (rc == SQLITE_OK && op == SQLITE_FCNTL_VFSNAME)
+  {
+    *(char**) pArg = sqlite3_mprintf(TEMPCRYPT_VFS_NAME "/%z", *(char**) pArg);
+  }
+  return rc;
+}
+
+static int
+TempCryptSectorSize(sqlite3_file* pFile)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  return p->m_file->pMethods->xSectorSize(p->m_file);
+}
+
+static int
+TempCryptDeviceCharacteristics(sqlite3_file* pFile)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  return p->m_file->pMethods->xDeviceCharacteristics(p->m_file);
+}
+
+static const sqlite3_io_methods tempCryptIoMethods =
+{
+  1,                              /* iVersion */
+  TempCryptClose,                 /* xClose */
+  TempCryptRead,                  /* xRead */
+  TempCryptWrite,                 /* xWrite */
+  TempCryptTruncate,              /* xTruncate */
+  TempCryptSync,                  /* xSync */
+  TempCryptFileSize,              /* xFileSize */
+  TempCryptLock,                  /* xLock */
+  TempCryptUnlock,                /* xUnlock */
+  TempCryptCheckReservedLock,     /* xCheckReservedLock */
+  TempCryptFileControl,           /* xFileControl */
+  TempCryptSectorSize,            /* xSectorSize */
+  TempCryptDeviceCharacteristics, /* xDeviceCharacteristics */
+  0,                              /* xShmMap */
+  0,                              /* xShmLock */
+  0,                              /* xShmBarrier */
+  0,                              /* xShmUnmap */
+  0,                              /* xFetch */
+  0                               /* xUnfetch */
+};
+
+static int
+TempCryptOpen(sqlite3_vfs* pVfs, const char* zName, sqlite3_file* pFile, int flags, int* pOutFlags)
+{
+  TempCryptFile* p = (TempCryptFile*) pFile;
+  sqlite3_vfs* origVfs = ORIGVFS(pVfs);
+  int rc;
+
+  if ((flags & TEMPCRYPT_FILES) == 0)
+  {
+    /* Not a temporary file, let the underlying VFS handle it directly */
+    return origVfs->xOpen(origVfs, zName, pFile, flags, pOutFlags);
+  }
+
+  memset(p, 0, sizeof(TempCryptFile));
+  p->m_file = (sqlite3_file*) &p[1];
+  rc = origVfs->xOpen(origVfs, zName, p->m_file, flags, pOutFlags);
+  if (rc == SQLITE_OK)
+  {
+    chacha20_rng(p->m_key, sizeof(p->m_key));
+    chacha20_rng(p->m_nonce, sizeof(p->m_nonce));
+    p->m_base.pMethods = &tempCryptIoMethods;
+  }
+  else
+  {
+    p->m_base.pMethods = NULL;
+  }
+  return rc;
+}
+
+static int
+TempCryptDelete(sqlite3_vfs* pVfs, const char* zName, int syncDir)
+{
+  return ORIGVFS(pVfs)->xDelete(ORIGVFS(pVfs), zName, syncDir);
+}
+
+static int
+TempCryptAccess(sqlite3_vfs* pVfs, const char* zName, int flags, int* pResOut)
+{
+  return ORIGVFS(pVfs)->xAccess(ORIGVFS(pVfs), zName, flags, pResOut);
+}
+
+static int
+TempCryptFullPathname(sqlite3_vfs* pVfs, const char* zName, int nOut, char* zOut)
+{
+  return ORIGVFS(pVfs)->xFullPathname(ORIGVFS(pVfs), zName, nOut, zOut);
+}
+
+static void*
+TempCryptDlOpen(sqlite3_vfs* pVfs, const char* zFilename)
+{
+  return ORIGVFS(pVfs)->xDlOpen(ORIGVFS(pVfs), zFilename);
+}
+
+static void
+TempCryptDlError(sqlite3_vfs* pVfs, int nByte, char* zErrMsg)
+{
+  ORIGVFS(pVfs)->xDlError(ORIGVFS(pVfs), nByte, zErrMsg);
+}
+
+static void
+(*TempCryptDlSym(sqlite3_vfs* pVfs, void* p, const char* zSym))(void)
+{
+  return ORIGVFS(pVfs)->xDlSym(ORIGVFS(pVfs), p, zSym);
+}
+
+static void
+TempCryptDlClose(sqlite3_vfs* pVfs, void* pHandle)
+{
+  ORIGVFS(pVfs)->xDlClose(ORIGVFS(pVfs), pHandle);
+}
+
+static int
+TempCryptRandomness(sqlite3_vfs* pVfs, int nByte, char* zOut)
+{
+  return ORIGVFS(pVfs)->xRandomness(ORIGVFS(pVfs), nByte, zOut);
+}
+
+static int
+TempCryptSleep(sqlite3_vfs* pVfs, int nMicro)
+{
+  return ORIGVFS(pVfs)->xSleep(ORIGVFS(pVfs), nMicro);
+}
+
+static int
+TempCryptCurrentTime(sqlite3_vfs* pVfs, double* pTimeOut)
+{
+  return ORIGVFS(pVfs)->xCurrentTime(ORIGVFS(pVfs), pTimeOut);
+}
+
+static int
+TempCryptGetLastError(sqlite3_vfs* pVfs, int nErr, char* zErr)
+{
+  return ORIGVFS(pVfs)->xGetLastError(ORIGVFS(pVfs), nErr, zErr);
+}
+
+static int
+TempCryptCurrentTimeInt64(sqlite3_vfs* pVfs, sqlite3_int64* pTimeOut)
+{
+  return ORIGVFS(pVfs)->xCurrentTimeInt64(ORIGVFS(pVfs), pTimeOut);
+}
+
+static int
+TempCryptSetSystemCall(sqlite3_vfs* pVfs, const char* zName, sqlite3_syscall_ptr pNewFunc)
+{
+  return ORIGVFS(pVfs)->xSetSystemCall(ORIGVFS(pVfs), zName, pNewFunc);
+}
+
+static sqlite3_syscall_ptr
+TempCryptGetSystemCall(sqlite3_vfs* pVfs, const char* zName)
+{
+  return ORIGVFS(pVfs)->xGetSystemCall(ORIGVFS(pVfs), zName);
+}
+
+static const char*
+TempCryptNextSystemCall(sqlite3_vfs* pVfs, const char* zName)
+{
+  return ORIGVFS(pVfs)->xNextSystemCall(ORIGVFS(pVfs), zName);
+}
+
+static sqlite3_vfs tempCryptVfs =
+{
+  3,                              /* iVersion */
+  0,                              /* szOsFile (set on registration) */
+  0,                              /* mxPathname (set on registration) */
+  0,                              /* pNext */
+  TEMPCRYPT_VFS_NAME,             /* zName */
+  0,                              /* pAppData (set to the underlying VFS) */
+  TempCryptOpen,                  /* xOpen */
+  TempCryptDelete,                /* xDelete */
+  TempCryptAccess,                /* xAccess */
+  TempCryptFullPathname,          /* xFullPathname */
+  TempCryptDlOpen,                /* xDlOpen */
+  TempCryptDlError,               /* xDlError */
+  TempCryptDlSym,                 /* xDlSym */
+  TempCryptDlClose,               /* xDlClose */
+  TempCryptRandomness,            /* xRandomness */
+  TempCryptSleep,                 /* xSleep */
+  TempCryptCurrentTime,           /* xCurrentTime */
+  TempCryptGetLastError,          /* xGetLastError */
+  TempCryptCurrentTimeInt64,      /* xCurrentTimeInt64 */
+  TempCryptSetSystemCall,         /* xSetSystemCall */
+  TempCryptGetSystemCall,         /* xGetSystemCall */
+  TempCryptNextSystemCall         /* xNextSystemCall */
+};
+
+/*
+** Install the shim on top of the current default VFS and make it the new
+** default. Called once from sqlite3_initialize().
+*/
+int
+sqlite3_tempcrypt_init(void)
+{
+  sqlite3_vfs* origVfs = sqlite3_vfs_find(NULL);
+  if (origVfs == NULL)
+  {
+    return SQLITE_ERROR;
+  }
+  if (origVfs == &tempCryptVfs)
+  {
+    return SQLITE_OK;
+  }
+  tempCryptVfs.iVersion = (origVfs->iVersion < 3) ? origVfs->iVersion : 3;
+  tempCryptVfs.szOsFile = sizeof(TempCryptFile) + origVfs->szOsFile;
+  tempCryptVfs.mxPathname = origVfs->mxPathname;
+  tempCryptVfs.pAppData = origVfs;
+  return sqlite3_vfs_register(&tempCryptVfs, 1);
+}
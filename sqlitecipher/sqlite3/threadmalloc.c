@@ -0,0 +1,314 @@
+/*
+** Name:        threadmalloc.c
+** Purpose:     Memory allocator with per-thread caches of size classes
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** An implementation of sqlite3_mem_methods for SQLITE_CONFIG_MALLOC. Sizes
+** up to THREAD_MALLOC_MAX_SIZE are rounded up to a size class, 16, 24, 32,
+** 48, 64, ... bytes, and freed blocks are kept in a free list per class of
+** the freeing thread. Allocations of the same class by that thread reuse
+** them without a lock. Each list holds at most THREAD_MALLOC_CACHE_BYTES;
+** beyond that, and for larger sizes, blocks go to the system allocator.
+**
+** Every block has a header holding its size class, for xSize and for
+** xFree. A block freed by another thread than the one which allocated it
+** simply joins the cache of the freeing thread. The cache of a thread is
+** given back to the system when the thread ends.
+**
+** Install the allocator with wxsqlite3_install_malloc() before SQLite is
+** initialized, or with the driver option QSQLITE_MALLOC=thread on the first
+** connection of a process. The allocator is most useful with memory
+** statistics disabled (SQLITE_DEFAULT_MEMSTATUS=0, the default of
+** sqlite3.pri), since otherwise SQLite serializes all allocations on its
+** statistics mutex anyway.
+*/
+
+#if SQLITE_OS_UNIX
+#include <pthread.h>
+#endif
+
+#define THREAD_MALLOC_HEADER       16            /* Keeps blocks 16-byte aligned */
+#define THREAD_MALLOC_CLASSES      21            /* Size classes 16 ... 16384 bytes */
+#define THREAD_MALLOC_MAX_SIZE     16384
+#define THREAD_MALLOC_LARGE        THREAD_MALLOC_CLASSES
+#define THREAD_MALLOC_CACHE_BYTES  (64*1024)     /* Per size class and thread */
+
+typedef struct _ThreadMallocHeader
+{
+  sqlite3_int64 m_size;           /* Usable size */
+  int           m_class;          /* Size class, or THREAD_MALLOC_LARGE */
+} ThreadMallocHeader;
+
+typedef struct _ThreadMallocCache
+{
+  void* m_free[THREAD_MALLOC_CLASSES];   /* Free blocks, linked through their first bytes */
+  int   m_count[THREAD_MALLOC_CLASSES];
+} ThreadMallocCache;
+
+#if SQLITE_OS_UNIX
+static pthread_key_t threadMallocKey;
+#elif SQLITE_OS_WIN
+static DWORD threadMallocKey = FLS_OUT_OF_INDEXES;
+#endif
+static int threadMallocKeyValid = 0;
+
+static sqlite3_int64
+ThreadMallocClassSize(int sizeClass)
+{
+  /* Even classes are powers of 2, odd classes lie halfway in between */
+  return (sqlite3_int64) ((sizeClass & 1) ? 24 : 16) << (sizeClass / 2);
+}
+
+static int
+ThreadMallocClass(int nByte)
+{
+  unsigned int m = (unsigned int) (nByte - 1);
+  int b = 0;
+  if (nByte <= 16)
+  {
+    return 0;
+  }
+  /* 2^b < nByte <= 2^(b+1) */
+  while ((m >> (b + 1)) != 0)
+  {
+    ++b;
+  }
+  return ((unsigned int) nByte <= (3u << (b - 1))) ? 2 * (b - 4) + 1 : 2 * (b - 3);
+}
+
+static void
+ThreadMallocFlush(ThreadMallocCache* cache)
+{
+  int j;
+  for (j = 0; j < THREAD_MALLOC_CLASSES; ++j)
+  {
+    while (cache->m_free[j] != NULL)
+    {
+      void* p = cache->m_free[j];
+      cache->m_free[j] = *(void**) p;
+      free((char*) p - THREAD_MALLOC_HEADER);
+    }
+    cache->m_count[j] = 0;
+  }
+}
+
+#if SQLITE_OS_UNIX
+static void
+ThreadMallocThreadEnd(void* pArg)
+{
+  ThreadMallocFlush((ThreadMallocCache*) pArg);
+  free(pArg);
+}
+#elif SQLITE_OS_WIN
+static void WINAPI
+ThreadMallocThreadEnd(void* pArg)
+{
+  if (pArg != NULL)
+  {
+    ThreadMallocFlush((ThreadMallocCache*) pArg);
+    free(pArg);
+  }
+}
+#endif
+
+/*
+** The cache of the calling thread, created on first use, or NULL
+*/
+static ThreadMallocCache*
+ThreadMallocGetCache(int create)
+{
+  ThreadMallocCache* cache = NULL;
+  if (!threadMallocKeyValid)
+  {
+    return NULL;
+  }
+#if SQLITE_OS_UNIX
+  cache = (ThreadMallocCache*) pthread_getspecific(threadMallocKey);
+  if (cache == NULL && create)
+  {
+    cache = (ThreadMallocCache*) calloc(1, sizeof(ThreadMallocCache));
+    if (cache != NULL && pthread_setspecific(threadMallocKey, cache) != 0)
+    {
+      free(cache);
+      cache = NULL;
+    }
+  }
+#elif SQLITE_OS_WIN
+  cache = (ThreadMallocCache*) FlsGetValue(threadMallocKey);
+  if (cache == NULL && create)
+  {
+    cache = (ThreadMallocCache*) calloc(1, sizeof(ThreadMallocCache));
+    if (cache != NULL && !FlsSetValue(threadMallocKey, cache))
+    {
+      free(cache);
+      cache = NULL;
+    }
+  }
+#endif
+  return cache;
+}
+
+static void*
+ThreadMallocMalloc(int nByte)
+{
+  ThreadMallocHeader* header;
+  ThreadMallocCache* cache;
+  int sizeClass;
+  sqlite3_int64 size;
+
+  if (nByte <= 0)
+  {
+    return NULL;
+  }
+  if (nByte > THREAD_MALLOC_MAX_SIZE)
+  {
+    sizeClass = THREAD_MALLOC_LARGE;
+    size = nByte;
+  }
+  else
+  {
+    sizeClass = ThreadMallocClass(nByte);
+    size = ThreadMallocClassSize(sizeClass);
+    cache = ThreadMallocGetCache(0);
+    if (cache != NULL && cache->m_free[sizeClass] != NULL)
+    {
+      void* p = cache->m_free[sizeClass];
+      cache->m_free[sizeClass] = *(void**) p;
+      cache->m_count[sizeClass]--;
+      return p;
+    }
+  }
+  header = (ThreadMallocHeader*) malloc((size_t) size + THREAD_MALLOC_HEADER);
+  if (header == NULL)
+  {
+    return NULL;
+  }
+  header->m_size = size;
+  header->m_class = sizeClass;
+  return (char*) header + THREAD_MALLOC_HEADER;
+}
+
+static void
+ThreadMallocFree(void* p)
+{
+  ThreadMallocHeader* header;
+  if (p == NULL)
+  {
+    return;
+  }
+  header = (ThreadMallocHeader*) ((char*) p - THREAD_MALLOC_HEADER);
+  if (header->m_class != THREAD_MALLOC_LARGE)
+  {
+    ThreadMallocCache* cache = ThreadMallocGetCache(1);
+    if (cache != NULL && (sqlite3_int64) cache->m_count[header->m_class] * header->m_size < THREAD_MALLOC_CACHE_BYTES)
+    {
+      *(void**) p = cache->m_free[header->m_class];
+      cache->m_free[header->m_class] = p;
+      cache->m_count[header->m_class]++;
+      return;
+    }
+  }
+  free(header);
+}
+
+static int
+ThreadMallocSize(void* p)
+{
+  if (p == NULL)
+  {
+    return 0;
+  }
+  return (int) ((ThreadMallocHeader*) ((char*) p - THREAD_MALLOC_HEADER))->m_size;
+}
+
+static void*
+ThreadMallocRealloc(void* p, int nByte)
+{
+  ThreadMallocHeader* header = (ThreadMallocHeader*) ((char*) p - THREAD_MALLOC_HEADER);
+  void* q;
+  if (nByte <= header->m_size && (header->m_class == THREAD_MALLOC_LARGE ? nByte > THREAD_MALLOC_MAX_SIZE : ThreadMallocClass(nByte) == header->m_class))
+  {
+    return p;
+  }
+  if (header->m_class == THREAD_MALLOC_LARGE && nByte > THREAD_MALLOC_MAX_SIZE)
+  {
+    header = (ThreadMallocHeader*) realloc(header, (size_t) nByte + THREAD_MALLOC_HEADER);
+    if (header == NULL)
+    {
+      return NULL;
+    }
+    header->m_size = nByte;
+    return (char*) header + THREAD_MALLOC_HEADER;
+  }
+  q = ThreadMallocMalloc(nByte);
+  if (q != NULL)
+  {
+    memcpy(q, p, (size_t) ((nByte < header->m_size) ? nByte : header->m_size));
+    ThreadMallocFree(p);
+  }
+  return q;
+}
+
+static int
+ThreadMallocRoundup(int nByte)
+{
+  if (nByte > THREAD_MALLOC_MAX_SIZE)
+  {
+    return (nByte + 7) & ~7;
+  }
+  return (int) ThreadMallocClassSize(ThreadMallocClass(nByte));
+}
+
+static int
+ThreadMallocInit(void* pAppData)
+{
+  if (!threadMallocKeyValid)
+  {
+#if SQLITE_OS_UNIX
+    threadMallocKeyValid = (pthread_key_create(&threadMallocKey, ThreadMallocThreadEnd) == 0);
+#elif SQLITE_OS_WIN
+    threadMallocKey = FlsAlloc(ThreadMallocThreadEnd);
+    threadMallocKeyValid = (threadMallocKey != FLS_OUT_OF_INDEXES);
+#endif
+  }
+  /* Without thread-local storage every block goes to the system allocator */
+  return SQLITE_OK;
+}
+
+static void
+ThreadMallocShutdown(void* pAppData)
+{
+  ThreadMallocCache* cache = ThreadMallocGetCache(0);
+  if (cache != NULL)
+  {
+    ThreadMallocFlush(cache);
+  }
+  /* The key stays, the caches of other threads are freed when they end */
+}
+
+static const sqlite3_mem_methods threadMallocMethods =
+{
+  ThreadMallocMalloc,             /* xMalloc */
+  ThreadMallocFree,               /* xFree */
+  ThreadMallocRealloc,            /* xRealloc */
+  ThreadMallocSize,               /* xSize */
+  ThreadMallocRoundup,            /* xRoundup */
+  ThreadMallocInit,               /* xInit */
+  ThreadMallocShutdown,           /* xShutdown */
+  0                               /* pAppData */
+};
+
+/*
+** Use the allocator for all of SQLite. Like every sqlite3_config() call
+** this fails with SQLITE_MISUSE once SQLite is initialized.
+*/
+int
+wxsqlite3_install_malloc(void)
+{
+  return sqlite3_config(SQLITE_CONFIG_MALLOC, &threadMallocMethods);
+}
@@ -0,0 +1,900 @@
+/*
+** Name:        uringvfs.c
+** Purpose:     VFS shim batching database writes, through io_uring on Linux
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** The unix VFS writes every page with its own pwrite() call, so a commit or
+** checkpoint of N pages costs N system calls before the final fsync().
+**
+** This file implements the VFS "uring", a shim on top of the default VFS
+** that is selected per connection (vfs=uring in a URI filename, or the
+** driver option QSQLITE_VFS=uring). Writes to the main database file are
+** copied into a per-file queue and returned immediately. The queue is
+** sorted by offset, adjacent pages are coalesced into single vectored
+** writes, and everything is submitted as one batch through io_uring. If
+** io_uring is not available (old kernel, seccomp filter) the same runs are
+** written with pwritev() instead.
+**
+** The queue is flushed before any operation through which the written data
+** could be observed or must be durable: xSync, xRead, xFileSize, xTruncate,
+** locking, shared memory, xFetch, file controls (SQLITE_FCNTL_SYNC ends
+** every commit, SQLITE_FCNTL_CKPT_DONE every checkpoint) and xClose. Errors
+** of queued writes are reported by the operation that flushes them.
+**
+** Journal and WAL files are passed to the underlying VFS unchanged: they are
+** appended sequentially, and WAL frames become visible to other connections
+** through the wal-index of the database file, not of the WAL file.
+**
+** Reads are not batched. The pager requests one page at a time and has no
+** read-ahead path, so a single io_uring read would only add overhead to
+** pread(); sequential scans already benefit from the kernel's read-ahead.
+*/
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define URING_VFS_NAME      "uring"
+#define URING_MAX_WRITES    256            /* Queued writes per file */
+#define URING_MAX_BYTES     (4*1024*1024)  /* Queued bytes per file */
+#define URING_RING_ENTRIES  32
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define URING_HAVE_IO_URING 1
+#else
+#define URING_HAVE_IO_URING 0
+#endif
+
+typedef struct _UringRing
+{
+  int                   m_fd;
+  unsigned              m_sqEntries;
+  unsigned*             m_sqHead;
+  unsigned*             m_sqTail;
+  unsigned*             m_sqMask;
+  unsigned*             m_sqArray;
+  struct io_uring_sqe*  m_sqes;
+  unsigned*             m_cqHead;
+  unsigned*             m_cqTail;
+  unsigned*             m_cqMask;
+  struct io_uring_cqe*  m_cqes;
+  void*                 m_sqMap;
+  size_t                m_sqMapSize;
+  void*                 m_cqMap;
+  size_t                m_cqMapSize;
+  size_t                m_sqesSize;
+} UringRing;
+
+typedef struct _UringPendingWrite
+{
+  sqlite3_int64 m_offset;
+  int           m_size;
+  int           m_pos;    /* Position of the data in UringFile.m_buffer */
+} UringPendingWrite;
+
+typedef struct _UringPendingRun
+{
+  sqlite3_int64 m_offset;
+  int           m_first;  /* First write of the run in m_writes/m_iov */
+  int           m_count;  /* Number of writes */
+  sqlite3_int64 m_size;   /* Total size in bytes */
+  sqlite3_int64 m_done;   /* Bytes written so far, negative errno on error */
+} UringPendingRun;
+
+typedef struct _UringFile
+{
+  sqlite3_file      m_base;       /* Base class - must be first */
+  sqlite3_file*     m_file;       /* Underlying file */
+  int               m_fd;         /* Descriptor of the underlying unix file, -1 to write through */
+  UringRing*        m_ring;       /* NULL until the first flush, or if io_uring is not available */
+  int               m_ringFailed; /* Use pwritev() for this file */
+  UringPendingWrite m_writes[URING_MAX_WRITES];
+  struct iovec      m_iov[URING_MAX_WRITES];
+  UringPendingRun   m_runs[URING_MAX_WRITES];
+  int               m_nWrites;
+  unsigned char*    m_buffer;     /* Data of the queued writes */
+  int               m_bufferSize;
+  int               m_bufferUsed;
+} UringFile;
+
+#define ORIGVFS(p)  ((sqlite3_vfs*) ((p)->pAppData))
+
+/* Set once io_uring_setup() failed, so that later files don't retry */
+static int uringUnavailable = !URING_HAVE_IO_URING;
+
+/* --- io_uring --- */
+
+#if URING_HAVE_IO_URING
+
+static void
+UringRingFree(UringRing* ring)
+{
+  if (ring->m_sqes != NULL) munmap(ring->m_sqes, ring->m_sqesSize);
+  if (ring->m_cqMap != NULL && ring->m_cqMap != ring->m_sqMap) munmap(ring->m_cqMap, ring->m_cqMapSize);
+  if (ring->m_sqMap != NULL) munmap(ring->m_sqMap, ring->m_sqMapSize);
+  if (ring->m_fd >= 0) close(ring->m_fd);
+  sqlite3_free(ring);
+}
+
+static UringRing*
+UringRingCreate(void)
+{
+  struct io_uring_params params;
+  UringRing* ring = (UringRing*) sqlite3_malloc(sizeof(UringRing));
+  unsigned char* sq;
+  unsigned char* cq;
+  if (ring == NULL)
+  {
+    return NULL;
+  }
+  memset(ring, 0, sizeof(UringRing));
+  memset(&params, 0, sizeof(params));
+  ring->m_fd = (int) syscall(__NR_io_uring_setup, URING_RING_ENTRIES, &params);
+  if (ring->m_fd < 0)
+  {
+    uringUnavailable = 1;
+    sqlite3_free(ring);
+    return NULL;
+  }
+
+  ring->m_sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->m_cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ring->m_cqMapSize > ring->m_sqMapSize) ring->m_sqMapSize = ring->m_cqMapSize;
+    ring->m_cqMapSize = ring->m_sqMapSize;
+  }
+  ring->m_sqMap = mmap(NULL, ring->m_sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->m_fd, IORING_OFF_SQ_RING);
+  if (ring->m_sqMap == MAP_FAILED)
+  {
+    ring->m_sqMap = NULL;
+    UringRingFree(ring);
+    return NULL;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    ring->m_cqMap = ring->m_sqMap;
+  }
+  else
+  {
+    ring->m_cqMap = mmap(NULL, ring->m_cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->m_fd, IORING_OFF_CQ_RING);
+    if (ring->m_cqMap == MAP_FAILED)
+    {
+      ring->m_cqMap = NULL;
+      UringRingFree(ring);
+      return NULL;
+    }
+  }
+  ring->m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->m_sqes = (struct io_uring_sqe*) mmap(NULL, ring->m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->m_fd, IORING_OFF_SQES);
+  if (ring->m_sqes == MAP_FAILED)
+  {
+    ring->m_sqes = NULL;
+    UringRingFree(ring);
+    return NULL;
+  }
+
+  sq = (unsigned char*) ring->m_sqMap;
+  cq = (unsigned char*) ring->m_cqMap;
+  ring->m_sqEntries = params.sq_entries;
+  ring->m_sqHead = (unsigned*) (sq + params.sq_off.head);
+  ring->m_sqTail = (unsigned*) (sq + params.sq_off.tail);
+  ring->m_sqMask = (unsigned*) (sq + params.sq_off.ring_mask);
+  ring->m_sqArray = (unsigned*) (sq + params.sq_off.array);
+  ring->m_cqHead = (unsigned*) (cq + params.cq_off.head);
+  ring->m_cqTail = (unsigned*) (cq + params.cq_off.tail);
+  ring->m_cqMask = (unsigned*) (cq + params.cq_off.ring_mask);
+  ring->m_cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+  return ring;
+}
+
+/*
+** Reap the completions in the ring, storing the results of the runs unless
+** results is 0. Returns the number of completions.
+*/
+static unsigned
+UringRingReap(UringFile* p, int results)
+{
+  UringRing* ring = p->m_ring;
+  unsigned head = *ring->m_cqHead;
+  unsigned cqTail = __atomic_load_n(ring->m_cqTail, __ATOMIC_ACQUIRE);
+  unsigned completed = 0;
+  while (head != cqTail)
+  {
+    struct io_uring_cqe* cqe = &ring->m_cqes[head & *ring->m_cqMask];
+    if (results)
+    {
+      p->m_runs[cqe->user_data].m_done = cqe->res;
+    }
+    ++head;
+    ++completed;
+  }
+  __atomic_store_n(ring->m_cqHead, head, __ATOMIC_RELEASE);
+  return completed;
+}
+
+/*
+** Write the runs [first, first+count) with one io_uring_enter() call per
+** URING_RING_ENTRIES runs. The result of each run is stored in m_done.
+** Returns -1 if a batch could not be submitted at all, the caller then
+** writes all runs again with pwritev(). If a batch was submitted in part,
+** all runs fail and the ring is given up.
+*/
+static int
+UringRingWrite(UringFile* p, int first, int count)
+{
+  UringRing* ring = p->m_ring;
+  const int firstRun = first;
+  const int lastRun = first + count;
+  while (count > 0)
+  {
+    unsigned tail = *ring->m_sqTail;
+    unsigned n = (count < (int) ring->m_sqEntries) ? (unsigned) count : ring->m_sqEntries;
+    unsigned submitted = 0;
+    unsigned completed = 0;
+    unsigned k;
+    for (k = 0; k < n; ++k)
+    {
+      UringPendingRun* run = &p->m_runs[first + k];
+      unsigned index = (tail + k) & *ring->m_sqMask;
+      struct io_uring_sqe* sqe = &ring->m_sqes[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_WRITEV;
+      sqe->fd = p->m_fd;
+      sqe->addr = (unsigned long) &p->m_iov[run->m_first];
+      sqe->len = (unsigned) run->m_count;
+      sqe->off = (unsigned long long) run->m_offset;
+      sqe->user_data = (unsigned long long) (first + k);
+      run->m_done = -EIO;
+      ring->m_sqArray[index] = index;
+    }
+    __atomic_store_n(ring->m_sqTail, tail + n, __ATOMIC_RELEASE);
+
+    while (completed < submitted || submitted < n)
+    {
+      int rc = (int) syscall(__NR_io_uring_enter, ring->m_fd, n - submitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+      if (rc < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+        {
+          continue;
+        }
+        if (submitted == 0)
+        {
+          return -1;
+        }
+        /* The writes in flight read from m_buffer, so wait for them before
+        ** the caller reuses it. The remaining entries of the submission
+        ** queue are never submitted, the ring is given up. */
+        while (completed < submitted)
+        {
+          rc = (int) syscall(__NR_io_uring_enter, ring->m_fd, 0, submitted - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+          if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+          {
+            /* The kernel may still read the buffer, leave it to the kernel */
+            p->m_buffer = NULL;
+            p->m_bufferSize = 0;
+            break;
+          }
+          completed += UringRingReap(p, 0);
+        }
+        for (k = (unsigned) firstRun; k < (unsigned) lastRun; ++k)
+        {
+          p->m_runs[k].m_done = -EIO;
+        }
+        p->m_ringFailed = 1;
+        return 0;
+      }
+      submitted += (unsigned) rc;
+      completed += UringRingReap(p, 1);
+    }
+    first += n;
+    count -= n;
+  }
+  return 0;
+}
+
+#endif
+
+/* --- Write queue --- */
+
+static int
+UringCompareWrites(const void* a, const void* b)
+{
+  sqlite3_int64 x = ((const UringPendingWrite*) a)->m_offset;
+  sqlite3_int64 y = ((const UringPendingWrite*) b)->m_offset;
+  return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+/*
+** Complete a run after a short write, or write it completely if the ring
+** could not be used, with plain pwrite() calls.
+*/
+static void
+UringFinishRun(UringFile* p, UringPendingRun* run)
+{
+  sqlite3_int64 skip = run->m_done;
+  int k;
+  for (k = run->m_first; k < run->m_first + run->m_count && run->m_done >= 0; ++k)
+  {
+    const unsigned char* data = (const unsigned char*) p->m_iov[k].iov_base;
+    sqlite3_int64 size = (sqlite3_int64) p->m_iov[k].iov_len;
+    sqlite3_int64 offset = p->m_writes[k].m_offset;
+    if (skip >= size)
+    {
+      skip -= size;
+      continue;
+    }
+    data += skip;
+    offset += skip;
+    size -= skip;
+    skip = 0;
+    while (size > 0)
+    {
+      ssize_t wrote = pwrite(p->m_fd, data, (size_t) size, (off_t) offset);
+      if (wrote < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (wrote <= 0)
+      {
+        run->m_done = (wrote < 0) ? -errno : -ENOSPC;
+        break;
+      }
+      data += wrote;
+      offset += wrote;
+      size -= wrote;
+      run->m_done += wrote;
+    }
+  }
+}
+
+/*
+** Write all queued data to the file. Adjacent writes are coalesced into one
+** vectored write, and all of them are submitted together.
+*/
+static int
+UringFlush(UringFile* p)
+{
+  int rc = SQLITE_OK;
+  int nRuns = 0;
+  int k;
+  if (p->m_nWrites == 0)
+  {
+    return SQLITE_OK;
+  }
+
+  qsort(p->m_writes, p->m_nWrites, sizeof(UringPendingWrite), UringCompareWrites);
+  for (k = 0; k < p->m_nWrites; ++k)
+  {
+    UringPendingWrite* w = &p->m_writes[k];
+    UringPendingRun* run = (nRuns > 0) ? &p->m_runs[nRuns - 1] : NULL;
+    p->m_iov[k].iov_base = p->m_buffer + w->m_pos;
+    p->m_iov[k].iov_len = (size_t) w->m_size;
+    if (run != NULL && run->m_offset + run->m_size == w->m_offset)
+    {
+      run->m_count++;
+      run->m_size += w->m_size;
+    }
+    else
+    {
+      run = &p->m_runs[nRuns++];
+      run->m_offset = w->m_offset;
+      run->m_first = k;
+      run->m_count = 1;
+      run->m_size = w->m_size;
+      run->m_done = 0;
+    }
+  }
+
+#if URING_HAVE_IO_URING
+  if (p->m_ring == NULL && !p->m_ringFailed && !uringUnavailable)
+  {
+    p->m_ring = UringRingCreate();
+    p->m_ringFailed = (p->m_ring == NULL);
+  }
+  if (p->m_ring != NULL && UringRingWrite(p, 0, nRuns) != 0)
+  {
+    /* The ring is unusable, write this and all later batches with pwritev() */
+    UringRingFree(p->m_ring);
+    p->m_ring = NULL;
+    p->m_ringFailed = 1;
+    for (k = 0; k < nRuns; ++k)
+    {
+      p->m_runs[k].m_done = 0;
+    }
+  }
+  if (p->m_ring == NULL)
+#endif
+  {
+    for (k = 0; k < nRuns; ++k)
+    {
+      UringPendingRun* run = &p->m_runs[k];
+      ssize_t wrote;
+      do
+      {
+        wrote = pwritev(p->m_fd, &p->m_iov[run->m_first], run->m_count, (off_t) run->m_offset);
+      }
+      while (wrote < 0 && errno == EINTR);
+      run->m_done = (wrote < 0) ? -errno : wrote;
+    }
+  }
+
+  for (k = 0; k < nRuns; ++k)
+  {
+    UringPendingRun* run = &p->m_runs[k];
+    if (run->m_done == -EINVAL || run->m_done == -EOPNOTSUPP)
+    {
+      /* The kernel's io_uring lacks vectored writes, or rejected this file */
+      p->m_ringFailed = 1;
+      run->m_done = 0;
+    }
+    if (run->m_done >= 0 && run->m_done < run->m_size)
+    {
+      UringFinishRun(p, run);
+    }
+    if (run->m_done < 0 && rc == SQLITE_OK)
+    {
+      storeLastErrno((unixFile*) p->m_file, (int) -run->m_done);
+      rc = (run->m_done == -ENOSPC) ? SQLITE_FULL : SQLITE_IOERR_WRITE;
+    }
+  }
+#if URING_HAVE_IO_URING
+  if (p->m_ringFailed && p->m_ring != NULL)
+  {
+    UringRingFree(p->m_ring);
+    p->m_ring = NULL;
+  }
+#endif
+
+  p->m_nWrites = 0;
+  p->m_bufferUsed = 0;
+  return rc;
+}
+
+/*
+** Add a write to the queue. A write which replaces a queued one of the same
+** range overwrites its data; a partial overlap flushes the queue first, so
+** that the order of overlapping writes is kept.
+*/
+static int
+UringQueue(UringFile* p, const void* zBuf, int iAmt, sqlite3_int64 iOfst)
+{
+  int rc;
+  int k;
+  for (k = p->m_nWrites - 1; k >= 0; --k)
+  {
+    UringPendingWrite* w = &p->m_writes[k];
+    if (iOfst < w->m_offset + w->m_size && w->m_offset < iOfst + iAmt)
+    {
+      if (w->m_offset == iOfst && w->m_size == iAmt)
+      {
+        memcpy(p->m_buffer + w->m_pos, zBuf, iAmt);
+        return SQLITE_OK;
+      }
+      rc = UringFlush(p);
+      if (rc != SQLITE_OK)
+      {
+        return rc;
+      }
+      break;
+    }
+  }
+
+  if (p->m_nWrites == URING_MAX_WRITES || p->m_bufferUsed + iAmt > URING_MAX_BYTES)
+  {
+    rc = UringFlush(p);
+    if (rc != SQLITE_OK)
+    {
+      return rc;
+    }
+  }
+  if (iAmt > URING_MAX_BYTES)
+  {
+    return p->m_file->pMethods->xWrite(p->m_file, zBuf, iAmt, iOfst);
+  }
+  if (p->m_bufferUsed + iAmt > p->m_bufferSize)
+  {
+    int size = (p->m_bufferSize > 0) ? p->m_bufferSize : 64 * 1024;
+    unsigned char* buffer;
+    while (size < p->m_bufferUsed + iAmt)
+    {
+      size *= 2;
+    }
+    buffer = (unsigned char*) sqlite3_realloc(p->m_buffer, size);
+    if (buffer == NULL)
+    {
+      return SQLITE_IOERR_NOMEM;
+    }
+    p->m_buffer = buffer;
+    p->m_bufferSize = size;
+  }
+  memcpy(p->m_buffer + p->m_bufferUsed, zBuf, iAmt);
+  p->m_writes[p->m_nWrites].m_offset = iOfst;
+  p->m_writes[p->m_nWrites].m_size = iAmt;
+  p->m_writes[p->m_nWrites].m_pos = p->m_bufferUsed;
+  p->m_nWrites++;
+  p->m_bufferUsed += iAmt;
+  return SQLITE_OK;
+}
+
+/* --- I/O methods --- */
+
+static int
+UringClose(sqlite3_file* pFile)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = UringFlush(p);
+  int rc2 = p->m_file->pMethods->xClose(p->m_file);
+#if URING_HAVE_IO_URING
+  if (p->m_ring != NULL)
+  {
+    UringRingFree(p->m_ring);
+    p->m_ring = NULL;
+  }
+#endif
+  sqlite3_free(p->m_buffer);
+  p->m_buffer = NULL;
+  p->m_bufferSize = 0;
+  return (rc != SQLITE_OK) ? rc : rc2;
+}
+
+static int
+UringRead(sqlite3_file* pFile, void* zBuf, int iAmt, sqlite3_int64 iOfst)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = UringFlush(p);
+  return (rc == SQLITE_OK) ? p->m_file->pMethods->xRead(p->m_file, zBuf, iAmt, iOfst) : rc;
+}
+
+static int
+UringWrite(sqlite3_file* pFile, const void* zBuf, int iAmt, sqlite3_int64 iOfst)
+{
+  UringFile* p = (UringFile*) pFile;
+  if (p->m_fd < 0)
+  {
+    return p->m_file->pMethods->xWrite(p->m_file, zBuf, iAmt, iOfst);
+  }
+  return UringQueue(p, zBuf, iAmt, iOfst);
+}
+
+static int
+UringTruncate(sqlite3_file* pFile, sqlite3_int64 size)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = UringFlush(p);
+  return (rc == SQLITE_OK) ? p->m_file->pMethods->xTruncate(p->m_file, size) : rc;
+}
+
+static int
+UringSync(sqlite3_file* pFile, int flags)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = UringFlush(p);
+  return (rc == SQLITE_OK) ? p->m_file->pMethods->xSync(p->m_file, flags) : rc;
+}
+
+static int
+UringFileSize(sqlite3_file* pFile, sqlite3_int64* pSize)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = UringFlush(p);
+  return (rc == SQLITE_OK) ? p->m_file->pMethods->xFileSize(p->m_file, pSize) : rc;
+}
+
+static int
+UringLock(sqlite3_file* pFile, int eLock)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = UringFlush(p);
+  return (rc == SQLITE_OK) ? p->m_file->pMethods->xLock(p->m_file, eLock) : rc;
+}
+
+static int
+UringUnlock(sqlite3_file* pFile, int eLock)
+{
+  UringFile* p = (UringFile*) pFile;
+  /* The lock is released even if the flush failed, its error is reported */
+  int rc = UringFlush(p);
+  int rcUnlock = p->m_file->pMethods->xUnlock(p->m_file, eLock);
+  return (rc == SQLITE_OK) ? rcUnlock : rc;
+}
+
+static int
+UringCheckReservedLock(sqlite3_file* pFile, int* pResOut)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = UringFlush(p);
+  return (rc == SQLITE_OK) ? p->m_file->pMethods->xCheckReservedLock(p->m_file, pResOut) : rc;
+}
+
+static int
+UringFileControl(sqlite3_file* pFile, int op, void* pArg)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = (op != SQLITE_FCNTL_SIZE_HINT) ? UringFlush(p) : SQLITE_OK;
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+  rc = p->m_file->pMethods->xFileControl(p->m_file, op, pArg);
+  if (rc == SQLITE_OK && op == SQLITE_FCNTL_VFSNAME)
+  {
+    *(char**) pArg = sqlite3_mprintf(URING_VFS_NAME "/%z", *(char**) pArg);
+  }
+  return rc;
+}
+
+static int
+UringSectorSize(sqlite3_file* pFile)
+{
+  UringFile* p = (UringFile*) pFile;
+  return p->m_file->pMethods->xSectorSize(p->m_file);
+}
+
+static int
+UringDeviceCharacteristics(sqlite3_file* pFile)
+{
+  UringFile* p = (UringFile*) pFile;
+  return p->m_file->pMethods->xDeviceCharacteristics(p->m_file);
+}
+
+static int
+UringShmMap(sqlite3_file* pFile, int iPg, int pgsz, int bExtend, void volatile** pp)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = UringFlush(p);
+  return (rc == SQLITE_OK) ? p->m_file->pMethods->xShmMap(p->m_file, iPg, pgsz, bExtend, pp) : rc;
+}
+
+static int
+UringShmLock(sqlite3_file* pFile, int offset, int n, int flags)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = UringFlush(p);
+  int rcLock;
+  if (rc != SQLITE_OK && (flags & SQLITE_SHM_UNLOCK) == 0)
+  {
+    return rc;
+  }
+  /* Like in UringUnlock, locks are released even if the flush failed */
+  rcLock = p->m_file->pMethods->xShmLock(p->m_file, offset, n, flags);
+  return (rc == SQLITE_OK) ? rcLock : rc;
+}
+
+static void
+UringShmBarrier(sqlite3_file* pFile)
+{
+  UringFile* p = (UringFile*) pFile;
+  UringFlush(p);
+  p->m_file->pMethods->xShmBarrier(p->m_file);
+}
+
+static int
+UringShmUnmap(sqlite3_file* pFile, int deleteFlag)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = UringFlush(p);
+  int rcUnmap = p->m_file->pMethods->xShmUnmap(p->m_file, deleteFlag);
+  return (rc == SQLITE_OK) ? rcUnmap : rc;
+}
+
+static int
+UringFetch(sqlite3_file* pFile, sqlite3_int64 iOfst, int iAmt, void** pp)
+{
+  UringFile* p = (UringFile*) pFile;
+  int rc = UringFlush(p);
+  *pp = NULL;
+  return (rc == SQLITE_OK) ? p->m_file->pMethods->xFetch(p->m_file, iOfst, iAmt, pp) : rc;
+}
+
+static int
+UringUnfetch(sqlite3_file* pFile, sqlite3_int64 iOfst, void* pPage)
+{
+  UringFile* p = (UringFile*) pFile;
+  return p->m_file->pMethods->xUnfetch(p->m_file, iOfst, pPage);
+}
+
+static const sqlite3_io_methods uringIoMethods =
+{
+  3,                              /* iVersion */
+  UringClose,                     /* xClose */
+  UringRead,                      /* xRead */
+  UringWrite,                     /* xWrite */
+  UringTruncate,                  /* xTruncate */
+  UringSync,                      /* xSync */
+  UringFileSize,                  /* xFileSize */
+  UringLock,                      /* xLock */
+  UringUnlock,                    /* xUnlock */
+  UringCheckReservedLock,         /* xCheckReservedLock */
+  UringFileControl,               /* xFileControl */
+  UringSectorSize,                /* xSectorSize */
+  UringDeviceCharacteristics,     /* xDeviceCharacteristics */
+  UringShmMap,                    /* xShmMap */
+  UringShmLock,                   /* xShmLock */
+  UringShmBarrier,                /* xShmBarrier */
+  UringShmUnmap,                  /* xShmUnmap */
+  UringFetch,                     /* xFetch */
+  UringUnfetch                    /* xUnfetch */
+};
+
+/* --- VFS methods --- */
+
+static int
+UringOpen(sqlite3_vfs* pVfs, const char* zName, sqlite3_file* pFile, int flags, int* pOutFlags)
+{
+  UringFile* p = (UringFile*) pFile;
+  sqlite3_vfs* origVfs = ORIGVFS(pVfs);
+  const sqlite3_io_methods* methods;
+  int rc;
+
+  if ((flags & SQLITE_OPEN_MAIN_DB) == 0)
+  {
+    /* Journals, WAL and temporary files go to the underlying VFS directly */
+    return origVfs->xOpen(origVfs, zName, pFile, flags, pOutFlags);
+  }
+
+  memset(p, 0, offsetof(UringFile, m_writes));
+  p->m_nWrites = 0;
+  p->m_buffer = NULL;
+  p->m_bufferSize = 0;
+  p->m_bufferUsed = 0;
+  p->m_file = (sqlite3_file*) &p[1];
+  rc = origVfs->xOpen(origVfs, zName, p->m_file, flags, pOutFlags);
+  if (rc != SQLITE_OK)
+  {
+    p->m_base.pMethods = NULL;
+    return rc;
+  }
+
+  /* Only files of the unix VFS expose a descriptor, all others write through */
+  methods = p->m_file->pMethods;
+  p->m_fd = (methods != NULL && methods->xWrite == unixWrite && methods->iVersion >= 3) ? ((unixFile*) p->m_file)->h : -1;
+  p->m_base.pMethods = &uringIoMethods;
+  return SQLITE_OK;
+}
+
+static int
+UringDelete(sqlite3_vfs* pVfs, const char* zName, int syncDir)
+{
+  return ORIGVFS(pVfs)->xDelete(ORIGVFS(pVfs), zName, syncDir);
+}
+
+static int
+UringAccess(sqlite3_vfs* pVfs, const char* zName, int flags, int* pResOut)
+{
+  return ORIGVFS(pVfs)->xAccess(ORIGVFS(pVfs), zName, flags, pResOut);
+}
+
+static int
+UringFullPathname(sqlite3_vfs* pVfs, const char* zName, int nOut, char* zOut)
+{
+  return ORIGVFS(pVfs)->xFullPathname(ORIGVFS(pVfs), zName, nOut, zOut);
+}
+
+static void*
+UringDlOpen(sqlite3_vfs* pVfs, const char* zFilename)
+{
+  return ORIGVFS(pVfs)->xDlOpen(ORIGVFS(pVfs), zFilename);
+}
+
+static void
+UringDlError(sqlite3_vfs* pVfs, int nByte, char* zErrMsg)
+{
+  ORIGVFS(pVfs)->xDlError(ORIGVFS(pVfs), nByte, zErrMsg);
+}
+
+static void
+(*UringDlSym(sqlite3_vfs* pVfs, void* p, const char* zSym))(void)
+{
+  return ORIGVFS(pVfs)->xDlSym(ORIGVFS(pVfs), p, zSym);
+}
+
+static void
+UringDlClose(sqlite3_vfs* pVfs, void* pHandle)
+{
+  ORIGVFS(pVfs)->xDlClose(ORIGVFS(pVfs), pHandle);
+}
+
+static int
+UringRandomness(sqlite3_vfs* pVfs, int nByte, char* zOut)
+{
+  return ORIGVFS(pVfs)->xRandomness(ORIGVFS(pVfs), nByte, zOut);
+}
+
+static int
+UringSleep(sqlite3_vfs* pVfs, int nMicro)
+{
+  return ORIGVFS(pVfs)->xSleep(ORIGVFS(pVfs), nMicro);
+}
+
+static int
+UringCurrentTime(sqlite3_vfs* pVfs, double* pTimeOut)
+{
+  return ORIGVFS(pVfs)->xCurrentTime(ORIGVFS(pVfs), pTimeOut);
+}
+
+static int
+UringGetLastError(sqlite3_vfs* pVfs, int nErr, char* zErr)
+{
+  return ORIGVFS(pVfs)->xGetLastError(ORIGVFS(pVfs), nErr, zErr);
+}
+
+static int
+UringCurrentTimeInt64(sqlite3_vfs* pVfs, sqlite3_int64* pTimeOut)
+{
+  return ORIGVFS(pVfs)->xCurrentTimeInt64(ORIGVFS(pVfs), pTimeOut);
+}
+
+static int
+UringSetSystemCall(sqlite3_vfs* pVfs, const char* zName, sqlite3_syscall_ptr pNewFunc)
+{
+  return ORIGVFS(pVfs)->xSetSystemCall(ORIGVFS(pVfs), zName, pNewFunc);
+}
+
+static sqlite3_syscall_ptr
+UringGetSystemCall(sqlite3_vfs* pVfs, const char* zName)
+{
+  return ORIGVFS(pVfs)->xGetSystemCall(ORIGVFS(pVfs), zName);
+}
+
+static const char*
+UringNextSystemCall(sqlite3_vfs* pVfs, const char* zName)
+{
+  return ORIGVFS(pVfs)->xNextSystemCall(ORIGVFS(pVfs), zName);
+}
+
+static sqlite3_vfs uringVfs =
+{
+  3,                              /* iVersion */
+  0,                              /* szOsFile (set on registration) */
+  0,                              /* mxPathname (set on registration) */
+  0,                              /* pNext */
+  URING_VFS_NAME,                 /* zName */
+  0,                              /* pAppData (set to the underlying VFS) */
+  UringOpen,                      /* xOpen */
+  UringDelete,                    /* xDelete */
+  UringAccess,                    /* xAccess */
+  UringFullPathname,              /* xFullPathname */
+  UringDlOpen,                    /* xDlOpen */
+  UringDlError,                   /* xDlError */
+  UringDlSym,                     /* xDlSym */
+  UringDlClose,                   /* xDlClose */
+  UringRandomness,                /* xRandomness */
+  UringSleep,                     /* xSleep */
+  UringCurrentTime,               /* xCurrentTime */
+  UringGetLastError,              /* xGetLastError */
+  UringCurrentTimeInt64,          /* xCurrentTimeInt64 */
+  UringSetSystemCall,             /* xSetSystemCall */
+  UringGetSystemCall,             /* xGetSystemCall */
+  UringNextSystemCall             /* xNextSystemCall */
+};
+
+/*
+** Register the shim on top of the current default VFS, without making it
+** the default. Called once from sqlite3_initialize().
+*/
+int
+sqlite3_uringvfs_init(void)
+{
+  sqlite3_vfs* origVfs = sqlite3_vfs_find(NULL);
+  if (origVfs == NULL)
+  {
+    return SQLITE_ERROR;
+  }
+  if (sqlite3_vfs_find(URING_VFS_NAME) != NULL)
+  {
+    return SQLITE_OK;
+  }
+  uringVfs.iVersion = (origVfs->iVersion < 3) ? origVfs->iVersion : 3;
+  uringVfs.szOsFile = sizeof(UringFile) + origVfs->szOsFile;
+  uringVfs.mxPathname = origVfs->mxPathname;
+  uringVfs.pAppData = origVfs;
+  return sqlite3_vfs_register(&uringVfs, 0);
+}
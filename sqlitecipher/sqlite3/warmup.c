@@ -0,0 +1,667 @@
+/*
+** Name:        warmup.c
+** Purpose:     Loading pages into the page cache of a connection ahead of use
+** Author:      QtCipherSqlitePlugin developers
+** Created:     2026-10-18
+** Copyright:   (c) 2026 QtCipherSqlitePlugin developers
+** License:     LGPL-3.0+ WITH WxWindows-exception-3.1
+*/
+
+/*
+** After a restart every first access of a page is a synchronous read and a
+** decryption. wxsqlite3_warmup() loads the pages a connection is likely to
+** need into its page cache right after it is opened:
+**
+** - the pages of a list, typically those cached by the connection at its
+**   last close as returned by wxsqlite3_cached_pages(), then
+** - the b-trees of the schema level by level from their roots, so that the
+**   interior pages every lookup passes come first,
+**
+** until nPages pages are loaded or the page cache is full. The pages are
+** read in file order, a batch at a time, and decrypted on up to nThreads
+** threads. Each thread has a copy of the codec of the connection, since the
+** ciphers keep state while decrypting. The pager then takes the decrypted
+** pages through sqlite3CodecSharedGet() instead of reading the file. Pages
+** with a newer version in the WAL are read the usual way.
+**
+** Everything happens in one read transaction; the pages stay in the cache
+** afterwards as long as the file is not changed by another connection.
+*/
+
+#define WARMUP_BATCH_PAGES   1024   /* Pages read and decrypted at a time */
+#define WARMUP_MAX_THREADS   16
+#define WARMUP_THREAD_PAGES  32     /* Fewer pages per thread are not worth a thread */
+
+typedef struct _WarmupPages
+{
+  Pgno*          m_pgno;            /* Sorted */
+  unsigned char* m_data;            /* Decrypted pages, in the order of m_pgno */
+  int            m_count;
+  int            m_pageSize;
+} WarmupPages;
+
+typedef struct _WarmupThread
+{
+  Codec*         m_codec;
+  WarmupPages*   m_pages;
+  int            m_first;
+  int            m_last;            /* Exclusive */
+  int            m_rc;
+} WarmupThread;
+
+typedef struct _WarmupState
+{
+  Btree*         m_bt;
+  Pager*         m_pager;
+  Codec*         m_codec;           /* NULL if the database is not encrypted */
+  Codec*         m_copies[WARMUP_MAX_THREADS];  /* For all threads but the calling one */
+  int            m_threads;
+  int            m_pageSize;
+  Pgno           m_dbSize;
+  Bitvec*        m_seen;            /* Pages loaded or found in the cache */
+  Bitvec*        m_expanded;        /* Pages whose children were looked at */
+  int            m_budget;          /* Pages still to load */
+} WarmupState;
+
+/*
+** Called by sqlite3CodecSharedGet() while wxsqlite3_warmup() loads pages
+*/
+static int
+WarmupPagesGet(WarmupPages* pages, Pgno pgno, void* pData)
+{
+  int lo = 0, hi = pages->m_count - 1;
+  while (lo <= hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (pages->m_pgno[mid] == pgno)
+    {
+      memcpy(pData, pages->m_data + (sqlite3_int64) mid * pages->m_pageSize, pages->m_pageSize);
+      return 1;
+    }
+    if (pages->m_pgno[mid] < pgno)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid - 1;
+    }
+  }
+  return 0;
+}
+
+static int
+WarmupComparePgno(const void* a, const void* b)
+{
+  Pgno x = *(const Pgno*) a;
+  Pgno y = *(const Pgno*) b;
+  return (x < y) ? -1 : (x > y);
+}
+
+static void*
+WarmupDecrypt(void* pArg)
+{
+  WarmupThread* thread = (WarmupThread*) pArg;
+  WarmupPages* pages = thread->m_pages;
+  int j;
+  for (j = thread->m_first; j < thread->m_last && thread->m_rc == SQLITE_OK; ++j)
+  {
+    thread->m_rc = CodecDecrypt(thread->m_codec, pages->m_pgno[j],
+                                pages->m_data + (sqlite3_int64) j * pages->m_pageSize, pages->m_pageSize);
+  }
+  return NULL;
+}
+
+/*
+** Read the pages into pages->m_data and decrypt them in parallel
+*/
+static int
+WarmupReadPages(WarmupState* state, WarmupPages* pages)
+{
+  WarmupThread threads[WARMUP_MAX_THREADS];
+  SQLiteThread* handles[WARMUP_MAX_THREADS];
+  int nThreads = state->m_threads;
+  int rc = SQLITE_OK;
+  int j;
+
+  for (j = 0; j < pages->m_count && rc == SQLITE_OK; ++j)
+  {
+    unsigned char* data = pages->m_data + (sqlite3_int64) j * pages->m_pageSize;
+    rc = sqlite3OsRead(state->m_pager->fd, data, pages->m_pageSize, (pages->m_pgno[j] - 1) * (i64) pages->m_pageSize);
+    if (rc == SQLITE_IOERR_SHORT_READ)
+    {
+      rc = SQLITE_OK;
+    }
+  }
+  if (rc != SQLITE_OK)
+  {
+    return rc;
+  }
+
+  if (nThreads > pages->m_count / WARMUP_THREAD_PAGES)
+  {
+    nThreads = (pages->m_count / WARMUP_THREAD_PAGES > 0) ? pages->m_count / WARMUP_THREAD_PAGES : 1;
+  }
+  memset(handles, 0, sizeof(handles));
+  for (j = 0; j < nThreads; ++j)
+  {
+    threads[j].m_codec = (j == 0) ? state->m_codec : state->m_copies[j - 1];
+    threads[j].m_pages = pages;
+    threads[j].m_first = (int) ((sqlite3_int64) pages->m_count * j / nThreads);
+    threads[j].m_last = (int) ((sqlite3_int64) pages->m_count * (j + 1) / nThreads);
+    threads[j].m_rc = SQLITE_OK;
+  }
+  /* The calling thread takes the first share */
+  for (j = 1; j < nThreads; ++j)
+  {
+    if (sqlite3ThreadCreate(&handles[j], WarmupDecrypt, &threads[j]) != SQLITE_OK)
+    {
+      handles[j] = NULL;
+      WarmupDecrypt(&threads[j]);
+    }
+  }
+  WarmupDecrypt(&threads[0]);
+  for (j = 0; j < nThreads; ++j)
+  {
+    if (handles[j] != NULL)
+    {
+      void* pOut;
+      sqlite3ThreadJoin(handles[j], &pOut);
+    }
+    if (threads[j].m_rc != SQLITE_OK)
+    {
+      rc = threads[j].m_rc;
+    }
+  }
+  state->m_codec->m_pagesDecrypted += pages->m_count;
+  return rc;
+}
+
+/*
+** Load the given pages into the page cache, skipping pages already there
+*/
+static int
+WarmupLoadBatch(WarmupState* state, const Pgno* aPgno, int nPgno)
+{
+  WarmupPages pages;
+  Pgno* direct;
+  int nDirect = 0;
+  int rc = SQLITE_OK;
+  int j;
+
+  memset(&pages, 0, sizeof(pages));
+  pages.m_pageSize = state->m_pageSize;
+  pages.m_pgno = (Pgno*) sqlite3_malloc64(sizeof(Pgno) * 2 * (sqlite3_int64) nPgno);
+  if (pages.m_pgno == NULL)
+  {
+    return SQLITE_NOMEM;
+  }
+  /* Pages read the usual way: unencrypted ones, or those in the WAL */
+  direct = pages.m_pgno + nPgno;
+
+  for (j = 0; j < nPgno && state->m_budget > 0; ++j)
+  {
+    Pgno pgno = aPgno[j];
+    DbPage* pPage;
+    if (pgno < 2 || pgno > state->m_dbSize || sqlite3BitvecTest(state->m_seen, pgno))
+    {
+      continue;
+    }
+    rc = sqlite3BitvecSet(state->m_seen, pgno);
+    if (rc != SQLITE_OK)
+    {
+      break;
+    }
+    pPage = sqlite3PagerLookup(state->m_pager, pgno);
+    if (pPage != NULL)
+    {
+      sqlite3PagerUnref(pPage);
+      continue;
+    }
+    state->m_budget--;
+#ifndef SQLITE_OMIT_WAL
+    if (pagerUseWal(state->m_pager))
+    {
+      u32 iFrame = 0;
+      rc = sqlite3WalFindFrame(state->m_pager->pWal, pgno, &iFrame);
+      if (rc != SQLITE_OK)
+      {
+        break;
+      }
+      if (iFrame != 0)
+      {
+        direct[nDirect++] = pgno;
+        continue;
+      }
+    }
+#endif
+    if (state->m_codec == NULL)
+    {
+      direct[nDirect++] = pgno;
+    }
+    else
+    {
+      pages.m_pgno[pages.m_count++] = pgno;
+    }
+  }
+
+  if (rc == SQLITE_OK && pages.m_count > 0)
+  {
+    qsort(pages.m_pgno, pages.m_count, sizeof(Pgno), WarmupComparePgno);
+    pages.m_data = (unsigned char*) sqlite3_malloc64((sqlite3_int64) pages.m_count * pages.m_pageSize);
+    rc = (pages.m_data != NULL) ? WarmupReadPages(state, &pages) : SQLITE_NOMEM;
+    if (rc == SQLITE_OK)
+    {
+      state->m_codec->m_warmupPages = &pages;
+      for (j = 0; j < pages.m_count && rc == SQLITE_OK; ++j)
+      {
+        DbPage* pPage = NULL;
+        rc = sqlite3PagerGet(state->m_pager, pages.m_pgno[j], &pPage, 0);
+        if (pPage != NULL)
+        {
+          sqlite3PagerUnref(pPage);
+        }
+      }
+      state->m_codec->m_warmupPages = NULL;
+    }
+  }
+  if (rc == SQLITE_OK && nDirect > 0)
+  {
+    qsort(direct, nDirect, sizeof(Pgno), WarmupComparePgno);
+    for (j = 0; j < nDirect && rc == SQLITE_OK; ++j)
+    {
+      DbPage* pPage = NULL;
+      rc = sqlite3PagerGet(state->m_pager, direct[j], &pPage, 0);
+      if (pPage != NULL)
+      {
+        sqlite3PagerUnref(pPage);
+      }
+    }
+  }
+  sqlite3_free(pages.m_data);
+  sqlite3_free(pages.m_pgno);
+  return rc;
+}
+
+static int
+WarmupLoad(WarmupState* state, const Pgno* aPgno, int nPgno)
+{
+  int rc = SQLITE_OK;
+  int j;
+  for (j = 0; j < nPgno && rc == SQLITE_OK && state->m_budget > 0; j += WARMUP_BATCH_PAGES)
+  {
+    rc = WarmupLoadBatch(state, aPgno + j, (nPgno - j < WARMUP_BATCH_PAGES) ? nPgno - j : WARMUP_BATCH_PAGES);
+  }
+  return rc;
+}
+
+/*
+** Append the children of a cached interior b-tree page. Pages loaded from the
+** list of hot pages are expanded as well, but no page twice.
+*/
+static int
+WarmupAppendChildren(WarmupState* state, Pgno pgno, Pgno** paNext, int* pnNext, int* pnAlloc)
+{
+  DbPage* pPage = sqlite3PagerLookup(state->m_pager, pgno);
+  const unsigned char* data;
+  int hdr = (pgno == 1) ? 100 : 0;
+  int nCell, j;
+  int rc = SQLITE_OK;
+
+  if (sqlite3BitvecTest(state->m_expanded, pgno))
+  {
+    return SQLITE_OK;
+  }
+  rc = sqlite3BitvecSet(state->m_expanded, pgno);
+  if (pPage == NULL || rc != SQLITE_OK)
+  {
+    if (pPage != NULL)
+    {
+      sqlite3PagerUnref(pPage);
+    }
+    return rc;
+  }
+  data = (const unsigned char*) sqlite3PagerGetData(pPage);
+  if (data[hdr] == 0x02 || data[hdr] == 0x05)
+  {
+    nCell = get2byte(&data[hdr + 3]);
+    if (hdr + 12 + 2 * nCell > state->m_pageSize)
+    {
+      nCell = 0;
+    }
+    for (j = 0; j <= nCell && rc == SQLITE_OK; ++j)
+    {
+      Pgno child;
+      if (j < nCell)
+      {
+        int offset = get2byte(&data[hdr + 12 + 2 * j]);
+        if (offset + 4 > state->m_pageSize)
+        {
+          continue;
+        }
+        child = get4byte(&data[offset]);
+      }
+      else
+      {
+        child = get4byte(&data[hdr + 8]);
+      }
+      if (child < 2 || child > state->m_dbSize || sqlite3BitvecTest(state->m_expanded, child))
+      {
+        continue;
+      }
+      if (*pnNext == *pnAlloc)
+      {
+        int nAlloc = 2 * (*pnAlloc) + 64;
+        Pgno* aNext = (Pgno*) sqlite3_realloc64(*paNext, sizeof(Pgno) * (sqlite3_int64) nAlloc);
+        if (aNext == NULL)
+        {
+          rc = SQLITE_NOMEM;
+          break;
+        }
+        *paNext = aNext;
+        *pnAlloc = nAlloc;
+      }
+      (*paNext)[(*pnNext)++] = child;
+    }
+  }
+  sqlite3PagerUnref(pPage);
+  return rc;
+}
+
+/*
+** Load the b-trees of the schema level by level
+*/
+static int
+WarmupBtrees(WarmupState* state, sqlite3* db, const char* zDbName)
+{
+  Pgno* aLevel = NULL;
+  Pgno* aNext = NULL;
+  int nLevel = 0, nLevelAlloc = 0, nNext = 0, nNextAlloc = 0;
+  sqlite3_stmt* pStmt = NULL;
+  char* zSql;
+  int rc;
+  int j;
+
+  zSql = sqlite3_mprintf("SELECT rootpage FROM \"%w\".sqlite_master WHERE rootpage>1", zDbName);
+  rc = (zSql != NULL) ? sqlite3_prepare_v2(db, zSql, -1, &pStmt, NULL) : SQLITE_NOMEM;
+  sqlite3_free(zSql);
+  /* The schema itself is the b-tree rooted at page 1 */
+  aLevel = (Pgno*) sqlite3_malloc64(sizeof(Pgno) * 64);
+  if (rc == SQLITE_OK && aLevel == NULL)
+  {
+    rc = SQLITE_NOMEM;
+  }
+  if (rc == SQLITE_OK)
+  {
+    nLevelAlloc = 64;
+    aLevel[nLevel++] = 1;
+    while ((rc = sqlite3_step(pStmt)) == SQLITE_ROW)
+    {
+      if (nLevel == nLevelAlloc)
+      {
+        Pgno* aGrown = (Pgno*) sqlite3_realloc64(aLevel, sizeof(Pgno) * 2 * (sqlite3_int64) nLevelAlloc);
+        if (aGrown == NULL)
+        {
+          rc = SQLITE_NOMEM;
+          break;
+        }
+        aLevel = aGrown;
+        nLevelAlloc *= 2;
+      }
+      aLevel[nLevel++] = (Pgno) sqlite3_column_int64(pStmt, 0);
+    }
+    if (rc == SQLITE_DONE)
+    {
+      rc = SQLITE_OK;
+    }
+  }
+  sqlite3_finalize(pStmt);
+
+  while (rc == SQLITE_OK && nLevel > 0 && state->m_budget > 0)
+  {
+    rc = WarmupLoad(state, aLevel, nLevel);
+    nNext = 0;
+    for (j = 0; j < nLevel && rc == SQLITE_OK; ++j)
+    {
+      rc = WarmupAppendChildren(state, aLevel[j], &aNext, &nNext, &nNextAlloc);
+    }
+    /* The next level becomes the current one */
+    {
+      Pgno* aSwap = aLevel;
+      int nSwapAlloc = nLevelAlloc;
+      aLevel = aNext;
+      nLevel = nNext;
+      nLevelAlloc = nNextAlloc;
+      aNext = aSwap;
+      nNextAlloc = nSwapAlloc;
+    }
+  }
+  sqlite3_free(aLevel);
+  sqlite3_free(aNext);
+  return rc;
+}
+
+/*
+** Start a read transaction, unless the connection is in one already.
+** *pBegun tells whether it has to be ended.
+*/
+static int
+WarmupBeginRead(sqlite3* db, const char* zDbName, int* pBegun)
+{
+  char* zSql;
+  int rc;
+  *pBegun = 0;
+  if (sqlite3_get_autocommit(db))
+  {
+    rc = sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    if (rc != SQLITE_OK)
+    {
+      return rc;
+    }
+    *pBegun = 1;
+  }
+  zSql = sqlite3_mprintf("SELECT count(*) FROM \"%w\".sqlite_master", zDbName);
+  rc = (zSql != NULL) ? sqlite3_exec(db, zSql, NULL, NULL, NULL) : SQLITE_NOMEM;
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK && *pBegun)
+  {
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+    *pBegun = 0;
+  }
+  return rc;
+}
+
+int
+wxsqlite3_warmup(sqlite3* db, const char* zDbName, const unsigned int* aHotPages, int nHotPages, int nPages, int nThreads)
+{
+  WarmupState state;
+  Btree* pBt;
+  int begun = 0;
+  int dbIndex;
+  int rc;
+  int j;
+
+  if (db == NULL || nPages <= 0)
+  {
+    return (db == NULL) ? SQLITE_MISUSE : SQLITE_OK;
+  }
+  if (zDbName == NULL)
+  {
+    zDbName = "main";
+  }
+  sqlite3_mutex_enter(db->mutex);
+  dbIndex = sqlite3FindDbName(db, zDbName);
+  pBt = (dbIndex >= 0) ? db->aDb[dbIndex].pBt : NULL;
+  if (pBt == NULL)
+  {
+    sqlite3_mutex_leave(db->mutex);
+    return SQLITE_ERROR;
+  }
+  rc = WarmupBeginRead(db, zDbName, &begun);
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_mutex_leave(db->mutex);
+    return rc;
+  }
+
+  memset(&state, 0, sizeof(state));
+  sqlite3BtreeEnter(pBt);
+  state.m_bt = pBt;
+  state.m_pager = sqlite3BtreePager(pBt);
+  state.m_pageSize = sqlite3BtreeGetPageSize(pBt);
+  sqlite3PagerPagecount(state.m_pager, (int*) &state.m_dbSize);
+  /* Loading more pages than the cache holds would evict the first ones */
+  state.m_budget = numberOfCachePages(state.m_pager->pPCache) - sqlite3PcachePagecount(state.m_pager->pPCache);
+  if (state.m_budget > nPages)
+  {
+    state.m_budget = nPages;
+  }
+  if (state.m_pager->xCodec != NULL && state.m_pager->pCodec != NULL)
+  {
+    Codec* codec = (Codec*) state.m_pager->pCodec;
+    if (CodecIsEncrypted(codec) && CodecHasReadCipher(codec) && codec->m_readCipher != NULL && !codec->m_rekeying)
+    {
+      state.m_codec = codec;
+    }
+  }
+  state.m_threads = (nThreads < 1) ? 1 : (nThreads > WARMUP_MAX_THREADS) ? WARMUP_MAX_THREADS : nThreads;
+  if (state.m_codec != NULL)
+  {
+    for (j = 1; j < state.m_threads; ++j)
+    {
+      Codec* copy = (Codec*) sqlite3_malloc(sizeof(Codec));
+      if (copy == NULL || CodecInit(copy) != SQLITE_OK)
+      {
+        sqlite3_free(copy);
+        break;
+      }
+      CodecSetDb(copy, db);
+      if (CodecCopy(copy, state.m_codec) != SQLITE_OK)
+      {
+        sqlite3CodecFree(copy);
+        break;
+      }
+      copy->m_pageSize = state.m_codec->m_pageSize;
+      copy->m_reserved = state.m_codec->m_reserved;
+      state.m_copies[j - 1] = copy;
+    }
+    /* Fewer threads if copying the codec failed */
+    state.m_threads = j;
+  }
+  state.m_seen = sqlite3BitvecCreate(state.m_dbSize > 0 ? state.m_dbSize : 1);
+  state.m_expanded = sqlite3BitvecCreate(state.m_dbSize > 0 ? state.m_dbSize : 1);
+  rc = (state.m_seen != NULL && state.m_expanded != NULL) ? SQLITE_OK : SQLITE_NOMEM;
+
+  if (rc == SQLITE_OK && state.m_budget > 0 && nHotPages > 0 && aHotPages != NULL)
+  {
+    Pgno* aPgno = (Pgno*) sqlite3_malloc64(sizeof(Pgno) * (sqlite3_int64) nHotPages);
+    rc = (aPgno != NULL) ? SQLITE_OK : SQLITE_NOMEM;
+    if (rc == SQLITE_OK)
+    {
+      for (j = 0; j < nHotPages; ++j)
+      {
+        aPgno[j] = (Pgno) aHotPages[j];
+      }
+      rc = WarmupLoad(&state, aPgno, nHotPages);
+    }
+    sqlite3_free(aPgno);
+  }
+  if (rc == SQLITE_OK && state.m_budget > 0)
+  {
+    rc = WarmupBtrees(&state, db, zDbName);
+  }
+
+  sqlite3BitvecDestroy(state.m_seen);
+  sqlite3BitvecDestroy(state.m_expanded);
+  for (j = 0; j < WARMUP_MAX_THREADS; ++j)
+  {
+    if (state.m_copies[j] != NULL)
+    {
+      sqlite3CodecFree(state.m_copies[j]);
+    }
+  }
+  sqlite3BtreeLeave(pBt);
+  if (begun)
+  {
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+  }
+  sqlite3_mutex_leave(db->mutex);
+  return rc;
+}
+
+int
+wxsqlite3_cached_pages(sqlite3* db, const char* zDbName, unsigned int** paPages, int* pnPages)
+{
+  Btree* pBt;
+  Pager* pPager;
+  Pgno dbSize = 0;
+  Pgno pgno;
+  unsigned int* aPages;
+  int nCached, nPages = 0;
+  int begun = 0;
+  int dbIndex;
+  int rc;
+
+  if (db == NULL || paPages == NULL || pnPages == NULL)
+  {
+    return SQLITE_MISUSE;
+  }
+  *paPages = NULL;
+  *pnPages = 0;
+  if (zDbName == NULL)
+  {
+    zDbName = "main";
+  }
+  sqlite3_mutex_enter(db->mutex);
+  dbIndex = sqlite3FindDbName(db, zDbName);
+  pBt = (dbIndex >= 0) ? db->aDb[dbIndex].pBt : NULL;
+  if (pBt == NULL)
+  {
+    sqlite3_mutex_leave(db->mutex);
+    return SQLITE_ERROR;
+  }
+  /* Drops the cache if another connection changed the file meanwhile */
+  rc = WarmupBeginRead(db, zDbName, &begun);
+  if (rc != SQLITE_OK)
+  {
+    sqlite3_mutex_leave(db->mutex);
+    return rc;
+  }
+
+  sqlite3BtreeEnter(pBt);
+  pPager = sqlite3BtreePager(pBt);
+  sqlite3PagerPagecount(pPager, (int*) &dbSize);
+  nCached = sqlite3PcachePagecount(pPager->pPCache);
+  aPages = (unsigned int*) sqlite3_malloc64(sizeof(unsigned int) * (sqlite3_int64) (nCached > 0 ? nCached : 1));
+  if (aPages == NULL)
+  {
+    rc = SQLITE_NOMEM;
+  }
+  /* The cache has no iterator, so look every page up until all are found */
+  for (pgno = 1; rc == SQLITE_OK && pgno <= dbSize && nPages < nCached; ++pgno)
+  {
+    DbPage* pPage = sqlite3PagerLookup(pPager, pgno);
+    if (pPage != NULL)
+    {
+      aPages[nPages++] = pgno;
+      sqlite3PagerUnref(pPage);
+    }
+  }
+  sqlite3BtreeLeave(pBt);
+  if (begun)
+  {
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+  }
+  sqlite3_mutex_leave(db->mutex);
+
+  if (rc == SQLITE_OK)
+  {
+    *paPages = aPages;
+    *pnPages = nPages;
+  }
+  else
+  {
+    sqlite3_free(aPages);
+  }
+  return rc;
+}
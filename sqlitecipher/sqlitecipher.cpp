@@ -40,10 +40,21 @@
 #include <QCoreApplication>
 #include <QDateTime>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QSaveFile>
+#include <QSettings>
 #include <QSqlError>
 #include <QSqlField>
 #include <QSqlIndex>
 #include <QSqlQuery>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include <QtEndian>
 #include <QtSql/private/qsqlcachedresult_p.h>
 #include <QtSql/private/qsqldriver_p.h>
 
@@ -78,11 +89,17 @@ Q_DECLARE_OPAQUE_POINTER(sqlite3_stmt*)
 
 #define CHECK_SQLITE_KEY \
     do { \
-        sqlite3_key(d->access, password.toUtf8().constData(), password.size()); \
-        int result = sqlite3_exec(d->access, QStringLiteral("SELECT count(*) FROM sqlite_master LIMIT 1").toUtf8().constData(), nullptr, nullptr, nullptr); \
+        int result; \
+        if (autoCipher) { \
+            result = wxsqlite3_key_auto(d->access, "main", key.toUtf8().constData(), key.size(), &cipher); \
+        } else { \
+            result = sqlite3_key(d->access, key.toUtf8().constData(), key.size()); \
+        } \
+        if (result == SQLITE_OK) \
+            result = sqlite3_exec(d->access, QStringLiteral("SELECT count(*) FROM sqlite_master LIMIT 1").toUtf8().constData(), nullptr, nullptr, nullptr); \
         if (result != SQLITE_OK) { \
             if (d->access) { sqlite3_close(d->access); d->access = nullptr; } \
-            setLastError(qMakeError(d->access, tr("Invalid password. Maybe cipher not match?"), QSqlError::ConnectionError)); setOpenError(true); return false; \
+            setLastError(qMakeError(d->access, tr("Invalid password. Maybe cipher not match?"), QSqlError::ConnectionError)); setOpenError(true); setOpen(false); return false; \
         } \
     } while (0)
 
@@ -154,14 +171,102 @@ protected:
     void virtual_hook(int id, void *data) DECL_OVERRIDE;
 };
 
+// Lock-wait accounting of the busy handler installed for QSQLITE_BUSY_TIMEOUT
+struct SQLiteBusyState
+{
+    int timeout = 0;
+    qint64 waits = 0;
+    qint64 waitNs = 0;
+    qint64 timeouts = 0;
+};
+
+// Background maintenance of a database file for QSQLITE_BACKGROUND_CHECKPOINT
+// and QSQLITE_INCREMENTAL_VACUUM. There is one thread per file, shared by all
+// driver connections to it, with a connection of its own. The WAL hook of the
+// driver connections replaces SQLite's autocheckpoint, so commits only report
+// the WAL size; the commit hook tells the thread when the database is in use.
+// A rekey on a driver connection leaves the thread with the old key: after a
+// few failed checkpoints the WAL hook opens the thread's connection again with
+// the key of the committing connection.
+class SQLiteMaintainer : public QThread
+{
+public:
+    static SQLiteMaintainer *acquire(sqlite3 *source, const QByteArray &vfs, int checkpointThreshold,
+                                     int checkpointCap, int vacuumPages);
+    void release();
+
+    static int walHook(void *arg, sqlite3 *db, const char *dbName, int frames);
+    static int commitHook(void *arg);
+    QByteArray checkpointStats(bool reset);
+    QByteArray vacuumStats(bool reset);
+
+protected:
+    void run() DECL_OVERRIDE;
+
+private:
+    SQLiteMaintainer(const QString &path, const QByteArray &vfs, sqlite3 *connection);
+    static sqlite3 *openConnection(const QString &path, const QByteArray &vfs, sqlite3 *source);
+    void checkpoint(bool idle, int cap);
+    bool vacuum(int pages);
+
+    const QString path;
+    const QByteArray vfs;
+    sqlite3 *connection;    // replaced by the WAL hook while the thread does not use it
+    int refs = 1;           // guarded by the registry mutex
+
+    QMutex mutex;
+    QWaitCondition wake;
+    // A task is set up by the first connection asking for it
+    int threshold = 0;      // WAL frames that trigger a checkpoint right away, 0 without checkpoints
+    int cap = 0;            // WAL frames from which RESTART or TRUNCATE is used
+    int vacuumPages = 0;    // pages per incremental_vacuum step, 0 without vacuum
+    bool stop = false;
+    bool sleeping = false;
+    bool working = false;          // the thread uses its connection
+    int failures = 0;              // checkpoints failed in a row, because the key did not fit
+    bool keyStale = false;         // waiting for the WAL hook to reopen the connection
+    bool reopening = false;        // a WAL hook opens the new connection
+    bool incomplete = false;       // the last checkpoint left frames behind
+    bool vacuumPending = true;     // look at the freelist once after start
+    qint64 commits = 0;
+    qint64 checkpointedCommits = 0;
+    qint64 vacuumedCommits = 0;
+    QElapsedTimer lastActivity;    // last commit or checkpoint
+    int walFrames = 0;
+
+    // Metrics returned by checkpoint_stats()
+    qint64 checkpoints = 0;
+    qint64 restarts = 0;
+    qint64 truncates = 0;
+    qint64 busy = 0;
+    qint64 errors = 0;
+    qint64 lastNs = 0;
+    qint64 maxNs = 0;
+    qint64 totalNs = 0;
+    int walFramesMax = 0;
+
+    // Metrics returned by vacuum_stats()
+    qint64 vacuumSteps = 0;
+    qint64 vacuumFreedPages = 0;
+    qint64 vacuumBusy = 0;
+    qint64 vacuumErrors = 0;
+    qint64 vacuumLastNs = 0;
+    qint64 vacuumMaxNs = 0;
+    qint64 vacuumTotalNs = 0;
+};
+
 class SQLiteCipherDriverPrivate : public QSqlDriverPrivate
 {
     Q_DECLARE_PUBLIC(SQLiteCipherDriver)
 public:
-    inline SQLiteCipherDriverPrivate() : QSqlDriverPrivate(), access(nullptr) {}
+    inline SQLiteCipherDriverPrivate() : QSqlDriverPrivate(), access(nullptr), maintainer(nullptr) {}
     sqlite3 *access;
     QList <SQLiteResult *> results;
     QStringList notificationid;
+    SQLiteBusyState busy;
+    SQLiteMaintainer *maintainer;
+    // QSQLITE_WARMUP: where the cached pages are recorded at close, empty when off
+    QString warmupPath;
 };
 
 
@@ -719,6 +824,401 @@ static void _q_regexp_cleanup(void *cache)
 }
 #endif
 
+/*
+ * Same back-off as sqlite3_busy_timeout(), but the time spent waiting for
+ * locks is recorded so it can be queried with busy_wait_stats().
+ */
+static int _q_busy_handler(void *arg, int count)
+{
+    static const int delays[] = { 1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100 };
+    static const int totals[] = { 0, 1, 3, 8, 18, 33, 53, 78, 103, 128, 178, 228 };
+    static const int ndelay = int(sizeof(delays) / sizeof(delays[0]));
+    SQLiteBusyState *state = static_cast<SQLiteBusyState *>(arg);
+    int delay, prior;
+    if (count < ndelay) {
+        delay = delays[count];
+        prior = totals[count];
+    } else {
+        delay = delays[ndelay - 1];
+        prior = totals[ndelay - 1] + delay * (count - (ndelay - 1));
+    }
+    if (prior + delay > state->timeout) {
+        delay = state->timeout - prior;
+        if (delay <= 0) {
+            ++state->timeouts;
+            return 0;
+        }
+    }
+    QElapsedTimer timer;
+    timer.start();
+    sqlite3_sleep(delay);
+    ++state->waits;
+    state->waitNs += timer.nsecsElapsed();
+    return 1;
+}
+
+// busy_wait_stats([reset]) returns the lock-wait statistics of the connection as JSON
+static void _q_busy_wait_stats(sqlite3_context* context, int argc, sqlite3_value** argv)
+{
+    if (argc > 1) {
+        sqlite3_result_error(context, "wrong number of arguments to function busy_wait_stats()", -1);
+        return;
+    }
+    SQLiteBusyState *state = static_cast<SQLiteBusyState *>(sqlite3_user_data(context));
+    const QByteArray stats = QStringLiteral("{\"waits\":%1,\"wait_us\":%2,\"timeouts\":%3}")
+            .arg(state->waits).arg(state->waitNs / 1000).arg(state->timeouts).toUtf8();
+    sqlite3_result_text(context, stats.constData(), stats.size(), SQLITE_TRANSIENT);
+    if (argc == 1 && sqlite3_value_int(argv[0])) {
+        state->waits = 0;
+        state->waitNs = 0;
+        state->timeouts = 0;
+    }
+}
+
+typedef QHash<QString, SQLiteMaintainer *> SQLiteMaintainerHash;
+Q_GLOBAL_STATIC(QMutex, _q_maintainersMutex)
+Q_GLOBAL_STATIC(SQLiteMaintainerHash, _q_maintainers)
+
+static int _q_pragma_value(sqlite3 *access, const char *pragma, qint64 *value)
+{
+    sqlite3_stmt *stmt = nullptr;
+    int rc = sqlite3_prepare_v2(access, pragma, -1, &stmt, nullptr);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            *value = sqlite3_column_int64(stmt, 0);
+            rc = SQLITE_OK;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+SQLiteMaintainer::SQLiteMaintainer(const QString &path, const QByteArray &vfs, sqlite3 *connection)
+    : path(path), vfs(vfs), connection(connection)
+{
+    lastActivity.start();
+}
+
+// A connection of the maintainer to the database, with the key of source
+sqlite3 *SQLiteMaintainer::openConnection(const QString &path, const QByteArray &vfs, sqlite3 *source)
+{
+    sqlite3 *connection = nullptr;
+    int rc = sqlite3_open_v2(path.toUtf8().constData(), &connection,
+                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_PRIVATECACHE,
+                             vfs.isEmpty() ? nullptr : vfs.constData());
+    // Reading the WAL needs the page size, and so the key
+    if (rc == SQLITE_OK)
+        rc = wxsqlite3_key_copy(connection, "main", source, "main");
+    if (rc != SQLITE_OK) {
+        sqlite3_close(connection);
+        return nullptr;
+    }
+    // No busy handler: RESTART and TRUNCATE hold off writers while they wait
+    // for readers, so they rather fail and are tried again when idle
+    return connection;
+}
+
+// The maintainer of the main database of source, started on first use
+SQLiteMaintainer *SQLiteMaintainer::acquire(sqlite3 *source, const QByteArray &vfs, int checkpointThreshold,
+                                            int checkpointCap, int vacuumPages)
+{
+    // In-memory and temporary databases have no file to maintain
+    const char *file = sqlite3_db_filename(source, "main");
+    if (!file || !*file)
+        return nullptr;
+    const QString path = QString::fromUtf8(file);
+
+    QMutexLocker locker(_q_maintainersMutex());
+    SQLiteMaintainer *maintainer = _q_maintainers()->value(path);
+    if (maintainer) {
+        ++maintainer->refs;
+        QMutexLocker taskLocker(&maintainer->mutex);
+        if (maintainer->threshold == 0 && checkpointThreshold > 0) {
+            maintainer->threshold = checkpointThreshold;
+            maintainer->cap = checkpointCap;
+        }
+        if (maintainer->vacuumPages == 0 && vacuumPages > 0) {
+            maintainer->vacuumPages = vacuumPages;
+            maintainer->vacuumPending = true;
+        }
+        return maintainer;
+    }
+
+    sqlite3 *connection = openConnection(path, vfs, source);
+    if (!connection)
+        return nullptr;
+
+    maintainer = new SQLiteMaintainer(path, vfs, connection);
+    maintainer->threshold = checkpointThreshold;
+    maintainer->cap = checkpointCap;
+    maintainer->vacuumPages = vacuumPages;
+    _q_maintainers()->insert(path, maintainer);
+    maintainer->start(QThread::LowPriority);
+    return maintainer;
+}
+
+void SQLiteMaintainer::release()
+{
+    {
+        QMutexLocker locker(_q_maintainersMutex());
+        if (--refs > 0)
+            return;
+        _q_maintainers()->remove(path);
+    }
+    {
+        QMutexLocker locker(&mutex);
+        stop = true;
+        wake.wakeOne();
+    }
+    wait();
+    delete this;
+}
+
+// Called before every commit of a driver connection
+int SQLiteMaintainer::commitHook(void *arg)
+{
+    SQLiteMaintainer *maintainer = static_cast<SQLiteMaintainer *>(arg);
+    QMutexLocker locker(&maintainer->mutex);
+    ++maintainer->commits;
+    maintainer->lastActivity.start();
+    if (maintainer->sleeping)
+        maintainer->wake.wakeOne();
+    return 0;
+}
+
+// Called after every commit of a driver connection in WAL mode
+int SQLiteMaintainer::walHook(void *arg, sqlite3 *db, const char *dbName, int frames)
+{
+    if (qstrcmp(dbName, "main") != 0)
+        return SQLITE_OK;
+    SQLiteMaintainer *maintainer = static_cast<SQLiteMaintainer *>(arg);
+    QMutexLocker locker(&maintainer->mutex);
+    maintainer->walFrames = frames;
+    maintainer->walFramesMax = qMax(maintainer->walFramesMax, frames);
+    if (frames >= maintainer->threshold)
+        maintainer->wake.wakeOne();
+    // The thread is idle while its key is stale, so its connection is free
+    if (!maintainer->keyStale || maintainer->working || maintainer->reopening)
+        return SQLITE_OK;
+    maintainer->reopening = true;
+    locker.unlock();
+
+    // A new connection, the old one keeps the page layout of the old key.
+    // Opened without the mutex, so that commits of other connections go on.
+    sqlite3 *connection = openConnection(maintainer->path, maintainer->vfs, db);
+    locker.relock();
+    maintainer->reopening = false;
+    if (!connection)
+        return SQLITE_OK;
+    qSwap(connection, maintainer->connection);
+    maintainer->keyStale = false;
+    maintainer->failures = 0;
+    maintainer->incomplete = true;
+    maintainer->wake.wakeOne();
+    locker.unlock();
+    sqlite3_close(connection);
+    return SQLITE_OK;
+}
+
+void SQLiteMaintainer::run()
+{
+    // Idle tasks wait until the database was not written for that long
+    static const int idleMs = 500;
+    // Pause between incremental vacuum steps, so that writers get in
+    static const int vacuumPauseMs = 20;
+    QMutexLocker locker(&mutex);
+    while (!stop) {
+        const bool fresh = commits != checkpointedCommits;
+        const bool checkpointDue = threshold > 0 && !keyStale && (fresh || incomplete);
+        const bool vacuumDue = vacuumPages > 0 && !keyStale && (commits != vacuumedCommits || vacuumPending);
+        // Taken under the mutex, a later connection may set up a task
+        const int checkpointCap = cap;
+        const int pages = vacuumPages;
+        if (!checkpointDue && !vacuumDue) {
+            sleeping = true;
+            wake.wait(&mutex);
+            sleeping = false;
+            continue;
+        }
+        if (checkpointDue && fresh && walFrames >= threshold) {
+            checkpointedCommits = commits;
+            working = true;
+            locker.unlock();
+            checkpoint(false, checkpointCap);
+            locker.relock();
+            working = false;
+            continue;
+        }
+        const qint64 quiet = lastActivity.elapsed();
+        if (quiet < idleMs) {
+            wake.wait(&mutex, idleMs - quiet);
+            continue;
+        }
+        if (vacuumDue) {
+            // Vacuum first, its frames are checkpointed afterwards
+            vacuumedCommits = commits;
+            working = true;
+            locker.unlock();
+            const bool more = vacuum(pages);
+            locker.relock();
+            working = false;
+            vacuumPending = more;
+            if (threshold > 0)
+                incomplete = true;
+            if (more)
+                wake.wait(&mutex, vacuumPauseMs);
+        } else {
+            checkpointedCommits = commits;
+            working = true;
+            locker.unlock();
+            checkpoint(true, checkpointCap);
+            locker.relock();
+            working = false;
+        }
+    }
+    locker.unlock();
+    sqlite3_close(connection);
+}
+
+void SQLiteMaintainer::checkpoint(bool idle, int cap)
+{
+    QElapsedTimer timer;
+    timer.start();
+    int mode = SQLITE_CHECKPOINT_PASSIVE;
+    int logFrames = -1;
+    int doneFrames = -1;
+    // A read opens the WAL of this connection, and follows journal mode changes
+    int rc = sqlite3_exec(connection, "PRAGMA schema_version", nullptr, nullptr, nullptr);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_wal_checkpoint_v2(connection, "main", mode, &logFrames, &doneFrames);
+    if (rc == SQLITE_OK && logFrames >= cap) {
+        // Make writers start over at the beginning of the WAL, and shrink the
+        // file while nobody writes
+        mode = idle ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_RESTART;
+        rc = sqlite3_wal_checkpoint_v2(connection, "main", mode, &logFrames, &doneFrames);
+    }
+    const qint64 ns = timer.nsecsElapsed();
+
+    QMutexLocker locker(&mutex);
+    ++checkpoints;
+    if (mode == SQLITE_CHECKPOINT_RESTART)
+        ++restarts;
+    else if (mode == SQLITE_CHECKPOINT_TRUNCATE)
+        ++truncates;
+    if (rc == SQLITE_BUSY)
+        ++busy;
+    else if (rc != SQLITE_OK)
+        ++errors;
+    // The pages do not decrypt with the key of this connection, most likely
+    // the database was rekeyed meanwhile
+    failures = (rc == SQLITE_NOTADB || rc == SQLITE_CORRUPT) ? failures + 1 : 0;
+    if (failures >= 3)
+        keyStale = true;
+    lastNs = ns;
+    maxNs = qMax(maxNs, ns);
+    totalNs += ns;
+    // Readers kept frames from being copied, try again when idle
+    incomplete = rc == SQLITE_BUSY || (rc == SQLITE_OK && doneFrames < logFrames);
+    lastActivity.start();
+}
+
+// One incremental vacuum step, true if there are free pages left
+bool SQLiteMaintainer::vacuum(int pages)
+{
+    QElapsedTimer timer;
+    timer.start();
+    qint64 autoVacuum = 0;
+    qint64 freeBefore = 0;
+    qint64 freeAfter = 0;
+    int rc = _q_pragma_value(connection, "PRAGMA auto_vacuum", &autoVacuum);
+    // Only auto_vacuum=INCREMENTAL keeps the pointer maps incremental_vacuum needs
+    if (rc == SQLITE_OK && autoVacuum != 2)
+        return false;
+    if (rc == SQLITE_OK)
+        rc = _q_pragma_value(connection, "PRAGMA freelist_count", &freeBefore);
+    if (rc == SQLITE_OK && freeBefore == 0)
+        return false;
+    if (rc == SQLITE_OK) {
+        const QByteArray pragma = "PRAGMA incremental_vacuum(" + QByteArray::number(pages) + ")";
+        rc = sqlite3_exec(connection, pragma.constData(), nullptr, nullptr, nullptr);
+    }
+    if (rc == SQLITE_OK)
+        rc = _q_pragma_value(connection, "PRAGMA freelist_count", &freeAfter);
+    const qint64 ns = timer.nsecsElapsed();
+
+    QMutexLocker locker(&mutex);
+    ++vacuumSteps;
+    if (rc == SQLITE_OK)
+        vacuumFreedPages += freeBefore - freeAfter;
+    else if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+        ++vacuumBusy;
+    else
+        ++vacuumErrors;
+    vacuumLastNs = ns;
+    vacuumMaxNs = qMax(vacuumMaxNs, ns);
+    vacuumTotalNs += ns;
+    if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+        // Someone holds a lock, wait for the next idle period
+        lastActivity.start();
+        return true;
+    }
+    return rc == SQLITE_OK && freeAfter > 0;
+}
+
+QByteArray SQLiteMaintainer::checkpointStats(bool reset)
+{
+    QMutexLocker locker(&mutex);
+    const QByteArray result = QStringLiteral("{\"checkpoints\":%1,\"restarts\":%2,\"truncates\":%3,\"busy\":%4,\"errors\":%5,"
+                                             "\"last_us\":%6,\"max_us\":%7,\"total_us\":%8,\"wal_frames\":%9,\"wal_frames_max\":%10}")
+            .arg(checkpoints).arg(restarts).arg(truncates).arg(busy).arg(errors)
+            .arg(lastNs / 1000).arg(maxNs / 1000).arg(totalNs / 1000).arg(walFrames).arg(walFramesMax).toUtf8();
+    if (reset) {
+        checkpoints = restarts = truncates = busy = errors = 0;
+        lastNs = maxNs = totalNs = 0;
+        walFramesMax = walFrames;
+    }
+    return result;
+}
+
+QByteArray SQLiteMaintainer::vacuumStats(bool reset)
+{
+    QMutexLocker locker(&mutex);
+    const QByteArray result = QStringLiteral("{\"steps\":%1,\"freed_pages\":%2,\"busy\":%3,\"errors\":%4,"
+                                             "\"last_us\":%5,\"max_us\":%6,\"total_us\":%7}")
+            .arg(vacuumSteps).arg(vacuumFreedPages).arg(vacuumBusy).arg(vacuumErrors)
+            .arg(vacuumLastNs / 1000).arg(vacuumMaxNs / 1000).arg(vacuumTotalNs / 1000).toUtf8();
+    if (reset) {
+        vacuumSteps = vacuumFreedPages = vacuumBusy = vacuumErrors = 0;
+        vacuumLastNs = vacuumMaxNs = vacuumTotalNs = 0;
+    }
+    return result;
+}
+
+// checkpoint_stats([reset]) returns the metrics of the background checkpoints as JSON
+static void _q_checkpoint_stats(sqlite3_context* context, int argc, sqlite3_value** argv)
+{
+    if (argc > 1) {
+        sqlite3_result_error(context, "wrong number of arguments to function checkpoint_stats()", -1);
+        return;
+    }
+    SQLiteMaintainer *maintainer = static_cast<SQLiteMaintainer *>(sqlite3_user_data(context));
+    const QByteArray stats = maintainer->checkpointStats(argc == 1 && sqlite3_value_int(argv[0]));
+    sqlite3_result_text(context, stats.constData(), stats.size(), SQLITE_TRANSIENT);
+}
+
+// vacuum_stats([reset]) returns the metrics of the background incremental vacuum as JSON
+static void _q_vacuum_stats(sqlite3_context* context, int argc, sqlite3_value** argv)
+{
+    if (argc > 1) {
+        sqlite3_result_error(context, "wrong number of arguments to function vacuum_stats()", -1);
+        return;
+    }
+    SQLiteMaintainer *maintainer = static_cast<SQLiteMaintainer *>(sqlite3_user_data(context));
+    const QByteArray stats = maintainer->vacuumStats(argc == 1 && sqlite3_value_int(argv[0]));
+    sqlite3_result_text(context, stats.constData(), stats.size(), SQLITE_TRANSIENT);
+}
+
 SQLiteCipherDriver::SQLiteCipherDriver(QObject * parent)
     : QSqlDriver(*new SQLiteCipherDriverPrivate, parent)
 {
@@ -787,7 +1287,8 @@ static int _cipherNameToValue(const QString &name) {
     } else if (lowerName == QStringLiteral("sqlcipher")) {
         return SQLCIPHER;
     } else {
-        return UNKNOWN_CIPHER;
+        // Ciphers registered with wxsqlite3_register_cipher
+        return wxsqlite3_cipher_index(lowerName.toUtf8().constData());
     }
 }
 
@@ -806,6 +1307,139 @@ static QString _cipherValueToName(const QtSqliteCipher &cipher) {
     }
 }
 
+static const char *_cipherValueToParamName(int cipher) {
+    // Ciphers registered with wxsqlite3_register_cipher follow the built-in ones
+    const char *name = wxsqlite3_cipher_name(cipher);
+    return name ? name : "";
+}
+
+/*
+   Sets the KDF iterations for a new key of the given cipher: calibrated
+   on this machine to take targetMs if a target is given, the configured
+   count otherwise. Returns the count, -1 if the cipher has none.
+*/
+static int _q_prepareKdf(sqlite3 *access, int cipher, int configuredIter, int targetMs)
+{
+    if (configuredIter <= 0)
+        return -1;
+    const int kdfIter = targetMs > 0 ? wxsqlite3_kdf_calibrate(_cipherValueToParamName(cipher), targetMs) : configuredIter;
+    wxsqlite3_config_cipher(access, _cipherValueToParamName(cipher), "kdf_iter", kdfIter);
+    return kdfIter;
+}
+
+/*
+   The key parameters of a database can be recorded in "<database>.kdf",
+   so that opening it needs no cipher options.
+*/
+static QString _q_kdfRecordPath(const QString &db)
+{
+    return db + QLatin1String(".kdf");
+}
+
+static void _q_recordKdf(const QString &db, int cipher, int kdfIter)
+{
+    QSettings record(_q_kdfRecordPath(db), QSettings::IniFormat);
+    record.setValue(QStringLiteral("cipher"), QLatin1String(_cipherValueToParamName(cipher)));
+    if (kdfIter > 0)
+        record.setValue(QStringLiteral("kdf_iter"), kdfIter);
+    else
+        record.remove(QStringLiteral("kdf_iter"));
+}
+
+static QString _q_warmupPath(const QString &db)
+{
+    return db + QLatin1String(".warmup");
+}
+
+// Magic number of the page lists recorded for QSQLITE_WARMUP
+static const char _q_warmupMagic[4] = { 'W', 'U', 'P', '1' };
+
+/*
+   Loads pages into the page cache of a new connection: the pages recorded at
+   the last close, then the b-trees of the schema. pages < 0 gives a
+   percentage of the database.
+*/
+static void _q_warmup(sqlite3 *access, const QString &path, int pages)
+{
+    if (pages < 0) {
+        qint64 pageCount = 0;
+        if (_q_pragma_value(access, "PRAGMA page_count", &pageCount) != SQLITE_OK)
+            return;
+        pages = int(qMax<qint64>(1, pageCount * -pages / 100));
+    }
+    QVector<unsigned int> hotPages;
+    QFile file(path);
+    if (file.open(QIODevice::ReadOnly)) {
+        const QByteArray data = file.readAll();
+        if (data.size() >= 4 && data.startsWith(QByteArray(_q_warmupMagic, 4)) && data.size() % 4 == 0) {
+            hotPages.resize(data.size() / 4 - 1);
+            for (int i = 0; i < hotPages.size(); ++i)
+                hotPages[i] = qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(data.constData()) + 4 * (i + 1));
+        }
+    }
+    wxsqlite3_warmup(access, "main", hotPages.constData(), hotPages.size(), pages, QThread::idealThreadCount());
+}
+
+// Records the pages in the page cache for the next _q_warmup. The list is not
+// encrypted, it tells which pages were in use but nothing of their content.
+static void _q_recordWarmup(sqlite3 *access, const QString &path)
+{
+    unsigned int *pages = nullptr;
+    int count = 0;
+    if (wxsqlite3_cached_pages(access, "main", &pages, &count) != SQLITE_OK)
+        return;
+    QByteArray data(_q_warmupMagic, 4);
+    data.resize(4 + 4 * count);
+    for (int i = 0; i < count; ++i)
+        qToLittleEndian<quint32>(pages[i], reinterpret_cast<uchar *>(data.data()) + 4 * (i + 1));
+    sqlite3_free(pages);
+    QSaveFile file(path);
+    if (file.open(QIODevice::WriteOnly) && file.write(data) == data.size())
+        file.commit();
+}
+
+/*
+   Whether a raw key of the given number of hex digits fits the cipher.
+   SQLCipher optionally takes the salt after the key, registered ciphers
+   define their own format and an unknown cipher takes any built-in size.
+*/
+static bool _q_isRawKeySize(int cipher, int digits)
+{
+    switch (cipher) {
+    case UNKNOWN_CIPHER:
+        return digits == 32 || digits == 64 || digits == 96;
+    case AES_128_CBC:
+        return digits == 32;
+    case AES_256_CBC:
+    case CHACHA20:
+        return digits == 64;
+    case SQLCIPHER:
+        return digits == 64 || digits == 96;
+    default:
+        return digits > 0 && digits % 2 == 0;
+    }
+}
+
+/*
+   Returns a raw key in the x'<hex>' form the ciphers take as the key
+   itself, or a null string if the key is not hex or has not the key size
+   of the cipher. The ciphers would silently derive a key from it instead.
+*/
+static QString _q_rawKey(const QString &key, int cipher)
+{
+    QString hex = key;
+    if (hex.startsWith(QLatin1String("x'"), Qt::CaseInsensitive) && hex.endsWith(QLatin1Char('\'')))
+        hex = hex.mid(2, hex.size() - 3);
+    if (!_q_isRawKeySize(cipher, hex.size()))
+        return QString();
+    for (const QChar c : hex) {
+        const char l = c.toLatin1();
+        if (!((l >= '0' && l <= '9') || (l >= 'a' && l <= 'f') || (l >= 'A' && l <= 'F')))
+            return QString();
+    }
+    return QLatin1String("x'") + hex + QLatin1Char('\'');
+}
+
 /*
    SQLite dbs have no user name, hosts or ports.
    just file names and password we need.
@@ -824,12 +1458,14 @@ bool SQLiteCipherDriver::open(const QString & db, const QString &, const QString
     };
 
     int timeOut = 5000;
+    int sorterThreads = -1;
     int keyOp = OPEN_WITH_KEY;
     bool sharedCache = false;
     bool openReadOnlyOption = false;
     bool openUriOption = false;
     QString newPassword = QString::null;
     int cipher = -1;
+    bool autoCipher = false;
     // AES128CBC
     bool aes128cbcLegacy = false;
     // AES256CBC
@@ -845,6 +1481,35 @@ bool SQLiteCipherDriver::open(const QString & db, const QString &, const QString
     bool sqlcipherHmacUse = true;
     int sqlcipherHmacPgno = 1;
     int sqlcipherHmacSaltMask = 0x3a;
+    // KDF iterations by cipher, for the ciphers whose files depend on them
+    int *kdfIterOption[] = { nullptr, nullptr, nullptr, &chacha20KdfIter, &sqlcipherKdfIter };
+    int kdfTargetMs = 0;
+    bool recordKdf = false;
+    // 0: passphrase, 1: raw hex key, 2: raw hex key through HKDF
+    int rawKey = 0;
+    // VFS to open the database with, e.g. "uring"; empty for the default VFS
+    QByteArray vfs;
+    // QSQLITE_DIRECT_IO: page cache size in MiB replacing the OS page cache, 0 when off
+    int directIoCacheMb = 0;
+    // QSQLITE_SHARED_PAGES: limit of the process-wide decrypted page store in MiB, -1 when not given
+    int sharedPagesMb = -1;
+    // QSQLITE_PCACHE=clock: install the partitioned CLOCK page cache
+    bool clockPcache = false;
+    // QSQLITE_MALLOC=thread: install the allocator with per-thread caches
+    bool threadMalloc = false;
+    // QSQLITE_EXTENSIONS: extension groups registered on this connection, null when not given
+    QByteArray extensions;
+    // QSQLITE_LOOKASIDE: lookaside slot size and count of this connection, -1 for SQLite's default
+    int lookasideSize = -1;
+    int lookasideCount = -1;
+    // QSQLITE_BACKGROUND_CHECKPOINT: WAL frames that trigger a background checkpoint, 0 when off
+    int checkpointThreshold = 0;
+    // QSQLITE_CHECKPOINT_CAP: WAL frames from which checkpoints restart or truncate the WAL
+    int checkpointCap = 0;
+    // QSQLITE_INCREMENTAL_VACUUM: pages per background incremental_vacuum step, 0 when off
+    int vacuumPages = 0;
+    // QSQLITE_WARMUP: pages to load into the page cache at open, negative for a percentage, 0 when off
+    int warmupPages = 0;
 
 #ifdef REGULAR_EXPRESSION_ENABLED
     static const QLatin1String regexpConnectOption = QLatin1String("QSQLITE_ENABLE_REGEXP");
@@ -852,6 +1517,16 @@ bool SQLiteCipherDriver::open(const QString & db, const QString &, const QString
     int regexpCacheSize = 25;
 #endif
 
+    // Parameters recorded with QSQLITE_KDF_RECORD, explicit options take precedence
+    const bool canRecordKdf = !db.isEmpty() && db != QLatin1String(":memory:");
+    if (canRecordKdf && QFileInfo::exists(_q_kdfRecordPath(db))) {
+        QSettings record(_q_kdfRecordPath(db), QSettings::IniFormat);
+        cipher = _cipherNameToValue(record.value(QStringLiteral("cipher")).toString());
+        const int kdfIter = record.value(QStringLiteral("kdf_iter"), -1).toInt();
+        if (cipher > 0 && cipher <= SQLCIPHER && kdfIterOption[cipher] && kdfIter > 0)
+            *kdfIterOption[cipher] = kdfIter;
+    }
+
     const QStringList opts = QString(conOpts).remove(QLatin1Char(' ')).split(QLatin1Char(';'));
     foreach (const QString &option, opts) {
         if (option.startsWith(QLatin1String("QSQLITE_BUSY_TIMEOUT="))) {
@@ -861,6 +1536,83 @@ bool SQLiteCipherDriver::open(const QString & db, const QString &, const QString
                 timeOut = nt;
             }
         }
+        if (option.startsWith(QLatin1String("QSQLITE_SORTER_THREADS="))) {
+            bool ok;
+            const int nt = option.midRef(23).toInt(&ok);
+            if (ok) {
+                sorterThreads = nt;
+            }
+        }
+        if (option.startsWith(QLatin1String("QSQLITE_KDF_TARGET_MS="))) {
+            bool ok;
+            const int nt = option.midRef(22).toInt(&ok);
+            if (ok) {
+                kdfTargetMs = nt;
+            }
+        }
+        if (option.startsWith(QLatin1String("QSQLITE_RAW_KEY="))) {
+            if (option.midRef(16).compare(QLatin1String("hkdf"), Qt::CaseInsensitive) == 0) {
+                rawKey = 2;
+            } else {
+                bool ok;
+                const int nr = option.midRef(16).toInt(&ok);
+                if (ok) {
+                    rawKey = nr ? 1 : 0;
+                }
+            }
+        }
+        if (option.startsWith(QLatin1String("QSQLITE_VFS="))) {
+            vfs = option.mid(12).toUtf8();
+        }
+        if (option.startsWith(QLatin1String("QSQLITE_SHARED_PAGES="))) {
+            bool ok;
+            const int nm = option.midRef(21).toInt(&ok);
+            if (ok && nm >= 0) {
+                sharedPagesMb = nm;
+            }
+        }
+        if (option.startsWith(QLatin1String("QSQLITE_PCACHE="))) {
+            clockPcache = (option.midRef(15).compare(QLatin1String("clock"), Qt::CaseInsensitive) == 0);
+        }
+        if (option.startsWith(QLatin1String("QSQLITE_MALLOC="))) {
+            threadMalloc = (option.midRef(15).compare(QLatin1String("thread"), Qt::CaseInsensitive) == 0);
+        }
+        if (option.startsWith(QLatin1String("QSQLITE_EXTENSIONS="))) {
+            // Comma separated group names, "all" or "none"
+            extensions = option.mid(19).toUtf8();
+        }
+        if (option.startsWith(QLatin1String("QSQLITE_LOOKASIDE="))) {
+            // <slot size>,<slot count>; 0,0 turns lookaside off
+            const QStringList lookaside = option.mid(18).split(QLatin1Char(','));
+            bool okSize = false, okCount = false;
+            if (lookaside.size() == 2) {
+                const int ns = lookaside.at(0).toInt(&okSize);
+                const int nc = lookaside.at(1).toInt(&okCount);
+                if (okSize && okCount && ns >= 0 && nc >= 0) {
+                    lookasideSize = ns;
+                    lookasideCount = nc;
+                }
+            }
+        }
+        if (option.startsWith(QLatin1String("QSQLITE_CHECKPOINT_CAP="))) {
+            bool ok;
+            const int nc = option.midRef(23).toInt(&ok);
+            if (ok && nc > 0) {
+                checkpointCap = nc;
+            }
+        }
+        if (option.startsWith(QLatin1String("QSQLITE_WARMUP="))) {
+            // <pages> or <percent>%
+            QStringRef value = option.midRef(15);
+            const bool percent = value.endsWith(QLatin1Char('%'));
+            if (percent)
+                value.chop(1);
+            bool ok;
+            const int np = value.toInt(&ok);
+            if (ok && np > 0 && (!percent || np <= 100)) {
+                warmupPages = percent ? -np : np;
+            }
+        }
         if (option.startsWith(QLatin1String("QSQLITE_UPDATE_KEY="))) {
             newPassword = option.mid(19);
             keyOp = UPDATE_KEY;
@@ -868,6 +1620,7 @@ bool SQLiteCipherDriver::open(const QString & db, const QString &, const QString
         if (option.startsWith(QLatin1String("QSQLITE_USE_CIPHER="))) {
             QString cipherName = option.mid(19);
             cipher = _cipherNameToValue(cipherName);
+            autoCipher = (cipherName.toLower() == QLatin1String("auto"));
         }
         if (option.startsWith(QLatin1String("AES128CBC_LEGACY="))) {
             bool ok;
@@ -981,6 +1734,38 @@ bool SQLiteCipherDriver::open(const QString & db, const QString &, const QString
             keyOp = CREATE_KEY;
         } else if (option == QLatin1String("QSQLITE_REMOVE_KEY")) {
             keyOp = REMOVE_KEY;
+        } else if (option == QLatin1String("QSQLITE_KDF_RECORD")) {
+            recordKdf = canRecordKdf;
+        } else if (option.startsWith(QLatin1String("QSQLITE_BACKGROUND_CHECKPOINT"))) {
+            const QString checkpointOption = option.mid(29);
+            if (checkpointOption.isEmpty()) {
+                checkpointThreshold = 1000;
+            } else if (checkpointOption.startsWith(QLatin1Char('='))) {
+                bool ok = false;
+                const int frames = checkpointOption.mid(1).toInt(&ok);
+                if (ok && frames > 0)
+                    checkpointThreshold = frames;
+            }
+        } else if (option.startsWith(QLatin1String("QSQLITE_INCREMENTAL_VACUUM"))) {
+            const QString vacuumOption = option.mid(26);
+            if (vacuumOption.isEmpty()) {
+                vacuumPages = 128;
+            } else if (vacuumOption.startsWith(QLatin1Char('='))) {
+                bool ok = false;
+                const int pages = vacuumOption.mid(1).toInt(&ok);
+                if (ok && pages > 0)
+                    vacuumPages = pages;
+            }
+        } else if (option.startsWith(QLatin1String("QSQLITE_DIRECT_IO"))) {
+            const QString directOption = option.mid(17);
+            if (directOption.isEmpty()) {
+                directIoCacheMb = 64;
+            } else if (directOption.startsWith(QLatin1Char('='))) {
+                bool ok = false;
+                const int cacheMb = directOption.mid(1).toInt(&ok);
+                if (ok && cacheMb > 0)
+                    directIoCacheMb = cacheMb;
+            }
         }
 #ifdef REGULAR_EXPRESSION_ENABLED
         else if (option.startsWith(regexpConnectOption)) {
@@ -1000,6 +1785,34 @@ bool SQLiteCipherDriver::open(const QString & db, const QString &, const QString
 #endif
     }
 
+    // Process-wide settings. The allocator and the page cache can only be
+    // replaced before SQLite is initialized, so they must be requested by the
+    // first connection; the shared page store initializes SQLite and comes
+    // last. Its limit is the last one set by any connection.
+    if (threadMalloc)
+        wxsqlite3_install_malloc();
+    if (clockPcache)
+        wxsqlite3_install_pcache();
+    if (sharedPagesMb >= 0)
+        wxsqlite3_shared_pages_limit(sqlite3_int64(sharedPagesMb) * 1024 * 1024);
+
+    // Raw keys skip the KDF, so they must be given as hex of the key size
+    QString key = password;
+    if (rawKey && !password.isEmpty()) {
+        const int keyCipher = autoCipher ? UNKNOWN_CIPHER : (cipher > 0 ? cipher : wxsqlite3_config(nullptr, "cipher", -1));
+        key = _q_rawKey(password, keyCipher);
+        bool valid = !key.isNull();
+        if (!newPassword.isEmpty()) {
+            newPassword = _q_rawKey(newPassword, keyCipher);
+            valid = valid && !newPassword.isNull();
+        }
+        if (!valid) {
+            setLastError(QSqlError(tr("Error opening database"), tr("Raw keys must be hex encoded and match the key size of the cipher"), QSqlError::ConnectionError));
+            setOpenError(true);
+            return false;
+        }
+    }
+
     int openMode = (openReadOnlyOption ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE));
     openMode |= (sharedCache ? SQLITE_OPEN_SHAREDCACHE : SQLITE_OPEN_PRIVATECACHE);
     if (openUriOption)
@@ -1007,8 +1820,34 @@ bool SQLiteCipherDriver::open(const QString & db, const QString &, const QString
 
     openMode |= SQLITE_OPEN_NOMUTEX;
 
-    if (sqlite3_open_v2(db.toUtf8().constData(), &d->access, openMode, nullptr) == SQLITE_OK) {
-        sqlite3_busy_timeout(d->access, timeOut);
+    // An explicit QSQLITE_VFS takes precedence
+    if (directIoCacheMb > 0 && vfs.isEmpty())
+        vfs = "direct";
+
+    // Without QSQLITE_EXTENSIONS the connection gets the default groups
+    int rc;
+    if (extensions.isNull()) {
+        rc = sqlite3_open_v2(db.toUtf8().constData(), &d->access, openMode, vfs.isEmpty() ? nullptr : vfs.constData());
+    } else {
+        rc = wxsqlite3_open_extensions(db.toUtf8().constData(), &d->access, openMode,
+                                       vfs.isEmpty() ? nullptr : vfs.constData(), extensions.constData());
+        if (rc == SQLITE_ERROR && !d->access) {
+            setLastError(QSqlError(tr("Error opening database"), tr("Unknown extension group in QSQLITE_EXTENSIONS"), QSqlError::ConnectionError));
+            setOpenError(true);
+            return false;
+        }
+    }
+    if (rc == SQLITE_OK) {
+        // First, while no lookaside slot is in use
+        if (lookasideSize >= 0)
+            sqlite3_db_config(d->access, SQLITE_DBCONFIG_LOOKASIDE, nullptr, lookasideSize, lookasideCount);
+        d->busy = SQLiteBusyState();
+        d->busy.timeout = timeOut;
+        sqlite3_busy_handler(d->access, timeOut > 0 ? &_q_busy_handler : nullptr, &d->busy);
+        sqlite3_create_function_v2(d->access, "busy_wait_stats", -1, SQLITE_UTF8, &d->busy,
+                                   &_q_busy_wait_stats, nullptr, nullptr, nullptr);
+        if (sorterThreads >= 0)
+            sqlite3_limit(d->access, SQLITE_LIMIT_WORKER_THREADS, sorterThreads);
 
         setOpen(true);
         setOpenError(false);
@@ -1019,41 +1858,38 @@ bool SQLiteCipherDriver::open(const QString & db, const QString &, const QString
                                        nullptr, &_q_regexp_cleanup);
         }
 #endif
-        if (cipher > 0) {
-            wxsqlite3_config(d->access, "cipher", cipher);
-            switch (cipher) {
-            case AES_128_CBC:
-            {
+        if (cipher > 0 || autoCipher) {
+            // With QSQLITE_USE_CIPHER=auto every cipher is a candidate, the
+            // legacy mode is derived from the file
+            if (cipher > 0)
+                wxsqlite3_config(d->access, "cipher", cipher);
+            if (autoCipher || cipher == AES_128_CBC) {
                 wxsqlite3_config_cipher(d->access, "aes128cbc", "legacy", aes128cbcLegacy ? 1 : 0);
-                break;
             }
-            case AES_256_CBC:
-            {
+            if (autoCipher || cipher == AES_256_CBC) {
                 wxsqlite3_config_cipher(d->access, "aes256cbc", "legacy", aes256cbcLegacy ? 1 : 0);
                 wxsqlite3_config_cipher(d->access, "aes256cbc", "kdf_iter", aes256cbcKdfIter);
-                break;
             }
-            case CHACHA20:
-            {
+            if (autoCipher || cipher == CHACHA20) {
                 wxsqlite3_config_cipher(d->access, "chacha20", "legacy", chacha20Legacy ? 1 : 0);
                 wxsqlite3_config_cipher(d->access, "chacha20", "kdf_iter", chacha20KdfIter);
-                break;
             }
-            case SQLCIPHER:
-            {
+            if (autoCipher || cipher == SQLCIPHER) {
                 wxsqlite3_config_cipher(d->access, "sqlcipher", "legacy", sqlcipherLegacy ? 1 : 0);
                 wxsqlite3_config_cipher(d->access, "sqlcipher", "kdf_iter", sqlcipherKdfIter);
                 wxsqlite3_config_cipher(d->access, "sqlcipher", "fast_kdf_iter", sqlcipherFastKdfIter);
                 wxsqlite3_config_cipher(d->access, "sqlcipher", "hmac_use", sqlcipherHmacUse ? 1 : 0);
                 wxsqlite3_config_cipher(d->access, "sqlcipher", "hmac_pgno", sqlcipherHmacPgno);
                 wxsqlite3_config_cipher(d->access, "sqlcipher", "hmac_salt_mask", sqlcipherHmacSaltMask);
-                break;
-            }
-            default:
-                // Do nothing
-                break;
             }
         }
+        if (rawKey == 2) {
+            // Kept as default, opening and rekeying both allocate ciphers.
+            // SQLCipher defines its own raw key format and has no HKDF step.
+            wxsqlite3_config_cipher(d->access, "aes128cbc", "default:raw_hkdf", 1);
+            wxsqlite3_config_cipher(d->access, "aes256cbc", "default:raw_hkdf", 1);
+            wxsqlite3_config_cipher(d->access, "chacha20", "default:raw_hkdf", 1);
+        }
 
         if (!(password.isNull() || password.isEmpty())) {
             switch (keyOp) {
@@ -1064,24 +1900,37 @@ bool SQLiteCipherDriver::open(const QString & db, const QString &, const QString
             }
             case CREATE_KEY:
             {
-                if (SQLITE_OK != sqlite3_rekey(d->access, password.toUtf8().constData(), password.size())) {
+                const int newCipher = wxsqlite3_config(d->access, "cipher", -1);
+                const int configuredIter = (newCipher > 0 && newCipher <= SQLCIPHER && kdfIterOption[newCipher]) ? *kdfIterOption[newCipher] : -1;
+                const int newKdfIter = _q_prepareKdf(d->access, newCipher, configuredIter, rawKey ? 0 : kdfTargetMs);
+                if (SQLITE_OK != sqlite3_rekey(d->access, key.toUtf8().constData(), key.size())) {
                     setLastError(qMakeError(d->access, tr("Cannot create password. Maybe it is encrypted?"), QSqlError::ConnectionError));
                     setOpenError(true);
                     setOpen(false);
                     sqlite3_close_v2(d->access);
                     return false;
                 }
+                if (recordKdf)
+                    _q_recordKdf(db, newCipher, newKdfIter);
                 break;
             }
             case UPDATE_KEY:
             {
                 // verify old password
                 CHECK_SQLITE_KEY;
+                // keep the detected cipher
+                if (autoCipher && cipher > 0)
+                    wxsqlite3_config(d->access, "cipher", cipher);
                 // set new password
                 if (newPassword.isEmpty() || newPassword.isNull()) {
-                    sqlite3_rekey(d->access, nullptr, 0);
+                    if (sqlite3_rekey(d->access, nullptr, 0) == SQLITE_OK && recordKdf)
+                        QFile::remove(_q_kdfRecordPath(db));
                 } else {
-                    sqlite3_rekey(d->access, newPassword.toUtf8().constData(), newPassword.size());
+                    const int newCipher = wxsqlite3_config(d->access, "cipher", -1);
+                    const int configuredIter = (newCipher > 0 && newCipher <= SQLCIPHER && kdfIterOption[newCipher]) ? *kdfIterOption[newCipher] : -1;
+                    const int newKdfIter = _q_prepareKdf(d->access, newCipher, configuredIter, rawKey ? 0 : kdfTargetMs);
+                    if (sqlite3_rekey(d->access, newPassword.toUtf8().constData(), newPassword.size()) == SQLITE_OK && recordKdf)
+                        _q_recordKdf(db, newCipher, newKdfIter);
                 }
                 break;
             }
@@ -1090,11 +1939,40 @@ bool SQLiteCipherDriver::open(const QString & db, const QString &, const QString
                 // verify old password
                 CHECK_SQLITE_KEY;
                 // set new password to null
-                sqlite3_rekey(d->access, nullptr, 0);
+                if (sqlite3_rekey(d->access, nullptr, 0) == SQLITE_OK && recordKdf)
+                    QFile::remove(_q_kdfRecordPath(db));
                 break;
             }
             }
         }
+        if (directIoCacheMb > 0) {
+            // The database file bypasses the OS page cache, give SQLite that memory instead.
+            // Needs the schema, so it runs after the key is set.
+            const QByteArray pragma = "PRAGMA cache_size=-" + QByteArray::number(directIoCacheMb * 1024);
+            sqlite3_exec(d->access, pragma.constData(), nullptr, nullptr, nullptr);
+        }
+        if (warmupPages != 0 && canRecordKdf) {
+            // With the key and the final cache size
+            d->warmupPath = _q_warmupPath(db);
+            _q_warmup(d->access, d->warmupPath, warmupPages);
+        }
+        if (checkpointThreshold > 0 || vacuumPages > 0) {
+            // After the key is set, the maintainer copies it
+            d->maintainer = SQLiteMaintainer::acquire(d->access, vfs, checkpointThreshold,
+                                                      checkpointCap > 0 ? checkpointCap : 4 * checkpointThreshold, vacuumPages);
+            if (d->maintainer) {
+                sqlite3_commit_hook(d->access, &SQLiteMaintainer::commitHook, d->maintainer);
+                if (checkpointThreshold > 0) {
+                    sqlite3_wal_hook(d->access, &SQLiteMaintainer::walHook, d->maintainer);
+                    sqlite3_create_function_v2(d->access, "checkpoint_stats", -1, SQLITE_UTF8, d->maintainer,
+                                               &_q_checkpoint_stats, nullptr, nullptr, nullptr);
+                }
+                if (vacuumPages > 0) {
+                    sqlite3_create_function_v2(d->access, "vacuum_stats", -1, SQLITE_UTF8, d->maintainer,
+                                               &_q_vacuum_stats, nullptr, nullptr, nullptr);
+                }
+            }
+        }
         return true;
     } else {
         if (d->access) {
@@ -1126,9 +2004,24 @@ void SQLiteCipherDriver::close()
             sqlite3_update_hook(d->access, nullptr, nullptr);
         }
 
+        if (!d->warmupPath.isEmpty()) {
+            _q_recordWarmup(d->access, d->warmupPath);
+            d->warmupPath.clear();
+        }
+
+        if (d->maintainer) {
+            sqlite3_commit_hook(d->access, nullptr, nullptr);
+            sqlite3_wal_hook(d->access, nullptr, nullptr);
+        }
+
         if (sqlite3_close(d->access) != SQLITE_OK)
             setLastError(qMakeError(d->access, tr("Error closing database"), QSqlError::ConnectionError));
         d->access = nullptr;
+
+        if (d->maintainer) {
+            d->maintainer->release();
+            d->maintainer = nullptr;
+        }
         setOpen(false);
         setOpenError(false);
     }
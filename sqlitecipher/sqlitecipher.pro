@@ -10,6 +10,9 @@ QT_FOR_CONFIG += sqldrivers-private
 
 CONFIG  += c++11 plugin
 
+# Build with ThreadSanitizer: qmake CONFIG+=tsan
+tsan: CONFIG += sanitizer sanitize_thread
+
 include($$PWD/sqlite3/sqlite3.pri)
 
 target.path = $$[QT_INSTALL_PLUGINS]/sqldrivers/
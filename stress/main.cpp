@@ -0,0 +1,458 @@
+#include <QtSql>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QVector>
+
+#include <random>
+
+#ifdef Q_OS_IOS
+#  include <QtPlugin>
+
+Q_IMPORT_PLUGIN(SqliteCipherDriverPlugin)
+#endif
+
+/*
+ * Contention stress test for the SQLITECIPHER driver and the codec.
+ *
+ * Every worker thread opens its own connection to a shared encrypted
+ * database and to a private one. It then runs a random mix of the
+ * following until --duration expires:
+ *
+ * - reads and writes on the shared database;
+ * - WAL checkpoints;
+ * - rekeys of its private database, followed by a reopen with the new key;
+ * - attaches of a third encrypted database;
+ * - update notifications.
+ *
+ * Rekeys and attaches allocate ciphers and draw salts from chacha20_rng()
+ * concurrently, and they change the per-connection codec parameter tables.
+ *
+ * Per-operation latency histograms and the lock-wait time recorded by the
+ * driver's busy handler (busy_wait_stats()) are printed at the end.
+ *
+ * The run fails on:
+ * - any error other than SQLITE_BUSY/SQLITE_LOCKED, in particular
+ *   corruption or MAC failures;
+ * - a thread that makes no progress for --stall seconds. A stalled thread
+ *   aborts the process so a core dump shows where it hangs.
+ *
+ * Build with "qmake CONFIG+=tsan" to run under ThreadSanitizer.
+ */
+
+enum Operation {
+    READ = 0,
+    WRITE,
+    CHECKPOINT,
+    REKEY,
+    ATTACH,
+    NOTIFY,
+    OPERATION_COUNT
+};
+
+static const char *operationNames[OPERATION_COUNT] = { "read", "write", "checkpoint", "rekey", "attach", "notify" };
+// Relative frequency of the operations
+static const int operationWeights[OPERATION_COUNT] = { 60, 25, 4, 2, 4, 5 };
+
+static const int rowCount = 10000;
+static const int bucketCount = 32;
+
+struct Options
+{
+    QString directory;
+    QString cipher;
+    QString journal;
+    int threads;
+    int duration;
+    int busyTimeout;
+    int stall;
+};
+
+struct Histogram
+{
+    // Bucket i counts latencies below 2^i microseconds
+    qint64 buckets[bucketCount] = {};
+    qint64 count = 0;
+    qint64 errors = 0;
+
+    void add(qint64 ns)
+    {
+        qint64 us = ns / 1000;
+        int i = 0;
+        while (i < bucketCount - 1 && us >= (Q_INT64_C(1) << i))
+            ++i;
+        ++buckets[i];
+        ++count;
+    }
+
+    void merge(const Histogram &other)
+    {
+        for (int i = 0; i < bucketCount; ++i)
+            buckets[i] += other.buckets[i];
+        count += other.count;
+        errors += other.errors;
+    }
+
+    // Upper bound of the bucket holding the given percentile, in microseconds
+    qint64 percentile(double p) const
+    {
+        qint64 rank = qint64(p * count);
+        for (int i = 0; i < bucketCount; ++i) {
+            rank -= buckets[i];
+            if (rank < 0)
+                return Q_INT64_C(1) << i;
+        }
+        return Q_INT64_C(1) << (bucketCount - 1);
+    }
+};
+
+static QString databasePath(const Options &options, const QString &name)
+{
+    return QDir(options.directory).absoluteFilePath(name + QStringLiteral(".db"));
+}
+
+static void configure(QSqlDatabase &db, const Options &options, const QString &path, const QString &key)
+{
+    db.setDatabaseName(path);
+    db.setPassword(key);
+    db.setConnectOptions(QStringLiteral("QSQLITE_USE_CIPHER=%1;QSQLITE_BUSY_TIMEOUT=%2")
+                         .arg(options.cipher).arg(options.busyTimeout));
+}
+
+static bool isBusy(const QSqlError &error)
+{
+    // SQLITE_BUSY and SQLITE_LOCKED, extended codes included
+    const int code = error.nativeErrorCode().toInt() & 0xff;
+    return code == 5 || code == 6;
+}
+
+class Worker : public QThread
+{
+public:
+    Worker(int index, const Options &options, const QElapsedTimer *clock)
+        : m_index(index), m_options(options), m_clock(clock), m_operation(-1), m_notifications(0)
+    {
+        m_progress.store(0);
+    }
+
+    const Histogram &histogram(int op) const { return m_histograms[op]; }
+    QStringList failures() const { return m_failures; }
+    QJsonObject busyStats() const { return m_busyStats; }
+    qint64 notifications() const { return m_notifications; }
+    int progress() const { return m_progress.load(); }
+    int operation() const { return m_operation.load(); }
+
+protected:
+    void run() override
+    {
+        const QString sharedName = QStringLiteral("stress_shared_%1").arg(m_index);
+        const QString privateName = QStringLiteral("stress_private_%1").arg(m_index);
+        {
+            QSqlDatabase shared = QSqlDatabase::addDatabase(QStringLiteral("SQLITECIPHER"), sharedName);
+            QSqlDatabase own = QSqlDatabase::addDatabase(QStringLiteral("SQLITECIPHER"), privateName);
+            configure(shared, m_options, databasePath(m_options, QStringLiteral("shared")), QStringLiteral("shared"));
+            configure(own, m_options, databasePath(m_options, QStringLiteral("private_%1").arg(m_index)), QStringLiteral("private"));
+            if (!shared.open() || !own.open()) {
+                m_failures << QStringLiteral("open: %1 %2").arg(shared.lastError().text(), own.lastError().text());
+            } else {
+                runStress(shared, own);
+                QSqlQuery query(shared);
+                if (query.exec(QStringLiteral("SELECT busy_wait_stats()")) && query.next())
+                    m_busyStats = QJsonDocument::fromJson(query.value(0).toByteArray()).object();
+            }
+            shared.close();
+            own.close();
+        }
+        QSqlDatabase::removeDatabase(sharedName);
+        QSqlDatabase::removeDatabase(privateName);
+    }
+
+private:
+    bool check(QSqlQuery &query, bool ok, int op)
+    {
+        if (ok)
+            return true;
+        if (isBusy(query.lastError())) {
+            ++m_histograms[op].errors;
+        } else {
+            m_failures << QStringLiteral("%1: %2").arg(QLatin1String(operationNames[op]), query.lastError().text());
+        }
+        return false;
+    }
+
+    bool execute(QSqlQuery &query, const QString &sql, int op)
+    {
+        return check(query, query.exec(sql), op);
+    }
+
+    bool runOperation(int op, QSqlDatabase &shared, QSqlDatabase &own, std::mt19937 &rng)
+    {
+        std::uniform_int_distribution<int> ids(1, rowCount);
+        QSqlQuery query(shared);
+        switch (op) {
+        case READ:
+            if (!execute(query, QStringLiteral("SELECT v FROM t WHERE id = %1").arg(ids(rng)), op))
+                return false;
+            while (query.next())
+                query.value(0);
+            return true;
+        case WRITE:
+            if (!execute(query, QStringLiteral("BEGIN IMMEDIATE"), op))
+                return false;
+            for (int i = 0; i < 10; ++i) {
+                if (!execute(query, QStringLiteral("UPDATE t SET v = randomblob(200) WHERE id = %1").arg(ids(rng)), op)) {
+                    query.exec(QStringLiteral("ROLLBACK"));
+                    return false;
+                }
+            }
+            if (!execute(query, QStringLiteral("COMMIT"), op)) {
+                query.exec(QStringLiteral("ROLLBACK"));
+                return false;
+            }
+            return true;
+        case CHECKPOINT:
+            return execute(query, QStringLiteral("PRAGMA wal_checkpoint(PASSIVE)"), op);
+        case REKEY:
+        {
+            // The cipher setting is used once per key operation, select it
+            // again so that the database keeps its cipher
+            const QString key = QStringLiteral("private%1").arg(++m_rekeys);
+            QSqlQuery ownQuery(own);
+            if (!execute(ownQuery, QStringLiteral("SELECT wxsqlite3_config('cipher', '%1')").arg(m_options.cipher), op)
+                || !execute(ownQuery, QStringLiteral("PRAGMA rekey='%1'").arg(key), op))
+                return false;
+            ownQuery.finish();
+            own.close();
+            own.setPassword(key);
+            if (!own.open()) {
+                m_failures << QStringLiteral("rekey: reopen failed: %1").arg(own.lastError().text());
+                return false;
+            }
+            QSqlQuery verify(own);
+            return execute(verify, QStringLiteral("SELECT count(*) FROM t"), op);
+        }
+        case ATTACH:
+            if (!execute(query, QStringLiteral("SELECT wxsqlite3_config('cipher', '%1')").arg(m_options.cipher), op)
+                || !execute(query, QStringLiteral("ATTACH DATABASE '%1' AS other KEY 'attached'")
+                                   .arg(databasePath(m_options, QStringLiteral("attached"))), op))
+                return false;
+            if (execute(query, QStringLiteral("SELECT sum(length(v)) FROM other.t WHERE id <= 100"), op))
+                query.next();
+            query.finish();
+            return execute(query, QStringLiteral("DETACH DATABASE other"), op);
+        case NOTIFY:
+            // Notifications are delivered through queued calls to the driver
+            QCoreApplication::processEvents();
+            return execute(query, QStringLiteral("INSERT INTO n(v) VALUES (%1)").arg(ids(rng)), op);
+        }
+        return false;
+    }
+
+    void runStress(QSqlDatabase &shared, QSqlDatabase &own)
+    {
+        QObject::connect(shared.driver(),
+                         static_cast<void (QSqlDriver::*)(const QString &, QSqlDriver::NotificationSource, const QVariant &)>(&QSqlDriver::notification),
+                         [this](const QString &, QSqlDriver::NotificationSource, const QVariant &) { ++m_notifications; });
+        shared.driver()->subscribeToNotification(QStringLiteral("n"));
+
+        std::mt19937 rng(m_index + 1);
+        std::discrete_distribution<int> operations(std::begin(operationWeights), std::end(operationWeights));
+        const qint64 end = qint64(m_options.duration) * 1000;
+        QElapsedTimer timer;
+        while (m_clock->elapsed() < end && m_failures.isEmpty()) {
+            const int op = operations(rng);
+            m_operation.store(op);
+            timer.start();
+            if (runOperation(op, shared, own, rng))
+                m_histograms[op].add(timer.nsecsElapsed());
+            m_operation.store(-1);
+            m_progress.store(int(m_clock->elapsed()));
+        }
+        QCoreApplication::processEvents();
+        shared.driver()->unsubscribeFromNotification(QStringLiteral("n"));
+    }
+
+    int m_index;
+    Options m_options;
+    const QElapsedTimer *m_clock;
+    Histogram m_histograms[OPERATION_COUNT];
+    QStringList m_failures;
+    QJsonObject m_busyStats;
+    QAtomicInt m_progress;
+    QAtomicInt m_operation;
+    qint64 m_notifications;
+    int m_rekeys = 0;
+};
+
+static bool createDatabase(const Options &options, const QString &name, const QString &key)
+{
+    bool ok = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("SQLITECIPHER"), QStringLiteral("stress_create"));
+        configure(db, options, databasePath(options, name), key);
+        if (db.open()) {
+            QSqlQuery query(db);
+            const QStringList queries = QStringList()
+                << QStringLiteral("PRAGMA journal_mode=%1").arg(options.journal)
+                << QStringLiteral("CREATE TABLE t(id INTEGER PRIMARY KEY, v BLOB)")
+                << QStringLiteral("CREATE TABLE n(id INTEGER PRIMARY KEY, v INTEGER)")
+                << QStringLiteral("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x<%1) "
+                                  "INSERT INTO t SELECT x, randomblob(200) FROM c").arg(rowCount);
+            ok = true;
+            foreach (const QString &sql, queries) {
+                if (!query.exec(sql)) {
+                    qWarning() << name << sql << query.lastError().text();
+                    ok = false;
+                    break;
+                }
+            }
+        } else {
+            qWarning() << name << db.lastError().text();
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(QStringLiteral("stress_create"));
+    return ok;
+}
+
+static bool checkIntegrity(const Options &options, const QString &name, const QString &key)
+{
+    bool ok = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("SQLITECIPHER"), QStringLiteral("stress_check"));
+        configure(db, options, databasePath(options, name), key);
+        if (db.open()) {
+            QSqlQuery query(db);
+            ok = query.exec(QStringLiteral("PRAGMA integrity_check")) && query.next()
+                 && query.value(0).toString() == QLatin1String("ok");
+            if (!ok)
+                qWarning() << name << "integrity check failed:" << query.value(0).toString() << query.lastError().text();
+        } else {
+            qWarning() << name << db.lastError().text();
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(QStringLiteral("stress_check"));
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("stress"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Contention stress test for the SQLITECIPHER driver"));
+    parser.addHelpOption();
+    const QCommandLineOption threadsOption(QStringLiteral("threads"), QStringLiteral("Number of worker threads."), QStringLiteral("n"), QString::number(QThread::idealThreadCount() * 2));
+    const QCommandLineOption durationOption(QStringLiteral("duration"), QStringLiteral("Run time."), QStringLiteral("seconds"), QStringLiteral("30"));
+    const QCommandLineOption cipherOption(QStringLiteral("cipher"), QStringLiteral("Cipher: aes128cbc, aes256cbc, chacha20 or sqlcipher."), QStringLiteral("name"), QStringLiteral("chacha20"));
+    const QCommandLineOption journalOption(QStringLiteral("journal"), QStringLiteral("Journal mode: wal or delete."), QStringLiteral("mode"), QStringLiteral("wal"));
+    const QCommandLineOption busyOption(QStringLiteral("busy-timeout"), QStringLiteral("Busy timeout per connection."), QStringLiteral("ms"), QStringLiteral("5000"));
+    const QCommandLineOption stallOption(QStringLiteral("stall"), QStringLiteral("Abort when a thread makes no progress for this long."), QStringLiteral("seconds"), QStringLiteral("60"));
+    const QCommandLineOption directoryOption(QStringLiteral("directory"), QStringLiteral("Directory for the databases, a temporary one by default."), QStringLiteral("path"));
+    parser.addOptions({ threadsOption, durationOption, cipherOption, journalOption, busyOption, stallOption, directoryOption });
+    parser.process(app);
+
+    QTemporaryDir tmpDir;
+    Options options;
+    options.directory = parser.isSet(directoryOption) ? parser.value(directoryOption) : tmpDir.path();
+    options.cipher = parser.value(cipherOption).toLower();
+    options.journal = parser.value(journalOption).toLower();
+    options.threads = qMax(1, parser.value(threadsOption).toInt());
+    options.duration = qMax(1, parser.value(durationOption).toInt());
+    options.busyTimeout = qMax(0, parser.value(busyOption).toInt());
+    options.stall = qMax(1, parser.value(stallOption).toInt());
+
+    if (!QSqlDatabase::isDriverAvailable(QStringLiteral("SQLITECIPHER"))) {
+        qWarning() << "SQLITECIPHER driver not found.";
+        return 1;
+    }
+    bool ok = createDatabase(options, QStringLiteral("shared"), QStringLiteral("shared"))
+              && createDatabase(options, QStringLiteral("attached"), QStringLiteral("attached"));
+    for (int i = 0; ok && i < options.threads; ++i)
+        ok = createDatabase(options, QStringLiteral("private_%1").arg(i), QStringLiteral("private"));
+    if (!ok)
+        return 1;
+
+    QElapsedTimer clock;
+    QVector<Worker *> workers;
+    clock.start();
+    for (int i = 0; i < options.threads; ++i) {
+        workers.append(new Worker(i, options, &clock));
+        workers.last()->start();
+    }
+
+    // Watchdog: a worker that stops making progress is stuck on a lock
+    bool running = true;
+    while (running) {
+        running = false;
+        foreach (Worker *worker, workers) {
+            if (worker->wait(200))
+                continue;
+            running = true;
+            const qint64 idle = clock.elapsed() - worker->progress();
+            if (worker->operation() >= 0 && idle > qint64(options.stall) * 1000) {
+                qFatal("Deadlock: a worker has been stuck in '%s' for %lld s",
+                       operationNames[worker->operation()], (long long)(idle / 1000));
+            }
+        }
+    }
+    const double seconds = clock.elapsed() / 1000.0;
+
+    Histogram totals[OPERATION_COUNT];
+    QStringList failures;
+    qint64 waits = 0, waitUs = 0, timeouts = 0, notifications = 0;
+    foreach (Worker *worker, workers) {
+        for (int op = 0; op < OPERATION_COUNT; ++op)
+            totals[op].merge(worker->histogram(op));
+        failures += worker->failures();
+        waits += qint64(worker->busyStats().value(QStringLiteral("waits")).toDouble());
+        waitUs += qint64(worker->busyStats().value(QStringLiteral("wait_us")).toDouble());
+        timeouts += qint64(worker->busyStats().value(QStringLiteral("timeouts")).toDouble());
+        notifications += worker->notifications();
+    }
+    qDeleteAll(workers);
+
+    QTextStream out(stdout);
+    qint64 operations = 0;
+    out << QStringLiteral("%1 threads, %2 s, cipher %3, journal %4\n")
+           .arg(options.threads).arg(seconds, 0, 'f', 1).arg(options.cipher, options.journal);
+    out << QStringLiteral("%1 %2 %3 %4 %5 %6\n").arg(QStringLiteral("operation"), -12).arg(QStringLiteral("count"), 10)
+           .arg(QStringLiteral("busy"), 8).arg(QStringLiteral("p50 us"), 10).arg(QStringLiteral("p99 us"), 10).arg(QStringLiteral("max us"), 10);
+    for (int op = 0; op < OPERATION_COUNT; ++op) {
+        const Histogram &h = totals[op];
+        operations += h.count;
+        out << QStringLiteral("%1 %2 %3 %4 %5 %6\n").arg(QString::fromLatin1(operationNames[op]), -12).arg(h.count, 10)
+               .arg(h.errors, 8).arg(h.percentile(0.50), 10).arg(h.percentile(0.99), 10).arg(h.percentile(1.0), 10);
+    }
+    out << QStringLiteral("throughput: %1 ops/s\n").arg(operations / seconds, 0, 'f', 0);
+    out << QStringLiteral("lock waits: %1, %2 ms waiting, %3 busy timeouts\n").arg(waits).arg(waitUs / 1000).arg(timeouts);
+    out << QStringLiteral("notifications received: %1\n").arg(notifications);
+    out << QStringLiteral("\nlatency histogram (operations below the bound)\n");
+    for (int i = 0; i < bucketCount; ++i) {
+        qint64 row = 0;
+        for (int op = 0; op < OPERATION_COUNT; ++op)
+            row += totals[op].buckets[i];
+        if (row == 0)
+            continue;
+        out << QStringLiteral("< %1 us").arg(Q_INT64_C(1) << i, 10);
+        for (int op = 0; op < OPERATION_COUNT; ++op)
+            out << QStringLiteral(" %1=%2").arg(QLatin1String(operationNames[op])).arg(totals[op].buckets[i]);
+        out << "\n";
+    }
+    out.flush();
+
+    ok = checkIntegrity(options, QStringLiteral("shared"), QStringLiteral("shared"))
+         && checkIntegrity(options, QStringLiteral("attached"), QStringLiteral("attached"));
+    if (!failures.isEmpty()) {
+        foreach (const QString &failure, failures)
+            qWarning().noquote() << "FAILED:" << failure;
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
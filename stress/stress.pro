@@ -0,0 +1,22 @@
+QT       += core sql
+
+QT       -= gui
+
+TARGET    = stress
+CONFIG   += console c++11
+CONFIG   -= app_bundle
+
+# Build with ThreadSanitizer: qmake CONFIG+=tsan
+tsan: CONFIG += sanitizer sanitize_thread
+
+TEMPLATE = app
+
+ios {
+    CONFIG(debug, debug|release) {
+        LIBS += -lsqlitecipher_debug
+    } else {
+        LIBS += -lsqlitecipher
+    }
+}
+
+SOURCES += main.cpp
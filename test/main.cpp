@@ -3,6 +3,8 @@
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlError>
+#include <QJsonDocument>
+#include <QJsonObject>
 
 #ifdef Q_OS_IOS
 #  include <QtPlugin>
@@ -32,6 +34,17 @@ private slots:
     void createDbWithPassphrase();
     void refuseToReadWithoutPassphrase();
     void allowToReadWithPassphrase();
+    void checkCipherConformance_data();
+    void checkCipherConformance();
+    void detectCipher_data();
+    void detectCipher();
+    void refusePasswordOnPlaintext();
+    void openWithRawKey_data();
+    void openWithRawKey();
+    void refuseInvalidRawKey_data();
+    void refuseInvalidRawKey();
+    void sharedPagesFollowFile();
+    void checkpointAfterUpdateKey();
     void cleanupTestCase()
     {
         QSqlDatabase::removeDatabase("db");
@@ -89,5 +102,261 @@ void TestSqliteCipher::allowToReadWithPassphrase()
     QVERIFY(q.value(0).toInt() == 42);
 }
 
+void TestSqliteCipher::checkCipherConformance_data()
+{
+    QTest::addColumn<QString>("cipher");
+    QTest::newRow("aes128cbc") << QString("aes128cbc");
+    QTest::newRow("aes256cbc") << QString("aes256cbc");
+    QTest::newRow("chacha20") << QString("chacha20");
+    QTest::newRow("sqlcipher") << QString("sqlcipher");
+}
+
+void TestSqliteCipher::checkCipherConformance()
+{
+    QFETCH(QString, cipher);
+    QSqlQuery q(QSqlDatabase::database("db"));
+    QVERIFY2(q.exec(QString("SELECT wxsqlite3_cipher_check('%1')").arg(cipher)), q.lastError().text().toLatin1().constData());
+    QVERIFY(q.next());
+    QCOMPARE(q.value(0).toString(), QString("ok"));
+}
+
+void TestSqliteCipher::detectCipher_data()
+{
+    QTest::addColumn<QString>("cipher");
+    QTest::addColumn<bool>("legacy");
+    const QStringList ciphers = QStringList() << "aes128cbc" << "aes256cbc" << "chacha20" << "sqlcipher";
+    for(const QString& cipher : ciphers)
+    {
+        QTest::newRow(cipher.toLatin1().constData()) << cipher << false;
+        QTest::newRow((cipher + "-legacy").toLatin1().constData()) << cipher << true;
+    }
+}
+
+void TestSqliteCipher::detectCipher()
+{
+    QFETCH(QString, cipher);
+    QFETCH(bool, legacy);
+    const QString dbname = QDir(tmpDir.path()).absoluteFilePath(QString("detect-%1-%2.db").arg(cipher).arg(legacy));
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("SQLITECIPHER", "detect");
+        db.setDatabaseName(dbname);
+        db.setPassword("foobar");
+        db.setConnectOptions(QString("QSQLITE_USE_CIPHER=%1;%2QSQLITE_CREATE_KEY")
+                             .arg(cipher, legacy ? QString("%1_LEGACY=1;").arg(cipher.toUpper()) : QString()));
+        QVERIFY2(db.open(), db.lastError().text().toLatin1().constData());
+        QSqlQuery q(db);
+        QVERIFY2(q.exec("create table foo(bar integer)"), q.lastError().text().toLatin1().constData());
+        QVERIFY2(q.exec("insert into foo values (42)"), q.lastError().text().toLatin1().constData());
+        db.close();
+
+        db.setConnectOptions("QSQLITE_USE_CIPHER=auto");
+        QVERIFY2(db.open(), db.lastError().text().toLatin1().constData());
+        QSqlQuery r(db);
+        QVERIFY2(r.exec("select bar from foo"), r.lastError().text().toLatin1().constData());
+        QVERIFY(r.next());
+        QCOMPARE(r.value(0).toInt(), 42);
+        db.close();
+
+        db.setPassword("barfoo");
+        QVERIFY(!db.open());
+    }
+    QSqlDatabase::removeDatabase("detect");
+}
+
+void TestSqliteCipher::refusePasswordOnPlaintext()
+{
+    const QString dbname = QDir(tmpDir.path()).absoluteFilePath("plaintext.db");
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("SQLITECIPHER", "plaintext");
+        db.setDatabaseName(dbname);
+        QVERIFY2(db.open(), db.lastError().text().toLatin1().constData());
+        QSqlQuery q(db);
+        QVERIFY2(q.exec("create table foo(bar integer)"), q.lastError().text().toLatin1().constData());
+        db.close();
+
+        // Detection finds no cipher, the file must not be opened unencrypted
+        db.setPassword("foobar");
+        db.setConnectOptions("QSQLITE_USE_CIPHER=auto");
+        QVERIFY(!db.open());
+        QVERIFY(!db.isOpen());
+    }
+    QSqlDatabase::removeDatabase("plaintext");
+}
+
+static QString rawKeyOfSize(int digits)
+{
+    return QString("0123456789abcdef").repeated(digits / 16 + 1).left(digits);
+}
+
+void TestSqliteCipher::openWithRawKey_data()
+{
+    QTest::addColumn<QString>("cipher");
+    QTest::addColumn<QString>("mode");
+    QTest::addColumn<int>("digits");
+    const QStringList modes = QStringList() << "1" << "hkdf";
+    for(const QString& mode : modes)
+    {
+        QTest::newRow(("aes128cbc-" + mode).toLatin1().constData()) << QString("aes128cbc") << mode << 32;
+        QTest::newRow(("aes256cbc-" + mode).toLatin1().constData()) << QString("aes256cbc") << mode << 64;
+        QTest::newRow(("chacha20-" + mode).toLatin1().constData()) << QString("chacha20") << mode << 64;
+        QTest::newRow(("sqlcipher-" + mode).toLatin1().constData()) << QString("sqlcipher") << mode << 64;
+    }
+}
+
+void TestSqliteCipher::openWithRawKey()
+{
+    QFETCH(QString, cipher);
+    QFETCH(QString, mode);
+    QFETCH(int, digits);
+    const QString dbname = QDir(tmpDir.path()).absoluteFilePath(QString("raw-%1-%2.db").arg(cipher, mode));
+    const QString options = QString("QSQLITE_USE_CIPHER=%1;QSQLITE_RAW_KEY=%2").arg(cipher, mode);
+    const QString key = rawKeyOfSize(digits);
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("SQLITECIPHER", "raw");
+        db.setDatabaseName(dbname);
+        db.setPassword(key);
+        db.setConnectOptions(options + ";QSQLITE_CREATE_KEY");
+        QVERIFY2(db.open(), db.lastError().text().toLatin1().constData());
+        QSqlQuery q(db);
+        QVERIFY2(q.exec("create table foo(bar integer)"), q.lastError().text().toLatin1().constData());
+        QVERIFY2(q.exec("insert into foo values (42)"), q.lastError().text().toLatin1().constData());
+        db.close();
+
+        // The key is also taken in the x'<hex>' form
+        db.setPassword(QString("x'%1'").arg(key.toUpper()));
+        db.setConnectOptions(options);
+        QVERIFY2(db.open(), db.lastError().text().toLatin1().constData());
+        QSqlQuery r(db);
+        QVERIFY2(r.exec("select bar from foo"), r.lastError().text().toLatin1().constData());
+        QVERIFY(r.next());
+        QCOMPARE(r.value(0).toInt(), 42);
+        db.close();
+
+        db.setPassword(rawKeyOfSize(digits + 1).right(digits));
+        QVERIFY(!db.open());
+    }
+    QSqlDatabase::removeDatabase("raw");
+}
+
+void TestSqliteCipher::refuseInvalidRawKey_data()
+{
+    QTest::addColumn<QString>("cipher");
+    QTest::addColumn<QString>("key");
+    const QStringList ciphers = QStringList() << "aes128cbc" << "aes256cbc" << "chacha20" << "sqlcipher";
+    for(const QString& cipher : ciphers)
+    {
+        const int digits = cipher == "aes128cbc" ? 32 : 64;
+        QTest::newRow((cipher + "-short").toLatin1().constData()) << cipher << rawKeyOfSize(digits - 2);
+        QTest::newRow((cipher + "-long").toLatin1().constData()) << cipher << rawKeyOfSize(digits + 2);
+        QTest::newRow((cipher + "-nothex").toLatin1().constData()) << cipher << rawKeyOfSize(digits - 1) + "g";
+    }
+}
+
+void TestSqliteCipher::refuseInvalidRawKey()
+{
+    QFETCH(QString, cipher);
+    QFETCH(QString, key);
+    const QString dbname = QDir(tmpDir.path()).absoluteFilePath(QString("raw-invalid-%1.db").arg(cipher));
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("SQLITECIPHER", "raw-invalid");
+        db.setDatabaseName(dbname);
+        db.setPassword(key);
+        db.setConnectOptions(QString("QSQLITE_USE_CIPHER=%1;QSQLITE_RAW_KEY=1;QSQLITE_CREATE_KEY").arg(cipher));
+        QVERIFY(!db.open());
+        QVERIFY2(db.lastError().databaseText().startsWith("Raw keys must be hex encoded"), db.lastError().text().toLatin1().constData());
+        // Refused before the file is opened
+        QVERIFY(!QFile::exists(dbname));
+    }
+    QSqlDatabase::removeDatabase("raw-invalid");
+}
+
+void TestSqliteCipher::sharedPagesFollowFile()
+{
+    const QString dbname = QDir(tmpDir.path()).absoluteFilePath("shared.db");
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("SQLITECIPHER", "shared");
+        db.setDatabaseName(dbname);
+        db.setPassword("foobar");
+        // The file is created again under the same name and key, AES encrypts
+        // page 1 of both files to the same bytes
+        for(int value : {111, 222})
+        {
+            QFile::remove(dbname);
+            db.setConnectOptions("QSQLITE_USE_CIPHER=aes256cbc;QSQLITE_SHARED_PAGES=8;QSQLITE_CREATE_KEY");
+            QVERIFY2(db.open(), db.lastError().text().toLatin1().constData());
+            QSqlQuery q(db);
+            QVERIFY2(q.exec("create table foo(bar integer)"), q.lastError().text().toLatin1().constData());
+            QVERIFY2(q.exec(QString("insert into foo values (%1)").arg(value)), q.lastError().text().toLatin1().constData());
+            db.close();
+
+            db.setConnectOptions("QSQLITE_USE_CIPHER=aes256cbc;QSQLITE_SHARED_PAGES=8");
+            QVERIFY2(db.open(), db.lastError().text().toLatin1().constData());
+            QSqlQuery r(db);
+            QVERIFY2(r.exec("select bar from foo"), r.lastError().text().toLatin1().constData());
+            QVERIFY(r.next());
+            QCOMPARE(r.value(0).toInt(), value);
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase("shared");
+}
+
+void TestSqliteCipher::checkpointAfterUpdateKey()
+{
+    const QString dbname = QDir(tmpDir.path()).absoluteFilePath("checkpoint.db");
+    {
+        // Starts the background checkpoints with the old key
+        QSqlDatabase db = QSqlDatabase::addDatabase("SQLITECIPHER", "checkpoint-old");
+        db.setDatabaseName(dbname);
+        db.setPassword("foobar");
+        db.setConnectOptions("QSQLITE_USE_CIPHER=aes256cbc;QSQLITE_CREATE_KEY;QSQLITE_BACKGROUND_CHECKPOINT=10");
+        QVERIFY2(db.open(), db.lastError().text().toLatin1().constData());
+        QSqlQuery q(db);
+        QVERIFY2(q.exec("PRAGMA journal_mode=WAL"), q.lastError().text().toLatin1().constData());
+        QVERIFY2(q.exec("create table foo(bar blob)"), q.lastError().text().toLatin1().constData());
+
+        QSqlDatabase rekeyed = QSqlDatabase::addDatabase("SQLITECIPHER", "checkpoint-new");
+        rekeyed.setDatabaseName(dbname);
+        rekeyed.setPassword("foobar");
+        rekeyed.setConnectOptions("QSQLITE_USE_CIPHER=aes256cbc;QSQLITE_UPDATE_KEY=newpass;QSQLITE_BACKGROUND_CHECKPOINT=10");
+        QVERIFY2(rekeyed.open(), rekeyed.lastError().text().toLatin1().constData());
+        db.close();
+
+        // The checkpoints fail until the connection of the checkpoint thread
+        // is opened again with the new key
+        QSqlQuery r(rekeyed);
+        QVERIFY2(r.exec("select checkpoint_stats(1)"), r.lastError().text().toLatin1().constData());
+        int rows = 0;
+        auto checkpointed = [&]() {
+            for(int i = 0; i < 20; ++i)
+            {
+                if(r.exec("insert into foo values (randomblob(1000))"))
+                    ++rows;
+            }
+            QTest::qWait(50);
+            if(!r.exec("select checkpoint_stats()") || !r.next())
+                return false;
+            const QJsonObject stats = QJsonDocument::fromJson(r.value(0).toByteArray()).object();
+            return stats["checkpoints"].toInt() > stats["busy"].toInt() + stats["errors"].toInt();
+        };
+        QTRY_VERIFY_WITH_TIMEOUT(checkpointed(), 10000);
+        rekeyed.close();
+
+        rekeyed.setConnectOptions("QSQLITE_USE_CIPHER=aes256cbc");
+        rekeyed.setPassword("newpass");
+        QVERIFY2(rekeyed.open(), rekeyed.lastError().text().toLatin1().constData());
+        QSqlQuery c(rekeyed);
+        QVERIFY2(c.exec("PRAGMA integrity_check"), c.lastError().text().toLatin1().constData());
+        QVERIFY(c.next());
+        QCOMPARE(c.value(0).toString(), QString("ok"));
+        QVERIFY2(c.exec("select count(*) from foo"), c.lastError().text().toLatin1().constData());
+        QVERIFY(c.next());
+        QCOMPARE(c.value(0).toInt(), rows);
+        rekeyed.close();
+    }
+    QSqlDatabase::removeDatabase("checkpoint-old");
+    QSqlDatabase::removeDatabase("checkpoint-new");
+}
+
 QTEST_GUILESS_MAIN(TestSqliteCipher)
 #include "main.moc"
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Compare two workload results and flag regressions.
+
+Usage: compare.py BASELINE.json CURRENT.json [--throughput PCT] [--latency PCT]
+
+A regression is a throughput drop of more than --throughput percent (default
+5) or a latency percentile increase of more than --latency percent (default
+10), for the total or for any operation. The exit code is 1 when at least one
+regression is found, 2 when the two runs used different configurations.
+"""
+
+import argparse
+import json
+import sys
+
+PERCENTILES = ("p50", "p95", "p99", "p999")
+
+
+def load(path):
+    with open(path) as f:
+        return json.load(f)
+
+
+def change(old, new):
+    if old == 0:
+        return 0.0
+    return (new - old) * 100.0 / old
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--throughput", type=float, default=5.0,
+                        help="allowed throughput drop in percent")
+    parser.add_argument("--latency", type=float, default=10.0,
+                        help="allowed latency increase in percent")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+
+    if baseline.get("config") != current.get("config"):
+        print("Configurations differ, results are not comparable:")
+        for key in sorted(set(baseline.get("config", {})) | set(current.get("config", {}))):
+            old = baseline.get("config", {}).get(key)
+            new = current.get("config", {}).get(key)
+            if old != new:
+                print("  %s: %s -> %s" % (key, old, new))
+        return 2
+
+    groups = [("total", baseline["total"], current["total"])]
+    for name in sorted(baseline.get("operations", {})):
+        if name in current.get("operations", {}):
+            groups.append((name, baseline["operations"][name], current["operations"][name]))
+
+    regressions = 0
+    print("%-8s %-10s %14s %14s %9s" % ("op", "metric", "baseline", "current", "change"))
+    for name, old, new in groups:
+        delta = change(old["throughput"], new["throughput"])
+        flag = ""
+        if -delta > args.throughput:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-8s %-10s %14.1f %14.1f %+8.1f%%%s" % (name, "ops/s", old["throughput"], new["throughput"], delta, flag))
+        for p in PERCENTILES:
+            if p not in old or p not in new:
+                continue
+            delta = change(old[p], new[p])
+            flag = ""
+            if delta > args.latency:
+                flag = "  REGRESSION"
+                regressions += 1
+            print("%-8s %-10s %14.1f %14.1f %+8.1f%%%s" % (name, p + " us", old[p], new[p], delta, flag))
+
+    errors = current.get("errors", 0)
+    if errors > baseline.get("errors", 0):
+        print("errors: %d -> %d  REGRESSION" % (baseline.get("errors", 0), errors))
+        regressions += 1
+
+    print("%d regression(s) found" % regressions)
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
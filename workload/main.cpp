@@ -0,0 +1,471 @@
+#include <QtSql>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QScopedPointer>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#ifdef Q_OS_IOS
+#  include <QtPlugin>
+
+Q_IMPORT_PLUGIN(SqliteCipherDriverPlugin)
+#endif
+
+/*
+ * YCSB-style workload generator for the SQLITECIPHER driver.
+ *
+ * A table of --records rows is loaded once. Then --threads workers, each
+ * with its own connection, run a mix of point reads, updates, inserts and
+ * short scans for --duration seconds. Keys follow a uniform or (scrambled)
+ * zipfian distribution. The result is written as JSON: throughput and the
+ * p50/p95/p99/p999 latencies per operation. Compare two results with
+ * compare.py to catch regressions.
+ */
+
+enum Operation {
+    READ = 0,
+    UPDATE,
+    INSERT,
+    SCAN,
+    OPERATION_COUNT
+};
+
+static const char *operationNames[OPERATION_COUNT] = { "read", "update", "insert", "scan" };
+
+struct Options
+{
+    QString database;
+    QString cipher;
+    QString key;
+    QString journal;
+    QString synchronous;
+    QString distribution;
+    qint64 records;
+    int payload;
+    int pageSize;
+    int cacheSize;
+    int threads;
+    int duration;
+    int warmup;
+    int scanLength;
+    double theta;
+    double mix[OPERATION_COUNT];
+    quint64 seed;
+};
+
+/*
+ * Zipfian generator of Gray et al., "Quickly generating billion-record
+ * synthetic databases", as used by YCSB. Produces ranks in [0, items).
+ */
+class ZipfianGenerator
+{
+public:
+    ZipfianGenerator(qint64 items, double theta)
+        : m_items(items), m_theta(theta)
+    {
+        const double zeta2 = zeta(2, theta);
+        m_zetan = zeta(items, theta);
+        m_alpha = 1.0 / (1.0 - theta);
+        m_eta = (1.0 - std::pow(2.0 / items, 1.0 - theta)) / (1.0 - zeta2 / m_zetan);
+    }
+
+    qint64 next(double u) const
+    {
+        const double uz = u * m_zetan;
+        if (uz < 1.0)
+            return 0;
+        if (uz < 1.0 + std::pow(0.5, m_theta))
+            return 1;
+        const qint64 rank = qint64(m_items * std::pow(m_eta * u - m_eta + 1.0, m_alpha));
+        return std::min(rank, m_items - 1);
+    }
+
+private:
+    static double zeta(qint64 n, double theta)
+    {
+        double sum = 0.0;
+        for (qint64 i = 1; i <= n; ++i)
+            sum += 1.0 / std::pow(double(i), theta);
+        return sum;
+    }
+
+    qint64 m_items;
+    double m_theta;
+    double m_zetan;
+    double m_alpha;
+    double m_eta;
+};
+
+// Spread the popular ranks over the key space, like YCSB's scrambled zipfian
+static qint64 scramble(qint64 rank, qint64 items)
+{
+    quint64 hash = 14695981039346656037ULL;
+    for (int i = 0; i < 8; ++i) {
+        hash ^= (quint64(rank) >> (i * 8)) & 0xff;
+        hash *= 1099511628211ULL;
+    }
+    return qint64(hash % quint64(items));
+}
+
+static void configure(QSqlDatabase &db, const Options &options)
+{
+    db.setDatabaseName(options.database);
+    QString connectOptions = QStringLiteral("QSQLITE_BUSY_TIMEOUT=10000");
+    if (options.cipher != QLatin1String("none")) {
+        db.setPassword(options.key);
+        connectOptions += QStringLiteral(";QSQLITE_USE_CIPHER=") + options.cipher;
+    }
+    db.setConnectOptions(connectOptions);
+}
+
+static bool execAll(QSqlDatabase &db, const QStringList &queries)
+{
+    QSqlQuery query(db);
+    foreach (const QString &sql, queries) {
+        if (!query.exec(sql)) {
+            qWarning() << sql << ":" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+static QStringList connectionPragmas(const Options &options)
+{
+    return QStringList()
+        << QStringLiteral("PRAGMA cache_size=-%1").arg(options.cacheSize)
+        << QStringLiteral("PRAGMA synchronous=%1").arg(options.synchronous);
+}
+
+class Worker : public QThread
+{
+public:
+    Worker(int index, const Options &options, const ZipfianGenerator *zipfian,
+           QAtomicInt *inserted, const QElapsedTimer *clock)
+        : m_index(index), m_options(options), m_zipfian(zipfian),
+          m_inserted(inserted), m_clock(clock), m_errors(0)
+    {
+    }
+
+    const QVector<qint64> &latencies(int op) const { return m_latencies[op]; }
+    qint64 errors() const { return m_errors; }
+    QString failure() const { return m_failure; }
+
+protected:
+    void run() override
+    {
+        const QString name = QStringLiteral("workload_%1").arg(m_index);
+        {
+            QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("SQLITECIPHER"), name);
+            configure(db, m_options);
+            if (!db.open()) {
+                m_failure = db.lastError().text();
+            } else if (execAll(db, connectionPragmas(m_options))) {
+                runWorkload(db);
+            }
+            db.close();
+        }
+        QSqlDatabase::removeDatabase(name);
+    }
+
+private:
+    qint64 nextKey(std::mt19937_64 &rng)
+    {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        const qint64 items = m_options.records;
+        if (m_zipfian)
+            return scramble(m_zipfian->next(uniform(rng)), items) + 1;
+        return qint64(uniform(rng) * items) % items + 1;
+    }
+
+    void runWorkload(QSqlDatabase &db)
+    {
+        QSqlQuery queries[OPERATION_COUNT] = { QSqlQuery(db), QSqlQuery(db), QSqlQuery(db), QSqlQuery(db) };
+        queries[READ].prepare(QStringLiteral("SELECT v FROM usertable WHERE id = ?"));
+        queries[UPDATE].prepare(QStringLiteral("UPDATE usertable SET v = ? WHERE id = ?"));
+        queries[INSERT].prepare(QStringLiteral("INSERT INTO usertable(id, v) VALUES (?, ?)"));
+        queries[SCAN].prepare(QStringLiteral("SELECT id, v FROM usertable WHERE id >= ? ORDER BY id LIMIT ?"));
+
+        std::mt19937_64 rng(m_options.seed + quint64(m_index));
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        const QByteArray payload(m_options.payload, 'w');
+        const qint64 warmupEnd = qint64(m_options.warmup) * 1000;
+        const qint64 end = warmupEnd + qint64(m_options.duration) * 1000;
+
+        QElapsedTimer timer;
+        while (m_clock->elapsed() < end) {
+            int op = 0;
+            double choice = uniform(rng);
+            while (op < OPERATION_COUNT - 1 && choice >= m_options.mix[op]) {
+                choice -= m_options.mix[op];
+                ++op;
+            }
+
+            QSqlQuery &query = queries[op];
+            switch (op) {
+            case READ:
+                query.bindValue(0, nextKey(rng));
+                break;
+            case UPDATE:
+                query.bindValue(0, payload);
+                query.bindValue(1, nextKey(rng));
+                break;
+            case INSERT:
+                query.bindValue(0, m_options.records + m_inserted->fetchAndAddRelaxed(1) + 1);
+                query.bindValue(1, payload);
+                break;
+            case SCAN:
+                query.bindValue(0, nextKey(rng));
+                query.bindValue(1, m_options.scanLength);
+                break;
+            }
+
+            timer.start();
+            bool ok = query.exec();
+            while (ok && query.next()) {
+                query.value(0);
+            }
+            const qint64 elapsed = timer.nsecsElapsed();
+            query.finish();
+
+            if (m_clock->elapsed() < warmupEnd)
+                continue;
+            if (ok) {
+                m_latencies[op].append(elapsed);
+            } else {
+                ++m_errors;
+            }
+        }
+    }
+
+    int m_index;
+    Options m_options;
+    const ZipfianGenerator *m_zipfian;
+    QAtomicInt *m_inserted;
+    const QElapsedTimer *m_clock;
+    QVector<qint64> m_latencies[OPERATION_COUNT];
+    qint64 m_errors;
+    QString m_failure;
+};
+
+static bool loadDatabase(const Options &options)
+{
+    bool ok = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("SQLITECIPHER"), QStringLiteral("workload_load"));
+        configure(db, options);
+        if (!db.open()) {
+            qWarning() << "Can not open database:" << db.lastError().text();
+        } else {
+            QSqlQuery query(db);
+            query.exec(QStringLiteral("SELECT count(*) FROM usertable"));
+            const qint64 existing = query.next() ? query.value(0).toLongLong() : -1;
+            query.finish();
+            if (existing >= 0 && existing != options.records) {
+                qWarning() << "Database holds" << existing << "records instead of" << options.records
+                           << "- remove it or change --records";
+            } else if (existing < 0) {
+                ok = execAll(db, QStringList()
+                    << QStringLiteral("PRAGMA page_size=%1").arg(options.pageSize)
+                    << QStringLiteral("PRAGMA journal_mode=%1").arg(options.journal)
+                    << QStringLiteral("CREATE TABLE usertable(id INTEGER PRIMARY KEY, v BLOB)")
+                    << QStringLiteral("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x<%1) "
+                                      "INSERT INTO usertable SELECT x, randomblob(%2) FROM c")
+                       .arg(options.records).arg(options.payload));
+            } else {
+                // Drop the rows inserted by the previous run
+                ok = execAll(db, QStringList()
+                    << QStringLiteral("PRAGMA journal_mode=%1").arg(options.journal)
+                    << QStringLiteral("DELETE FROM usertable WHERE id > %1").arg(options.records));
+            }
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(QStringLiteral("workload_load"));
+    return ok;
+}
+
+static QJsonObject latencyStats(QVector<qint64> latencies, double seconds)
+{
+    QJsonObject stats;
+    std::sort(latencies.begin(), latencies.end());
+    const int n = latencies.size();
+    stats.insert(QStringLiteral("count"), double(n));
+    stats.insert(QStringLiteral("throughput"), seconds > 0 ? n / seconds : 0.0);
+    if (n == 0)
+        return stats;
+
+    // Nearest-rank percentiles, in microseconds
+    const double percentiles[] = { 0.50, 0.95, 0.99, 0.999 };
+    const char *names[] = { "p50", "p95", "p99", "p999" };
+    for (int i = 0; i < 4; ++i) {
+        int rank = int(std::ceil(percentiles[i] * n)) - 1;
+        rank = qBound(0, rank, n - 1);
+        stats.insert(QLatin1String(names[i]), latencies.at(rank) / 1000.0);
+    }
+    stats.insert(QStringLiteral("max"), latencies.last() / 1000.0);
+    return stats;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("workload"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Workload generator for the SQLITECIPHER driver"));
+    parser.addHelpOption();
+    const QCommandLineOption databaseOption(QStringLiteral("database"), QStringLiteral("Database file."), QStringLiteral("file"), QStringLiteral("workload.db"));
+    const QCommandLineOption cipherOption(QStringLiteral("cipher"), QStringLiteral("Cipher: none, aes128cbc, aes256cbc, chacha20 or sqlcipher."), QStringLiteral("name"), QStringLiteral("chacha20"));
+    const QCommandLineOption keyOption(QStringLiteral("key"), QStringLiteral("Passphrase."), QStringLiteral("key"), QStringLiteral("workload"));
+    const QCommandLineOption journalOption(QStringLiteral("journal"), QStringLiteral("Journal mode: wal or delete."), QStringLiteral("mode"), QStringLiteral("wal"));
+    const QCommandLineOption synchronousOption(QStringLiteral("synchronous"), QStringLiteral("PRAGMA synchronous: off, normal or full."), QStringLiteral("mode"), QStringLiteral("normal"));
+    const QCommandLineOption recordsOption(QStringLiteral("records"), QStringLiteral("Number of records loaded."), QStringLiteral("n"), QStringLiteral("100000"));
+    const QCommandLineOption payloadOption(QStringLiteral("payload"), QStringLiteral("Record size in bytes."), QStringLiteral("bytes"), QStringLiteral("100"));
+    const QCommandLineOption pageSizeOption(QStringLiteral("page-size"), QStringLiteral("Page size of a new database."), QStringLiteral("bytes"), QStringLiteral("4096"));
+    const QCommandLineOption cacheSizeOption(QStringLiteral("cache-size"), QStringLiteral("Page cache per connection."), QStringLiteral("KiB"), QStringLiteral("2000"));
+    const QCommandLineOption threadsOption(QStringLiteral("threads"), QStringLiteral("Number of worker threads."), QStringLiteral("n"), QStringLiteral("4"));
+    const QCommandLineOption durationOption(QStringLiteral("duration"), QStringLiteral("Measured run time."), QStringLiteral("seconds"), QStringLiteral("10"));
+    const QCommandLineOption warmupOption(QStringLiteral("warmup"), QStringLiteral("Unmeasured run time before the measurement."), QStringLiteral("seconds"), QStringLiteral("2"));
+    const QCommandLineOption distributionOption(QStringLiteral("distribution"), QStringLiteral("Key distribution: zipfian or uniform."), QStringLiteral("name"), QStringLiteral("zipfian"));
+    const QCommandLineOption thetaOption(QStringLiteral("theta"), QStringLiteral("Zipfian skew, 0 < theta < 1."), QStringLiteral("theta"), QStringLiteral("0.99"));
+    const QCommandLineOption readOption(QStringLiteral("read"), QStringLiteral("Proportion of point reads."), QStringLiteral("ratio"), QStringLiteral("0.95"));
+    const QCommandLineOption updateOption(QStringLiteral("update"), QStringLiteral("Proportion of updates."), QStringLiteral("ratio"), QStringLiteral("0.05"));
+    const QCommandLineOption insertOption(QStringLiteral("insert"), QStringLiteral("Proportion of inserts."), QStringLiteral("ratio"), QStringLiteral("0"));
+    const QCommandLineOption scanOption(QStringLiteral("scan"), QStringLiteral("Proportion of scans."), QStringLiteral("ratio"), QStringLiteral("0"));
+    const QCommandLineOption scanLengthOption(QStringLiteral("scan-length"), QStringLiteral("Rows read by a scan."), QStringLiteral("n"), QStringLiteral("100"));
+    const QCommandLineOption seedOption(QStringLiteral("seed"), QStringLiteral("Random seed."), QStringLiteral("n"), QStringLiteral("1"));
+    const QCommandLineOption outputOption(QStringLiteral("output"), QStringLiteral("Write the JSON result to file instead of stdout."), QStringLiteral("file"));
+    parser.addOptions({ databaseOption, cipherOption, keyOption, journalOption, synchronousOption,
+                        recordsOption, payloadOption, pageSizeOption, cacheSizeOption, threadsOption,
+                        durationOption, warmupOption, distributionOption, thetaOption, readOption,
+                        updateOption, insertOption, scanOption, scanLengthOption, seedOption, outputOption });
+    parser.process(app);
+
+    Options options;
+    options.database = parser.value(databaseOption);
+    options.cipher = parser.value(cipherOption).toLower();
+    options.key = parser.value(keyOption);
+    options.journal = parser.value(journalOption).toLower();
+    options.synchronous = parser.value(synchronousOption).toLower();
+    options.distribution = parser.value(distributionOption).toLower();
+    options.records = qMax(1LL, parser.value(recordsOption).toLongLong());
+    options.payload = qMax(1, parser.value(payloadOption).toInt());
+    options.pageSize = parser.value(pageSizeOption).toInt();
+    options.cacheSize = qMax(1, parser.value(cacheSizeOption).toInt());
+    options.threads = qMax(1, parser.value(threadsOption).toInt());
+    options.duration = qMax(1, parser.value(durationOption).toInt());
+    options.warmup = qMax(0, parser.value(warmupOption).toInt());
+    options.scanLength = qMax(1, parser.value(scanLengthOption).toInt());
+    options.theta = parser.value(thetaOption).toDouble();
+    options.mix[READ] = parser.value(readOption).toDouble();
+    options.mix[UPDATE] = parser.value(updateOption).toDouble();
+    options.mix[INSERT] = parser.value(insertOption).toDouble();
+    options.mix[SCAN] = parser.value(scanOption).toDouble();
+    options.seed = parser.value(seedOption).toULongLong();
+
+    double total = 0.0;
+    for (int op = 0; op < OPERATION_COUNT; ++op)
+        total += qMax(0.0, options.mix[op]);
+    if (total <= 0.0) {
+        qWarning() << "The operation mix is empty.";
+        return 1;
+    }
+    for (int op = 0; op < OPERATION_COUNT; ++op)
+        options.mix[op] = qMax(0.0, options.mix[op]) / total;
+    if (options.distribution == QLatin1String("zipfian") && !(options.theta > 0.0 && options.theta < 1.0)) {
+        qWarning() << "--theta must be between 0 and 1.";
+        return 1;
+    }
+
+    if (!QSqlDatabase::isDriverAvailable(QStringLiteral("SQLITECIPHER"))) {
+        qWarning() << "SQLITECIPHER driver not found.";
+        return 1;
+    }
+    if (!loadDatabase(options))
+        return 1;
+
+    QScopedPointer<ZipfianGenerator> zipfian;
+    if (options.distribution == QLatin1String("zipfian"))
+        zipfian.reset(new ZipfianGenerator(options.records, options.theta));
+
+    QAtomicInt inserted(0);
+    QElapsedTimer clock;
+    QVector<Worker *> workers;
+    clock.start();
+    for (int i = 0; i < options.threads; ++i) {
+        workers.append(new Worker(i, options, zipfian.data(), &inserted, &clock));
+        workers.last()->start();
+    }
+
+    QVector<qint64> all;
+    QVector<qint64> perOperation[OPERATION_COUNT];
+    qint64 errors = 0;
+    bool failed = false;
+    foreach (Worker *worker, workers) {
+        worker->wait();
+        if (!worker->failure().isEmpty()) {
+            qWarning() << "Worker failed:" << worker->failure();
+            failed = true;
+        }
+        for (int op = 0; op < OPERATION_COUNT; ++op) {
+            perOperation[op] += worker->latencies(op);
+            all += worker->latencies(op);
+        }
+        errors += worker->errors();
+    }
+    qDeleteAll(workers);
+    if (failed)
+        return 1;
+
+    QJsonObject config;
+    config.insert(QStringLiteral("cipher"), options.cipher);
+    config.insert(QStringLiteral("journal"), options.journal);
+    config.insert(QStringLiteral("synchronous"), options.synchronous);
+    config.insert(QStringLiteral("records"), double(options.records));
+    config.insert(QStringLiteral("payload"), options.payload);
+    config.insert(QStringLiteral("page_size"), options.pageSize);
+    config.insert(QStringLiteral("cache_size_kib"), options.cacheSize);
+    config.insert(QStringLiteral("threads"), options.threads);
+    config.insert(QStringLiteral("duration_s"), options.duration);
+    config.insert(QStringLiteral("distribution"), options.distribution);
+    config.insert(QStringLiteral("theta"), options.theta);
+    QJsonObject mix;
+    for (int op = 0; op < OPERATION_COUNT; ++op)
+        mix.insert(QLatin1String(operationNames[op]), options.mix[op]);
+    config.insert(QStringLiteral("mix"), mix);
+
+    QJsonObject operations;
+    for (int op = 0; op < OPERATION_COUNT; ++op) {
+        if (!perOperation[op].isEmpty())
+            operations.insert(QLatin1String(operationNames[op]), latencyStats(perOperation[op], options.duration));
+    }
+
+    QJsonObject result;
+    result.insert(QStringLiteral("config"), config);
+    result.insert(QStringLiteral("total"), latencyStats(all, options.duration));
+    result.insert(QStringLiteral("operations"), operations);
+    result.insert(QStringLiteral("errors"), double(errors));
+
+    const QByteArray json = QJsonDocument(result).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "Can not write" << file.fileName();
+            return 1;
+        }
+        file.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+QT       += core sql
+
+QT       -= gui
+
+TARGET    = workload
+CONFIG   += console c++11
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+ios {
+    CONFIG(debug, debug|release) {
+        LIBS += -lsqlitecipher_debug
+    } else {
+        LIBS += -lsqlitecipher
+    }
+}
+
+SOURCES += main.cpp
+OTHER_FILES += compare.py